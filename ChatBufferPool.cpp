@@ -0,0 +1,216 @@
+// ChatBufferPool.cpp
+
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ChatPacket.h"
+#include "ChatBufferPool.h"
+
+using namespace std;
+
+/// @brief  Memory taken from malloc at once for the blocks of one size class
+#define SLAB_SIZE         ( 64 * 1024 )
+/// @brief  Fewest blocks in a slab (for the largest classes)
+#define MIN_SLAB_BLOCKS   4
+/// @brief  Number of size classes
+#define SIZE_CLASS_COUNT  5
+
+/// @brief  Usable size of the blocks of each class, smallest first (multiples of 16)
+static const int sizeClasses[ SIZE_CLASS_COUNT ] = {
+    64 ,                            // Queued frames, tasks
+    256 ,                           // Short replies
+    1024 ,
+    MAX_PACKET_LENGTH + 64 ,        // Any packet, with the structure in front of it, io_uring writes
+    2 * MAX_PACKET_LENGTH           // Receive buffers
+};
+
+struct BufferPool;
+
+/**
+ * @brief  Placed in front of the data of every block
+ */
+struct BlockHeader {
+    union {
+        BufferPool    *owner;       ///< Pool the block goes back to (NULL if it came from malloc)
+        BlockHeader   *next;        ///< Next free block, once it is freed
+    };
+    int             sizeClass;      ///< Index in 'sizeClasses'
+    int             padding;        ///< Keeps the data 16 bytes aligned
+};
+
+/**
+ * @brief  Blocks of one size, in the pool of one thread
+ */
+struct SizeClassPool {
+    BlockHeader    *freeList;       ///< Blocks freed by the owner (owner only)
+    BlockHeader    *remoteList;     ///< Blocks freed by other threads (pushed atomically, taken all at once by the owner)
+    char           *slabNext;       ///< Next block never handed out, in the newest slab
+    int             slabLeft;       ///< Blocks left from 'slabNext' on
+};
+
+/**
+ * @brief  Pool of one thread
+ *
+ * The counters are written by the owner only (and read atomically),
+ * except 'remoteFrees'. Each pool is on its own cache lines.
+ */
+struct BufferPool {
+    SizeClassPool   classes[ SIZE_CLASS_COUNT ];
+    unsigned long   allocations;        ///< Blocks handed out
+    unsigned long   recycled;           ///< Blocks handed out again after being freed
+    unsigned long   localFrees;         ///< Blocks freed by the owner
+    unsigned long   remoteFrees;        ///< Blocks freed by other threads (changed atomically)
+    unsigned long   maxInUse;           ///< Most blocks handed out and not freed
+    unsigned long   slabs;              ///< Slabs taken from malloc
+    unsigned long   slabBytes;          ///< Size of these slabs
+    unsigned long   largeAllocations;   ///< Buffers too large for a block
+} __attribute__ (( aligned ( 64 ) ));
+
+/// @brief  Pools of all the threads (under 'poolsLock', they are never freed)
+static vector <BufferPool*> pools;
+static pthread_mutex_t poolsLock = PTHREAD_MUTEX_INITIALIZER;
+/// @brief  Pool of the calling thread (NULL till its first buffer)
+static __thread BufferPool *localPool = NULL;
+
+/// @brief  Pool of the calling thread, made on the first call
+static BufferPool* getLocalPool ();
+/// @brief  Smallest class with blocks of at least 'size' bytes, -1 if there is none
+static int findSizeClass ( int size );
+/// @brief  A free block of a class of the pool, recycled if possible
+static BlockHeader* takeBlock ( BufferPool *pool , int sizeClass );
+
+void* allocBuffer ( int size ) {
+
+    BufferPool *pool = getLocalPool ();
+    int sizeClass = findSizeClass ( size );
+    if ( sizeClass < 0 ) {
+        BlockHeader *block = (BlockHeader*) malloc ( sizeof ( BlockHeader ) + size );
+        block->owner = NULL;
+        block->sizeClass = -1;
+        __atomic_store_n ( &pool->largeAllocations , pool->largeAllocations + 1 , __ATOMIC_RELAXED );
+        return block + 1;
+    }
+
+    BlockHeader *block = takeBlock ( pool , sizeClass );
+    block->owner = pool;
+    block->sizeClass = sizeClass;
+    return block + 1;
+}
+
+void freeBuffer ( void *buffer ) {
+
+    if ( buffer == NULL )
+        return;
+
+    BlockHeader *block = (BlockHeader*) buffer - 1;
+    BufferPool *pool = block->owner;
+    if ( pool == NULL ) {
+        free ( block );
+        return;
+    }
+
+    // 'next' takes the place of 'owner' from here on
+    SizeClassPool *sizePool = &pool->classes[ block->sizeClass ];
+    if ( pool == localPool ) {
+        block->next = sizePool->freeList;
+        sizePool->freeList = block;
+        __atomic_store_n ( &pool->localFrees , pool->localFrees + 1 , __ATOMIC_RELAXED );
+        return;
+    }
+
+    // The owner only ever takes the whole list, so a plain push is safe
+    BlockHeader *head = __atomic_load_n ( &sizePool->remoteList , __ATOMIC_RELAXED );
+    do
+        block->next = head;
+    while ( !__atomic_compare_exchange_n ( &sizePool->remoteList , &head , block , true ,
+                                           __ATOMIC_RELEASE , __ATOMIC_RELAXED ) );
+    __atomic_add_fetch ( &pool->remoteFrees , 1 , __ATOMIC_RELAXED );
+}
+
+void getBufferPoolStats ( BufferPoolStats *stats ) {
+
+    unsigned long freed = 0;
+    stats->allocations = stats->recycled = stats->remoteFrees = stats->maxInUse = 0;
+    stats->slabs = stats->slabBytes = stats->largeAllocations = 0;
+
+    pthread_mutex_lock ( &poolsLock );
+    stats->pools = pools.size();
+    for ( int i = 0 ; i < pools.size() ; i++ ) {
+        BufferPool *pool = pools[i];
+        stats->allocations += __atomic_load_n ( &pool->allocations , __ATOMIC_RELAXED );
+        stats->recycled += __atomic_load_n ( &pool->recycled , __ATOMIC_RELAXED );
+        unsigned long remoteFrees = __atomic_load_n ( &pool->remoteFrees , __ATOMIC_RELAXED );
+        stats->remoteFrees += remoteFrees;
+        freed += __atomic_load_n ( &pool->localFrees , __ATOMIC_RELAXED ) + remoteFrees;
+        stats->maxInUse += __atomic_load_n ( &pool->maxInUse , __ATOMIC_RELAXED );
+        stats->slabs += __atomic_load_n ( &pool->slabs , __ATOMIC_RELAXED );
+        stats->slabBytes += __atomic_load_n ( &pool->slabBytes , __ATOMIC_RELAXED );
+        stats->largeAllocations += __atomic_load_n ( &pool->largeAllocations , __ATOMIC_RELAXED );
+    }
+    pthread_mutex_unlock ( &poolsLock );
+
+    // The counters of a busy thread may be read a little apart
+    stats->inUse = stats->allocations > freed ? stats->allocations - freed : 0;
+}
+
+static BufferPool* getLocalPool () {
+
+    if ( localPool != NULL )
+        return localPool;
+
+    // First buffer of this thread
+    BufferPool *pool = new BufferPool ();
+    pthread_mutex_lock ( &poolsLock );
+    pools.push_back ( pool );
+    pthread_mutex_unlock ( &poolsLock );
+    localPool = pool;
+    return pool;
+}
+
+static int findSizeClass ( int size ) {
+
+    for ( int i = 0 ; i < SIZE_CLASS_COUNT ; i++ ) {
+        if ( size <= sizeClasses[i] )
+            return i;
+    }
+    return -1;
+}
+
+static BlockHeader* takeBlock ( BufferPool *pool , int sizeClass ) {
+
+    SizeClassPool *sizePool = &pool->classes[ sizeClass ];
+
+    unsigned long allocations = pool->allocations + 1;
+    __atomic_store_n ( &pool->allocations , allocations , __ATOMIC_RELAXED );
+    unsigned long inUse = allocations - pool->localFrees - __atomic_load_n ( &pool->remoteFrees , __ATOMIC_RELAXED );
+    if ( inUse > pool->maxInUse )
+        __atomic_store_n ( &pool->maxInUse , inUse , __ATOMIC_RELAXED );
+
+    // Our own frees first, then all the ones from the other threads at once
+    if ( sizePool->freeList == NULL )
+        sizePool->freeList = __atomic_exchange_n ( &sizePool->remoteList , NULL , __ATOMIC_ACQUIRE );
+    BlockHeader *block = sizePool->freeList;
+    if ( block != NULL ) {
+        sizePool->freeList = block->next;
+        __atomic_store_n ( &pool->recycled , pool->recycled + 1 , __ATOMIC_RELAXED );
+        return block;
+    }
+
+    // Nothing to recycle, hand out a new block (from a new slab if needed)
+    int blockSize = sizeof ( BlockHeader ) + sizeClasses[ sizeClass ];
+    if ( sizePool->slabLeft == 0 ) {
+        int count = SLAB_SIZE / blockSize;
+        if ( count < MIN_SLAB_BLOCKS )
+            count = MIN_SLAB_BLOCKS;
+        sizePool->slabNext = (char*) malloc ( count * blockSize );
+        sizePool->slabLeft = count;
+        __atomic_store_n ( &pool->slabs , pool->slabs + 1 , __ATOMIC_RELAXED );
+        __atomic_store_n ( &pool->slabBytes , pool->slabBytes + count * blockSize , __ATOMIC_RELAXED );
+    }
+    block = (BlockHeader*) sizePool->slabNext;
+    sizePool->slabNext += blockSize;
+    sizePool->slabLeft--;
+    return block;
+}
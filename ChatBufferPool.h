@@ -0,0 +1,48 @@
+// ChatBufferPool.h
+
+#ifndef __ChatBufferPool_h
+#define __ChatBufferPool_h
+
+#include <stdint.h>
+
+/*
+ * Buffers of a few fixed sizes, recycled instead of going back to malloc.
+ *
+ * Every thread has its own pool, made of slabs of equal blocks, one kind
+ * of slab per size class (large enough for a packet, a receive buffer,
+ * a queued frame, ...). allocBuffer() takes the first free block of the
+ * calling thread without any lock. A block is always given back to the
+ * pool of the thread which allocated it: freed by that thread, it goes
+ * straight back to its free list, and freed by another thread (e.g. a
+ * reply built by a worker and written by a reactor), it is pushed on a
+ * lock-free list of the owner, which takes the whole list back when its
+ * own free list is empty.
+ *
+ * Slabs are never returned, so once the pools have grown to what the
+ * traffic needs, sending and receiving packets does not call malloc at
+ * all. Sizes larger than the largest class go to malloc.
+ */
+
+/**
+ * @brief  Counters of all the pools (see getBufferPoolStats())
+ */
+struct BufferPoolStats {
+    int             pools;            ///< Threads which have a pool
+    unsigned long   allocations;      ///< Blocks handed out so far
+    unsigned long   recycled;         ///< Allocations served by a block freed before (pool hits)
+    unsigned long   remoteFrees;      ///< Blocks freed by another thread than their owner
+    unsigned long   inUse;            ///< Blocks handed out and not yet freed
+    unsigned long   maxInUse;         ///< Most blocks ever in use, added up over the threads
+    unsigned long   slabs;            ///< Slabs taken from malloc
+    unsigned long   slabBytes;        ///< Memory held by the slabs (they are never freed)
+    unsigned long   largeAllocations; ///< Sizes too large for the pools, passed to malloc
+};
+
+/// @brief  Buffer of at least 'size' bytes from the pool of the calling thread
+void* allocBuffer ( int size );
+/// @brief  Give a buffer back to the pool it came from (from any thread)
+void freeBuffer ( void *buffer );
+/// @brief  Current counters of all the pools, from any thread
+void getBufferPoolStats ( BufferPoolStats *stats );
+
+#endif  // __ChatBufferPool_h
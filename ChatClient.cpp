@@ -5,29 +5,53 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <iterator>
 #include <stdint.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/select.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "ChatCodec.h"
 #include "ChatPacket.h"
+#include "ChatRecvBuffer.h"
 
 using namespace std;
 
-/// @brief  Helper function to get the next NULL terminated string in the packet stream
-string getNextString ( const char *buffer , int &offset );
-/// @brief  Helper function to get the next uint32_t in the packet stream
-uint32_t getNextUint32 ( const char *buffer , int &offset );
-/// @brief  Helper function to get the next uint16_t in the packet stream
-uint16_t getNextUint16 ( const char *buffer , int &offset );
-
-/// @brief  Helper function to put the next NULL terminated string in the packet stream
-void putNextString ( char *buffer , int &offset , const string &nextString );
-/// @brief  Helper function to put the next uint32_t in the packet stream
-void putNextUint32 ( char *buffer , int &offset , uint32_t nextUint32 );
-/// @brief  Helper function to put the next uint16_t in the packet stream
-void putNextUint16 ( char *buffer , int &offset , uint16_t nextUint16 );
+/// @brief  Bytes of words (or text) in one chunk of a message, so that it fits in a packet with both user names
+#define MESSAGE_ROOM  ( MAX_PACKET_LENGTH - PACKET_HEADER_LENGTH - 2 * MAX_USER_NAME_LENGTH - sizeof ( uint16_t ) )
+/// @brief  Times in a row we try to come back after the connection broke
+#define MAX_RECONNECTS  5
+
+/// @brief  The words left in a line of input
+vector <string> readWords ( istringstream &ss );
+/// @brief  The rest of a line of input as it was typed, after the space ending the last word read
+string readText ( istringstream &ss );
+/// @brief  The text of a message, in chunks of at most 'room' bytes (cut after a space if there is one)
+vector <string> splitText ( const string &text , int room );
+/// @brief  The words of a message, in chunks of at most 'room' bytes of strings (a word too long is cut)
+vector < vector <string> > splitMessage ( const vector <string> &words , int room );
+/// @brief  ID for the next request (0 if the server does not echo them), remembering the command which sends it
+uint32_t nextRequestID ( uint32_t features , map <uint32_t,string> &inFlight , const string &command );
+/// @brief  Apply a login or exit at 'change' to the copy of the list of users at 'version' (FEATURE_PRESENCE)
+/// returns false if some change before it is missing, and the list must be asked for again
+bool applyPresence ( set <string> &usersOnline , uint32_t &version , uint32_t change ,
+                     const string &name , bool joined );
+/// @brief  Connect to the server, returns the socket (-1 if it failed)
+int connectServer ( const string &serverIP , uint16_t serverPort );
+/// @brief  Send a request encoded at 'packet', tagged with 'requestID' unless it is 0
+bool sendRequest ( int socketFD , const char *packet , int length , uint32_t requestID );
+/// @brief  Whether 'words' makes up the whole message of a forward (printed), or a chunk of it (kept)
+bool joinChunks ( map <string,string> &pending , const string &key , bool continued ,
+                  string_view text , string &message );
+bool joinChunks ( map <string,string> &pending , const string &key , bool continued ,
+                  FrameStrings words , string &message );
 
 /// @brief  Starting point of the client
 int main ( int argc , char **argv ) {
@@ -43,27 +67,15 @@ int main ( int argc , char **argv ) {
     cin >> serverPort;
     cout << "Enter user name: ";
     cin >> userName;
-
-    // Connect to the server
-    // step 1: socket
-    int socketFD;
-    if ( ( socketFD = socket ( AF_INET , SOCK_STREAM , 0 ) ) < 0 ) {
-        cerr << "Error on socket()\n";
+    if ( userName.size() >= MAX_USER_NAME_LENGTH ) {
+        cerr << "Error: User name longer than " << MAX_USER_NAME_LENGTH - 1 << " characters\n";
         return -1;
     }
 
-    // step 2: server IP and address
-    struct sockaddr_in serverAddress;
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_addr.s_addr = inet_addr ( serverIP.c_str() );
-    serverAddress.sin_port = htons ( serverPort );
-
-    // step 3: connect
-    if ( connect ( socketFD , (struct sockaddr*) &serverAddress ,
-                   sizeof ( struct sockaddr_in ) ) != 0 ) {
-        cerr << "Error on connect(), is the server running?\n";
+    // Connect to the server
+    int socketFD = connectServer ( serverIP , serverPort );
+    if ( socketFD < 0 )
         return -1;
-    }
 
     // client IP and port
     struct sockaddr_in clientAddress;
@@ -77,43 +89,36 @@ int main ( int argc , char **argv ) {
 
     // Create a buffer we can use to send packets to the server
     char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
+
+    // Packets from the server are received into this buffer, several may arrive in one recv()
+    RecvBuffer recvBuffer;
+    initRecvBuffer ( &recvBuffer );
     if ( replyBuffer == NULL ) {
         cerr << "Error: Heap over\n";
         close ( socketFD );
         return -1;
     }
-    int replyOffset , lengthOffset;
+    int replyLength;
 
     /*
-     * This is an example of how to use the helper functions to
-     * create a Login packet (in ChatPacket.h).
+     * This is an example of how to create a Login packet (in ChatPacket.h).
      *
      * First, you need to allocate a buffer (shown above).
-     * Second, you need to set the offset (replyOffset) to 0 initially.
-     * Then, you can write the packet fields one by one as shown.
-     * Finally, at the end, the 'replyOffset' would contain the number
-     * of bytes you have written into the buffer. So, you can write the
-     * 'length' field.
+     * Then, encodePacket() writes the whole packet, given the cookie
+     * and the fields of this type of packet (see ChatCodec.h), and
+     * returns the number of bytes it has written into the buffer.
      *
      * Now, you can send the buffer using the send() function.
-     *
-     * To write another packet, reset the offsets as shown and start again.
      */
 
-    // Send a Login request to the server
-    replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    // Request Type
-    putNextUint16 ( replyBuffer , replyOffset , REQUEST_LOGIN );
-    // Length (we will fill this later on)
-    putNextUint16 ( replyBuffer , replyOffset , 0 );
-    // Cookie (set as zero on login)
-    putNextUint32 ( replyBuffer , replyOffset , 0 );
-    // User name
-    putNextString ( replyBuffer , replyOffset , userName );
-    // Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
+    // Send a Login request to the server (the cookie is zero on login), saying we can send
+    // and receive long messages as chunks, match responses by request ID, send text,
+    // keep the list of users up to date ourselves, and be in several groups
+    replyLength = encodePacket < LoginRequest > ( replyBuffer , 0 , userName ,
+                                                  FEATURE_CHUNKED | FEATURE_REQUEST_IDS | FEATURE_MESSAGE_TEXT |
+                                                  FEATURE_PRESENCE | FEATURE_GROUPS );
+
+    if ( send ( socketFD , replyBuffer , replyLength , 0 ) < 0 ) {
         cerr << "Error on send()\n";
         close ( socketFD );
         return -1;
@@ -121,44 +126,27 @@ int main ( int argc , char **argv ) {
 
     // Wait for a successful response
     // -----------------------------------------------
-    size_t bufferSize = sizeof ( uint16_t ) + sizeof ( uint16_t );
-    char *buffer = new char[ bufferSize ];
-    if ( buffer == NULL ) {
-        cerr << "Error: Heap Over\n";
-        close ( socketFD );
-        return -1;
-    }
-    // The flag MSG_WAITALL ensures that we get the all the 4 bytes in one recv()
-    if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize ) {
-        cerr << "Error on recv(), did server terminate?\n";
-        close ( socketFD );
-        return -1;
-    }
-    // Read the 'type' and 'length' fields from the buffer using helper functions
-    int offset = 0;
-    uint16_t type , length;
-    type = getNextUint16 ( buffer , offset );
-    length = getNextUint16 ( buffer , offset );
-    delete[] buffer;
-
-    bufferSize = length - ( sizeof ( uint16_t ) + sizeof ( uint16_t ) );
-    buffer = new char[ bufferSize ];
-    if ( buffer == NULL ) {
-        cerr << "Error: Heap Over\n";
-        close ( socketFD );
-        return -1;
+    Frame frame;
+    int result;
+    while ( ( result = nextFrame ( &recvBuffer , &frame ) ) == 0 ) {
+        if ( recvFrames ( &recvBuffer , socketFD ) <= 0 ) {
+            cerr << "Error on recv(), did server terminate?\n";
+            close ( socketFD );
+            return -1;
+        }
     }
-    if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize ) {
-        cerr << "Error on recv(), did server terminate?\n";
+    if ( result < 0 ) {
+        cerr << "Error: Invalid packet length\n";
         close ( socketFD );
         return -1;
     }
-    // Put 'offset' as 0, so that the buffer is ready for reading using helper functions
-    offset = 0;
+    // The reader hands out the fields of the packet one by one
+    FrameReader reader;
+    initFrameReader ( &reader , frame.body , frame.bodyLength );
 
-    // get status
-    uint32_t status = getNextUint32(buffer, offset);
-	uint32_t cookie = getNextUint32(buffer, offset);
+    // get status, cookie and the features the server agreed to (none from an older server)
+    uint32_t status , cookie = 0 , features = 0;
+    decodePacket < LoginResponse > ( &reader , status , cookie , features );
 	cout << cookie << endl;
 
 	// if status != success, print fail message and end process
@@ -188,8 +176,9 @@ int main ( int argc , char **argv ) {
          << "4. creategroup <user1> <user2> ... : Create group chat\n"
          << "5. discuss <message> : Send message to users in the group chat\n"
          << "6. leavegroup : Leave group chat\n"
-         << "7. help : Display all commands\n"
-         << "8. exit : Disconnect from Chat server\n\n";
+         << "7. group <id> : Switch to another of your group chats\n"
+         << "8. help : Display all commands\n"
+         << "9. exit : Disconnect from Chat server\n\n";
 
     /**
      * Some points to remember about C++ input/output -
@@ -202,6 +191,33 @@ int main ( int argc , char **argv ) {
     cout.flush();
     // Remove the trailing '\n' left by 'cin'
     char trailingLinefeed = cin.get();
+    // Messages of which only the first chunks have arrived, by sender
+    map <string,string> pendingChunks;
+    // Requests not answered yet, by request ID (FEATURE_REQUEST_IDS)
+    map <uint32_t,string> requestsInFlight;
+    // Users listed so far by the pages of a Show response still coming
+    int usersListed = 0;
+    // Times we tried to come back since the connection broke
+    int reconnects = 0;
+    // Our copy of the list of users, and its version (FEATURE_PRESENCE), with the
+    // names of the Show response still coming, and the changes it is to be followed by
+    set <string> usersOnline , usersShown;
+    uint32_t rosterVersion = 0;
+    bool rosterKnown = false;
+    map < uint32_t , pair <string,bool> > rosterChanges;
+    // The groups we are in (FEATURE_GROUPS), and the one discuss and leavegroup are about
+    set <uint32_t> groupIDs;
+    uint32_t currentGroup = 0;
+
+    // The list of users is asked for once, and kept up to date from then on
+    if ( features & FEATURE_PRESENCE ) {
+        replyLength = encodePacket < ShowRequest > ( replyBuffer , cookie );
+        if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , "" ) ) ) {
+            cerr << "Error on send()\n";
+            close ( socketFD );
+            return -1;
+        }
+    }
 
     // Infinite loop until user inputs 'exit'
     while ( true ) {
@@ -217,8 +233,12 @@ int main ( int argc , char **argv ) {
         FD_SET ( socketFD , &readFDs );             // For Socket input
         FD_SET ( socketFD , &exceptionFDs );
 
+        // Packets left in the receive buffer are handled without waiting for more input
+        struct timeval noWait = { 0 , 0 };
+        bool framePending = frameReady ( &recvBuffer );
+
         // Wait for input using select()
-        if ( select ( socketFD + 1 , &readFDs , NULL , &exceptionFDs , NULL ) < 0 ) {
+        if ( select ( socketFD + 1 , &readFDs , NULL , &exceptionFDs , framePending ? &noWait : NULL ) < 0 ) {
             cerr << "Error on select()\n";
             close ( socketFD );
             return -1;
@@ -262,26 +282,17 @@ int main ( int argc , char **argv ) {
          			<< "4. creategroup <user1> <user2> ... : Create group chat\n"
          			<< "5. discuss <message> : Send message to users in the group chat\n"
          			<< "6. leavegroup : Leave group chat\n"
-         			<< "7. help : Display all commands\n"
-         			<< "8. exit : Disconnect from Chat server\n\n";
+         			<< "7. group <id> : Switch to another of your group chats\n"
+         			<< "8. help : Display all commands\n"
+         			<< "9. exit : Disconnect from Chat server\n\n";
             }
 
             // EXIT
             else if ( command == "exit" ) {
-				// Send a Exit request to the server
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , REQUEST_EXIT );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Cookie (Need to use the Cookie assigned by ChatServer)
-    			putNextUint32 ( replyBuffer , replyOffset , cookie );
-    			// User name
-    			putNextString ( replyBuffer , replyOffset , userName );
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
+				// Send a Exit request to the server (with the Cookie assigned by ChatServer)
+    			replyLength = encodePacket < ExitRequest > ( replyBuffer , cookie , userName );
+
+    			if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , inputLine ) ) ) {
         			cerr << "Error on send()\n";
         			close ( socketFD );
         			return -1;
@@ -290,20 +301,23 @@ int main ( int argc , char **argv ) {
 				continue;
             }
 
-            // SHOW
+            // SHOW (our own copy if it is up to date)
+            else if ( command == "show" && rosterKnown ) {
+				cout << "=== Users Online ===" << endl;
+				int i = 1;
+				for ( const string &name : usersOnline ) {
+					if ( name == userName )
+						cout << i << ". " << name << " (you)" << endl;
+					else
+						cout << i << ". " << name << endl;
+					++i;
+				}
+            }
             else if ( command == "show" ) {
 				// Send a SHOW request to the server
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , REQUEST_SHOW );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Cookie
-    			putNextUint32 ( replyBuffer , replyOffset , cookie );
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
+    			replyLength = encodePacket < ShowRequest > ( replyBuffer , cookie );
+
+    			if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , inputLine ) ) ) {
         			cerr << "Error on send()\n";
         			close ( socketFD );
         			return -1;
@@ -315,117 +329,143 @@ int main ( int argc , char **argv ) {
             // TALK
             else if ( command == "talk" ) {
 
-				// Send a TALK request to the server
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , REQUEST_TALK );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Cookie
-    			putNextUint32 ( replyBuffer , replyOffset , cookie );
-
                 string receiverName;
-				string message;
                 ss >> receiverName;
-				// Sender Name
-				putNextString ( replyBuffer, replyOffset, userName);
-				// Receiver Name
-				putNextString ( replyBuffer, replyOffset, receiverName);
-                while ( ss ) {
-					ss >> message;
-
-                    // To eliminate the classic "last string repeating twice problem"
-                    if ( ss )
-                        putNextString ( replyBuffer , replyOffset , message );
-                }
-                // Terminate with two NULLs (i.e. terminate with an empty string)
-                putNextString ( replyBuffer , replyOffset , "" );
-				
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-        			close ( socketFD );
-        			return -1;
-    			}
+                // The text of the message, or else its words (the list is terminated with an empty string)
+                bool isText = ( features & FEATURE_MESSAGE_TEXT ) != 0;
+                vector <string> texts;
+                vector < vector <string> > chunks;
+                if ( isText )
+                    texts = splitText ( readText ( ss ) , MESSAGE_ROOM );
+                else
+                    chunks = splitMessage ( readWords ( ss ) , MESSAGE_ROOM );
+
+				// Send a TALK request to the server, one per chunk if the message does not fit in a packet
+				int count = isText ? texts.size() : chunks.size();
+				for ( int i = 0 ; i < count ; i++ ) {
+					if ( isText )
+    					replyLength = encodePacket < TalkTextRequest > ( replyBuffer , cookie , userName , receiverName , string_view ( texts[i] ) );
+					else
+    					replyLength = encodePacket < TalkRequest > ( replyBuffer , cookie , userName , receiverName , chunks[i] );
+					if ( i + 1 < count && ( features & FEATURE_CHUNKED ) )
+						markPacketContinued ( replyBuffer );
+
+    				uint32_t requestID = nextRequestID ( features , requestsInFlight , i + 1 < count ? string () : inputLine );
+    				if ( !sendRequest ( socketFD , replyBuffer , replyLength , requestID ) ) {
+        				cerr << "Error on send()\n";
+        				close ( socketFD );
+        				return -1;
+    				}
+				}
 				
 				continue;
             }
 
             // YELL
             else if ( command == "yell" ) {
-				// Send a YELL request to the server
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , REQUEST_YELL );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Cookie
-    			putNextUint32 ( replyBuffer , replyOffset , cookie );
-				
-				string message;
-                while ( ss ) {
-					ss >> message;
-
-                    // To eliminate the classic "last string repeating twice problem"
-                    if ( ss )
-                        putNextString ( replyBuffer , replyOffset , message );
-                }
-                // Terminate with two NULLs (i.e. terminate with an empty string)
-                putNextString ( replyBuffer , replyOffset , "" );
-
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-        			close ( socketFD );
-        			return -1;
-    			}
+				// Send a YELL request to the server, with the message (in chunks, as for TALK)
+				bool isText = ( features & FEATURE_MESSAGE_TEXT ) != 0;
+				vector <string> texts;
+				vector < vector <string> > chunks;
+				if ( isText )
+					texts = splitText ( readText ( ss ) , MESSAGE_ROOM );
+				else
+					chunks = splitMessage ( readWords ( ss ) , MESSAGE_ROOM );
+
+				int count = isText ? texts.size() : chunks.size();
+				for ( int i = 0 ; i < count ; i++ ) {
+					if ( isText )
+    					replyLength = encodePacket < YellTextRequest > ( replyBuffer , cookie , string_view ( texts[i] ) );
+					else
+    					replyLength = encodePacket < YellRequest > ( replyBuffer , cookie , chunks[i] );
+					if ( i + 1 < count && ( features & FEATURE_CHUNKED ) )
+						markPacketContinued ( replyBuffer );
+
+    				uint32_t requestID = nextRequestID ( features , requestsInFlight , i + 1 < count ? string () : inputLine );
+    				if ( !sendRequest ( socketFD , replyBuffer , replyLength , requestID ) ) {
+        				cerr << "Error on send()\n";
+        				close ( socketFD );
+        				return -1;
+    				}
+				}
 				
 				continue;
             }
 
+            // GROUP (which of our groups discuss and leavegroup are about)
+            else if ( command == "group" ) {
+				uint32_t groupID = 0;
+				ss >> groupID;
+				if ( groupIDs.count ( groupID ) ) {
+					currentGroup = groupID;
+					cout << "You are now in group chat " << currentGroup << endl;
+				}
+				else
+					cerr << "You are not in group chat " << groupID << endl;
+            }
+
             // DISCUSS
             else if ( command == "discuss" ) {
+				// Send a DISCUSS request to the server, with the message (in chunks, as for TALK)
+				bool isText = ( features & FEATURE_MESSAGE_TEXT ) != 0;
+				vector <string> texts;
+				vector < vector <string> > chunks;
+				if ( isText )
+					texts = splitText ( readText ( ss ) , MESSAGE_ROOM );
+				else
+					chunks = splitMessage ( readWords ( ss ) , MESSAGE_ROOM );
+
+				int count = isText ? texts.size() : chunks.size();
+				bool named = ( features & FEATURE_GROUPS ) != 0;
+				for ( int i = 0 ; i < count ; i++ ) {
+					if ( isText )
+    					replyLength = named ? encodePacket < DiscussIDTextRequest > ( replyBuffer , cookie , currentGroup , string_view ( texts[i] ) )
+    					                    : encodePacket < DiscussTextRequest > ( replyBuffer , cookie , string_view ( texts[i] ) );
+					else
+    					replyLength = named ? encodePacket < DiscussIDRequest > ( replyBuffer , cookie , currentGroup , chunks[i] )
+    					                    : encodePacket < DiscussRequest > ( replyBuffer , cookie , chunks[i] );
+					if ( i + 1 < count && ( features & FEATURE_CHUNKED ) )
+						markPacketContinued ( replyBuffer );
+
+    				uint32_t requestID = nextRequestID ( features , requestsInFlight , i + 1 < count ? string () : inputLine );
+    				if ( !sendRequest ( socketFD , replyBuffer , replyLength , requestID ) ) {
+        				cerr << "Error on send()\n";
+        				close ( socketFD );
+        				return -1;
+    				}
+				}
+
+				continue;
             }
 
             // LEAVEGROUP
             else if ( command == "leavegroup" ) {
+				// Send a LEAVEGROUP request to the server, for the current group (we then
+				// talk in the last one we are still in)
+				if ( features & FEATURE_GROUPS ) {
+    				replyLength = encodePacket < LeaveGroupIDRequest > ( replyBuffer , cookie , currentGroup );
+					groupIDs.erase ( currentGroup );
+					currentGroup = groupIDs.empty() ? 0 : *groupIDs.rbegin();
+				}
+				else
+    				replyLength = encodePacket < LeaveGroupRequest > ( replyBuffer , cookie );
+
+    			if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , inputLine ) ) ) {
+        			cerr << "Error on send()\n";
+        			close ( socketFD );
+        			return -1;
+    			}
+
+				continue;
             }
 
             // CREATEGROUP
             else if ( command == "creategroup" ) {
 				
-				// Send a CREATEGROUP request to the server
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , REQUEST_CREATEGROUP );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Cookie
-    			putNextUint32 ( replyBuffer , replyOffset , cookie );
-
-                /*
-                 * To read names from the input one by one, you
-                 * can use the following while loop
-                 */
-				
-                string groupUserName;
-                while ( ss ) {
-                    ss >> groupUserName;
+				// Send a CREATEGROUP request to the server, with the names of the invited users
+    			replyLength = encodePacket < CreateGroupRequest > ( replyBuffer , cookie , readWords ( ss ) );
 
-                    // To eliminate the classic "last string repeating twice problem"
-                    if ( ss )
-                        putNextString ( replyBuffer , replyOffset , groupUserName );
-                }
-                // Terminate with two NULLs (i.e. terminate with an empty string)
-                putNextString ( replyBuffer , replyOffset , "" );
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
+    			if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , inputLine ) ) ) {
         			cerr << "Error on send()\n";
         			close ( socketFD );
         			return -1;
@@ -447,7 +487,7 @@ int main ( int argc , char **argv ) {
         }
 
         // Socket input from the server
-        else if ( FD_ISSET ( socketFD , &readFDs ) ) {
+        else if ( FD_ISSET ( socketFD , &readFDs ) || framePending ) {
 
             // Now we know that we will not block on using 'recv()'
             // Note that we should read ONLY the length of one packet, otherwise we would block!
@@ -462,46 +502,93 @@ int main ( int argc , char **argv ) {
              * block forever. But for this assignment, it is ok, you are not required to do this.
              */
 
-            // Step 1: First, get the 'type' and 'length' of the packet (first 2 fields are total 4 bytes)
-            size_t bufferSize = sizeof ( uint16_t ) + sizeof ( uint16_t );
-            char *buffer = new char[ bufferSize ];
-            if ( buffer == NULL ) {
-                cerr << "Error: Heap Over\n";
+            // Get whatever has arrived, which may be several packets, or only part of one
+            if ( FD_ISSET ( socketFD , &readFDs ) && recvFrames ( &recvBuffer , socketFD ) <= 0 ) {
+                // The connection broke, we log in again with our cookie, which gives us
+                // our session back, and the messages we missed, in one round trip
                 close ( socketFD );
-                return -1;
-            }
-            // The flag MSG_WAITALL ensures that we get the all the 4 bytes in one recv()
-            if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize ) {
-                cerr << "Error on recv(), did server terminate?\n";
-                close ( socketFD );
-                return -1;
+                freeRecvBuffer ( &recvBuffer );
+                initRecvBuffer ( &recvBuffer );
+                if ( reconnects++ == MAX_RECONNECTS ) {
+                    cerr << "Error on recv(), did server terminate?\n";
+                    delete[] replyBuffer;
+                    return -1;
+                }
+                cerr << "\nConnection lost, reconnecting...\n";
+                if ( reconnects > 1 )
+                    sleep ( 1 );
+                if ( ( socketFD = connectServer ( serverIP , serverPort ) ) < 0 ) {
+                    delete[] replyBuffer;
+                    return -1;
+                }
+                replyLength = encodePacket < LoginRequest > ( replyBuffer , cookie , userName , features );
+                if ( send ( socketFD , replyBuffer , replyLength , 0 ) < 0 ) {
+                    cerr << "Error on send()\n";
+                    close ( socketFD );
+                    return -1;
+                }
+                continue;
             }
-            // Read the 'type' and 'length' fields from the buffer using helper functions
-            int offset = 0;
-            uint16_t type , length;
-            type = getNextUint16 ( buffer , offset );
-            length = getNextUint16 ( buffer , offset );
-            delete[] buffer;
-
-            // Step 2: Now that we know the packet length, we can recv() the full packet
-            bufferSize = length - ( sizeof ( uint16_t ) + sizeof ( uint16_t ) );
-            buffer = new char[ bufferSize ];
-            if ( buffer == NULL ) {
-                cerr << "Error: Heap Over\n";
+
+            // Take the next complete packet, the rest (if any) is handled in the next iterations
+            Frame frame;
+            int result = nextFrame ( &recvBuffer , &frame );
+            if ( result == 0 )
+                continue;
+            if ( result < 0 ) {
+                cerr << "Error: Invalid packet length\n";
                 close ( socketFD );
                 return -1;
             }
-            if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize ) {
-                cerr << "Error on recv(), did server terminate?\n";
-                close ( socketFD );
-                return -1;
+            // A chunk of a longer message is marked in its type
+            uint16_t type = frame.type & ~PACKET_CONTINUED;
+            bool continued = ( frame.type & PACKET_CONTINUED ) != 0;
+            // A response to one of our requests says which one it answers
+            string answered;
+            if ( ( features & FEATURE_REQUEST_IDS ) && isTaggedResponse ( type ) ) {
+                map <uint32_t,string>::iterator request = requestsInFlight.find ( takeRequestID ( frame.body , frame.bodyLength ) );
+                if ( request != requestsInFlight.end() ) {
+                    answered = " (" + request->second + ")";
+                    // The last chunk answers it
+                    if ( !continued )
+                        requestsInFlight.erase ( request );
+                }
             }
-            // Put 'offset' as 0, so that the buffer is ready for reading using helper functions
-            offset = 0;
+            // The strings read are views into the receive buffer, valid till the next recvFrames()
+            FrameReader reader;
+            initFrameReader ( &reader , frame.body , frame.bodyLength );
 
             // Process the packet here
             switch ( type ) {
 
+                case RESPONSE_LOGIN: {
+
+                    // We are back (or else the server closes the connection, and we try again)
+                    uint32_t status , newCookie = 0 , newFeatures = 0;
+                    decodePacket < LoginResponse > ( &reader , status , newCookie , newFeatures );
+                    if ( status != STATUS_SUCCESS )
+                        break;
+                    reconnects = 0;
+                    if ( newCookie == cookie ) {
+                        cout << endl << "Reconnected to the server" << endl;
+                        break;
+                    }
+
+                    // We were away too long, and were logged in again: what was sent meanwhile is lost
+                    cout << endl << "Logged in again, messages sent meanwhile were lost" << endl;
+                    cookie = newCookie;
+                    if ( features & FEATURE_PRESENCE ) {
+                        rosterKnown = false;
+                        replyLength = encodePacket < ShowRequest > ( replyBuffer , cookie );
+                        if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , "" ) ) ) {
+                            cerr << "Error on send()\n";
+                            close ( socketFD );
+                            return -1;
+                        }
+                    }
+                    break;
+                }
+
                 case RESPONSE_SHOW: {
 
                     /*
@@ -509,22 +596,27 @@ int main ( int argc , char **argv ) {
                      * buffer
                      */
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
+                    uint32_t status;
+                    FrameStrings names;
+                    decodePacket < ShowResponse > ( &reader , status , names );
 
 					if (status == STATUS_SUCCESS)
 					{
-						int i = 1;
-						cout << "=== Users Online ===" << endl;
-						string names = getNextString(buffer, offset);
-						while (names != "")
+						// A long list comes in pages, numbered on from the one before
+						int i = usersListed + 1;
+						if (usersListed == 0)
+							cout << "=== Users Online ===" << endl;
+						for (string_view name : names)
 						{
-							if (names == userName)
-								cout << i << ". " << names << " (you)" << endl;
+							if (features & FEATURE_PRESENCE)
+								usersShown.insert (string (name));
+							if (name == userName)
+								cout << i << ". " << name << " (you)" << endl;
 							else
-								cout << i << ". " << names << endl;
-							names = getNextString(buffer, offset);
+								cout << i << ". " << name << endl;
 							++i;
 						}
+						usersListed = continued ? i - 1 : 0;
 					}
 
                     // etc...
@@ -534,7 +626,8 @@ int main ( int argc , char **argv ) {
 				
                 case RESPONSE_YELL: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
+                    uint32_t status;
+                    decodePacket < YellResponse > ( &reader , status );
 
 					if (status == STATUS_SUCCESS)
 					{
@@ -542,7 +635,7 @@ int main ( int argc , char **argv ) {
 					}
 					else if (status == ERROR_NO_USER_ONLINE)
 					{
-						cerr<< "There is no other user online" << endl;
+						cerr<< "There is no other user online" << answered << endl;
 					}
 
                     // etc...
@@ -552,19 +645,23 @@ int main ( int argc , char **argv ) {
 
                 case RESPONSE_YELL_FWD: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
-					string senderName = getNextString(buffer, offset);
-					string message = getNextString(buffer, offset);
+                    uint32_t status;
+					string_view senderName , text;
+					FrameStrings message;
+					bool joined;
+					string whole;
+					if ( features & FEATURE_MESSAGE_TEXT ) {
+						decodePacket < YellTextForward > ( &reader , status , senderName , text );
+						joined = joinChunks ( pendingChunks , "yell " + string ( senderName ) , continued , text , whole );
+					}
+					else {
+						decodePacket < YellForward > ( &reader , status , senderName , message );
+						joined = joinChunks ( pendingChunks , "yell " + string ( senderName ) , continued , message , whole );
+					}
 
-					if (status == STATUS_SUCCESS)
+					if (status == STATUS_SUCCESS && joined)
 					{
-						cout << endl << senderName << " says: ";
-						while (message != "")
-						{
-							cout << message << " ";
-							message = getNextString (buffer, offset);
-						}
-						cout << endl;
+						cout << endl << senderName << " says: " << whole << endl;
 					}
 
                     // etc...
@@ -574,7 +671,8 @@ int main ( int argc , char **argv ) {
 
                 case RESPONSE_TALK: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
+                    uint32_t status;
+                    decodePacket < TalkResponse > ( &reader , status );
 
 					if (status == STATUS_SUCCESS)
 					{
@@ -582,7 +680,7 @@ int main ( int argc , char **argv ) {
 					}
 					else if (status == ERROR_USER_NOT_FOUND)
 					{
-						cerr<< "No such user" << endl;
+						cerr<< "No such user" << answered << endl;
 					}
 
                     // etc...
@@ -592,20 +690,42 @@ int main ( int argc , char **argv ) {
 
                 case RESPONSE_TALK_FWD: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
-					string senderName = getNextString(buffer, offset);
-					string receiverName = getNextString(buffer, offset);
-					string message = getNextString(buffer, offset);
+                    uint32_t status;
+					string_view senderName , receiverName , text;
+					FrameStrings message;
+					bool joined;
+					string whole;
+					if ( features & FEATURE_MESSAGE_TEXT ) {
+						decodePacket < TalkTextForward > ( &reader , status , senderName , receiverName , text );
+						joined = joinChunks ( pendingChunks , "talk " + string ( senderName ) , continued , text , whole );
+					}
+					else {
+						decodePacket < TalkForward > ( &reader , status , senderName , receiverName , message );
+						joined = joinChunks ( pendingChunks , "talk " + string ( senderName ) , continued , message , whole );
+					}
+
+					if (status == STATUS_SUCCESS && joined)
+					{
+						cout << endl << senderName << " says: " << whole << endl;
+					}
+
+                    // etc...
+
+                    break;
+                }
+
+                case RESPONSE_DISCUSS: {
+
+                    uint32_t status;
+                    decodePacket < DiscussResponse > ( &reader , status );
 
 					if (status == STATUS_SUCCESS)
 					{
-						cout << endl << senderName << " says: ";
-						while (message != "")
-						{
-							cout << message << " ";
-							message = getNextString (buffer, offset);
-						}
-						cout << endl;
+						;
+					}
+					else if (status == ERROR_NOT_IN_GROUP)
+					{
+						cerr<< "You are not in a group chat" << answered << endl;
 					}
 
                     // etc...
@@ -613,25 +733,129 @@ int main ( int argc , char **argv ) {
                     break;
                 }
 
-                case RESPONSE_CREATEGROUP: {
+                case RESPONSE_DISCUSS_FWD: {
+
+                    uint32_t status;
+					string_view senderName , text;
+					FrameStrings message;
+					uint32_t groupID = 0;
+					bool joined;
+					string whole;
+					bool named = ( features & FEATURE_GROUPS ) != 0;
+					if ( features & FEATURE_MESSAGE_TEXT ) {
+						if ( named )
+							decodePacket < DiscussIDTextForward > ( &reader , status , groupID , senderName , text );
+						else
+							decodePacket < DiscussTextForward > ( &reader , status , senderName , text );
+					}
+					else {
+						if ( named )
+							decodePacket < DiscussIDForward > ( &reader , status , groupID , senderName , message );
+						else
+							decodePacket < DiscussForward > ( &reader , status , senderName , message );
+					}
+					// The chunks of a sender are told apart by group
+					string chunkKey = "discuss " + to_string ( groupID ) + " " + string ( senderName );
+					if ( features & FEATURE_MESSAGE_TEXT )
+						joined = joinChunks ( pendingChunks , chunkKey , continued , text , whole );
+					else
+						joined = joinChunks ( pendingChunks , chunkKey , continued , message , whole );
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
+					if (status == STATUS_SUCCESS && joined)
+					{
+						if ( named )
+							cout << endl << senderName << " says to group " << groupID << ": " << whole << endl;
+						else
+							cout << endl << senderName << " says to the group: " << whole << endl;
+					}
+
+                    // etc...
+
+                    break;
+                }
+
+                case RESPONSE_LEAVEGROUP: {
+
+                    uint32_t status;
+                    decodePacket < LeaveGroupResponse > ( &reader , status );
 
 					if (status == STATUS_SUCCESS)
+					{
+						cout << "You have left the group chat" << endl;
+					}
+					else if (status == ERROR_NOT_IN_GROUP)
+					{
+						cerr<< "You are not in a group chat" << answered << endl;
+					}
+
+                    // etc...
+
+                    break;
+                }
+
+                case RESPONSE_CREATEGROUP: {
+
+                    uint32_t status;
+					uint32_t groupID = 0;
+					if ( features & FEATURE_GROUPS )
+						decodePacket < CreateGroupIDResponse > ( &reader , status , groupID );
+					else
+						decodePacket < CreateGroupResponse > ( &reader , status );
+
+					if (status == STATUS_SUCCESS && groupID != 0)
+					{
+						// We talk in the new group from now on
+						groupIDs.insert ( groupID );
+						currentGroup = groupID;
+						cout << "Group chat " << groupID << " created, request sent" << endl;
+					}
+					else if (status == STATUS_SUCCESS)
 					{
 						cout << "Group chat request sent" << endl;
 					}
 
                     // etc...
 
+                    break;
+                }
+
+				case RESPONSE_JOINGROUP_FWD: {
+
+                    uint32_t status;
+					string_view invitedName;
+					uint16_t answer;
+					uint32_t groupID = 0;
+					if ( features & FEATURE_GROUPS )
+						decodePacket < JoinGroupIDForward > ( &reader , status , groupID , invitedName , answer );
+					else
+						decodePacket < JoinGroupForward > ( &reader , status , invitedName , answer );
+					string groupName = groupID != 0 ? "group chat " + to_string ( groupID ) : "the group chat";
+
+					if (status == STATUS_SUCCESS)
+					{
+						if (answer == ACCEPT_GROUP)
+							cout << endl << invitedName << " joined " << groupName << endl;
+						else if (answer == REJECT_GROUP)
+							cout << endl << invitedName << " declined to join " << groupName << endl;
+						else
+							cout << endl << invitedName << " did not answer the invitation to " << groupName << endl;
+					}
+
+                    // etc...
+
                     break;
                 }
 
 				case RESPONSE_CREATEGROUP_FWD: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
-					string senderName = getNextString (buffer, offset);
-					string message = getNextString(buffer, offset);
+                    uint32_t status;
+					string_view senderName;
+					FrameStrings groupNames;
+					uint32_t groupID = 0;
+					if ( features & FEATURE_GROUPS )
+						decodePacket < CreateGroupIDForward > ( &reader , status , groupID , senderName , groupNames );
+					else
+						decodePacket < CreateGroupForward > ( &reader , status , senderName , groupNames );
 					string invitationMessage;
 					string userResponse;
 
@@ -640,13 +864,14 @@ int main ( int argc , char **argv ) {
 						// You received an invitation from bob to group chat with {bob, ted}
 						// Accept? (y/n):
 
-						invitationMessage = "\nYou received an invitation from " + senderName + " to group chat with {";
-						while (message != "")
+						invitationMessage = "\nYou received an invitation from " + string ( senderName ) + " to group chat " +
+						                    ( groupID != 0 ? to_string ( groupID ) + " " : string () ) + "with {";
+						string separator;
+						for (string_view groupName : groupNames)
 						{
-							invitationMessage += message;
-							message = getNextString (buffer, offset);
-							if (message != "")
-								invitationMessage += ", ";
+							invitationMessage += separator;
+							invitationMessage += groupName;
+							separator = ", ";
 						}
 						invitationMessage += "}";
 						invitationMessage += "\nAccept? (y/n): ";
@@ -662,20 +887,23 @@ int main ( int argc , char **argv ) {
 						else	// userReponse = "n"
 							group_response = REJECT_GROUP;
 
-						// Send a JOINGROUP request to the server
-    					replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    					// Request Type
-    					putNextUint16 ( replyBuffer , replyOffset , REQUEST_JOINGROUP );
-    					// Length (we will fill this later on)
-    					putNextUint16 ( replyBuffer , replyOffset , 0 );
-    					// Cookie
-    					putNextUint32 ( replyBuffer , replyOffset , cookie );
-						// Response
-						putNextUint16 ( replyBuffer , replyOffset , group_response );
-    					// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    					putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-						
-						
+						// Send a JOINGROUP request to the server, with the answer (to this group)
+						if ( features & FEATURE_GROUPS )
+    						replyLength = encodePacket < JoinGroupIDRequest > ( replyBuffer , cookie , groupID , group_response );
+						else
+    						replyLength = encodePacket < JoinGroupRequest > ( replyBuffer , cookie , group_response );
+						// We talk in the group we joined from now on
+						if ( group_response == ACCEPT_GROUP && groupID != 0 ) {
+							groupIDs.insert ( groupID );
+							currentGroup = groupID;
+						}
+
+						// There is no response to it, so the request is not kept as in flight
+    					if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , "" ) ) ) {
+        					cerr << "Error on send()\n";
+        					close ( socketFD );
+        					return -1;
+    					}
 					}
 
                     // etc...
@@ -685,19 +913,29 @@ int main ( int argc , char **argv ) {
 
                 case RESPONSE_EXIT: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
+                    uint32_t status;
+                    decodePacket < ExitResponse > ( &reader , status );
 
                     // etc...
 					if (status == STATUS_SUCCESS)
 					{
 						cout << "You have logged out" << endl;
 
-	            		delete[] buffer;
+	            		freeRecvBuffer ( &recvBuffer );
 	   				 	close ( socketFD );
 	    				delete[] replyBuffer;
 
 						return 0;
 	                }
+					else if (status == ERROR_TOO_SLOW)
+					{
+						// The server gave up on us, too many messages were waiting for us
+						cout << "Disconnected by the server (too slow to receive)" << endl;
+						freeRecvBuffer ( &recvBuffer );
+						close ( socketFD );
+						delete[] replyBuffer;
+						return -1;
+					}
 					else
 					{
 						cout << "Exit failed" << endl;
@@ -705,19 +943,56 @@ int main ( int argc , char **argv ) {
 					}
 				}
 
-                case RESPONSE_EXIT_FWD: {
+                case RESPONSE_EXIT_FWD:
+                case RESPONSE_LOGIN_FWD: {
 
-                    uint32_t status = getNextUint32 ( buffer , offset );
-					string senderName = getNextString (buffer, offset);
+                    uint32_t status , version = 0;
+					string_view senderName;
+					bool joined = type == RESPONSE_LOGIN_FWD;
+					if ( features & FEATURE_PRESENCE )
+						decodePacket < ExitPresenceForward > ( &reader , status , senderName , version );
+					else
+						decodePacket < ExitForward > ( &reader , status , senderName );
 
                     // etc...
-					if (status == STATUS_SUCCESS)
-					{
+					if (status != STATUS_SUCCESS)
+						break;
+					if ( ( features & FEATURE_PRESENCE ) == 0 ) {
 						cout << endl << senderName << " has logged out" << endl;
 						break;
-	                }
+					}
+
+					bool applied = true;
+					if ( joined && senderName.empty() ) {
+						// The version of the Show response just received, the changes kept
+						// meanwhile are applied if they came after it
+						usersOnline.swap ( usersShown );
+						usersShown.clear();
+						rosterVersion = version;
+						rosterKnown = true;
+						for ( auto &change : rosterChanges ) {
+							if ( applied )
+								applied = applyPresence ( usersOnline , rosterVersion , change.first ,
+								                          change.second.first , change.second.second );
+						}
+						rosterChanges.clear();
+					}
+					else if ( !rosterKnown )
+						rosterChanges[ version ] = make_pair ( string ( senderName ) , joined );
 					else
-						break;
+						applied = applyPresence ( usersOnline , rosterVersion , version , string ( senderName ) , joined );
+
+					// A change was missed, the list is asked for again
+					if ( !applied ) {
+						rosterKnown = false;
+						replyLength = encodePacket < ShowRequest > ( replyBuffer , cookie );
+						if ( !sendRequest ( socketFD , replyBuffer , replyLength , nextRequestID ( features , requestsInFlight , "" ) ) ) {
+							cerr << "Error on send()\n";
+							close ( socketFD );
+							return -1;
+						}
+					}
+					break;
 				}
                 // etc...
 
@@ -732,8 +1007,8 @@ int main ( int argc , char **argv ) {
             cout << "> ";
             cout.flush();
 
-            // Deallocate receive buffer
-            delete[] buffer;
+            // Release the receive buffer while there is nothing in it
+            trimRecvBuffer ( &recvBuffer );
         }
     }
 
@@ -746,81 +1021,155 @@ int main ( int argc , char **argv ) {
     return 0;
 }
 
-string getNextString ( const char *buffer , int &offset ) {
+vector <string> readWords ( istringstream &ss ) {
 
-    char nextString [ MAX_CHAT_LENGTH ];
+    // Read the words one by one (just like 'ss >> word;'), till the end of the line
+    return vector <string> ( istream_iterator <string> ( ss ) , istream_iterator <string> () );
+}
 
-    // Read the string byte by byte till we reach NULL
-    int i = 0;
-    while ( ( nextString[i++] = buffer[ offset++ ] ) != '\0' ) {
-        if ( i >= MAX_CHAT_LENGTH )
-            break;
+vector < vector <string> > splitMessage ( const vector <string> &words , int room ) {
+
+    vector < vector <string> > chunks ( 1 );
+    size_t used = 0;
+    for ( const string &word : words ) {
+        // A word longer than a chunk goes out in pieces
+        for ( size_t start = 0 ; start < word.size() ; start += room - 1 ) {
+            string piece = word.substr ( start , room - 1 );
+            if ( used + piece.size() + 1 > (size_t) room ) {
+                chunks.push_back ( vector <string> () );
+                used = 0;
+            }
+            chunks.back().push_back ( piece );
+            used += piece.size() + 1;
+        }
     }
-    nextString[i - 1] = '\0';
-
-    // The value of offset is now ready for the next call to getNextThing()
-    return string ( nextString );
+    return chunks;
 }
 
-uint32_t getNextUint32 ( const char *buffer , int &offset ) {
-
-    // Read the next uint32_t
-    uint32_t value;
-    value = *( const uint32_t* ) ( buffer + offset );
+string readText ( istringstream &ss ) {
 
-    // Convert from Network to Host order
-    value = ntohl ( value );
+    string text;
+    if ( ss.peek() == ' ' )
+        ss.get();
+    getline ( ss , text );
+    return text;
+}
 
-    // The value of offset is now ready for the next call to getNextThing()
-    offset += sizeof ( uint32_t );
-    return value;
+vector <string> splitText ( const string &text , int room ) {
+
+    vector <string> chunks;
+    size_t start = 0;
+    do {
+        // Cut after the last space which fits, so the words stay whole for older clients
+        size_t length = min ( (size_t) room , text.size() - start );
+        if ( start + length < text.size() ) {
+            size_t space = text.rfind ( ' ' , start + length - 1 );
+            if ( space != string::npos && space >= start )
+                length = space + 1 - start;
+        }
+        chunks.push_back ( text.substr ( start , length ) );
+        start += length;
+    } while ( start < text.size() );
+    return chunks;
 }
 
-uint16_t getNextUint16 ( const char *buffer , int &offset ) {
+bool joinChunks ( map <string,string> &pending , const string &key , bool continued ,
+                  string_view text , string &message ) {
+
+    // The chunks before the last one are kept, per sender
+    string &kept = pending[ key ];
+    kept.append ( text );
+    if ( continued )
+        return false;
 
-    // Read the next uint16_t
-    uint16_t value;
-    value = *( const uint16_t* ) ( buffer + offset );
+    message.swap ( kept );
+    pending.erase ( key );
+    return true;
+}
 
-    // Convert from Network to Host order
-    value = ntohs ( value );
+bool joinChunks ( map <string,string> &pending , const string &key , bool continued ,
+                  FrameStrings words , string &message ) {
 
-    // The value of offset is now ready for the next call to getNextThing()
-    offset += sizeof ( uint16_t );
-    return value;
+    string text;
+    for ( string_view word : words )
+        text.append ( word ).append ( 1 , ' ' );
+    return joinChunks ( pending , key , continued , text , message );
 }
 
-void putNextString ( char *buffer , int &offset , const string &nextString ) {
+bool applyPresence ( set <string> &usersOnline , uint32_t &version , uint32_t change ,
+                     const string &name , bool joined ) {
 
-    // Write the string byte by byte till we reach NULL
-    int i = 0;
-    const char *str = nextString.c_str();
-    while ( ( buffer[ offset++ ] = str[i++] ) != '\0' )
-        ;
+    // Already in the copy (the versions may wrap around)
+    int32_t ahead = (int32_t) ( change - version );
+    if ( ahead <= 0 )
+        return true;
+    if ( ahead > 1 )
+        return false;
 
-    // The value of offset is now ready for the next call to putNextThing()
+    version = change;
+    if ( joined ) {
+        usersOnline.insert ( name );
+        cout << endl << name << " has logged in" << endl;
+    }
+    else {
+        usersOnline.erase ( name );
+        cout << endl << name << " has logged out" << endl;
+    }
+    return true;
 }
 
-void putNextUint32 ( char *buffer , int &offset , uint32_t nextUint32 ) {
-
-    // Convert from Host to Network order
-    nextUint32 = htonl ( nextUint32 );
+uint32_t nextRequestID ( uint32_t features , map <uint32_t,string> &inFlight , const string &command ) {
 
-    // Write the next uint32_t
-    *( uint32_t* ) ( buffer + offset ) = nextUint32;
+    static uint32_t lastRequestID = 0;
+    if ( ( features & FEATURE_REQUEST_IDS ) == 0 )
+        return 0;
 
-    // The value of offset is now ready for the next call to putNextThing()
-    offset += sizeof ( uint32_t );
+    // Zero is kept for the responses nobody asked for
+    if ( ++lastRequestID == 0 )
+        lastRequestID = 1;
+    if ( !command.empty() )
+        inFlight[ lastRequestID ] = command;
+    return lastRequestID;
 }
 
-void putNextUint16 ( char *buffer , int &offset , uint16_t nextUint16 ) {
+int connectServer ( const string &serverIP , uint16_t serverPort ) {
+
+    // step 1: socket
+    int socketFD;
+    if ( ( socketFD = socket ( AF_INET , SOCK_STREAM , 0 ) ) < 0 ) {
+        cerr << "Error on socket()\n";
+        return -1;
+    }
 
-    // Convert from Host to Network order
-    nextUint16 = htons ( nextUint16 );
+    // step 2: server IP and address
+    struct sockaddr_in serverAddress;
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = inet_addr ( serverIP.c_str() );
+    serverAddress.sin_port = htons ( serverPort );
 
-    // Write the next uint16_t
-    *( uint16_t* ) ( buffer + offset ) = nextUint16;
+    // step 3: connect
+    if ( connect ( socketFD , (struct sockaddr*) &serverAddress ,
+                   sizeof ( struct sockaddr_in ) ) != 0 ) {
+        cerr << "Error on connect(), is the server running?\n";
+        close ( socketFD );
+        return -1;
+    }
+    return socketFD;
+}
 
-    // The value of offset is now ready for the next call to putNextThing()
-    offset += sizeof ( uint16_t );
+bool sendRequest ( int socketFD , const char *packet , int length , uint32_t requestID ) {
+
+    if ( requestID == 0 )
+        return send ( socketFD , packet , length , 0 ) == length;
+
+    // The type, the length and the ID, then the rest of the packet as it is, in one write
+    const int typeAndLength = LENGTH_FIELD_OFFSET + sizeof ( uint16_t );
+    char header[ typeAndLength + REQUEST_ID_LENGTH ];
+    putTaggedHeader ( header , packet , requestID );
+    struct iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = sizeof ( header );
+    parts[1].iov_base = (void*) ( packet + typeAndLength );
+    parts[1].iov_len = length - typeAndLength;
+    return writev ( socketFD , parts , 2 ) == length + (int) REQUEST_ID_LENGTH;
 }
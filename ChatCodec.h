@@ -0,0 +1,488 @@
+// ChatCodec.h
+
+#ifndef __ChatCodec_h
+#define __ChatCodec_h
+
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "ChatPacket.h"
+#include "ChatRecvBuffer.h"
+
+/*
+ * Layout of the packets described in ChatPacket.h, and the code writing
+ * and reading them, generated by the compiler from that layout.
+ *
+ * Each packet type is declared once (see the end of this file) as the
+ * list of fields which follow its header, i.e. after the cookie of a
+ * request or the status of a response --
+ *
+ *   typedef PacketSchema < RESPONSE_TALK_FWD ,
+ *                          UserNameField , UserNameField , StringListField > TalkForward;
+ *
+ * encodePacket < TalkForward > ( buffer , status , sender , receiver , messages )
+ * then writes a whole packet, and decodePacket < TalkForward > ( reader ,
+ * status , sender , receiver , messages ) reads one back. The type, the
+ * size of the fixed fields at the front, and the length of a packet
+ * without variable fields are constants, and bounds are checked once
+ * for all of these fields. Strings are read as views into the packet,
+ * and a list of strings as a FrameStrings, read one string at a time.
+ *
+ * Everything is inline templates (no tables, no virtual calls), used by
+ * both the client and the server. maxLength is the size of the largest
+ * packet of a type, checked at compile time against MAX_PACKET_LENGTH.
+ */
+
+/// @brief  Size of the 'type', 'length' and cookie (or status) fields
+#define PACKET_HEADER_LENGTH  ( 2 * sizeof ( uint16_t ) + sizeof ( uint32_t ) )
+
+/// @brief  Put a uint16_t in network order at 'offset', and move past it
+inline void putWireUint16 ( char *buffer , int &offset , uint16_t value ) {
+    value = htons ( value );
+    memcpy ( buffer + offset , &value , sizeof ( value ) );
+    offset += sizeof ( value );
+}
+
+/// @brief  Put a uint32_t in network order at 'offset', and move past it
+inline void putWireUint32 ( char *buffer , int &offset , uint32_t value ) {
+    value = htonl ( value );
+    memcpy ( buffer + offset , &value , sizeof ( value ) );
+    offset += sizeof ( value );
+}
+
+/// @brief  Put a string and its NULL at 'offset', and move past them
+inline void putWireString ( char *buffer , int &offset , std::string_view value ) {
+    memcpy ( buffer + offset , value.data() , value.size() );
+    offset += value.size();
+    buffer[ offset++ ] = '\0';
+}
+
+/// @brief  Next uint16_t of a reader, whose size was already checked
+inline uint16_t getWireUint16 ( FrameReader *reader ) {
+    uint16_t value;
+    memcpy ( &value , reader->data + reader->offset , sizeof ( value ) );
+    reader->offset += sizeof ( value );
+    return ntohs ( value );
+}
+
+/// @brief  Next uint32_t of a reader, whose size was already checked
+inline uint32_t getWireUint32 ( FrameReader *reader ) {
+    uint32_t value;
+    memcpy ( &value , reader->data + reader->offset , sizeof ( value ) );
+    reader->offset += sizeof ( value );
+    return ntohl ( value );
+}
+
+/**
+ * @brief  List of strings at the end of a packet, read one at a time
+ *
+ * Iterating reads the strings from the reader, up to the empty one
+ * ending the list (or the end of the packet), so it can only be done
+ * once.
+ */
+struct FrameStrings {
+    FrameReader   *reader;
+
+    struct iterator {
+        FrameReader        *reader;
+        std::string_view    current;
+        bool                done;
+
+        std::string_view operator* () const { return current; }
+        iterator& operator++ () { advance (); return *this; }
+        bool operator!= ( const iterator &other ) const { return done != other.done; }
+        void advance () { current = readString ( reader ); done = current.empty(); }
+    };
+
+    iterator begin () const { iterator first = { reader , std::string_view () , false }; first.advance (); return first; }
+    iterator end () const { return { reader , std::string_view () , true }; }
+};
+
+/**
+ * @brief  The words of a message sent as text (FEATURE_MESSAGE_TEXT), for the clients which get lists of words
+ *
+ * Iterating cuts the text at every run of white space, without copying.
+ */
+struct MessageWords {
+    std::string_view   text;
+
+    struct iterator {
+        std::string_view    rest;
+        std::string_view    current;
+
+        std::string_view operator* () const { return current; }
+        iterator& operator++ () { advance (); return *this; }
+        bool operator!= ( const iterator &other ) const { return !current.empty() || !other.current.empty(); }
+        void advance () {
+            size_t start = rest.find_first_not_of ( " \t\r\n\v\f" );
+            rest = start == std::string_view::npos ? std::string_view () : rest.substr ( start );
+            size_t end = std::min ( rest.find_first_of ( " \t\r\n\v\f" ) , rest.size() );
+            current = rest.substr ( 0 , end );
+            rest = rest.substr ( end );
+        }
+    };
+
+    iterator begin () const { iterator first = { text , std::string_view () }; first.advance (); return first; }
+    iterator end () const { return { std::string_view () , std::string_view () }; }
+};
+
+/// @brief  String written for an element of a list (overload it for other element types)
+inline std::string_view listString ( std::string_view value ) {
+    return value;
+}
+
+/*
+ * Field types. Each one gives its size ('fixedLength' is 0 if it is not
+ * fixed, 'maxLength' is 0 if only the packet bounds it), and the code
+ * to put and get its value. 'get' skips the bounds check when 'checked'
+ * is false, i.e. when the packet is known to hold the field (the fields
+ * of variable size always check, and leave it unnamed).
+ */
+
+/// @brief  A uint16_t
+struct Uint16Field {
+    static constexpr int fixedLength = sizeof ( uint16_t );
+    static constexpr int maxLength = sizeof ( uint16_t );
+    static constexpr bool isList = false;
+
+    static void put ( char *buffer , int &offset , uint16_t value ) {
+        putWireUint16 ( buffer , offset , value );
+    }
+    static void get ( FrameReader *reader , uint16_t &value , bool checked ) {
+        value = checked ? readUint16 ( reader ) : getWireUint16 ( reader );
+    }
+};
+
+/// @brief  A uint32_t
+struct Uint32Field {
+    static constexpr int fixedLength = sizeof ( uint32_t );
+    static constexpr int maxLength = sizeof ( uint32_t );
+    static constexpr bool isList = false;
+
+    static void put ( char *buffer , int &offset , uint32_t value ) {
+        putWireUint32 ( buffer , offset , value );
+    }
+    static void get ( FrameReader *reader , uint32_t &value , bool checked ) {
+        value = checked ? readUint32 ( reader ) : getWireUint32 ( reader );
+    }
+};
+
+/// @brief  A NULL terminated string of at most 'MaxLength' bytes (including the NULL)
+template < int MaxLength >
+struct StringField {
+    static constexpr int fixedLength = 0;
+    static constexpr int maxLength = MaxLength;
+    static constexpr bool isList = false;
+
+    static void put ( char *buffer , int &offset , std::string_view value ) {
+        // A longer string is cut, so that the packet stays within maxLength
+        if ( value.size() >= (size_t) MaxLength )
+            value = value.substr ( 0 , MaxLength - 1 );
+        putWireString ( buffer , offset , value );
+    }
+    static void get ( FrameReader *reader , std::string_view &value , bool ) {
+        value = readString ( reader );
+        if ( value.size() >= (size_t) MaxLength )
+            reader->failed = true;
+    }
+};
+
+/// @brief  NULL terminated strings ending with an empty one, up to the end of the packet
+struct StringListField {
+    static constexpr int fixedLength = 0;
+    static constexpr int maxLength = 0;
+    static constexpr bool isList = true;
+
+    template < class List >
+    static void put ( char *buffer , int &offset , const List &list ) {
+        // As many strings as fit in the packet, which ends with an empty one in any case
+        for ( const auto &element : list ) {
+            std::string_view value = listString ( element );
+            if ( value.empty() || offset + (int) value.size() + 2 > MAX_PACKET_LENGTH )
+                break;
+            putWireString ( buffer , offset , value );
+        }
+        buffer[ offset++ ] = '\0';
+    }
+    static void get ( FrameReader *reader , FrameStrings &value , bool ) {
+        value.reader = reader;
+    }
+};
+
+/**
+ * @brief  The text of a message, as a uint16_t length followed by the bytes, up to the end of the packet
+ *
+ * Like a list, it takes what is left of the packet, so it must be the
+ * last field. The text is copied with one memcpy (and cut to what fits),
+ * or made of the words of a list, separated by spaces.
+ */
+struct MessageField {
+    static constexpr int fixedLength = 0;
+    static constexpr int maxLength = 0;
+    static constexpr bool isList = true;
+
+    template < class Text >
+    static void put ( char *buffer , int &offset , const Text &text ) {
+        int lengthOffset = offset;
+        offset += sizeof ( uint16_t );
+        int room = MAX_PACKET_LENGTH - offset;
+        if constexpr ( std::is_convertible_v < const Text& , std::string_view > ) {
+            std::string_view value = text;
+            int length = std::min ( (int) value.size() , room );
+            memcpy ( buffer + offset , value.data() , length );
+            offset += length;
+        }
+        else {
+            // The words of a list, as many as fit
+            int start = offset;
+            for ( const auto &element : text ) {
+                std::string_view word = listString ( element );
+                int separator = offset > start ? 1 : 0;
+                if ( offset - start + separator + (int) word.size() > room )
+                    break;
+                if ( separator )
+                    buffer[ offset++ ] = ' ';
+                memcpy ( buffer + offset , word.data() , word.size() );
+                offset += word.size();
+            }
+        }
+        putWireUint16 ( buffer , lengthOffset , offset - lengthOffset - sizeof ( uint16_t ) );
+    }
+    static void get ( FrameReader *reader , std::string_view &value , bool ) {
+        int length = readUint16 ( reader );
+        if ( reader->failed || reader->length - reader->offset < length ) {
+            reader->offset = reader->length;
+            reader->failed = true;
+            value = std::string_view ();
+            return;
+        }
+        value = std::string_view ( reader->data + reader->offset , length );
+        reader->offset += length;
+    }
+};
+
+/// @brief  A field which older peers leave out at the end of a packet (read as zero or empty then)
+template < class Field >
+struct OptionalField {
+    static constexpr int fixedLength = 0;
+    static constexpr int maxLength = Field::maxLength;
+    static constexpr bool isList = Field::isList;
+
+    template < class Value >
+    static void put ( char *buffer , int &offset , const Value &value ) {
+        Field::put ( buffer , offset , value );
+    }
+    template < class Value >
+    static void get ( FrameReader *reader , Value &value , bool ) {
+        if ( reader->offset < reader->length )
+            Field::get ( reader , value , true );
+        else
+            value = Value ();
+    }
+};
+
+/// @brief  User name field
+typedef StringField < MAX_USER_NAME_LENGTH > UserNameField;
+
+/// @brief  Size of the fixed fields before the first variable one
+template < class... Fields >
+constexpr int fixedPrefixLength () {
+    const int lengths[] = { Fields::fixedLength... , 0 };
+    int length = 0;
+    for ( int i = 0 ; lengths[i] > 0 ; i++ )
+        length += lengths[i];
+    return length;
+}
+
+/// @brief  Number of fixed fields before the first variable one
+template < class... Fields >
+constexpr int fixedPrefixCount () {
+    const int lengths[] = { Fields::fixedLength... , 0 };
+    int count = 0;
+    while ( lengths[ count ] > 0 )
+        count++;
+    return count;
+}
+
+/// @brief  Whether a list, if any, is the last field
+template < class... Fields >
+constexpr bool listIsLast () {
+    const bool lists[] = { Fields::isList... , false };
+    for ( int i = 0 ; i + 1 < (int) sizeof... ( Fields ) ; i++ ) {
+        if ( lists[i] )
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief  Layout of one type of packet, and its encoder and decoder
+ *
+ * 'Fields' are the fields after the header, in order.
+ */
+template < uint16_t Type , class... Fields >
+struct PacketSchema {
+    static constexpr uint16_t type = Type;
+    /// Whether every field has a fixed size (the length is then known)
+    static constexpr bool fixedSize = ( ( Fields::fixedLength > 0 ) && ... );
+    static constexpr bool hasList = ( Fields::isList || ... );
+    /// Size of the cookie (or status) and of the fixed fields following it
+    static constexpr int bodyPrefixLength = sizeof ( uint32_t ) + fixedPrefixLength < Fields... > ();
+    static constexpr int prefixCount = fixedPrefixCount < Fields... > ();
+    /// Size of the largest packet (a list takes what is left of MAX_PACKET_LENGTH)
+    static constexpr int boundedLength = PACKET_HEADER_LENGTH + ( Fields::maxLength + ... + 0 );
+    static constexpr int maxLength = hasList ? MAX_PACKET_LENGTH : boundedLength;
+
+    static_assert ( listIsLast < Fields... > () , "A string list must be the last field of a packet" );
+    static_assert ( boundedLength + ( hasList ? 1 : 0 ) <= MAX_PACKET_LENGTH , "Packet larger than MAX_PACKET_LENGTH" );
+
+    template < class... Values >
+    static int encode ( char *buffer , uint32_t head , const Values&... values ) {
+
+        static_assert ( sizeof... ( Values ) == sizeof... ( Fields ) , "One value is needed for each field" );
+        int offset = 0;
+        putWireUint16 ( buffer , offset , Type );
+        putWireUint16 ( buffer , offset , fixedSize ? maxLength : 0 );
+        putWireUint32 ( buffer , offset , head );
+        ( Fields::put ( buffer , offset , values ) , ... );
+
+        // Only now is the length of a variable packet known
+        if ( !fixedSize ) {
+            int lengthOffset = LENGTH_FIELD_OFFSET;
+            putWireUint16 ( buffer , lengthOffset , offset );
+        }
+        return offset;
+    }
+
+    template < class... Values >
+    static bool decode ( FrameReader *reader , uint32_t &head , Values&... values ) {
+        static_assert ( sizeof... ( Values ) == sizeof... ( Fields ) , "One value is needed for each field" );
+        return decodeFields ( reader , head , std::index_sequence_for < Fields... > () , values... );
+    }
+
+private:
+    template < size_t... Index , class... Values >
+    static bool decodeFields ( FrameReader *reader , uint32_t &head , std::index_sequence < Index... > ,
+                               Values&... values ) {
+
+        // One check covers the cookie (or status) and the fixed fields after it. If
+        // they are not all there, every field is zero or empty (as with readUint32())
+        bool fits = reader->length - reader->offset >= bodyPrefixLength;
+        if ( !fits ) {
+            reader->offset = reader->length;
+            reader->failed = true;
+        }
+        head = fits ? getWireUint32 ( reader ) : 0;
+        ( Fields::get ( reader , values , !fits || (int) Index >= prefixCount ) , ... );
+        return !reader->failed;
+    }
+};
+
+/// @brief  Write a whole packet of type 'Packet' in 'buffer' (which has room for Packet::maxLength), returns its length
+template < class Packet , class... Values >
+inline int encodePacket ( char *buffer , uint32_t cookieOrStatus , const Values&... values ) {
+    return Packet::encode ( buffer , cookieOrStatus , values... );
+}
+
+/// @brief  Mark an encoded packet as a chunk, followed by more chunks of the same message
+inline void markPacketContinued ( char *buffer ) {
+    buffer[0] |= PACKET_CONTINUED >> 8;
+}
+
+/// @brief  Whether a type of response carries the request ID once FEATURE_REQUEST_IDS is in use
+inline bool isTaggedResponse ( uint16_t type ) {
+    return type > RESPONSE_LOGIN && type <= RESPONSE_EXIT;
+}
+
+/// @brief  Write the 'type' and 'length' of an encoded packet, and a request ID after them, at 'header'
+///
+/// The cookie (or status) and the fields of 'packet' follow these
+/// REQUEST_ID_LENGTH + 4 bytes unchanged. 'header' may be REQUEST_ID_LENGTH
+/// bytes in front of the packet, which then becomes the tagged packet in
+/// place, REQUEST_ID_LENGTH bytes longer, without moving its body.
+inline void putTaggedHeader ( char *header , const char *packet , uint32_t requestID ) {
+    uint16_t type , length;
+    memcpy ( &type , packet , sizeof ( type ) );
+    memcpy ( &length , packet + LENGTH_FIELD_OFFSET , sizeof ( length ) );
+    int offset = 0;
+    memcpy ( header , &type , sizeof ( type ) );
+    offset += sizeof ( type );
+    putWireUint16 ( header , offset , ntohs ( length ) + REQUEST_ID_LENGTH );
+    putWireUint32 ( header , offset , requestID );
+}
+
+/// @brief  Take the request ID off the front of the body of a tagged packet (0 if it is too short)
+inline uint32_t takeRequestID ( const char *&body , int &length ) {
+    if ( length < (int) REQUEST_ID_LENGTH )
+        return 0;
+    uint32_t requestID;
+    memcpy ( &requestID , body , sizeof ( requestID ) );
+    body += REQUEST_ID_LENGTH;
+    length -= REQUEST_ID_LENGTH;
+    return ntohl ( requestID );
+}
+
+/// @brief  Read the fields of a packet of type 'Packet', returns false if they do not fit in it
+template < class Packet , class... Values >
+inline bool decodePacket ( FrameReader *reader , uint32_t &cookieOrStatus , Values&... values ) {
+    return Packet::decode ( reader , cookieOrStatus , values... );
+}
+
+/*
+ * Requests (after the cookie)
+ */
+typedef PacketSchema < REQUEST_LOGIN , UserNameField , OptionalField < Uint32Field > >  LoginRequest;
+typedef PacketSchema < REQUEST_SHOW >                                         ShowRequest;
+typedef PacketSchema < REQUEST_TALK , UserNameField , UserNameField , StringListField >  TalkRequest;
+typedef PacketSchema < REQUEST_YELL , StringListField >                       YellRequest;
+typedef PacketSchema < REQUEST_TALK , UserNameField , UserNameField , MessageField >  TalkTextRequest;
+typedef PacketSchema < REQUEST_YELL , MessageField >                          YellTextRequest;
+typedef PacketSchema < REQUEST_CREATEGROUP , StringListField >                CreateGroupRequest;
+typedef PacketSchema < REQUEST_DISCUSS , StringListField >                    DiscussRequest;
+typedef PacketSchema < REQUEST_DISCUSS , MessageField >                       DiscussTextRequest;
+typedef PacketSchema < REQUEST_LEAVEGROUP >                                   LeaveGroupRequest;
+typedef PacketSchema < REQUEST_HELP >                                         HelpRequest;
+typedef PacketSchema < REQUEST_EXIT , UserNameField >                         ExitRequest;
+typedef PacketSchema < REQUEST_JOINGROUP , Uint16Field >                      JoinGroupRequest;
+// With FEATURE_GROUPS, naming the group first
+typedef PacketSchema < REQUEST_DISCUSS , Uint32Field , StringListField >      DiscussIDRequest;
+typedef PacketSchema < REQUEST_DISCUSS , Uint32Field , MessageField >         DiscussIDTextRequest;
+typedef PacketSchema < REQUEST_LEAVEGROUP , Uint32Field >                     LeaveGroupIDRequest;
+typedef PacketSchema < REQUEST_JOINGROUP , Uint32Field , Uint16Field >        JoinGroupIDRequest;
+
+/*
+ * Responses (after the status)
+ */
+typedef PacketSchema < RESPONSE_LOGIN , Uint32Field , OptionalField < Uint32Field > >  LoginResponse;
+typedef PacketSchema < RESPONSE_SHOW , StringListField >                      ShowResponse;
+typedef PacketSchema < RESPONSE_TALK >                                        TalkResponse;
+typedef PacketSchema < RESPONSE_YELL >                                        YellResponse;
+typedef PacketSchema < RESPONSE_CREATEGROUP >                                 CreateGroupResponse;
+typedef PacketSchema < RESPONSE_DISCUSS >                                     DiscussResponse;
+typedef PacketSchema < RESPONSE_LEAVEGROUP >                                  LeaveGroupResponse;
+typedef PacketSchema < RESPONSE_HELP >                                        HelpResponse;
+typedef PacketSchema < RESPONSE_EXIT >                                        ExitResponse;
+typedef PacketSchema < RESPONSE_TALK_FWD , UserNameField , UserNameField , StringListField >  TalkForward;
+typedef PacketSchema < RESPONSE_YELL_FWD , UserNameField , StringListField >  YellForward;
+typedef PacketSchema < RESPONSE_TALK_FWD , UserNameField , UserNameField , MessageField >  TalkTextForward;
+typedef PacketSchema < RESPONSE_YELL_FWD , UserNameField , MessageField >     YellTextForward;
+typedef PacketSchema < RESPONSE_CREATEGROUP_FWD , UserNameField , StringListField >  CreateGroupForward;
+typedef PacketSchema < RESPONSE_DISCUSS_FWD , UserNameField , StringListField >  DiscussForward;
+typedef PacketSchema < RESPONSE_DISCUSS_FWD , UserNameField , MessageField >  DiscussTextForward;
+typedef PacketSchema < RESPONSE_JOINGROUP_FWD , UserNameField , Uint16Field >  JoinGroupForward;
+typedef PacketSchema < RESPONSE_EXIT_FWD , UserNameField >                    ExitForward;
+typedef PacketSchema < RESPONSE_EXIT_FWD , UserNameField , Uint32Field >      ExitPresenceForward;
+typedef PacketSchema < RESPONSE_LOGIN_FWD , UserNameField , Uint32Field >     LoginForward;
+// With FEATURE_GROUPS, naming the group first
+typedef PacketSchema < RESPONSE_CREATEGROUP , Uint32Field >                   CreateGroupIDResponse;
+typedef PacketSchema < RESPONSE_CREATEGROUP_FWD , Uint32Field , UserNameField , StringListField >  CreateGroupIDForward;
+typedef PacketSchema < RESPONSE_DISCUSS_FWD , Uint32Field , UserNameField , StringListField >  DiscussIDForward;
+typedef PacketSchema < RESPONSE_DISCUSS_FWD , Uint32Field , UserNameField , MessageField >  DiscussIDTextForward;
+typedef PacketSchema < RESPONSE_JOINGROUP_FWD , Uint32Field , UserNameField , Uint16Field >  JoinGroupIDForward;
+
+#endif  // __ChatCodec_h
@@ -0,0 +1,115 @@
+// ChatEpoch.cpp
+
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ChatEpoch.h"
+
+using namespace std;
+
+/// @brief  Retired blocks a thread keeps before it tries to free them
+#define RECLAIM_THRESHOLD  64
+
+/**
+ * @brief  Memory waiting for the readers which may still use it
+ */
+struct RetiredMemory {
+    void           *memory;
+    EpochRelease    release;
+    uint64_t        epoch;      ///< Epoch it was unlinked in
+};
+
+/**
+ * @brief  Read sections and retired memory of one thread
+ *
+ * 'active' is written by the owner only, and read by the threads freeing
+ * memory. Each thread is on its own cache lines.
+ */
+struct EpochThread {
+    uint64_t                active;     ///< Epoch the running read section started in, 0 if none
+    int                     depth;      ///< Nested read sections (owner only)
+    vector <RetiredMemory>  retired;    ///< Memory retired by this thread (owner only)
+} __attribute__ (( aligned ( 64 ) ));
+
+/// @brief  Epoch counter, moved on each time retired memory is looked at (starts at 1, 0 means no read section)
+static uint64_t globalEpoch = 1;
+/// @brief  Every thread which ever read or retired (under 'threadsLock', they are never freed)
+static vector <EpochThread*> threads;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+/// @brief  Record of the calling thread (NULL till it first needs one)
+static __thread EpochThread *localThread = NULL;
+
+/// @brief  Record of the calling thread, made on the first call
+static EpochThread* getLocalThread ();
+/// @brief  Free the memory retired by 'thread' which no read section can still use
+static void reclaimMemory ( EpochThread *thread );
+
+void beginEpochRead () {
+
+    EpochThread *thread = getLocalThread ();
+    if ( thread->depth++ > 0 )
+        return;
+
+    __atomic_store_n ( &thread->active , __atomic_load_n ( &globalEpoch , __ATOMIC_ACQUIRE ) , __ATOMIC_RELAXED );
+    // The epoch must be seen by the writers before any shared pointer is loaded
+    __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+}
+
+void endEpochRead () {
+
+    EpochThread *thread = localThread;
+    if ( --thread->depth > 0 )
+        return;
+    __atomic_store_n ( &thread->active , 0 , __ATOMIC_RELEASE );
+}
+
+void retireEpochMemory ( void *memory , EpochRelease release ) {
+
+    EpochThread *thread = getLocalThread ();
+    RetiredMemory retired = { memory , release , __atomic_load_n ( &globalEpoch , __ATOMIC_ACQUIRE ) };
+    thread->retired.push_back ( retired );
+    if ( thread->retired.size() >= RECLAIM_THRESHOLD )
+        reclaimMemory ( thread );
+}
+
+static EpochThread* getLocalThread () {
+
+    if ( localThread != NULL )
+        return localThread;
+
+    EpochThread *thread = new EpochThread ();
+    thread->active = 0;
+    thread->depth = 0;
+    pthread_mutex_lock ( &threadsLock );
+    threads.push_back ( thread );
+    pthread_mutex_unlock ( &threadsLock );
+    localThread = thread;
+    return thread;
+}
+
+static void reclaimMemory ( EpochThread *thread ) {
+
+    // Read sections starting from now on cannot find anything retired so far
+    uint64_t oldest = __atomic_add_fetch ( &globalEpoch , 1 , __ATOMIC_SEQ_CST );
+    __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+
+    pthread_mutex_lock ( &threadsLock );
+    for ( int i = 0 ; i < threads.size() ; i++ ) {
+        uint64_t active = __atomic_load_n ( &threads[i]->active , __ATOMIC_ACQUIRE );
+        if ( active != 0 && active < oldest )
+            oldest = active;
+    }
+    pthread_mutex_unlock ( &threadsLock );
+
+    // What was retired before the oldest running read section started is free
+    int kept = 0;
+    for ( int i = 0 ; i < thread->retired.size() ; i++ ) {
+        RetiredMemory &retired = thread->retired[i];
+        if ( retired.epoch < oldest )
+            retired.release ( retired.memory );
+        else
+            thread->retired[ kept++ ] = retired;
+    }
+    thread->retired.resize ( kept );
+}
@@ -0,0 +1,37 @@
+// ChatEpoch.h
+
+#ifndef __ChatEpoch_h
+#define __ChatEpoch_h
+
+#include <stdint.h>
+
+/*
+ * Lets threads read shared data without any lock, while other threads
+ * replace it (epoch based reclamation).
+ *
+ * A reader calls beginEpochRead() before it loads a pointer to shared
+ * data, and endEpochRead() once it is done with what it points to. A
+ * writer which unlinks some memory (so that no reader starting from now
+ * on can find it) hands it to retireEpochMemory() instead of freeing it.
+ * The memory is freed once every reader which was running at that time
+ * has ended: each read section notes the epoch (a global counter) it
+ * started in, the retired memory notes the epoch it was unlinked in, and
+ * memory older than the oldest running read section is freed.
+ *
+ * A read section only writes a counter of its own thread, so readers on
+ * different cores do not slow each other down, and writers never wait
+ * for them. Read sections may be nested, and must be short: memory
+ * retired during one is only freed after it.
+ */
+
+/// @brief  Frees memory handed to retireEpochMemory()
+typedef void (*EpochRelease) ( void *memory );
+
+/// @brief  Start reading shared data on the calling thread
+void beginEpochRead ();
+/// @brief  Done with the shared data read since beginEpochRead()
+void endEpochRead ();
+/// @brief  Release 'memory' (already unlinked) once no read section can still be using it
+void retireEpochMemory ( void *memory , EpochRelease release );
+
+#endif  // __ChatEpoch_h
@@ -0,0 +1,165 @@
+// ChatFanout.cpp
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ChatBufferPool.h"
+#include "ChatFanout.h"
+#include "ChatWorkerPool.h"
+
+using namespace std;
+
+/// @brief  Weight of the last chunk in the average cost per recipient (1 / 2^FANOUT_COST_SHIFT)
+#define FANOUT_COST_SHIFT  3
+
+/**
+ * @brief  A fan-out being sent, shared by the thread which started it and its helpers
+ */
+struct Fanout {
+    FanoutCost     *cost;
+    FanoutChunk     chunk;
+    void           *context;    ///< Only used for the chunks taken, so while the starting thread waits
+    size_t          count;      ///< Recipients
+    size_t          chunkSize;
+    size_t          next;       ///< First recipient not taken yet (changed atomically)
+    size_t          sent;       ///< Recipients sent to (changed atomically)
+    int             refs;       ///< The starting thread and the helpers not done yet (changed atomically)
+};
+
+/**
+ * @brief  A worker helping with a fan-out, on a strand of its own which goes away with it
+ */
+struct FanoutHelper {
+    WorkerTask      task;
+    Fanout         *fanout;
+    Strand          strand;
+};
+
+/// @brief  Counters of getFanoutStats() (changed atomically)
+static FanoutStats fanoutStats;
+
+/// @brief  Worker task of a helper
+static void runFanoutHelper ( WorkerTask *task );
+/// @brief  Take the chunks left one at a time and send them, returns the number of chunks taken
+static unsigned long takeChunks ( Fanout *fanout );
+/// @brief  Send one chunk, measuring its cost if it is long enough to tell
+static void sendChunk ( FanoutCost *cost , FanoutChunk chunk , void *context , size_t first , size_t last );
+/// @brief  Drop a reference to a fan-out, freeing it with the last one
+static void releaseFanout ( Fanout *fanout );
+/// @brief  Nanoseconds of the monotonic clock
+static uint64_t monotonicNanos ();
+
+void initFanoutCost ( FanoutCost *cost , uint64_t nanos ) {
+    cost->picos = nanos * 1000;
+}
+
+size_t fanoutChunkSize ( const FanoutCost *cost ) {
+
+    uint64_t picos = max ( __atomic_load_n ( &cost->picos , __ATOMIC_RELAXED ) , (uint64_t) 1 );
+    uint64_t size = (uint64_t) FANOUT_CHUNK_NANOS * 1000 / picos;
+    return min ( max ( size , (uint64_t) FANOUT_MIN_CHUNK ) , (uint64_t) FANOUT_MAX_CHUNK );
+}
+
+void runFanout ( FanoutCost *cost , size_t count , FanoutChunk chunk , void *context ) {
+
+    size_t chunkSize = fanoutChunkSize ( cost );
+    size_t chunks = ( count + chunkSize - 1 ) / chunkSize;
+    int helpers = min ( (size_t) max ( workerPoolSize() - 1 , 0 ) , chunks > 0 ? chunks - 1 : 0 );
+    if ( helpers == 0 ) {
+        if ( count > 0 )
+            sendChunk ( cost , chunk , context , 0 , count );
+        return;
+    }
+
+    Fanout *fanout = (Fanout*) allocBuffer ( sizeof ( Fanout ) );
+    fanout->cost = cost;
+    fanout->chunk = chunk;
+    fanout->context = context;
+    fanout->count = count;
+    fanout->chunkSize = chunkSize;
+    fanout->next = 0;
+    fanout->sent = 0;
+    fanout->refs = helpers + 1;
+    for ( int i = 0 ; i < helpers ; i++ ) {
+        FanoutHelper *helper = (FanoutHelper*) allocBuffer ( sizeof ( FanoutHelper ) );
+        helper->task.run = runFanoutHelper;
+        helper->task.last = true;
+        helper->fanout = fanout;
+        initStrand ( &helper->strand );
+        submitTask ( &helper->strand , &helper->task );
+    }
+
+    takeChunks ( fanout );
+    // Only the chunks the helpers are sending are left (their context is ours)
+    while ( __atomic_load_n ( &fanout->sent , __ATOMIC_ACQUIRE ) < count )
+        sched_yield ();
+
+    __atomic_add_fetch ( &fanoutStats.fanouts , 1 , __ATOMIC_RELAXED );
+    __atomic_add_fetch ( &fanoutStats.chunks , chunks , __ATOMIC_RELAXED );
+    releaseFanout ( fanout );
+}
+
+void getFanoutStats ( FanoutStats *stats ) {
+    stats->fanouts = __atomic_load_n ( &fanoutStats.fanouts , __ATOMIC_RELAXED );
+    stats->chunks = __atomic_load_n ( &fanoutStats.chunks , __ATOMIC_RELAXED );
+    stats->helped = __atomic_load_n ( &fanoutStats.helped , __ATOMIC_RELAXED );
+}
+
+static void runFanoutHelper ( WorkerTask *task ) {
+
+    FanoutHelper *helper = (FanoutHelper*) task;
+    Fanout *fanout = helper->fanout;
+    destroyStrand ( &helper->strand );
+    freeBuffer ( helper );
+
+    unsigned long taken = takeChunks ( fanout );
+    if ( taken > 0 )
+        __atomic_add_fetch ( &fanoutStats.helped , taken , __ATOMIC_RELAXED );
+    releaseFanout ( fanout );
+}
+
+static unsigned long takeChunks ( Fanout *fanout ) {
+
+    unsigned long taken = 0;
+    for ( ;; ) {
+        size_t first = __atomic_fetch_add ( &fanout->next , fanout->chunkSize , __ATOMIC_RELAXED );
+        if ( first >= fanout->count )
+            return taken;
+        size_t last = min ( first + fanout->chunkSize , fanout->count );
+        sendChunk ( fanout->cost , fanout->chunk , fanout->context , first , last );
+        __atomic_add_fetch ( &fanout->sent , last - first , __ATOMIC_RELEASE );
+        taken++;
+    }
+}
+
+static void sendChunk ( FanoutCost *cost , FanoutChunk chunk , void *context , size_t first , size_t last ) {
+
+    // The clock costs more than the few recipients of a small group
+    if ( last - first < FANOUT_MIN_CHUNK ) {
+        chunk ( context , first , last );
+        return;
+    }
+
+    uint64_t start = monotonicNanos ();
+    chunk ( context , first , last );
+    int64_t picos = ( monotonicNanos () - start ) * 1000 / ( last - first );
+
+    // A moving average, updated without a lock (a concurrent update may be lost)
+    int64_t average = __atomic_load_n ( &cost->picos , __ATOMIC_RELAXED );
+    average += ( picos - average ) >> FANOUT_COST_SHIFT;
+    __atomic_store_n ( &cost->picos , (uint64_t) max ( average , (int64_t) 1 ) , __ATOMIC_RELAXED );
+}
+
+static void releaseFanout ( Fanout *fanout ) {
+    if ( __atomic_sub_fetch ( &fanout->refs , 1 , __ATOMIC_ACQ_REL ) == 0 )
+        freeBuffer ( fanout );
+}
+
+static uint64_t monotonicNanos () {
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC , &now );
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,68 @@
+// ChatFanout.h
+
+#ifndef __ChatFanout_h
+#define __ChatFanout_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sends one packet to many users with several worker threads at once (a
+ * fan-out), e.g. a Discuss message to a large group.
+ *
+ * The thread which has the recipients cuts them into chunks, and hands
+ * the fan-out over to up to one helper per other worker, each on a
+ * strand of its own (see ChatWorkerPool.h). Then the starting thread and
+ * the helpers take the chunks one at a time, each the next one nobody
+ * has taken, until none are left. The starting thread then waits for
+ * the chunks still being sent by the helpers. It never waits for a
+ * chunk nobody has taken, so a fan-out finishes even when every worker
+ * is busy: the helpers run later and find nothing left. A fan-out only
+ * returns once every chunk has been sent, so the next packet of the
+ * same sender cannot overtake it.
+ *
+ * A chunk must be long enough to be worth handing over, and short
+ * enough for the work to spread over the workers. Each kind of fan-out
+ * measures how long its chunks take per recipient, and sizes its next
+ * chunks to take about FANOUT_CHUNK_NANOS. A fan-out of one chunk or
+ * less is sent on the spot by the calling thread, and so is any
+ * fan-out when there are no workers.
+ */
+
+/// @brief  Time a chunk of recipients should take, in nanoseconds
+#define FANOUT_CHUNK_NANOS  50000
+/// @brief  Bounds of the number of recipients in a chunk
+#define FANOUT_MIN_CHUNK    64
+#define FANOUT_MAX_CHUNK    65536
+
+/**
+ * @brief  Sends to the recipients 'first' to 'last' (excluded) of a fan-out, from any worker
+ */
+typedef void (*FanoutChunk) ( void *context , size_t first , size_t last );
+
+/**
+ * @brief  Measured cost of one recipient of a kind of fan-out (shared by all the fan-outs of that kind)
+ */
+struct FanoutCost {
+    uint64_t    picos;      ///< Picoseconds per recipient, averaged over the last chunks (changed atomically)
+};
+
+/**
+ * @brief  Counters of the fan-outs (see getFanoutStats())
+ */
+struct FanoutStats {
+    unsigned long   fanouts;        ///< Fan-outs split among the workers
+    unsigned long   chunks;         ///< Chunks of these fan-outs
+    unsigned long   helped;         ///< Chunks sent by a helper, not by the thread which started
+};
+
+/// @brief  Start measuring a kind of fan-out, guessing 'nanos' per recipient
+void initFanoutCost ( FanoutCost *cost , uint64_t nanos );
+/// @brief  Recipients in a chunk of this kind of fan-out now
+size_t fanoutChunkSize ( const FanoutCost *cost );
+/// @brief  Send to 'count' recipients in chunks, on this thread and idle workers, returns once all are sent
+void runFanout ( FanoutCost *cost , size_t count , FanoutChunk chunk , void *context );
+/// @brief  Current counters of the fan-outs, from any thread
+void getFanoutStats ( FanoutStats *stats );
+
+#endif  // __ChatFanout_h
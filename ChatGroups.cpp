@@ -0,0 +1,279 @@
+// ChatGroups.cpp
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ChatEpoch.h"
+#include "ChatGroups.h"
+#include "ChatPacket.h"
+#include "ChatTimerWheel.h"
+#include "ChatUserBitmap.h"
+
+using namespace std;
+
+/// @brief  Slots in a chunk, and most chunks (4M groups)
+#define SLOT_CHUNK_SIZE    1024
+#define MAX_SLOT_CHUNKS    4096
+/// @brief  Generations of a slot told apart by the IDs
+#define GROUP_GENERATIONS  ( ( 1U << ( 32 - GROUP_INDEX_BITS ) ) - 1 )
+/// @brief  Seconds on the timing wheel of the invitations (longer timeouts take more turns)
+#define INVITE_WHEEL_SLOTS 1024
+
+/**
+ * @brief  Slot of a group
+ */
+struct GroupSlot {
+    Group          *group;      ///< The group, NULL if the slot is free (read atomically)
+    uint32_t        generation; ///< Times the slot was freed (writers only)
+};
+
+/**
+ * @brief  An invitation waiting for its answer
+ */
+struct Invitation {
+    TimerEntry      timer;      ///< Time out (first, so that an expired timer is its invitation)
+    UserID          userID;     ///< The invited user
+    GroupID         groupID;
+    UserID          inviter;
+    uint64_t        sequence;   ///< Invitations made before this one
+};
+
+/// @brief  ID of the group of a slot (never NO_GROUP)
+static inline GroupID makeGroupID ( uint32_t slot , uint32_t generation ) {
+    return ( generation % GROUP_GENERATIONS + 1 ) << GROUP_INDEX_BITS | slot;
+}
+
+/// @brief  Release functions of the retired groups and sets of members
+static void freeGroup ( void *group );
+static void freeMembers ( void *members );
+/// @brief  Slot of a group, NULL if it was never handed out
+static GroupSlot* getSlot ( GroupTable *table , GroupID groupID );
+/// @brief  The group with an ID (with the lock held), NULL if it is gone
+static Group* findGroup ( GroupTable *table , GroupID groupID );
+/// @brief  Publish a new set of members of a group (with the lock held), and retire the old one
+static void publishMembers ( Group *group , UserBitmap *members );
+/// @brief  The invitation of a user to a group (NO_GROUP for its last one), NULL if there is none
+static Invitation* findInvitation ( GroupTable *table , UserID userID , GroupID groupID );
+/// @brief  End an invitation with 'answer' (with the lock held), returns its group
+static Group* endInvitation ( GroupTable *table , Invitation *invitation , uint16_t answer , bool tellInvited );
+/// @brief  Seconds of the monotonic clock
+static time_t monotonicSeconds ();
+
+void initGroupTable ( GroupTable *table , int inviteSeconds , InvitationEnd onEnd ) {
+
+    pthread_mutex_init ( &table->lock , NULL );
+    table->slotChunks = (GroupSlot**) calloc ( MAX_SLOT_CHUNKS , sizeof ( GroupSlot* ) );
+    table->slotCount = 0;
+    table->freeSlots.clear();
+    table->invitations.clear();
+    table->invitationCount = 0;
+    initTimerWheel ( &table->timeouts , INVITE_WHEEL_SLOTS , monotonicSeconds () );
+    table->inviteSeconds = inviteSeconds;
+    table->onEnd = onEnd;
+    table->count = 0;
+}
+
+GroupID createGroup ( GroupTable *table , UserID creator , const UserList &invited ) {
+
+    pthread_mutex_lock ( &table->lock );
+    uint32_t index;
+    if ( !table->freeSlots.empty() ) {
+        index = table->freeSlots.back();
+        table->freeSlots.pop_back();
+    }
+    else if ( table->slotCount < MAX_SLOT_CHUNKS * SLOT_CHUNK_SIZE ) {
+        index = table->slotCount++;
+        GroupSlot **chunk = &table->slotChunks[ index / SLOT_CHUNK_SIZE ];
+        if ( *chunk == NULL )
+            __atomic_store_n ( chunk , (GroupSlot*) calloc ( SLOT_CHUNK_SIZE , sizeof ( GroupSlot ) ) , __ATOMIC_RELEASE );
+    }
+    else {
+        pthread_mutex_unlock ( &table->lock );
+        return NO_GROUP;
+    }
+
+    GroupSlot *slot = &table->slotChunks[ index / SLOT_CHUNK_SIZE ][ index % SLOT_CHUNK_SIZE ];
+    Group *group = new Group ();
+    group->groupID = makeGroupID ( index , slot->generation );
+    group->creator = creator;
+    group->members = new UserBitmap ();
+    initUserBitmap ( group->members );
+    addToBitmap ( group->members , userIndex ( creator ) );
+    for ( UserID userID : invited ) {
+        if ( userID == creator
+          || find ( group->invited.begin() , group->invited.end() , userID ) != group->invited.end() )
+            continue;
+        Invitation *invitation = new Invitation ();
+        invitation->userID = userID;
+        invitation->groupID = group->groupID;
+        invitation->inviter = creator;
+        invitation->sequence = table->invitationCount++;
+        // Counted from the last second the wheel was advanced to, which may be one ago
+        if ( table->inviteSeconds > 0 )
+            addTimer ( &table->timeouts , &invitation->timer , table->inviteSeconds + 1 );
+        table->invitations[ make_pair ( userID , group->groupID ) ] = invitation;
+        group->invited.push_back ( userID );
+    }
+
+    __atomic_store_n ( &slot->group , group , __ATOMIC_RELEASE );
+    __atomic_add_fetch ( &table->count , 1 , __ATOMIC_RELAXED );
+    pthread_mutex_unlock ( &table->lock );
+    return group->groupID;
+}
+
+GroupID answerInvitation ( GroupTable *table , UserID userID , GroupID groupID , bool accept ) {
+
+    pthread_mutex_lock ( &table->lock );
+    Invitation *invitation = findInvitation ( table , userID , groupID );
+    Group *group = invitation != NULL ? endInvitation ( table , invitation , accept ? ACCEPT_GROUP : REJECT_GROUP , false ) : NULL;
+    groupID = accept && group != NULL ? group->groupID : NO_GROUP;
+    pthread_mutex_unlock ( &table->lock );
+    return groupID;
+}
+
+bool leaveGroup ( GroupTable *table , GroupID groupID , UserID userID ) {
+
+    pthread_mutex_lock ( &table->lock );
+    Group *group = findGroup ( table , groupID );
+    if ( group == NULL || !bitmapContains ( group->members , userIndex ( userID ) ) ) {
+        pthread_mutex_unlock ( &table->lock );
+        return false;
+    }
+
+    UserBitmap *members = new UserBitmap ( *group->members );
+    removeFromBitmap ( members , userIndex ( userID ) );
+    publishMembers ( group , members );
+    if ( members->count > 0 ) {
+        pthread_mutex_unlock ( &table->lock );
+        return true;
+    }
+
+    // The last member has left: the group goes, and its invitations end with it (no
+    // answer can join it any more). The inviters and the invited users are told.
+    UserList invited = group->invited;
+    for ( UserID invitedID : invited )
+        endInvitation ( table , findInvitation ( table , invitedID , groupID ) , EXPIRED_GROUP , true );
+    GroupSlot *slot = getSlot ( table , groupID );
+    __atomic_store_n ( &slot->group , (Group*) NULL , __ATOMIC_RELEASE );
+    slot->generation++;
+    table->freeSlots.push_back ( groupID & ( ( 1U << GROUP_INDEX_BITS ) - 1 ) );
+    __atomic_sub_fetch ( &table->count , 1 , __ATOMIC_RELAXED );
+    pthread_mutex_unlock ( &table->lock );
+
+    // Readers which found the group before it was unlinked may still be using it
+    retireEpochMemory ( group , freeGroup );
+    return true;
+}
+
+void dropInvitations ( GroupTable *table , UserID userID ) {
+
+    pthread_mutex_lock ( &table->lock );
+    for ( Invitation *invitation ; ( invitation = findInvitation ( table , userID , NO_GROUP ) ) != NULL ; )
+        endInvitation ( table , invitation , EXPIRED_GROUP , false );
+    pthread_mutex_unlock ( &table->lock );
+}
+
+void expireInvitations ( GroupTable *table ) {
+
+    vector <TimerEntry*> expired;
+    pthread_mutex_lock ( &table->lock );
+    advanceTimerWheel ( &table->timeouts , monotonicSeconds () , &expired );
+    for ( TimerEntry *timer : expired )
+        endInvitation ( table , (Invitation*) timer , EXPIRED_GROUP , true );
+    pthread_mutex_unlock ( &table->lock );
+}
+
+const UserBitmap* getGroupMembers ( GroupTable *table , GroupID groupID ) {
+
+    GroupSlot *slot = getSlot ( table , groupID );
+    Group *group = slot != NULL ? __atomic_load_n ( &slot->group , __ATOMIC_ACQUIRE ) : NULL;
+    if ( group == NULL || group->groupID != groupID )
+        return NULL;
+    return __atomic_load_n ( &group->members , __ATOMIC_ACQUIRE );
+}
+
+int groupCount ( const GroupTable *table ) {
+    return __atomic_load_n ( &table->count , __ATOMIC_RELAXED );
+}
+
+static void freeGroup ( void *group ) {
+    delete ( (Group*) group )->members;
+    delete (Group*) group;
+}
+
+static void freeMembers ( void *members ) {
+    delete (UserBitmap*) members;
+}
+
+static GroupSlot* getSlot ( GroupTable *table , GroupID groupID ) {
+
+    uint32_t index = groupID & ( ( 1U << GROUP_INDEX_BITS ) - 1 );
+    if ( groupID == NO_GROUP || index >= MAX_SLOT_CHUNKS * SLOT_CHUNK_SIZE )
+        return NULL;
+    GroupSlot *chunk = __atomic_load_n ( &table->slotChunks[ index / SLOT_CHUNK_SIZE ] , __ATOMIC_ACQUIRE );
+    return chunk != NULL ? &chunk[ index % SLOT_CHUNK_SIZE ] : NULL;
+}
+
+static Group* findGroup ( GroupTable *table , GroupID groupID ) {
+
+    GroupSlot *slot = getSlot ( table , groupID );
+    if ( slot == NULL || slot->group == NULL || slot->group->groupID != groupID )
+        return NULL;
+    return slot->group;
+}
+
+static void publishMembers ( Group *group , UserBitmap *members ) {
+
+    UserBitmap *old = group->members;
+    __atomic_store_n ( &group->members , members , __ATOMIC_RELEASE );
+    retireEpochMemory ( old , freeMembers );
+}
+
+static Invitation* findInvitation ( GroupTable *table , UserID userID , GroupID groupID ) {
+
+    if ( groupID != NO_GROUP ) {
+        InvitationMap::iterator found = table->invitations.find ( make_pair ( userID , groupID ) );
+        return found != table->invitations.end() ? found->second : NULL;
+    }
+
+    // The last one made, among the (few) invitations of the user
+    Invitation *last = NULL;
+    for ( InvitationMap::iterator i = table->invitations.lower_bound ( make_pair ( userID , NO_GROUP ) ) ;
+          i != table->invitations.end() && i->first.first == userID ; ++i ) {
+        if ( last == NULL || i->second->sequence > last->sequence )
+            last = i->second;
+    }
+    return last;
+}
+
+static Group* endInvitation ( GroupTable *table , Invitation *invitation , uint16_t answer , bool tellInvited ) {
+
+    UserID userID = invitation->userID;
+    table->invitations.erase ( make_pair ( userID , invitation->groupID ) );
+    cancelTimer ( &table->timeouts , &invitation->timer );
+
+    // The group of a pending invitation is always there (it takes its invitations with it)
+    Group *group = findGroup ( table , invitation->groupID );
+    group->invited.erase ( remove ( group->invited.begin() , group->invited.end() , userID ) , group->invited.end() );
+    if ( answer == ACCEPT_GROUP ) {
+        UserBitmap *members = new UserBitmap ( *group->members );
+        addToBitmap ( members , userIndex ( userID ) );
+        publishMembers ( group , members );
+    }
+
+    if ( table->onEnd != NULL )
+        table->onEnd ( userID , invitation->inviter , group->groupID , group->members , answer , tellInvited );
+    delete invitation;
+    return group;
+}
+
+static time_t monotonicSeconds () {
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC , &now );
+    return now.tv_sec;
+}
@@ -0,0 +1,126 @@
+// ChatGroups.h
+
+#ifndef __ChatGroups_h
+#define __ChatGroups_h
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ChatTimerWheel.h"
+#include "ChatUserBitmap.h"
+#include "ChatUserRegistry.h"
+
+/*
+ * The group chats, found by ID from any thread.
+ *
+ * A group is created by a CreateGroup request, with its creator as the
+ * only member, and invitations to the users it names. An invited user
+ * joins the group by accepting (see REQUEST_JOINGROUP), and leaves it
+ * with a LeaveGroup or an Exit request. The group goes when its last
+ * member leaves. A user may be in any number of groups, and invited to
+ * any number of them, one invitation per group.
+ *
+ * Every invitation ends once: accepted, refused, or dropped unanswered
+ * (when its time is up, when the user leaves, or when the group goes).
+ * The table then calls its InvitationEnd callback, with its lock held,
+ * so that the members are told in the order the group changes. The
+ * invitations time out on a timing wheel (see ChatTimerWheel.h) ticking
+ * every second, which only visits the invitations whose time is up.
+ *
+ * The members of a group are one compressed set of the numbers of their
+ * slots (see ChatUserBitmap.h), 2 bytes a member in a small group, shared
+ * by everyone who reads it, and never changed once published: a join or
+ * a leave makes a new set, publishes it, and retires the old one (see
+ * ChatEpoch.h). A Discuss message reads the set in a read section, without
+ * a lock, and finds each member by its slot (see getUserByIndex()), so
+ * sending it costs one step per member, however many users are online. A
+ * slot is not reused while a reader may still hold it, and a user leaves
+ * its groups before it is removed, so a member found this way is the one
+ * who joined.
+ *
+ * Groups are numbered the way users are (see UserID): the low bits of a
+ * GroupID are a slot, the high bits the generation of the slot, so the
+ * ID of a group which is gone finds nothing. The writers hold the one
+ * lock of the table, as groups change seldom compared to the messages
+ * sent to them.
+ */
+
+/// @brief  Bits of a GroupID numbering its slot (the others count the generations of the slot)
+#define GROUP_INDEX_BITS  22
+/// @brief  GroupID of no group
+#define NO_GROUP          0
+
+/**
+ * @brief  A group chat (see ChatGroups.h)
+ */
+typedef uint32_t GroupID;
+
+/**
+ * @brief  Members and invitations of a group
+ */
+struct Group {
+    GroupID         groupID;
+    UserID          creator;
+    UserBitmap     *members;    ///< Numbers of the slots of the members (replaced by the writers, read atomically)
+    UserList        invited;    ///< Users invited who have not answered yet (writers only)
+};
+
+/**
+ * @brief  Called when an invitation ends, with the 'members' of its group after it
+ *
+ * 'answer' is ACCEPT_GROUP, REJECT_GROUP or EXPIRED_GROUP. 'tellInvited'
+ * is true if the invited user did not end it itself (by answering, or by
+ * leaving), and should be told as well.
+ */
+typedef void (*InvitationEnd) ( UserID userID , UserID inviter , GroupID groupID , const UserBitmap *members ,
+                                uint16_t answer , bool tellInvited );
+
+struct GroupSlot;
+struct Invitation;
+
+/// @brief  Pending invitations, by invited user, then group
+typedef std::map < std::pair <UserID,GroupID> , Invitation* > InvitationMap;
+
+/**
+ * @brief  All the groups, by ID
+ */
+struct GroupTable {
+    pthread_mutex_t                 lock;           ///< Held by the writers
+    GroupSlot                     **slotChunks;     ///< Chunks of slots (written once each, read atomically)
+    uint32_t                        slotCount;      ///< Slots handed out so far (writers only)
+    std::vector <uint32_t>          freeSlots;      ///< Slots to reuse, last freed first (writers only)
+    InvitationMap                   invitations;    ///< Invitations by user, then group (writers only)
+    uint64_t                        invitationCount;///< Invitations made so far (writers only)
+    TimerWheel                      timeouts;       ///< Invitations by the second they time out (writers only)
+    int                             inviteSeconds;  ///< How long an invitation may wait for its answer
+    InvitationEnd                   onEnd;          ///< Called for each invitation ending (with the lock held)
+    int                             count;          ///< Number of groups (changed atomically)
+};
+
+/// @brief  Prepare an empty table, whose invitations time out after 'inviteSeconds'
+void initGroupTable ( GroupTable *table , int inviteSeconds , InvitationEnd onEnd );
+
+/// @brief  Create a group of 'creator', inviting the users of 'invited', returns its ID (NO_GROUP if there is no room)
+GroupID createGroup ( GroupTable *table , UserID creator , const UserList &invited );
+/// @brief  Answer the invitation of a user to a group (NO_GROUP for its last one), returns the group it joined
+///
+/// Returns NO_GROUP if it refused, or was not invited.
+GroupID answerInvitation ( GroupTable *table , UserID userID , GroupID groupID , bool accept );
+/// @brief  Take a user out of a group, returns false if it was not a member
+///
+/// The group goes with its last member. Its invitations end first, as
+/// EXPIRED_GROUP (the inviters and the invited users are told).
+bool leaveGroup ( GroupTable *table , GroupID groupID , UserID userID );
+/// @brief  Drop the invitations of a user (as it leaves)
+void dropInvitations ( GroupTable *table , UserID userID );
+/// @brief  Drop the invitations whose time is up
+void expireInvitations ( GroupTable *table );
+
+/// @brief  Members of a group, NULL if it is gone (in a read section)
+const UserBitmap* getGroupMembers ( GroupTable *table , GroupID groupID );
+/// @brief  Number of groups
+int groupCount ( const GroupTable *table );
+
+#endif  // __ChatGroups_h
@@ -9,6 +9,9 @@
  * This is a very simple implementation, where the client sends a
  * request to the server, and the server sends back a response.
  *
+ * The fields of each type of packet are also declared in ChatCodec.h,
+ * which writes and reads the packets from these declarations.
+ *
  * All Requests from the client start with this Request Header:
  * (for the size of each field, see the structures defined below)
  *
@@ -25,8 +28,6 @@
  * login. If the TCP connection between the client and server breaks,
  * the user can use the cookie instead of logging in again.
  *
- * (If you do not want to use Cookies, that is also ok)
- *
  * Format of each Request body is as follows:
  *
  * 1. Login Request:
@@ -34,9 +35,23 @@
  *  |------------------------------------------|
  *  |      User Name terminated by NULL        |
  *  |------------------------------------------|
+ *  |           Features (optional)            |
+ *  |------------------------------------------|
  *
  * Cookie value for the Login request is 0. The User name has a
- * maximum size (defined by MAX_USER_NAME_LENGTH).
+ * maximum size (defined by MAX_USER_NAME_LENGTH), and may not be empty
+ * (it is then answered with ERROR_USERNAME). Features is a
+ * uint32_t with the FEATURE_* bits the client can handle (none if it
+ * is missing). A connection logs in once: another Login request on it
+ * is answered with ERROR_USERNAME, and changes nothing.
+ *
+ * A client whose connection broke sends the Login request again on a
+ * new connection, with its cookie and its name. If the server still
+ * keeps the user (for a while after the connection broke), the client
+ * gets its session back: the Login response has the same cookie and
+ * features as before, and is followed by the forwards sent to the user
+ * meanwhile (the newest ones, if there were many). Otherwise it is an
+ * ordinary login, and the response has a new cookie.
  *
  * All Responses from the Server start with the following Response
  * Header:
@@ -50,9 +65,9 @@
  * Length specifies the length of the Response Datagram in bytes.
  * Status indicates Success or an appropriate Error Code.
  *
- * Note: There is no field to map responses to the original requests.
- * (i.e. how do we know which response is for which request?)
- * However, in this simple chat implementation, it is not required.
+ * Without FEATURE_REQUEST_IDS, there is no field to map responses to
+ * the original requests, so the responses come in the order of the
+ * requests (see Request IDs below).
  *
  * Format of each Response body is as follows:
  *
@@ -61,9 +76,12 @@
  *  |------------------------------------------|
  *  |                  Cookie                  |
  *  |------------------------------------------|
+ *  |                 Features                 |
+ *  |------------------------------------------|
  *
  * Cookie is a unique value given to the client for that particular chat
- * session.
+ * session. Features are the bits of the request which the server
+ * accepted, they are in use for the rest of the session.
  *
  * 2. Show Response:
  *
@@ -76,6 +94,134 @@
  * last user name is an empty string). The size of the list
  * should be at least one (since the user who sent the request must be
  * online).
+ *
+ * Chunks (FEATURE_CHUNKED):
+ *
+ * A Talk, Yell or Discuss message which does not fit in MAX_PACKET_LENGTH is
+ * sent as several packets of the same type, each a complete packet with
+ * some of the words of the message. All of them but the last have the
+ * PACKET_CONTINUED bit set in their type. The server forwards each chunk
+ * as soon as it arrives (as chunks to the clients which accepted the
+ * feature, as separate messages to the others), and sends one response,
+ * after the last chunk. A receiver puts the chunks of each sender back
+ * together, so no packet, and no buffer, is ever larger than
+ * MAX_PACKET_LENGTH.
+ *
+ * A Show response listing more users than fit in one packet is sent the
+ * same way, in pages (each a Show response with some of the names), all
+ * of them but the last with PACKET_CONTINUED set. With request IDs, every
+ * page has the ID of the request. A client without the feature gets the
+ * first page only.
+ *
+ * Request IDs (FEATURE_REQUEST_IDS):
+ *
+ * Once the feature is accepted, every request after the Login request,
+ * and every response to one (i.e. all but the Login response and the
+ * forwards), has a Request ID between the Length and the Cookie (or
+ * Status), which makes it REQUEST_ID_LENGTH bytes longer:
+ *
+ *  |------------------------------------------|
+ *  |    Request Type     |       Length       |
+ *  |------------------------------------------|
+ *  |                Request ID                |
+ *  |------------------------------------------|
+ *  |                  Cookie                  |
+ *  |------------------------------------------|
+ *
+ * The client chooses the ID of each request, and the server echoes it in
+ * the response, so the client may have any number of requests in flight
+ * and match the responses as they come. Requests which do not depend on
+ * the others (e.g. Show) are then handled as soon as they arrive, and
+ * may be answered before the requests sent ahead of them. Talk, Yell
+ * and Discuss keep their order, so the messages of a user arrive in the
+ * order they were typed. The response to a message sent in chunks has the ID of the
+ * last chunk, and a response the client did not ask for (e.g. an Exit
+ * response with ERROR_TOO_SLOW) has the ID 0.
+ *
+ * Message text (FEATURE_MESSAGE_TEXT):
+ *
+ * The message of a Talk, Yell or Discuss request (and of their forwards) is
+ * normally a list of words, each terminated by NULL, ending with an
+ * empty one. With this feature, it is the text as it was typed instead,
+ * white space included:
+ *
+ *  |------------------------------------------|
+ *  |     Text Length     |        Text        |
+ *  |------------------------------------------|
+ *
+ * Text Length is a uint16_t, and the Text is not terminated. It comes
+ * after the user names, and ends the packet. The server copies the
+ * text into the forwards as it is, and makes a list of its words for
+ * the clients without the feature (and the other way round). The
+ * chunks of a long text are put back together by joining their texts.
+ *
+ * Presence (FEATURE_PRESENCE):
+ *
+ * Instead of asking for the whole list of users again and again, a
+ * client may keep its own copy, which the server keeps up to date. Each
+ * login and each exit (or lost connection) counts up the version of the
+ * list of users, and is sent to the clients with the feature as a Login
+ * Forward, or an Exit Forward with the version after the user name:
+ *
+ *  |------------------------------------------|
+ *  |        User Name        |     Version    |
+ *  |------------------------------------------|
+ *
+ * Version is a uint32_t. A Show response to one of these clients is
+ * followed by a Login Forward with an empty user name, giving the
+ * version of the list just sent. The client applies the changes with a
+ * later version only, one version after the other: a version skipped
+ * (e.g. a packet dropped while the client was too slow) means the copy
+ * is no longer right, and it asks for the list again. The feature is
+ * only accepted together with FEATURE_CHUNKED, as the list may take
+ * several pages. The other clients still get the Exit Forward of the
+ * users who exit, without a version.
+ *
+ * Group chat:
+ *
+ * A CreateGroup request makes a new group, with its sender as the only
+ * member (who leaves the group it was in), and sends a CreateGroup
+ * Forward to each user it names who is logged in. An invited user
+ * answers with a JoinGroup request (ACCEPT_GROUP or REJECT_GROUP, there
+ * is no response), which answers its last invitation. The
+ * members of the group, and the user who invited, are then sent a
+ * JoinGroup Forward:
+ *
+ *  |------------------------------------------|
+ *  |        User Name        |     Answer     |
+ *  |------------------------------------------|
+ *
+ * Answer is a uint16_t: the answer of the invited user, or EXPIRED_GROUP
+ * if the invitation was dropped without one (it was not answered in
+ * time, the user left, or the group went with its last member). The
+ * invited user is sent it as well when it is still there to answer. A
+ * Discuss message is forwarded to the other members of the group of its
+ * sender, as a Discuss Forward with the name of the sender, and a
+ * LeaveGroup (or Exit) request takes the user out of the group. A user
+ * is in one group at a time, and Discuss and LeaveGroup are answered
+ * with ERROR_NOT_IN_GROUP outside of one. The group goes when its last
+ * member leaves. A client which has not logged in is in no group:
+ * its CreateGroup, Discuss and LeaveGroup requests are answered with
+ * ERROR_COOKIE_INVALID, and its JoinGroup requests are ignored.
+ *
+ * Groups (FEATURE_GROUPS):
+ *
+ * A user may be in any number of groups, and creating or joining one
+ * no longer takes it out of the others. Each group is then named by its
+ * Group ID, a uint32_t which comes first (after the cookie or the
+ * status) in the packets about it: the CreateGroup response gives the
+ * ID of the new group, and the CreateGroup, Discuss and JoinGroup
+ * Forwards, and the Discuss, LeaveGroup and JoinGroup requests, start
+ * with it:
+ *
+ *  |------------------------------------------|
+ *  |  Group ID  |    (fields of the packet)   |
+ *  |------------------------------------------|
+ *
+ * A user may answer any of its invitations, and a Discuss or LeaveGroup
+ * request naming a group the user is not in is answered with
+ * ERROR_NOT_IN_GROUP. The other members of a group get its packets in
+ * their own form, with or without the Group ID.
  */
 
 
@@ -97,10 +243,25 @@ struct ResponseHeader {
     uint32_t status;         ///< Status (SUCCESS/ERROR CODE)
 };
 
+/**
+ * @brief  Features a client asks for in its Login request (bits)
+ */
+enum {
+    FEATURE_CHUNKED     = 0x1 ,    ///< Talk, Yell and Discuss messages larger than a packet are sent in chunks
+    FEATURE_REQUEST_IDS = 0x2 ,    ///< Requests and their responses carry a Request ID
+    FEATURE_MESSAGE_TEXT = 0x4 ,   ///< Talk, Yell and Discuss messages are one text instead of a list of words
+    FEATURE_PRESENCE    = 0x8 ,    ///< Logins and exits are sent as they happen, with the version of the list of users
+    FEATURE_GROUPS      = 0x10     ///< Users are in several groups, named by their Group ID
+};
+
+/// @brief  Bit of the type field set on each chunk of a message, except the last one
+#define PACKET_CONTINUED     0x8000
+
 // group accept response
 enum {
 	REJECT_GROUP		= 0 ,
-	ACCEPT_GROUP		= 1
+	ACCEPT_GROUP		= 1 ,
+	EXPIRED_GROUP		= 2		///< Invitation dropped without an answer (in a JoinGroup Forward only)
 };
 
 /**
@@ -138,7 +299,8 @@ enum {
 	RESPONSE_CREATEGROUP_FWD	= 151,
 	RESPONSE_DISCUSS_FWD		= 161,
     RESPONSE_EXIT_FWD			= 191,
-	RESPONSE_JOINGROUP_FWD		= 101
+	RESPONSE_JOINGROUP_FWD		= 101,	///< An invitation to the group was answered, or dropped
+	RESPONSE_LOGIN_FWD			= 111	///< A user logged in (FEATURE_PRESENCE)
 	
 
     // etc ...
@@ -154,6 +316,8 @@ enum {
 	ERROR_USER_NOT_FOUND	= 3 ,
 	ERROR_NO_USER_ONLINE	= 4 ,
 	ERROR_EXIT_IN_GROUP			= 5 ,
+	ERROR_TOO_SLOW				= 6 ,	///< Sent with RESPONSE_EXIT to a client which did not keep up
+	ERROR_NOT_IN_GROUP			= 7 ,	///< Sent with RESPONSE_DISCUSS or RESPONSE_LEAVEGROUP to a user in no group
 
 
     ERROR_UNKNOWN           = 1024
@@ -168,5 +332,7 @@ enum {
 
 /// @brief  Byte Offset of the length field in the packets
 #define LENGTH_FIELD_OFFSET  sizeof ( uint16_t )
+/// @brief  Size of the Request ID (FEATURE_REQUEST_IDS), a packet with one may be that much longer than MAX_PACKET_LENGTH
+#define REQUEST_ID_LENGTH    sizeof ( uint32_t )
 
 #endif  // __ChatPacket_h
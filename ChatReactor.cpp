@@ -0,0 +1,1204 @@
+// ChatReactor.cpp
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "ChatBufferPool.h"
+#include "ChatPacket.h"
+#include "ChatReactor.h"
+#include "ChatRecvBuffer.h"
+#include "ChatSendQueue.h"
+#include "ChatUring.h"
+#include "ChatWorkerPool.h"
+
+using namespace std;
+
+/// @brief  Maximum number of events returned by one epoll_wait()
+#define MAX_EPOLL_EVENTS  256
+/// @brief  Maximum number of connections accepted per epoll event on the listening socket
+#define ACCEPT_BATCH      64
+
+/// @brief  Number of SQEs in each io_uring
+#define URING_ENTRIES        256
+/// @brief  Number of provided receive buffers in each io_uring (power of 2)
+#define URING_BUFFER_COUNT   256
+/// @brief  Buffer group ID of the provided receive buffers
+#define URING_BUFFER_GROUP   0
+
+/// @brief  Number of locks shared by all the connections (power of 2)
+#define CONNECTION_LOCK_COUNT  1024
+
+/**
+ * @brief  Kind of io_uring operation, kept in the low bits of user_data
+ */
+enum {
+    URING_OP_RECV   = 1 ,   ///< user_data is a Connection
+    URING_OP_SEND   = 2 ,   ///< user_data is a Connection
+    URING_OP_ACCEPT = 3 ,   ///< user_data is a Reactor
+    URING_OP_WAKE   = 4 ,   ///< user_data is a Reactor
+    URING_OP_MASK   = 7
+};
+
+/**
+ * @brief  A packet for all the connections of one reactor which receive broadcasts
+ */
+struct Broadcast {
+    SharedFrame  *shared;     ///< Data of the packet (one reference is held by this Broadcast)
+    Connection   *except;     ///< Connection which does not get the packet (may be NULL)
+    unsigned      channels;   ///< Connections listening to any of these get the packet
+};
+
+/**
+ * @brief  A connection handed back to its reactor by a worker
+ */
+struct CloseRequest {
+    Connection   *conn;
+    bool          done;       ///< 'onClose' has run (otherwise 'onPacket' asked for the connection to be closed)
+};
+
+/**
+ * @brief  A request waiting for a worker, the body follows in the same allocation
+ */
+struct PacketTask {
+    WorkerTask    task;
+    Connection   *conn;
+    uint16_t      type;       ///< Request type
+    int           length;     ///< Size of the body
+    bool          independent;   ///< Runs on 'strand' instead of the strand of the connection
+    Strand        strand;
+};
+
+/**
+ * @brief  The 'onClose' callback of a connection, run by a worker after its last request
+ */
+struct CloseTask {
+    WorkerTask    task;
+    Connection   *conn;
+};
+
+/**
+ * @brief  One reactor thread (shard) with its listening socket, and its epoll instance or io_uring
+ */
+struct Reactor {
+    int                   index;          ///< Shard number, also the core the thread is pinned to
+    int                   listenFD;       ///< Listening socket of this shard (SO_REUSEPORT)
+    int                   backend;        ///< REACTOR_EPOLL or REACTOR_URING
+    int                   epollFD;        ///< epoll instance (REACTOR_EPOLL)
+    Uring                 ring;           ///< io_uring instance (REACTOR_URING)
+    unsigned long         accepted;       ///< Number of connections accepted by this shard (read atomically)
+    unsigned long         closed;         ///< Number of connections closed by this shard (read atomically)
+    vector <Connection*>  connections;    ///< Open connections of this shard
+
+    int                   wakeFD;         ///< eventfd written by other threads which queued packets
+    uint64_t              wakeValue;      ///< Buffer of the read on 'wakeFD' (REACTOR_URING)
+    vector <int>          localFlush;     ///< Sockets with new packets, queued by this thread
+    vector <int>          flushing;       ///< Sockets being flushed
+    vector <Broadcast>    localBroadcasts;   ///< Broadcasts started by this thread
+    vector <Broadcast>    delivering;        ///< Broadcasts being delivered
+    vector <CloseRequest> closeRequests;     ///< Connections being handed back
+    pthread_mutex_t       flushLock;      ///< Lock on 'remoteFlush', 'remoteBroadcasts' and 'remoteClose'
+    vector <int>          remoteFlush;    ///< Sockets with new packets, queued by other threads
+    vector <Broadcast>    remoteBroadcasts;  ///< Broadcasts started by other threads
+    vector <CloseRequest> remoteClose;    ///< Connections handed back by the workers
+
+    pthread_t             threadID;       ///< Thread running the event loop
+};
+
+/**
+ * @brief  The sendmsg() in flight on a connection (REACTOR_URING)
+ */
+struct UringWrite {
+    struct msghdr  message;
+    struct iovec   vectors[ MAX_SEND_VECTORS ];
+};
+
+/**
+ * @brief  Lock on the table entry and the pending packets of the connections
+ *
+ * Each lock is on its own cache line, so that threads using different
+ * locks do not slow each other down.
+ */
+struct ConnectionLock {
+    pthread_spinlock_t  lock;
+} __attribute__ (( aligned ( 64 ) ));
+
+/// @brief  All the reactors, and the callbacks they report to
+static vector <Reactor*> reactors;
+static ReactorCallbacks reactorCallbacks;
+
+/// @brief  Open connections by socket, used to queue packets from any thread
+static Connection **connectionTable = NULL;
+static int connectionTableSize = 0;
+static ConnectionLock connectionLocks[ CONNECTION_LOCK_COUNT ];
+
+/// @brief  How much may be queued on one connection (see setSendLimits())
+static SendLimits sendLimits = { 4096 , 1024 * 1024 , SEND_DISCONNECT };
+/// @brief  Packets dropped, and connections closed, because of the above (changed atomically)
+static unsigned long droppedFrames = 0;
+static unsigned long droppedBytes = 0;
+static unsigned long slowDisconnects = 0;
+/// @brief  Reactor run by the calling thread (NULL outside the reactors)
+static __thread Reactor *currentReactor = NULL;
+/// @brief  Generation of the last connection opened (changed atomically)
+static uint32_t lastGeneration = 0;
+
+/// @brief  Event loops of the reactor threads
+static void* epollThread ( void *args );
+static void* uringThread ( void *args );
+
+/// @brief  Lock on the table entry and the pending packets of a socket
+static pthread_spinlock_t* connectionLock ( int socketFD );
+/// @brief  Make a connection reachable by sendPacket(), return false if the socket is out of range
+static bool registerConnection ( Connection *conn );
+/// @brief  Stop queueing packets on a connection, and take the ones already queued
+static void unregisterConnection ( Connection *conn );
+/// @brief  Add a frame to the queue of a connection, return false if it is closed
+static bool queueFrame ( ConnectionID connection , SendFrame *frame );
+/// @brief  Ask the owner of a socket to write its new packets
+static void scheduleFlush ( Reactor *owner , int socketFD );
+/// @brief  Hand a broadcast to a reactor
+static void postBroadcast ( Reactor *reactor , const Broadcast &broadcast );
+/// @brief  Hand a connection back to its reactor, to close it ('done' false) or to finish closing it
+static void postClose ( Connection *conn , bool done );
+/// @brief  Queue the broadcasts handed to a reactor on its connections
+static void deliverBroadcasts ( Reactor *reactor );
+/// @brief  Write the new packets of all the sockets scheduled on a reactor
+static void flushConnections ( Reactor *reactor );
+/// @brief  Number of packets at the front of the queue which are being written by io_uring
+static int framesInFlight ( Connection *conn );
+/// @brief  Count packets dropped because a client is too slow
+static void countDrops ( int frames , unsigned long bytes );
+/// @brief  Close a connection which went over the send limits with SEND_DISCONNECT
+static void disconnectSlowConnection ( Connection *conn );
+/// @brief  Start writing the queued packets of a connection, unless a write is already going on
+static void startWrite ( Connection *conn );
+/// @brief  Write queued packets till the socket is full, return false if the connection should be closed
+static bool writeConnection ( Connection *conn );
+
+/// @brief  Accept a batch of new connections on the listening socket of a reactor
+static void acceptConnections ( Reactor *reactor , int maxCount );
+/// @brief  Set up a newly accepted socket, return NULL if it was closed again
+static Connection* openConnection ( Reactor *reactor , int socketFD );
+/// @brief  Read everything available on a connection, return false if it should be closed
+static bool readConnection ( Connection *conn , uint32_t events );
+/// @brief  Handle bytes received in an io_uring buffer, return false if the connection should be closed
+static bool consumeBytes ( Connection *conn , const char *data , int length );
+/// @brief  Hand all complete packets in the receive buffer to the callbacks, return false if it should be closed
+static bool dispatchFrames ( Connection *conn );
+/// @brief  Hand one request to the callbacks, or to the workers, return false if the connection should be closed
+static bool handlePacket ( Connection *conn , const Frame &frame );
+/// @brief  Run a request on a worker
+static void runPacketTask ( WorkerTask *task );
+/// @brief  Run the 'onClose' callback on a worker
+static void runCloseTask ( WorkerTask *task );
+/// @brief  One task less holding off 'onClose', which the last one runs
+static void finishTask ( Connection *conn );
+/// @brief  Stop reading a connection, and close it once the callbacks are done with it
+static void closeConnection ( Connection *conn );
+/// @brief  Close the socket of a connection after 'onClose' (io_uring connections are freed by releaseConnection())
+static void finishClose ( Connection *conn );
+/// @brief  Free a closed connection if it has no io_uring operations left
+static void releaseConnection ( Connection *conn );
+
+/// @brief  io_uring operations of the reactor threads
+static void uringArmAccept ( Reactor *reactor );
+static void uringArmRecv ( Connection *conn );
+static void uringArmWake ( Reactor *reactor );
+static void uringSubmitWrite ( Connection *conn );
+static void uringOnAccept ( Reactor *reactor , int result , unsigned flags );
+static void uringOnRecv ( Connection *conn , int result , unsigned flags );
+static void uringOnSend ( Connection *conn , int result );
+static void uringOnWake ( Reactor *reactor , int result );
+
+bool startReactors ( const int *listenFDs , int count , int backend , const ReactorCallbacks &callbacks ) {
+
+    reactorCallbacks = callbacks;
+    int coreCount = sysconf ( _SC_NPROCESSORS_ONLN );
+
+    // A socket number is always below the limit on open files
+    struct rlimit fileLimit;
+    if ( getrlimit ( RLIMIT_NOFILE , &fileLimit ) != 0 ) {
+        cerr << "Error on getrlimit()\n";
+        return false;
+    }
+    connectionTableSize = fileLimit.rlim_cur > INT_MAX ? INT_MAX : fileLimit.rlim_cur;
+    connectionTable = (Connection**) calloc ( connectionTableSize , sizeof ( Connection* ) );
+    for ( int i = 0 ; i < CONNECTION_LOCK_COUNT ; i++ )
+        pthread_spin_init ( &connectionLocks[i].lock , PTHREAD_PROCESS_PRIVATE );
+
+    for ( int i = 0 ; i < count ; i++ ) {
+        Reactor *reactor = new Reactor;
+        reactor->index = i;
+        reactor->listenFD = listenFDs[i];
+        reactor->backend = backend;
+        reactor->epollFD = -1;
+        reactor->accepted = 0;
+        reactor->closed = 0;
+        pthread_mutex_init ( &reactor->flushLock , NULL );
+        if ( ( reactor->wakeFD = eventfd ( 0 , EFD_NONBLOCK | EFD_CLOEXEC ) ) < 0 ) {
+            cerr << "Error on eventfd()\n";
+            delete reactor;
+            return false;
+        }
+
+        if ( backend == REACTOR_URING ) {
+            if ( !uringInit ( &reactor->ring , URING_ENTRIES ) ||
+                 !uringSetupBuffers ( &reactor->ring , URING_BUFFER_GROUP ,
+                                      URING_BUFFER_COUNT , MAX_PACKET_LENGTH ) ) {
+                if ( reactor->ring.ringFD >= 0 )
+                    uringExit ( &reactor->ring );
+                if ( i > 0 ) {
+                    cerr << "Error setting up io_uring\n";
+                    delete reactor;
+                    return false;
+                }
+                // The kernel does not support what we need, use the classic sockets instead
+                cerr << "io_uring is not available, using epoll\n";
+                backend = reactor->backend = REACTOR_EPOLL;
+            }
+        }
+        if ( backend == REACTOR_EPOLL ) {
+            if ( ( reactor->epollFD = epoll_create1 ( EPOLL_CLOEXEC ) ) < 0 ) {
+                cerr << "Error on epoll_create1()\n";
+                delete reactor;
+                return false;
+            }
+
+            // Level-triggered, so that a batch of accepts can leave the rest for the next round
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = reactor;
+            if ( epoll_ctl ( reactor->epollFD , EPOLL_CTL_ADD , reactor->listenFD , &event ) < 0 ) {
+                cerr << "Error on epoll_ctl()\n";
+                delete reactor;
+                return false;
+            }
+            event.events = EPOLLIN;
+            event.data.ptr = &reactor->wakeFD;
+            if ( epoll_ctl ( reactor->epollFD , EPOLL_CTL_ADD , reactor->wakeFD , &event ) < 0 ) {
+                cerr << "Error on epoll_ctl()\n";
+                delete reactor;
+                return false;
+            }
+        }
+        reactors.push_back ( reactor );
+    }
+
+    // Started once they all exist, as a client of the first one may already broadcast to all
+    for ( int i = 0 ; i < count ; i++ ) {
+        Reactor *reactor = reactors[i];
+        if ( pthread_create ( &reactor->threadID , NULL ,
+                              backend == REACTOR_URING ? uringThread : epollThread , reactor ) != 0 ) {
+            cerr << "Error on pthread_create()\n";
+            return false;
+        }
+
+        // Each shard stays on its own core, with its own connections
+        if ( count <= coreCount ) {
+            cpu_set_t cpuSet;
+            CPU_ZERO ( &cpuSet );
+            CPU_SET ( i , &cpuSet );
+            if ( pthread_setaffinity_np ( reactor->threadID , sizeof ( cpuSet ) , &cpuSet ) != 0 )
+                cerr << "Error on pthread_setaffinity_np()\n";
+        }
+    }
+
+    return true;
+}
+
+int reactorBackend () {
+    return reactors.empty() ? REACTOR_EPOLL : reactors[0]->backend;
+}
+
+void setSendLimits ( const SendLimits &limits ) {
+    sendLimits = limits;
+}
+
+void getReactorStats ( ReactorStats *stats ) {
+
+    stats->accepted = stats->open = 0;
+    for ( int i = 0 ; i < reactors.size() ; i++ ) {
+        unsigned long accepted = __atomic_load_n ( &reactors[i]->accepted , __ATOMIC_RELAXED );
+        unsigned long closed = __atomic_load_n ( &reactors[i]->closed , __ATOMIC_RELAXED );
+        stats->accepted += accepted;
+        stats->open += accepted - closed;
+    }
+    stats->droppedFrames = __atomic_load_n ( &droppedFrames , __ATOMIC_RELAXED );
+    stats->droppedBytes = __atomic_load_n ( &droppedBytes , __ATOMIC_RELAXED );
+    stats->slowDisconnects = __atomic_load_n ( &slowDisconnects , __ATOMIC_RELAXED );
+}
+
+void waitReactors () {
+    for ( int i = 0 ; i < reactors.size() ; i++ )
+        pthread_join ( reactors[i]->threadID , NULL );
+}
+
+bool sendPacket ( ConnectionID connection , const char *buffer , int length ) {
+
+    int socketFD = connectionSocket ( connection );
+    if ( socketFD < 0 || socketFD >= connectionTableSize )
+        return false;
+
+    // The caller's buffer may be gone before the packet is written, so keep a copy
+    return sendSharedFrame ( connection , newSharedFrame ( buffer , length , 1 ) );
+}
+
+bool sendSharedFrame ( ConnectionID connection , SharedFrame *shared ) {
+
+    SendFrame *frame = newSendFrame ( shared );
+    int socketFD = connectionSocket ( connection );
+    if ( socketFD < 0 || socketFD >= connectionTableSize || !queueFrame ( connection , frame ) ) {
+        freeSendFrame ( frame );
+        return false;
+    }
+    return true;
+}
+
+void broadcastPacket ( const char *buffer , int length , Connection *except , unsigned channels ) {
+
+    // Encoded once, each reactor queues it on its own connections
+    Broadcast broadcast;
+    broadcast.shared = newSharedFrame ( buffer , length , reactors.size() );
+    broadcast.except = except;
+    broadcast.channels = channels;
+    for ( int i = 0 ; i < reactors.size() ; i++ )
+        postBroadcast ( reactors[i] , broadcast );
+}
+
+void setBroadcast ( Connection *conn , unsigned channels ) {
+    __atomic_store_n ( &conn->broadcastChannels , channels , __ATOMIC_RELEASE );
+}
+
+static bool queueFrame ( ConnectionID connection , SendFrame *frame ) {
+
+    int socketFD = connectionSocket ( connection );
+    pthread_spinlock_t *lock = connectionLock ( socketFD );
+    pthread_spin_lock ( lock );
+    // The connection the sender meant may be gone, and its socket given to another client
+    Connection *conn = connectionTable[ socketFD ];
+    if ( conn == NULL || conn->generation != connection >> 32 ) {
+        pthread_spin_unlock ( lock );
+        return false;
+    }
+
+    // A client which does not read must not make the server hold everything sent
+    // to it. With SEND_DROP_OLDEST, the owner drops the old packets when it flushes.
+    SendQueue *queue = &conn->sendQueue;
+    if ( sendLimits.policy != SEND_DROP_OLDEST &&
+         ( conn->overflowed || sendQueueFrames ( queue ) >= sendLimits.maxFrames ||
+           sendQueueBytes ( queue ) + frame->shared->length > sendLimits.maxBytes ) ) {
+        bool schedule = false;
+        if ( sendLimits.policy == SEND_DISCONNECT && !conn->overflowed ) {
+            // The owner closes the connection when it flushes
+            conn->overflowed = true;
+            schedule = !queue->flushScheduled;
+            queue->flushScheduled = true;
+        }
+        Reactor *owner = conn->reactor;
+        pthread_spin_unlock ( lock );
+
+        countDrops ( 1 , frame->shared->length );
+        freeSendFrame ( frame );
+        if ( schedule )
+            scheduleFlush ( owner , socketFD );
+        return true;
+    }
+
+    pushSendFrame ( &conn->sendQueue , frame );
+    // Only the first packet since the last flush needs to wake the owner
+    bool schedule = !conn->sendQueue.flushScheduled;
+    conn->sendQueue.flushScheduled = true;
+    Reactor *owner = conn->reactor;
+    pthread_spin_unlock ( lock );
+
+    if ( schedule )
+        scheduleFlush ( owner , socketFD );
+    return true;
+}
+
+static pthread_spinlock_t* connectionLock ( int socketFD ) {
+    return &connectionLocks[ socketFD & ( CONNECTION_LOCK_COUNT - 1 ) ].lock;
+}
+
+static bool registerConnection ( Connection *conn ) {
+
+    if ( conn->socketFD >= connectionTableSize ) {
+        cerr << "Error: socket " << conn->socketFD << " is above the open file limit\n";
+        return false;
+    }
+
+    pthread_spinlock_t *lock = connectionLock ( conn->socketFD );
+    pthread_spin_lock ( lock );
+    connectionTable[ conn->socketFD ] = conn;
+    pthread_spin_unlock ( lock );
+    return true;
+}
+
+static void unregisterConnection ( Connection *conn ) {
+
+    if ( conn->socketFD >= connectionTableSize )
+        return;
+
+    pthread_spinlock_t *lock = connectionLock ( conn->socketFD );
+    pthread_spin_lock ( lock );
+    if ( connectionTable[ conn->socketFD ] == conn )
+        connectionTable[ conn->socketFD ] = NULL;
+    spliceSendQueue ( &conn->sendQueue );
+    pthread_spin_unlock ( lock );
+}
+
+static void scheduleFlush ( Reactor *owner , int socketFD ) {
+
+    // Our own connections are flushed at the end of this loop iteration
+    if ( owner == currentReactor ) {
+        owner->localFlush.push_back ( socketFD );
+        return;
+    }
+
+    pthread_mutex_lock ( &owner->flushLock );
+    bool wake = owner->remoteFlush.empty();
+    owner->remoteFlush.push_back ( socketFD );
+    pthread_mutex_unlock ( &owner->flushLock );
+
+    // If the list was not empty, the owner has already been woken up
+    if ( wake ) {
+        uint64_t one = 1;
+        if ( write ( owner->wakeFD , &one , sizeof ( one ) ) < 0 && errno != EAGAIN )
+            cerr << "Error on write()\n";
+    }
+}
+
+static void postBroadcast ( Reactor *reactor , const Broadcast &broadcast ) {
+
+    if ( reactor == currentReactor ) {
+        reactor->localBroadcasts.push_back ( broadcast );
+        return;
+    }
+
+    pthread_mutex_lock ( &reactor->flushLock );
+    bool wake = reactor->remoteFlush.empty() && reactor->remoteBroadcasts.empty();
+    reactor->remoteBroadcasts.push_back ( broadcast );
+    pthread_mutex_unlock ( &reactor->flushLock );
+
+    if ( wake ) {
+        uint64_t one = 1;
+        if ( write ( reactor->wakeFD , &one , sizeof ( one ) ) < 0 && errno != EAGAIN )
+            cerr << "Error on write()\n";
+    }
+}
+
+static void postClose ( Connection *conn , bool done ) {
+
+    // Only called by the workers, never by the reactor itself
+    Reactor *reactor = conn->reactor;
+    CloseRequest request;
+    request.conn = conn;
+    request.done = done;
+
+    pthread_mutex_lock ( &reactor->flushLock );
+    bool wake = reactor->remoteFlush.empty() && reactor->remoteBroadcasts.empty() &&
+                reactor->remoteClose.empty();
+    reactor->remoteClose.push_back ( request );
+    pthread_mutex_unlock ( &reactor->flushLock );
+
+    if ( wake ) {
+        uint64_t one = 1;
+        if ( write ( reactor->wakeFD , &one , sizeof ( one ) ) < 0 && errno != EAGAIN )
+            cerr << "Error on write()\n";
+    }
+}
+
+static void deliverBroadcasts ( Reactor *reactor ) {
+
+    reactor->delivering.swap ( reactor->localBroadcasts );
+    for ( int i = 0 ; i < reactor->delivering.size() ; i++ ) {
+        Broadcast &broadcast = reactor->delivering[i];
+
+        // One atomic update for all the receivers on this reactor, the extra
+        // references are dropped at the end (the frames are only written, and
+        // so released, by this thread later on)
+        int refs = reactor->connections.size();
+        retainSharedFrame ( broadcast.shared , refs );
+        for ( int j = 0 ; j < reactor->connections.size() ; j++ ) {
+            Connection *conn = reactor->connections[j];
+            if ( conn == broadcast.except ||
+                 ( __atomic_load_n ( &conn->broadcastChannels , __ATOMIC_ACQUIRE ) & broadcast.channels ) == 0 )
+                continue;
+            SendFrame *frame = newSendFrame ( broadcast.shared );
+            if ( !queueFrame ( connectionID ( conn ) , frame ) )
+                freeSendFrame ( frame );
+            refs--;
+        }
+        releaseSharedFrame ( broadcast.shared , refs + 1 );
+    }
+    reactor->delivering.clear();
+}
+
+static void flushConnections ( Reactor *reactor ) {
+
+    pthread_mutex_lock ( &reactor->flushLock );
+    reactor->localFlush.insert ( reactor->localFlush.end() ,
+                                 reactor->remoteFlush.begin() , reactor->remoteFlush.end() );
+    reactor->remoteFlush.clear();
+    reactor->localBroadcasts.insert ( reactor->localBroadcasts.end() ,
+                                      reactor->remoteBroadcasts.begin() , reactor->remoteBroadcasts.end() );
+    reactor->remoteBroadcasts.clear();
+    reactor->closeRequests.swap ( reactor->remoteClose );
+    pthread_mutex_unlock ( &reactor->flushLock );
+
+    // A connection is handed back once to be closed (unless it already is), and once
+    // when its last callback is done, always in this order
+    for ( int i = 0 ; i < reactor->closeRequests.size() ; i++ ) {
+        Connection *conn = reactor->closeRequests[i].conn;
+        if ( !reactor->closeRequests[i].done )
+            closeConnection ( conn );
+        else {
+            finishClose ( conn );
+            if ( reactor->backend == REACTOR_URING )
+                releaseConnection ( conn );
+        }
+    }
+    reactor->closeRequests.clear();
+
+    // Replies go out before the broadcasts are spread over the connections, and
+    // closing a connection may queue more packets, so go on till nothing is left
+    while ( !reactor->localFlush.empty() || !reactor->localBroadcasts.empty() ) {
+        reactor->flushing.swap ( reactor->localFlush );
+        for ( int i = 0 ; i < reactor->flushing.size() ; i++ ) {
+            int socketFD = reactor->flushing[i];
+
+            // The socket may have been closed (and even reused) since it was scheduled
+            pthread_spinlock_t *lock = connectionLock ( socketFD );
+            pthread_spin_lock ( lock );
+            Connection *conn = connectionTable[ socketFD ];
+            bool overflowed = false;
+            if ( conn != NULL && conn->reactor == reactor ) {
+                spliceSendQueue ( &conn->sendQueue );
+                conn->sendQueue.flushScheduled = false;
+                overflowed = conn->overflowed;
+            }
+            else
+                conn = NULL;
+            pthread_spin_unlock ( lock );
+
+            if ( conn == NULL )
+                continue;
+            if ( overflowed ) {
+                disconnectSlowConnection ( conn );
+                continue;
+            }
+            if ( sendLimits.policy == SEND_DROP_OLDEST ) {
+                unsigned long bytes = 0;
+                int frames = dropOldestFrames ( &conn->sendQueue , framesInFlight ( conn ) ,
+                                                sendLimits.maxFrames , sendLimits.maxBytes , &bytes );
+                if ( frames > 0 )
+                    countDrops ( frames , bytes );
+            }
+            startWrite ( conn );
+        }
+        reactor->flushing.clear();
+
+        deliverBroadcasts ( reactor );
+    }
+}
+
+static int framesInFlight ( Connection *conn ) {
+    return conn->writeBusy && conn->uringWrite != NULL ? conn->uringWrite->message.msg_iovlen : 0;
+}
+
+static void countDrops ( int frames , unsigned long bytes ) {
+    __atomic_add_fetch ( &droppedFrames , frames , __ATOMIC_RELAXED );
+    __atomic_add_fetch ( &droppedBytes , bytes , __ATOMIC_RELAXED );
+}
+
+static void disconnectSlowConnection ( Connection *conn ) {
+
+    // Whatever is waiting is dropped, so that the callbacks can queue a last
+    // packet telling the client why it is disconnected
+    unsigned long bytes = 0;
+    int frames = dropOldestFrames ( &conn->sendQueue , framesInFlight ( conn ) , 0 , 0 , &bytes );
+    countDrops ( frames , bytes );
+
+    pthread_spinlock_t *lock = connectionLock ( conn->socketFD );
+    pthread_spin_lock ( lock );
+    conn->overflowed = false;
+    pthread_spin_unlock ( lock );
+
+    // Already waiting for the workers to finish with it
+    if ( conn->closing )
+        return;
+
+    __atomic_add_fetch ( &slowDisconnects , 1 , __ATOMIC_RELAXED );
+    conn->tooSlow = true;
+    closeConnection ( conn );
+}
+
+static void startWrite ( Connection *conn ) {
+
+    if ( conn->writeBusy || sendQueueEmpty ( &conn->sendQueue ) )
+        return;
+
+    if ( conn->reactor->backend == REACTOR_URING )
+        uringSubmitWrite ( conn );
+    else if ( !writeConnection ( conn ) )
+        closeConnection ( conn );
+}
+
+static bool writeConnection ( Connection *conn ) {
+
+    struct iovec vectors[ MAX_SEND_VECTORS ];
+    while ( !sendQueueEmpty ( &conn->sendQueue ) ) {
+        // As many packets as possible in one system call
+        struct msghdr message;
+        memset ( &message , 0 , sizeof ( message ) );
+        message.msg_iov = vectors;
+        message.msg_iovlen = sendQueueVector ( &conn->sendQueue , vectors , MAX_SEND_VECTORS );
+
+        ssize_t n = sendmsg ( conn->socketFD , &message , MSG_NOSIGNAL );
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+                cerr << "Error on sendmsg()\n";
+                return false;
+            }
+            // The socket buffer is full, go on when epoll reports EPOLLOUT
+            conn->writeBusy = true;
+            return true;
+        }
+        sendQueueAdvance ( &conn->sendQueue , n );
+    }
+
+    conn->writeBusy = false;
+    return true;
+}
+
+static void* epollThread ( void *args ) {
+
+    Reactor *reactor = (Reactor*) args;
+    currentReactor = reactor;
+    struct epoll_event events[ MAX_EPOLL_EVENTS ];
+
+    while ( true ) {
+        int count = epoll_wait ( reactor->epollFD , events , MAX_EPOLL_EVENTS , -1 );
+        if ( count < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            cerr << "Error on epoll_wait()\n";
+            return NULL;
+        }
+
+        for ( int i = 0 ; i < count ; i++ ) {
+            if ( events[i].data.ptr == reactor ) {
+                acceptConnections ( reactor , ACCEPT_BATCH );
+                continue;
+            }
+            if ( events[i].data.ptr == &reactor->wakeFD ) {
+                // Other threads queued packets, flushConnections() below picks them up
+                uint64_t value;
+                if ( read ( reactor->wakeFD , &value , sizeof ( value ) ) < 0 && errno != EAGAIN )
+                    cerr << "Error on read()\n";
+                continue;
+            }
+
+            Connection *conn = (Connection*) events[i].data.ptr;
+            uint32_t flags = events[i].events;
+            bool keepOpen = true;
+            if ( ( flags & EPOLLOUT ) && conn->writeBusy ) {
+                // There is room in the socket buffer again
+                conn->writeBusy = false;
+                keepOpen = writeConnection ( conn );
+            }
+            if ( keepOpen && !conn->closing && ( flags & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) )
+                keepOpen = readConnection ( conn , flags );
+            if ( !keepOpen )
+                closeConnection ( conn );
+        }
+
+        // Write everything queued while handling these events, one system call per connection
+        flushConnections ( reactor );
+    }
+
+    // Control should not reach here
+    return NULL;
+}
+
+static void* uringThread ( void *args ) {
+
+    Reactor *reactor = (Reactor*) args;
+    currentReactor = reactor;
+    Uring *ring = &reactor->ring;
+
+    uringArmAccept ( reactor );
+    uringArmWake ( reactor );
+
+    while ( true ) {
+        // Everything queued while handling the last batch of completions goes in here
+        flushConnections ( reactor );
+        if ( uringSubmitAndWait ( ring , 1 ) < 0 && errno != EBUSY ) {
+            cerr << "Error on io_uring_enter()\n";
+            return NULL;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ( ( cqe = uringPeekCQE ( ring ) ) != NULL ) {
+            uint64_t userData = cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            uringAdvanceCQ ( ring );
+
+            void *target = (void*) (uintptr_t) ( userData & ~(uint64_t) URING_OP_MASK );
+            switch ( userData & URING_OP_MASK ) {
+                case URING_OP_RECV:
+                    uringOnRecv ( (Connection*) target , result , flags );
+                    break;
+                case URING_OP_SEND:
+                    uringOnSend ( (Connection*) target , result );
+                    break;
+                case URING_OP_ACCEPT:
+                    uringOnAccept ( (Reactor*) target , result , flags );
+                    break;
+                case URING_OP_WAKE:
+                    uringOnWake ( (Reactor*) target , result );
+                    break;
+            }
+        }
+    }
+
+    // Control should not reach here
+    return NULL;
+}
+
+static void acceptConnections ( Reactor *reactor , int maxCount ) {
+
+    for ( int i = 0 ; i < maxCount ; i++ ) {
+        // The new socket is non-blocking from the start
+        int socketFD = accept4 ( reactor->listenFD , NULL , NULL , SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( socketFD < 0 ) {
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                cerr << "Error on accept4()\n";
+            return;
+        }
+
+        Connection *conn = openConnection ( reactor , socketFD );
+        if ( conn == NULL )
+            continue;
+        __atomic_store_n ( &reactor->accepted , reactor->accepted + 1 , __ATOMIC_RELAXED );
+
+        if ( reactor->backend == REACTOR_URING ) {
+            uringArmRecv ( conn );
+            continue;
+        }
+
+        // Edge-triggered, so the reactor must always read till EAGAIN, and
+        // EPOLLOUT is only reported when a full socket buffer has room again
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if ( epoll_ctl ( reactor->epollFD , EPOLL_CTL_ADD , socketFD , &event ) < 0 ) {
+            cerr << "Error on epoll_ctl()\n";
+            closeConnection ( conn );
+        }
+    }
+}
+
+static Connection* openConnection ( Reactor *reactor , int socketFD ) {
+
+    Connection *conn = new Connection;
+    conn->socketFD = socketFD;
+    // Several reactors accept at once, and 0 is never used (see NO_CONNECTION)
+    do
+        conn->generation = __atomic_add_fetch ( &lastGeneration , 1 , __ATOMIC_RELAXED );
+    while ( conn->generation == 0 );
+    conn->reactor = reactor;
+    conn->context = NULL;
+    initRecvBuffer ( &conn->recvBuffer );
+    initSendQueue ( &conn->sendQueue );
+    conn->broadcastChannels = 0;
+    conn->overflowed = false;
+    conn->tooSlow = false;
+    conn->writeBusy = false;
+    conn->uringWrite = NULL;
+    conn->pendingOps = 0;
+    initStrand ( &conn->strand );
+    conn->taskCount = 1;
+    conn->rejected = false;
+    conn->closing = false;
+    conn->finished = false;
+
+    // Get the Client's IP and Port
+    socklen_t addressLength = sizeof ( struct sockaddr_in );
+    if ( getpeername ( socketFD , (struct sockaddr*) &conn->clientAddress ,
+                       &addressLength ) != 0 ) {
+        cerr << "Error on getpeername()\n";
+        close ( socketFD );
+        destroyStrand ( &conn->strand );
+        delete conn;
+        return NULL;
+    }
+
+    if ( !registerConnection ( conn ) ) {
+        close ( socketFD );
+        destroyStrand ( &conn->strand );
+        delete conn;
+        return NULL;
+    }
+    conn->listIndex = reactor->connections.size();
+    reactor->connections.push_back ( conn );
+
+    reactorCallbacks.onOpen ( conn );
+    return conn;
+}
+
+static bool readConnection ( Connection *conn , uint32_t events ) {
+
+    while ( true ) {
+        // Get as many bytes as there are, which may be several packets, or only part of one
+        int n = recvFrames ( &conn->recvBuffer , conn->socketFD );
+        if ( n == 0 ) {
+            // The client closed the connection
+            return false;
+        }
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                return false;
+            // Nothing more to read till the next event
+            trimRecvBuffer ( &conn->recvBuffer );
+            return true;
+        }
+
+        bool drained = recvBufferDrained ( &conn->recvBuffer );
+        if ( !dispatchFrames ( conn ) )
+            return false;
+
+        // A short read means the socket is empty, so there is no need for
+        // another recv() to see EAGAIN (unless we still have to see the close)
+        if ( drained && !( events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) ) {
+            trimRecvBuffer ( &conn->recvBuffer );
+            return true;
+        }
+    }
+}
+
+static bool consumeBytes ( Connection *conn , const char *data , int length ) {
+
+    // Nothing left over from before, so the packets can be handed out
+    // straight from the io_uring buffer
+    if ( conn->recvBuffer.start == conn->recvBuffer.end ) {
+        Frame frame;
+        int result;
+        while ( ( result = parseFrame ( data , length , &frame ) ) > 0 ) {
+            if ( !handlePacket ( conn , frame ) )
+                return false;
+            data += frame.length , length -= frame.length;
+        }
+        if ( result < 0 ) {
+            cerr << "Error: Invalid packet length\n";
+            return false;
+        }
+        if ( length == 0 )
+            return true;
+    }
+
+    // Keep the incomplete packet till the rest of it arrives
+    appendRecvBuffer ( &conn->recvBuffer , data , length );
+    if ( !dispatchFrames ( conn ) )
+        return false;
+    trimRecvBuffer ( &conn->recvBuffer );
+    return true;
+}
+
+static bool dispatchFrames ( Connection *conn ) {
+
+    Frame frame;
+    int result;
+    while ( ( result = nextFrame ( &conn->recvBuffer , &frame ) ) > 0 ) {
+        if ( !handlePacket ( conn , frame ) )
+            return false;
+    }
+    if ( result < 0 ) {
+        cerr << "Error: Invalid packet length\n";
+        return false;
+    }
+
+    return true;
+}
+
+static bool handlePacket ( Connection *conn , const Frame &frame ) {
+
+    if ( workerPoolSize() == 0 )
+        return reactorCallbacks.onPacket ( conn , frame.type , frame.body , frame.bodyLength );
+
+    // The receive buffer is reused as soon as we return, so the task keeps a copy
+    PacketTask *packet = (PacketTask*) allocBuffer ( sizeof ( PacketTask ) + frame.bodyLength );
+    packet->task.run = runPacketTask;
+    packet->task.last = false;
+    packet->conn = conn;
+    packet->type = frame.type;
+    packet->length = frame.bodyLength;
+    packet->independent = reactorCallbacks.isIndependent != NULL &&
+                          reactorCallbacks.isIndependent ( conn , frame.type );
+    memcpy ( packet + 1 , frame.body , frame.bodyLength );
+    if ( !packet->independent ) {
+        submitTask ( &conn->strand , &packet->task );
+        return true;
+    }
+
+    // A strand of its own, which goes away with the task
+    initStrand ( &packet->strand );
+    packet->task.last = true;
+    __atomic_add_fetch ( &conn->taskCount , 1 , __ATOMIC_RELAXED );
+    submitTask ( &packet->strand , &packet->task );
+    return true;
+}
+
+static void runPacketTask ( WorkerTask *task ) {
+
+    PacketTask *packet = (PacketTask*) task;
+    Connection *conn = packet->conn;
+
+    // The requests which arrived after the one which failed are not handled
+    if ( !__atomic_load_n ( &conn->rejected , __ATOMIC_RELAXED ) &&
+         !reactorCallbacks.onPacket ( conn , packet->type , (const char*) ( packet + 1 ) , packet->length ) &&
+         !__atomic_exchange_n ( &conn->rejected , true , __ATOMIC_RELAXED ) )
+        postClose ( conn , false );
+
+    if ( !packet->independent ) {
+        freeBuffer ( packet );
+        return;
+    }
+    destroyStrand ( &packet->strand );
+    freeBuffer ( packet );
+    finishTask ( conn );
+}
+
+static void runCloseTask ( WorkerTask *task ) {
+
+    Connection *conn = ( (CloseTask*) task )->conn;
+    freeBuffer ( task );
+    finishTask ( conn );
+}
+
+static void finishTask ( Connection *conn ) {
+
+    if ( __atomic_sub_fetch ( &conn->taskCount , 1 , __ATOMIC_ACQ_REL ) > 0 )
+        return;
+
+    // The reactor may free the connection (and its strand) as soon as it is handed back
+    reactorCallbacks.onClose ( conn );
+    postClose ( conn , true );
+}
+
+static void closeConnection ( Connection *conn ) {
+
+    if ( conn->closing )
+        return;
+    conn->closing = true;
+
+    if ( workerPoolSize() > 0 ) {
+        // Nothing more is read, but the requests already handed to the workers
+        // are handled first, and the worker running 'onClose' after them hands
+        // the connection back to finishClose(). Till then the socket stays open,
+        // so its number cannot be reused, and packets can still be sent to it.
+        shutdown ( conn->socketFD , SHUT_RD );
+        CloseTask *close = (CloseTask*) allocBuffer ( sizeof ( CloseTask ) );
+        close->task.run = runCloseTask;
+        close->task.last = true;
+        close->conn = conn;
+        submitTask ( &conn->strand , &close->task );
+        return;
+    }
+
+    reactorCallbacks.onClose ( conn );
+    finishClose ( conn );
+}
+
+static void finishClose ( Connection *conn ) {
+
+    conn->finished = true;
+    unregisterConnection ( conn );
+
+    // Take it out of the connections of the reactor (the last one moves to its place)
+    Reactor *reactor = conn->reactor;
+    Connection *last = reactor->connections.back();
+    reactor->connections[ conn->listIndex ] = last;
+    last->listIndex = conn->listIndex;
+    reactor->connections.pop_back();
+    __atomic_store_n ( &reactor->closed , reactor->closed + 1 , __ATOMIC_RELAXED );
+
+    if ( reactor->backend == REACTOR_EPOLL ) {
+        // Last chance for the queued packets (e.g. the reply to an Exit request)
+        if ( !conn->writeBusy )
+            writeConnection ( conn );
+        epoll_ctl ( reactor->epollFD , EPOLL_CTL_DEL , conn->socketFD , NULL );
+        close ( conn->socketFD );
+        freeRecvBuffer ( &conn->recvBuffer );
+        clearSendQueue ( &conn->sendQueue );
+        destroyStrand ( &conn->strand );
+        delete conn;
+        return;
+    }
+
+    // Ends the pending receive, but lets the queued packets go out. The socket
+    // is closed by releaseConnection() once all operations are done (every
+    // io_uring completion handler calls it last).
+    shutdown ( conn->socketFD , SHUT_RD );
+    startWrite ( conn );
+}
+
+static void releaseConnection ( Connection *conn ) {
+
+    if ( !conn->finished || conn->pendingOps > 0 )
+        return;
+
+    close ( conn->socketFD );
+    freeRecvBuffer ( &conn->recvBuffer );
+    clearSendQueue ( &conn->sendQueue );
+    destroyStrand ( &conn->strand );
+    delete conn;
+}
+
+static void uringArmAccept ( Reactor *reactor ) {
+
+    // A multishot poll reports every new connection on the listening socket
+    struct io_uring_sqe *sqe = uringGetSQE ( &reactor->ring );
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = reactor->listenFD;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t) (uintptr_t) reactor | URING_OP_ACCEPT;
+}
+
+static void uringArmRecv ( Connection *conn ) {
+
+    // One multishot receive keeps delivering into the provided buffers till it fails
+    struct io_uring_sqe *sqe = uringGetSQE ( &conn->reactor->ring );
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socketFD;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t) (uintptr_t) conn | URING_OP_RECV;
+    conn->pendingOps++;
+}
+
+static void uringArmWake ( Reactor *reactor ) {
+
+    struct io_uring_sqe *sqe = uringGetSQE ( &reactor->ring );
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->wakeFD;
+    sqe->addr = (uint64_t) (uintptr_t) &reactor->wakeValue;
+    sqe->len = sizeof ( reactor->wakeValue );
+    sqe->user_data = (uint64_t) (uintptr_t) reactor | URING_OP_WAKE;
+}
+
+static void uringSubmitWrite ( Connection *conn ) {
+
+    // Only one write is in flight per connection, so that packets cannot interleave
+    // (its record is recycled by the pool of this reactor, like the frames it writes)
+    UringWrite *write = conn->uringWrite;
+    if ( write == NULL )
+        write = conn->uringWrite = (UringWrite*) allocBuffer ( sizeof ( UringWrite ) );
+    memset ( &write->message , 0 , sizeof ( write->message ) );
+    write->message.msg_iov = write->vectors;
+    write->message.msg_iovlen = sendQueueVector ( &conn->sendQueue , write->vectors , MAX_SEND_VECTORS );
+
+    struct io_uring_sqe *sqe = uringGetSQE ( &conn->reactor->ring );
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->socketFD;
+    sqe->addr = (uint64_t) (uintptr_t) &write->message;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t) (uintptr_t) conn | URING_OP_SEND;
+    conn->writeBusy = true;
+    conn->pendingOps++;
+}
+
+static void uringOnAccept ( Reactor *reactor , int result , unsigned flags ) {
+
+    // The poll only fires again for new connections, so take all the waiting ones
+    if ( result >= 0 )
+        acceptConnections ( reactor , INT_MAX );
+
+    if ( !( flags & IORING_CQE_F_MORE ) )
+        uringArmAccept ( reactor );
+}
+
+static void uringOnRecv ( Connection *conn , int result , unsigned flags ) {
+
+    Reactor *reactor = conn->reactor;
+    bool more = ( flags & IORING_CQE_F_MORE ) != 0;
+    if ( !more )
+        conn->pendingOps--;
+
+    if ( result > 0 && ( flags & IORING_CQE_F_BUFFER ) ) {
+        uint16_t bufferID = flags >> IORING_CQE_BUFFER_SHIFT;
+        if ( !conn->closing && !consumeBytes ( conn , uringBuffer ( &reactor->ring , bufferID ) , result ) )
+            closeConnection ( conn );
+        uringRecycleBuffer ( &reactor->ring , bufferID );
+    }
+    else if ( result != -ENOBUFS ) {
+        // The client closed the connection, or there was an error
+        closeConnection ( conn );
+    }
+
+    // The multishot receive stops when it runs out of buffers, start it again
+    if ( !more && !conn->closing )
+        uringArmRecv ( conn );
+
+    releaseConnection ( conn );
+}
+
+static void uringOnSend ( Connection *conn , int result ) {
+
+    conn->pendingOps--;
+    conn->writeBusy = false;
+
+    if ( result < 0 ) {
+        // Nothing more can be sent, drop the rest of the queue
+        if ( !conn->closing )
+            cerr << "Error on sendmsg()\n";
+        unregisterConnection ( conn );
+        clearSendQueue ( &conn->sendQueue );
+        closeConnection ( conn );
+    }
+    else {
+        // Packets queued while this write was in flight go in the next one
+        sendQueueAdvance ( &conn->sendQueue , result );
+        startWrite ( conn );
+    }
+
+    if ( !conn->writeBusy ) {
+        freeBuffer ( conn->uringWrite );
+        conn->uringWrite = NULL;
+    }
+
+    releaseConnection ( conn );
+}
+
+static void uringOnWake ( Reactor *reactor , int result ) {
+
+    // Other threads queued packets, the next flushConnections() picks them up
+    if ( result < 0 && result != -EAGAIN && result != -EINTR )
+        cerr << "Error on read()\n";
+    uringArmWake ( reactor );
+}
@@ -0,0 +1,209 @@
+// ChatReactor.h
+
+#ifndef __ChatReactor_h
+#define __ChatReactor_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "ChatRecvBuffer.h"
+#include "ChatSendQueue.h"
+#include "ChatWorkerPool.h"
+
+/*
+ * The reactor multiplexes all the client sockets on a small, fixed
+ * number of threads instead of running one thread per client.
+ *
+ * Every reactor thread is a shard with its own listening socket. All
+ * the listening sockets are bound to the same port with SO_REUSEPORT,
+ * so the kernel spreads the new connections over the shards, and each
+ * shard accepts its connections in batches with accept4(). The thread
+ * of each shard is pinned to its own core.
+ *
+ * Every reactor thread owns an edge-triggered epoll instance, and only
+ * the reactor which accepted a connection reads from it. Whenever a complete
+ * request has been received, the reactor calls the 'onPacket' callback
+ * of the connection with the body of the request (i.e. everything after
+ * the 'type' and 'length' fields).
+ *
+ * All sockets are non-blocking, so a request may arrive in several
+ * pieces, and one read may return several requests. The reactor reads
+ * into the RecvBuffer of the connection, hands every complete request
+ * to the callbacks straight from there, and keeps the partially
+ * received request until the rest of it arrives.
+ *
+ * If the worker pool is started, the reactor does not handle requests
+ * itself. Each request is copied into a task on the Strand of its
+ * connection instead, so the requests of one client are handled in
+ * order, one at a time, by whichever worker is free, and a slow
+ * request never holds up the reading and writing of the other
+ * clients. A request which the 'isIndependent' callback lets run
+ * alongside the others gets a strand of its own instead, so it does not
+ * wait for the requests ahead of it. 'onClose' then runs on a worker as
+ * well, after the last request (including the independent ones still
+ * running), and the worker hands the connection back to its reactor to
+ * close the socket.
+ *
+ * Packets sent to a connection, by any thread, go into its SendQueue.
+ * Only the reactor which owns the connection writes to the socket (so
+ * packets never interleave), at the end of each iteration of its event
+ * loop, with one sendmsg() for all the packets queued since the last
+ * one. Other threads wake the owner up through an eventfd.
+ *
+ * A broadcast (e.g. a Yell) is encoded once into a reference counted
+ * frame which is handed to every reactor, and each reactor queues it on
+ * its own connections. A broadcast goes out on one or more channels
+ * (bits chosen by the callbacks), and reaches the connections which
+ * listen to any of them, so that clients which understand different
+ * versions of a packet can each get their own.
+ *
+ * Nothing ever waits for a slow client. Instead, the packets queued on
+ * a connection are limited (see SendLimits), and what happens to the
+ * packets over the limits is chosen by the policy.
+ *
+ * Instead of epoll, the reactors can use io_uring (REACTOR_URING). A
+ * single multishot receive per connection then delivers the data into
+ * buffers registered with the ring, and the writes of all connections
+ * during one iteration of the event loop are submitted to the kernel
+ * in one system call.
+ */
+
+struct Reactor;
+struct Connection;
+struct UringWrite;
+
+/**
+ * @brief  A connection, by its socket and the generation of the connection (see connectionID())
+ *
+ * A socket number is given to a new connection as soon as the old one
+ * is closed. A ConnectionID kept for later (e.g. by a User) therefore
+ * finds nothing once its connection is gone, instead of the connection
+ * which took the socket since.
+ */
+typedef uint64_t ConnectionID;
+/// @brief  ConnectionID of no connection
+#define NO_CONNECTION  0
+
+/**
+ * @brief  I/O backend used by the reactor threads
+ */
+enum {
+    REACTOR_EPOLL   = 0 ,   ///< Non-blocking sockets with edge-triggered epoll
+    REACTOR_URING   = 1     ///< io_uring with multishot receives and batched sends
+};
+
+/**
+ * @brief  What happens to a packet for a connection which already has too much queued
+ */
+enum {
+    SEND_DROP_OLDEST   = 0 ,   ///< Drop the oldest queued packets to make room
+    SEND_DROP_NEWEST   = 1 ,   ///< Drop the new packet
+    SEND_DISCONNECT    = 2     ///< Drop everything and close the connection
+};
+
+/**
+ * @brief  Limits on the packets queued on one connection (see setSendLimits())
+ */
+struct SendLimits {
+    int     maxFrames;       ///< Maximum number of queued packets
+    int     maxBytes;        ///< Maximum number of queued bytes
+    int     policy;          ///< SEND_DROP_OLDEST, SEND_DROP_NEWEST or SEND_DISCONNECT
+};
+
+/**
+ * @brief  Counters of all the reactors (see getReactorStats())
+ */
+struct ReactorStats {
+    unsigned long   accepted;          ///< Connections accepted so far
+    unsigned long   open;              ///< Connections open now
+    unsigned long   droppedFrames;     ///< Packets dropped because a client was over the send limits
+    unsigned long   droppedBytes;      ///< Size of the dropped packets
+    unsigned long   slowDisconnects;   ///< Connections closed because they were over the send limits
+};
+
+/**
+ * @brief  Callbacks used by the reactor to report connection events
+ */
+struct ReactorCallbacks {
+    /// Called once when a new connection is accepted
+    void (*onOpen) ( Connection *conn );
+    /// Called for every complete request, in order (on a worker, if there are any), return false to close the connection
+    bool (*onPacket) ( Connection *conn , uint16_t type , const char *buffer , int length );
+    /// Called by the reactor for every request given to the workers, return true if it may run alongside the others of the connection (may be NULL)
+    bool (*isIndependent) ( Connection *conn , uint16_t type );
+    /// Called once when the connection is closed, after the last 'onPacket', and before the socket is closed
+    void (*onClose) ( Connection *conn );
+};
+
+/**
+ * @brief  State of one client connection
+ */
+struct Connection {
+    int                 socketFD;        ///< TCP Socket Descriptor
+    uint32_t            generation;      ///< Tells the connection apart from the earlier ones on the socket (never 0)
+    struct sockaddr_in  clientAddress;   ///< Client's IP and Port
+    Reactor            *reactor;         ///< Reactor which owns this connection
+    int                 listIndex;       ///< Position in the connections of the reactor
+    void               *context;         ///< Per-connection state of the callbacks
+
+    RecvBuffer          recvBuffer;      ///< Received bytes not yet handed to the callbacks
+
+    SendQueue           sendQueue;       ///< Packets waiting to be sent
+    unsigned            broadcastChannels; ///< Channels of broadcastPacket() reaching this connection (0 for none)
+    bool                overflowed;      ///< Went over the send limits with SEND_DISCONNECT (under the lock)
+    bool                tooSlow;         ///< Being closed because it went over the send limits
+    bool                writeBusy;       ///< Waiting for EPOLLOUT, or a write is in flight (REACTOR_URING)
+    UringWrite         *uringWrite;      ///< The write in flight (REACTOR_URING)
+    int                 pendingOps;      ///< io_uring operations not yet completed
+
+    Strand              strand;          ///< Requests waiting for a worker
+    int                 taskCount;       ///< Independent requests not yet handled, plus one till the close task runs (changed atomically)
+    bool                rejected;        ///< 'onPacket' returned false, the later requests are skipped (changed atomically)
+    bool                closing;         ///< Being closed, nothing more is read
+    bool                finished;        ///< 'onClose' has run, freed once the last io_uring operation completes
+};
+
+/// @brief  Limit the packets queued on each connection (call before startReactors())
+void setSendLimits ( const SendLimits &limits );
+/// @brief  Start one reactor thread per listening socket, which report events to 'callbacks'
+bool startReactors ( const int *listenFDs , int count , int backend , const ReactorCallbacks &callbacks );
+/// @brief  Backend actually in use (REACTOR_URING falls back to REACTOR_EPOLL if unavailable)
+int reactorBackend ();
+/// @brief  Wait till all the reactor threads have exited
+void waitReactors ();
+/// @brief  Current counters of all the reactors, from any thread
+void getReactorStats ( ReactorStats *stats );
+
+/// @brief  ID of a connection, for sendPacket() and sendSharedFrame()
+inline ConnectionID connectionID ( const Connection *conn ) {
+    return (ConnectionID) conn->generation << 32 | (uint32_t) conn->socketFD;
+}
+/// @brief  Socket of a connection ID (-1 for NO_CONNECTION)
+inline int connectionSocket ( ConnectionID connection ) {
+    return connection != NO_CONNECTION ? (int) (uint32_t) connection : -1;
+}
+
+/// @brief  Queue a complete packet on the connection 'connection', from any thread
+///
+/// The packet is copied, and written by the reactor which owns the
+/// connection at the end of its loop iteration. Returns false if the
+/// connection is closed (even if another one has its socket now).
+bool sendPacket ( ConnectionID connection , const char *buffer , int length );
+/// @brief  Queue a packet already in a shared frame, taking over one reference to it, from any thread
+///
+/// Nothing is copied, so a packet encoded once (e.g. a page of the
+/// roster) is sent as it is to every connection asking for it. The
+/// reference is dropped if the connection is closed.
+bool sendSharedFrame ( ConnectionID connection , SharedFrame *shared );
+
+/// @brief  Queue a complete packet on every connection listening to one of 'channels', except 'except', from any thread
+///
+/// The packet is copied once and shared by all the connections. Each
+/// reactor queues it on its own connections, so the caller does not
+/// wait for the receivers.
+void broadcastPacket ( const char *buffer , int length , Connection *except , unsigned channels );
+/// @brief  Choose the channels of broadcastPacket() reaching a connection (0 for none), from any thread
+void setBroadcast ( Connection *conn , unsigned channels );
+
+#endif  // __ChatReactor_h
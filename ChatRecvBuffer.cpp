@@ -0,0 +1,187 @@
+// ChatRecvBuffer.cpp
+
+#include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "ChatBufferPool.h"
+#include "ChatPacket.h"
+#include "ChatRecvBuffer.h"
+
+/// @brief  Size of the 'type' and 'length' fields at the start of every packet
+#define FRAME_HEADER_LENGTH  ( 2 * sizeof ( uint16_t ) )
+
+/// @brief  Make room at the end of the buffer for at least 'needed' more bytes
+static void reserveRecvBuffer ( RecvBuffer *buffer , int needed );
+
+void initRecvBuffer ( RecvBuffer *buffer ) {
+    buffer->data = NULL;
+    buffer->capacity = 0;
+    buffer->start = 0;
+    buffer->end = 0;
+}
+
+void freeRecvBuffer ( RecvBuffer *buffer ) {
+    freeBuffer ( buffer->data );
+    initRecvBuffer ( buffer );
+}
+
+void trimRecvBuffer ( RecvBuffer *buffer ) {
+    if ( buffer->start == buffer->end )
+        freeRecvBuffer ( buffer );
+}
+
+int recvFrames ( RecvBuffer *buffer , int socketFD ) {
+
+    if ( buffer->start == buffer->end )
+        buffer->start = buffer->end = 0;
+
+    // The packet at the start may be longer than the whole buffer
+    int needed = 1;
+    if ( buffer->end - buffer->start >= (int) FRAME_HEADER_LENGTH ) {
+        uint16_t length = ntohs ( *( const uint16_t* ) ( buffer->data + buffer->start + LENGTH_FIELD_OFFSET ) );
+        if ( length > buffer->end - buffer->start )
+            needed = length - ( buffer->end - buffer->start );
+    }
+    reserveRecvBuffer ( buffer , needed );
+
+    int n = recv ( socketFD , buffer->data + buffer->end , buffer->capacity - buffer->end , 0 );
+    if ( n > 0 )
+        buffer->end += n;
+    return n;
+}
+
+bool recvBufferDrained ( const RecvBuffer *buffer ) {
+    return buffer->end < buffer->capacity;
+}
+
+void appendRecvBuffer ( RecvBuffer *buffer , const char *data , int length ) {
+    reserveRecvBuffer ( buffer , length );
+    memcpy ( buffer->data + buffer->end , data , length );
+    buffer->end += length;
+}
+
+int nextFrame ( RecvBuffer *buffer , Frame *frame ) {
+
+    int result = parseFrame ( buffer->data + buffer->start , buffer->end - buffer->start , frame );
+    if ( result > 0 )
+        buffer->start += frame->length;
+    return result;
+}
+
+bool frameReady ( const RecvBuffer *buffer ) {
+    Frame frame;
+    return parseFrame ( buffer->data + buffer->start , buffer->end - buffer->start , &frame ) != 0;
+}
+
+int parseFrame ( const char *data , int length , Frame *frame ) {
+
+    if ( length < (int) FRAME_HEADER_LENGTH )
+        return 0;
+
+    frame->type = ntohs ( *( const uint16_t* ) data );
+    frame->length = ntohs ( *( const uint16_t* ) ( data + LENGTH_FIELD_OFFSET ) );
+    if ( frame->length < FRAME_HEADER_LENGTH )
+        return -1;
+    if ( frame->length > length )
+        return 0;
+
+    frame->body = data + FRAME_HEADER_LENGTH;
+    frame->bodyLength = frame->length - FRAME_HEADER_LENGTH;
+    return 1;
+}
+
+static void reserveRecvBuffer ( RecvBuffer *buffer , int needed ) {
+
+    if ( buffer->capacity - buffer->end >= needed )
+        return;
+
+    // Move the incomplete packet to the front of the buffer
+    int pending = buffer->end - buffer->start;
+    if ( buffer->start > 0 ) {
+        memmove ( buffer->data , buffer->data + buffer->start , pending );
+        buffer->start = 0;
+        buffer->end = pending;
+        if ( buffer->capacity - buffer->end >= needed )
+            return;
+    }
+
+    // Still too small (or not allocated yet)
+    int capacity = buffer->capacity > 0 ? buffer->capacity : RECV_BUFFER_SIZE;
+    while ( capacity - pending < needed )
+        capacity *= 2;
+    char *data = (char*) allocBuffer ( capacity );
+    if ( buffer->end > 0 )
+        memcpy ( data , buffer->data , buffer->end );
+    freeBuffer ( buffer->data );
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+void initFrameReader ( FrameReader *reader , const char *body , int length ) {
+    reader->data = body;
+    reader->length = length;
+    reader->offset = 0;
+    reader->failed = false;
+    reader->ends = NULL;
+    reader->endCount = 0;
+    reader->nextEnd = 0;
+}
+
+uint32_t readUint32 ( FrameReader *reader ) {
+
+    if ( reader->length - reader->offset < (int) sizeof ( uint32_t ) ) {
+        reader->offset = reader->length;
+        reader->failed = true;
+        return 0;
+    }
+
+    uint32_t value;
+    memcpy ( &value , reader->data + reader->offset , sizeof ( uint32_t ) );
+    reader->offset += sizeof ( uint32_t );
+    return ntohl ( value );
+}
+
+uint16_t readUint16 ( FrameReader *reader ) {
+
+    if ( reader->length - reader->offset < (int) sizeof ( uint16_t ) ) {
+        reader->offset = reader->length;
+        reader->failed = true;
+        return 0;
+    }
+
+    uint16_t value;
+    memcpy ( &value , reader->data + reader->offset , sizeof ( uint16_t ) );
+    reader->offset += sizeof ( uint16_t );
+    return ntohs ( value );
+}
+
+std::string_view readString ( FrameReader *reader ) {
+
+    // A list of strings may end with the body instead of an empty string
+    int left = reader->length - reader->offset;
+    if ( left <= 0 )
+        return std::string_view();
+
+    const char *start = reader->data + reader->offset;
+    const char *end;
+    if ( reader->ends != NULL ) {
+        // The NULLs were found beforehand, skip those of the fields already read
+        while ( reader->nextEnd < reader->endCount && reader->ends[ reader->nextEnd ] < reader->offset )
+            reader->nextEnd++;
+        end = reader->nextEnd < reader->endCount ? reader->data + reader->ends[ reader->nextEnd++ ] : NULL;
+    }
+    else
+        end = (const char*) memchr ( start , '\0' , left );
+    if ( end == NULL ) {
+        // The last string is cut off
+        reader->offset = reader->length;
+        reader->failed = true;
+        return std::string_view();
+    }
+
+    reader->offset += end - start + 1;
+    return std::string_view ( start , end - start );
+}
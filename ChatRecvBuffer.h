@@ -0,0 +1,106 @@
+// ChatRecvBuffer.h
+
+#ifndef __ChatRecvBuffer_h
+#define __ChatRecvBuffer_h
+
+#include <stdint.h>
+#include <string_view>
+
+#include "ChatPacket.h"
+
+/*
+ * Receive buffer of one connection, used by both the client and the
+ * server.
+ *
+ * Instead of one recv() for the 'type' and 'length' fields and another
+ * one for the rest of each packet, recvFrames() reads as many bytes as
+ * are available (and fit) in one call. nextFrame() then hands out the
+ * complete packets one by one, pointing into the buffer, so nothing is
+ * copied. A packet which has not arrived completely stays at the end of
+ * the buffer till the next recvFrames(), which first moves it to the
+ * front of the buffer (or grows the buffer if the packet is larger).
+ *
+ * The memory is only held while there are bytes in the buffer (see
+ * trimRecvBuffer()), so an idle connection does not hold any. It comes
+ * from the buffer pool of the reading thread, so taking it for every
+ * read does not cost a malloc.
+ *
+ * The fields of a packet are read with a FrameReader, which returns the
+ * strings as views into the packet instead of copies. A view is only
+ * valid as long as the packet, so anything kept longer (e.g. the name
+ * of a user) must be copied into a string.
+ */
+
+/// @brief  Initial size of a receive buffer
+#define RECV_BUFFER_SIZE  ( 2 * MAX_PACKET_LENGTH )
+
+/**
+ * @brief  A complete packet inside a receive buffer
+ *
+ * 'body' is only valid till the next call to recvFrames() or
+ * appendRecvBuffer() on the same buffer.
+ */
+struct Frame {
+    uint16_t     type;         ///< Request/Response type
+    uint16_t     length;       ///< Total size of the packet (in bytes)
+    const char  *body;         ///< Packet after the 'type' and 'length' fields
+    int          bodyLength;   ///< Size of 'body' (in bytes)
+};
+
+/**
+ * @brief  Receive buffer of one connection
+ */
+struct RecvBuffer {
+    char  *data;          ///< Memory of the buffer (NULL while empty)
+    int    capacity;      ///< Size of 'data'
+    int    start;         ///< First byte not yet handed out by nextFrame()
+    int    end;           ///< One past the last received byte
+};
+
+/**
+ * @brief  Reads the fields of a packet body one after the other
+ *
+ * Nothing is ever read past the end of the body. A field which does
+ * not fit reads as 0 (or an empty string) and sets 'failed'.
+ */
+struct FrameReader {
+    const char      *data;         ///< Packet body
+    int              length;       ///< Size of 'data'
+    int              offset;       ///< Next field
+    bool             failed;       ///< A field did not fit in the body
+    const uint16_t  *ends;         ///< Offsets of the NULLs, if already known (see scanFrameStrings())
+    int              endCount;     ///< Number of 'ends'
+    int              nextEnd;      ///< First of 'ends' which may be at or after 'offset'
+};
+
+/// @brief  Initialise an empty receive buffer
+void initRecvBuffer ( RecvBuffer *buffer );
+/// @brief  Release the memory of a receive buffer
+void freeRecvBuffer ( RecvBuffer *buffer );
+/// @brief  Release the memory of a receive buffer if it holds no bytes
+void trimRecvBuffer ( RecvBuffer *buffer );
+
+/// @brief  One recv() into the free space, returns like recv() (bytes, 0 on close, -1 on error)
+int recvFrames ( RecvBuffer *buffer , int socketFD );
+/// @brief  Whether the last recvFrames() left free space (i.e. read everything there was)
+bool recvBufferDrained ( const RecvBuffer *buffer );
+/// @brief  Copy bytes received elsewhere to the end of the buffer
+void appendRecvBuffer ( RecvBuffer *buffer , const char *data , int length );
+
+/// @brief  Next complete packet: 1 if found, 0 if incomplete, -1 if the length field is invalid
+int nextFrame ( RecvBuffer *buffer , Frame *frame );
+/// @brief  Whether nextFrame() has something to report (a packet or an invalid length)
+bool frameReady ( const RecvBuffer *buffer );
+/// @brief  Complete packet at the start of 'data' (same results as nextFrame())
+int parseFrame ( const char *data , int length , Frame *frame );
+
+/// @brief  Start reading the fields of a packet body
+void initFrameReader ( FrameReader *reader , const char *body , int length );
+/// @brief  Next uint32_t field (converted to host order)
+uint32_t readUint32 ( FrameReader *reader );
+/// @brief  Next uint16_t field (converted to host order)
+uint16_t readUint16 ( FrameReader *reader );
+/// @brief  Next NULL terminated string, without the NULL (empty at the end of the body)
+std::string_view readString ( FrameReader *reader );
+
+#endif  // __ChatRecvBuffer_h
@@ -0,0 +1,173 @@
+// ChatResume.cpp
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ChatEpoch.h"
+#include "ChatReactor.h"
+#include "ChatResume.h"
+#include "ChatSendQueue.h"
+
+using namespace std;
+
+/**
+ * @brief  A user whose connection broke
+ */
+struct AwayUser {
+    UserID      userID;
+    unsigned    channels;       ///< Broadcast channels of the user
+    void       *context;        ///< Session of the user, given back when it returns
+    time_t      expires;        ///< Monotonic second the user is no longer kept
+    SendQueue   held;           ///< Packets sent to the user meanwhile (only the list being written is used)
+};
+
+/// @brief  Seconds of the monotonic clock
+static time_t monotonicSeconds ();
+/// @brief  Add a packet to the ones held for a user, dropping the oldest if there are too many
+static void holdFrame ( AwayUser *away , SharedFrame *shared );
+
+void initResumeStore ( ResumeStore *store , UserRegistry *registry , int graceSeconds ) {
+
+    pthread_mutex_init ( &store->lock , NULL );
+    store->registry = registry;
+    store->graceSeconds = graceSeconds;
+    store->users.clear();
+    store->count = 0;
+}
+
+bool detachUser ( ResumeStore *store , UserID userID , unsigned channels , void *context ) {
+
+    if ( store->graceSeconds <= 0 )
+        return false;
+
+    pthread_mutex_lock ( &store->lock );
+    // From now on the senders see that the user is away, and hold what they send
+    if ( !moveUser ( store->registry , userID , NO_CONNECTION ) ) {
+        pthread_mutex_unlock ( &store->lock );
+        return false;
+    }
+
+    AwayUser *away = new AwayUser ();
+    away->userID = userID;
+    away->channels = channels;
+    away->context = context;
+    away->expires = monotonicSeconds () + store->graceSeconds;
+    initSendQueue ( &away->held );
+    store->users[ userID ] = away;
+    __atomic_add_fetch ( &store->count , 1 , __ATOMIC_RELAXED );
+    pthread_mutex_unlock ( &store->lock );
+    return true;
+}
+
+void* resumeUser ( ResumeStore *store , UserID userID , Connection *conn , const char *response , int length ) {
+
+    pthread_mutex_lock ( &store->lock );
+    map <UserID,AwayUser*>::iterator found = store->users.find ( userID );
+    if ( found == store->users.end() ) {
+        pthread_mutex_unlock ( &store->lock );
+        return NULL;
+    }
+    AwayUser *away = found->second;
+    store->users.erase ( found );
+    __atomic_sub_fetch ( &store->count , 1 , __ATOMIC_RELAXED );
+
+    // The response, then what was held, then what the others send from now on
+    sendPacket ( connectionID ( conn ) , response , length );
+    for ( SendFrame *frame = away->held.head ; frame != NULL ; frame = frame->next ) {
+        retainSharedFrame ( frame->shared , 1 );
+        sendSharedFrame ( connectionID ( conn ) , frame->shared );
+    }
+    setBroadcast ( conn , away->channels );
+    moveUser ( store->registry , userID , connectionID ( conn ) );
+    pthread_mutex_unlock ( &store->lock );
+
+    void *context = away->context;
+    clearSendQueue ( &away->held );
+    delete away;
+    return context;
+}
+
+void expireUsers ( ResumeStore *store , vector <void*> *contexts ) {
+
+    // Checked without the lock, as there is seldom anyone away
+    if ( __atomic_load_n ( &store->count , __ATOMIC_RELAXED ) == 0 )
+        return;
+
+    vector <AwayUser*> expired;
+    time_t now = monotonicSeconds ();
+    pthread_mutex_lock ( &store->lock );
+    for ( map <UserID,AwayUser*>::iterator i = store->users.begin() ; i != store->users.end() ; ) {
+        if ( i->second->expires > now ) {
+            ++i;
+            continue;
+        }
+        expired.push_back ( i->second );
+        i = store->users.erase ( i );
+        __atomic_sub_fetch ( &store->count , 1 , __ATOMIC_RELAXED );
+    }
+    pthread_mutex_unlock ( &store->lock );
+
+    for ( AwayUser *away : expired ) {
+        contexts->push_back ( away->context );
+        clearSendQueue ( &away->held );
+        delete away;
+    }
+}
+
+bool holdPacket ( ResumeStore *store , UserID userID , const char *buffer , int length ) {
+
+    pthread_mutex_lock ( &store->lock );
+    map <UserID,AwayUser*>::iterator found = store->users.find ( userID );
+    if ( found != store->users.end() ) {
+        holdFrame ( found->second , newSharedFrame ( buffer , length , 1 ) );
+        pthread_mutex_unlock ( &store->lock );
+        return true;
+    }
+
+    // The user came back (after its packets were queued, as the lock is held), or left
+    beginEpochRead ();
+    User *user = getUser ( store->registry , userID );
+    ConnectionID connection = user != NULL ? __atomic_load_n ( &user->connection , __ATOMIC_ACQUIRE ) : NO_CONNECTION;
+    endEpochRead ();
+    if ( connection != NO_CONNECTION )
+        sendPacket ( connection , buffer , length );
+    pthread_mutex_unlock ( &store->lock );
+    return connection != NO_CONNECTION;
+}
+
+void holdBroadcast ( ResumeStore *store , const char *buffer , int length , unsigned channels ) {
+
+    if ( __atomic_load_n ( &store->count , __ATOMIC_RELAXED ) == 0 )
+        return;
+
+    // Copied once, and shared by all the users holding it
+    pthread_mutex_lock ( &store->lock );
+    int count = 0;
+    for ( map <UserID,AwayUser*>::iterator i = store->users.begin() ; i != store->users.end() ; ++i ) {
+        if ( i->second->channels & channels )
+            count++;
+    }
+    SharedFrame *shared = count > 0 ? newSharedFrame ( buffer , length , count ) : NULL;
+    for ( map <UserID,AwayUser*>::iterator i = store->users.begin() ; i != store->users.end() ; ++i ) {
+        if ( i->second->channels & channels )
+            holdFrame ( i->second , shared );
+    }
+    pthread_mutex_unlock ( &store->lock );
+}
+
+static time_t monotonicSeconds () {
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC , &now );
+    return now.tv_sec;
+}
+
+static void holdFrame ( AwayUser *away , SharedFrame *shared ) {
+
+    pushSendFrame ( &away->held , newSendFrame ( shared ) );
+    spliceSendQueue ( &away->held );
+    unsigned long droppedBytes = 0;
+    dropOldestFrames ( &away->held , 0 , RESUME_MAX_FRAMES , RESUME_MAX_BYTES , &droppedBytes );
+}
@@ -0,0 +1,86 @@
+// ChatResume.h
+
+#ifndef __ChatResume_h
+#define __ChatResume_h
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ChatReactor.h"
+#include "ChatUserRegistry.h"
+
+/*
+ * Users whose connection broke, kept for a while so that they can come
+ * back without logging in again.
+ *
+ * When the connection of a user closes without an Exit request, the user
+ * is not removed: it is moved off its connection (to NO_CONNECTION,
+ * see moveUser()), and kept here with its session for a grace period.
+ * It stays in the registry and in the roster meanwhile, so no one else
+ * takes its name, and the others see neither an exit nor a login. The
+ * packets sent to it meanwhile (Talk and Yell forwards, invitations, the
+ * changes of the list of users) are held in a queue, which keeps the
+ * newest RESUME_MAX_FRAMES packets, and at most RESUME_MAX_BYTES.
+ *
+ * A client which connects again sends a Login request with the cookie
+ * it was given (a random number, which cannot be guessed from anything
+ * the client sees) and its name. If they match a user kept here, the
+ * Login response is sent, followed by the packets held, and the user is
+ * moved to the new connection. It is one round trip, and the name is not
+ * checked nor anything added to the registry or the roster.
+ *
+ * One lock guards the users kept here. A sender finds out that a user
+ * is away from its connection, without a lock, and only then hands the
+ * packet to holdPacket(), which sends it on the new socket if the user
+ * came back meanwhile. The packets held are queued on the new socket
+ * before the user is moved to it (under the lock), so that nothing sent
+ * after them overtakes them. A broadcast is held before it is posted to
+ * the reactors, so that a user coming back at that moment may get it
+ * twice, but does not miss it. The packets which were already queued on
+ * the old connection when it broke are not sent again (the client does
+ * not tell which ones it got).
+ */
+
+/// @brief  Most packets, and bytes, held for a user who is away (the oldest are dropped)
+#define RESUME_MAX_FRAMES  256
+#define RESUME_MAX_BYTES   ( 256 * 1024 )
+
+struct AwayUser;
+
+/**
+ * @brief  Users away, by ID
+ */
+struct ResumeStore {
+    pthread_mutex_t                 lock;
+    UserRegistry                   *registry;       ///< Registry of the users
+    int                             graceSeconds;   ///< How long a user is kept (0 keeps no one)
+    std::map <UserID,AwayUser*>     users;          ///< Users away (under the lock)
+    int                             count;          ///< Number of users away (changed atomically)
+};
+
+/// @brief  Prepare an empty store, for users of 'registry' kept 'graceSeconds' (0 for none)
+void initResumeStore ( ResumeStore *store , UserRegistry *registry , int graceSeconds );
+
+/// @brief  Keep a user whose connection closed, with its 'context' and broadcast 'channels'
+///
+/// Returns false (and keeps nothing) if no user is kept, or if the user
+/// has already left. The store owns 'context' from then on.
+bool detachUser ( ResumeStore *store , UserID userID , unsigned channels , void *context );
+/// @brief  Bring a user back on 'conn', returns its context (NULL if it is not kept here)
+///
+/// 'response' is queued first, then the packets held, then the user is
+/// moved to the socket of 'conn' and given its channels back.
+void* resumeUser ( ResumeStore *store , UserID userID , Connection *conn , const char *response , int length );
+/// @brief  Take the contexts of the users away for longer than the grace period (they are no longer kept)
+void expireUsers ( ResumeStore *store , std::vector <void*> *contexts );
+
+/// @brief  Hold a packet for a user who is away, or send it if the user came back meanwhile
+///
+/// Returns false if the user has left.
+bool holdPacket ( ResumeStore *store , UserID userID , const char *buffer , int length );
+/// @brief  Hold a packet for every user away who listens to one of 'channels' (see broadcastPacket())
+void holdBroadcast ( ResumeStore *store , const char *buffer , int length , unsigned channels );
+
+#endif  // __ChatResume_h
@@ -0,0 +1,210 @@
+// ChatRoster.cpp
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ChatCodec.h"
+#include "ChatEpoch.h"
+#include "ChatPacket.h"
+#include "ChatRoster.h"
+#include "ChatSendQueue.h"
+
+using namespace std;
+
+/// @brief  Bytes of the names (with their NULLs) fitting in one Show response
+#define ROSTER_PAGE_ROOM  ( MAX_PACKET_LENGTH - PACKET_HEADER_LENGTH - 1 )
+
+/**
+ * @brief  Users listed in one Show response
+ */
+struct RosterPage {
+    vector <string>     names;
+    vector <UserID>     users;      ///< User of each name
+    int                 bytes;      ///< Size of the names and their NULLs
+    SharedFrame        *frame;      ///< The page, encoded (the roster holds one reference)
+};
+
+/**
+ * @brief  Frames of the pages at one version, as the readers see them
+ *
+ * The frames follow the structure in the same allocation.
+ */
+struct RosterSnapshot {
+    uint64_t        version;
+    int             pageCount;
+};
+
+/// @brief  Frames of a snapshot
+static inline SharedFrame** snapshotPages ( RosterSnapshot *snapshot ) {
+    return (SharedFrame**) ( snapshot + 1 );
+}
+
+/// @brief  Encode a page again, and retire the frame it replaces
+static void encodePage ( RosterPage *page , bool continued );
+/// @brief  Make a new snapshot of the pages, and retire the one it replaces
+static void publishRoster ( Roster *roster );
+/// @brief  Release functions of the retired frames and snapshots
+static void releaseFrame ( void *frame );
+static void freeSnapshot ( void *snapshot );
+
+void initRoster ( Roster *roster , RosterChange onChange ) {
+
+    pthread_mutex_init ( &roster->lock , NULL );
+    roster->pages.clear();
+    roster->userPages.clear();
+    roster->snapshot = NULL;
+    roster->version = 0;
+    roster->onChange = onChange;
+
+    RosterPage *page = new RosterPage ();
+    page->bytes = 0;
+    page->frame = NULL;
+    roster->pages.push_back ( page );
+    encodePage ( page , false );
+    publishRoster ( roster );
+}
+
+void addRosterUser ( Roster *roster , UserID userID , string_view name ) {
+
+    uint32_t index = userIndex ( userID );
+    pthread_mutex_lock ( &roster->lock );
+
+    // A full last page is followed by a new one, and is no longer the last
+    RosterPage *page = roster->pages.back();
+    if ( page->bytes + (int) name.size() + 1 > ROSTER_PAGE_ROOM ) {
+        encodePage ( page , true );
+        page = new RosterPage ();
+        page->bytes = 0;
+        page->frame = NULL;
+        roster->pages.push_back ( page );
+    }
+
+    page->names.push_back ( string ( name ) );
+    page->users.push_back ( userID );
+    page->bytes += name.size() + 1;
+    if ( roster->userPages.size() <= index )
+        roster->userPages.resize ( index + 1 , NULL );
+    roster->userPages[ index ] = page;
+
+    encodePage ( page , false );
+    publishRoster ( roster );
+    if ( roster->onChange != NULL )
+        roster->onChange ( name , true , roster->version );
+    pthread_mutex_unlock ( &roster->lock );
+}
+
+void removeRosterUser ( Roster *roster , UserID userID ) {
+
+    uint32_t index = userIndex ( userID );
+    pthread_mutex_lock ( &roster->lock );
+
+    RosterPage *page = index < roster->userPages.size() ? roster->userPages[ index ] : NULL;
+    int position = -1;
+    for ( int i = 0 ; page != NULL && i < page->users.size() ; i++ ) {
+        if ( page->users[i] == userID )
+            position = i;
+    }
+    if ( position < 0 ) {
+        pthread_mutex_unlock ( &roster->lock );
+        return;
+    }
+
+    // The order of the names in a page does not matter, the last one fills the hole
+    string name;
+    name.swap ( page->names[ position ] );
+    page->bytes -= name.size() + 1;
+    page->names[ position ].swap ( page->names.back() );
+    page->names.pop_back();
+    page->users[ position ] = page->users.back();
+    page->users.pop_back();
+    roster->userPages[ index ] = NULL;
+
+    int pageNumber = 0;
+    while ( roster->pages[ pageNumber ] != page )
+        pageNumber++;
+
+    // The next page moves into this one if they both fit in one
+    RosterPage *next = pageNumber + 1 < roster->pages.size() ? roster->pages[ pageNumber + 1 ] : NULL;
+    if ( next != NULL && page->bytes + next->bytes <= ROSTER_PAGE_ROOM ) {
+        for ( int i = 0 ; i < next->users.size() ; i++ ) {
+            page->names.push_back ( next->names[i] );
+            page->users.push_back ( next->users[i] );
+            roster->userPages[ userIndex ( next->users[i] ) ] = page;
+        }
+        page->bytes += next->bytes;
+        roster->pages.erase ( roster->pages.begin() + pageNumber + 1 );
+        retireEpochMemory ( next->frame , releaseFrame );
+        delete next;
+    }
+
+    // An empty page goes, unless it is the only one
+    if ( page->users.empty() && roster->pages.size() > 1 ) {
+        roster->pages.erase ( roster->pages.begin() + pageNumber );
+        retireEpochMemory ( page->frame , releaseFrame );
+        delete page;
+        // The page before may now be the last
+        if ( pageNumber == roster->pages.size() )
+            encodePage ( roster->pages.back() , false );
+    }
+    else
+        encodePage ( page , pageNumber + 1 < roster->pages.size() );
+
+    publishRoster ( roster );
+    if ( roster->onChange != NULL )
+        roster->onChange ( name , false , roster->version );
+    pthread_mutex_unlock ( &roster->lock );
+}
+
+uint64_t getRosterFrames ( Roster *roster , vector <SharedFrame*> *frames ) {
+
+    beginEpochRead ();
+    RosterSnapshot *snapshot = __atomic_load_n ( &roster->snapshot , __ATOMIC_ACQUIRE );
+    SharedFrame **pages = snapshotPages ( snapshot );
+    for ( int i = 0 ; i < snapshot->pageCount ; i++ ) {
+        retainSharedFrame ( pages[i] , 1 );
+        frames->push_back ( pages[i] );
+    }
+    uint64_t version = snapshot->version;
+    endEpochRead ();
+    return version;
+}
+
+static void encodePage ( RosterPage *page , bool continued ) {
+
+    char buffer[ MAX_PACKET_LENGTH ];
+    int length = encodePacket < ShowResponse > ( buffer , STATUS_SUCCESS , page->names );
+    if ( continued )
+        markPacketContinued ( buffer );
+
+    // Readers may still be taking references to the frame replaced
+    if ( page->frame != NULL )
+        retireEpochMemory ( page->frame , releaseFrame );
+    page->frame = newSharedFrame ( buffer , length , 1 );
+}
+
+static void publishRoster ( Roster *roster ) {
+
+    int count = roster->pages.size();
+    RosterSnapshot *snapshot = (RosterSnapshot*) malloc ( sizeof ( RosterSnapshot ) + count * sizeof ( SharedFrame* ) );
+    snapshot->version = ++roster->version;
+    snapshot->pageCount = count;
+    for ( int i = 0 ; i < count ; i++ )
+        snapshotPages ( snapshot ) [i] = roster->pages[i]->frame;
+
+    RosterSnapshot *old = roster->snapshot;
+    __atomic_store_n ( &roster->snapshot , snapshot , __ATOMIC_RELEASE );
+    if ( old != NULL )
+        retireEpochMemory ( old , freeSnapshot );
+}
+
+static void releaseFrame ( void *frame ) {
+    releaseSharedFrame ( (SharedFrame*) frame , 1 );
+}
+
+static void freeSnapshot ( void *snapshot ) {
+    free ( snapshot );
+}
@@ -0,0 +1,74 @@
+// ChatRoster.h
+
+#ifndef __ChatRoster_h
+#define __ChatRoster_h
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ChatSendQueue.h"
+#include "ChatUserRegistry.h"
+
+/*
+ * The Show response, kept encoded and up to date.
+ *
+ * The names of the users logged in are kept in pages, each one encoded
+ * once as a whole Show Response packet (in a SharedFrame), which is
+ * queued as it is on every connection asking for the users. A login
+ * adds the name to the last page (or to a new one when it is full), an
+ * exit takes the name out of its page, which is merged with the next
+ * one if they both fit in one packet. Only the pages changed are encoded
+ * again.
+ *
+ * Every page but the last is marked PACKET_CONTINUED, so that the pages
+ * are the chunks of one response for a client taking chunks (see
+ * FEATURE_CHUNKED), and the roster is not limited by MAX_PACKET_LENGTH.
+ * A client without chunks gets the first page only.
+ *
+ * Each change counts up the version of the roster and publishes a new
+ * RosterSnapshot, the version and the frames of all the pages. Readers
+ * take references to these frames without a lock, inside an epoch read
+ * section (see ChatEpoch.h), while the writers hold the lock of the
+ * roster. Replaced frames and snapshots are retired.
+ *
+ * Each change is also handed to the RosterChange function of the roster,
+ * with the version it made, while the lock is still held: the changes
+ * reach it one at a time, in the order of their versions (see
+ * FEATURE_PRESENCE).
+ */
+
+struct RosterPage;
+struct RosterSnapshot;
+
+/// @brief  Told of a user added ('joined') or removed, and of the version of the roster after it
+typedef void (*RosterChange) ( std::string_view name , bool joined , uint64_t version );
+
+/**
+ * @brief  Users logged in, as encoded Show responses
+ */
+struct Roster {
+    pthread_mutex_t             lock;           ///< Held by the writers
+    std::vector <RosterPage*>   pages;          ///< Pages in the order they are sent (writers only)
+    std::vector <RosterPage*>   userPages;      ///< Page of each user, by userIndex() (writers only)
+    RosterSnapshot             *snapshot;       ///< Current pages (replaced by the writers, read atomically)
+    uint64_t                    version;        ///< Changes so far (writers only)
+    RosterChange                onChange;       ///< Called on each change, with the lock held (NULL for none)
+};
+
+/// @brief  Prepare an empty roster, which tells 'onChange' of its changes (NULL for none)
+void initRoster ( Roster *roster , RosterChange onChange );
+/// @brief  Add a user logged in
+void addRosterUser ( Roster *roster , UserID userID , std::string_view name );
+/// @brief  Remove a user (nothing happens if it is not there)
+void removeRosterUser ( Roster *roster , UserID userID );
+
+/// @brief  Append the frames of all the pages to 'frames', returns the version they are at
+///
+/// The caller owns one reference to each frame (see releaseSharedFrame()).
+/// There is always at least one page, which may list no one.
+uint64_t getRosterFrames ( Roster *roster , std::vector <SharedFrame*> *frames );
+
+#endif  // __ChatRoster_h
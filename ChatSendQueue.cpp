@@ -0,0 +1,178 @@
+// ChatSendQueue.cpp
+
+#include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include "ChatBufferPool.h"
+#include "ChatSendQueue.h"
+
+SharedFrame* newSharedFrame ( const char *buffer , int length , int refs ) {
+
+    SharedFrame *shared = (SharedFrame*) allocBuffer ( sizeof ( SharedFrame ) + length );
+    shared->refs = refs;
+    shared->length = length;
+    memcpy ( shared + 1 , buffer , length );
+    return shared;
+}
+
+void retainSharedFrame ( SharedFrame *shared , int count ) {
+    __atomic_add_fetch ( &shared->refs , count , __ATOMIC_RELAXED );
+}
+
+void releaseSharedFrame ( SharedFrame *shared , int count ) {
+    if ( count > 0 && __atomic_sub_fetch ( &shared->refs , count , __ATOMIC_ACQ_REL ) == 0 )
+        freeBuffer ( shared );
+}
+
+char* sharedFrameData ( SharedFrame *shared ) {
+    return (char*) ( shared + 1 );
+}
+
+SendFrame* newSendFrame ( SharedFrame *shared ) {
+
+    SendFrame *frame = (SendFrame*) allocBuffer ( sizeof ( SendFrame ) );
+    frame->next = NULL;
+    frame->shared = shared;
+    return frame;
+}
+
+void freeSendFrame ( SendFrame *frame ) {
+    releaseSharedFrame ( frame->shared , 1 );
+    freeBuffer ( frame );
+}
+
+void initSendQueue ( SendQueue *queue ) {
+    queue->head = queue->tail = NULL;
+    queue->headSent = 0;
+    queue->frames = queue->bytes = 0;
+    queue->pendingHead = queue->pendingTail = NULL;
+    queue->pendingFrames = queue->pendingBytes = 0;
+    queue->flushScheduled = false;
+}
+
+void clearSendQueue ( SendQueue *queue ) {
+
+    spliceSendQueue ( queue );
+    while ( queue->head != NULL ) {
+        SendFrame *frame = queue->head;
+        queue->head = frame->next;
+        freeSendFrame ( frame );
+    }
+    initSendQueue ( queue );
+}
+
+void pushSendFrame ( SendQueue *queue , SendFrame *frame ) {
+
+    frame->next = NULL;
+    if ( queue->pendingTail != NULL )
+        queue->pendingTail->next = frame;
+    else
+        queue->pendingHead = frame;
+    queue->pendingTail = frame;
+    queue->pendingFrames++;
+    queue->pendingBytes += frame->shared->length;
+}
+
+void spliceSendQueue ( SendQueue *queue ) {
+
+    if ( queue->pendingHead == NULL )
+        return;
+
+    if ( queue->tail != NULL )
+        queue->tail->next = queue->pendingHead;
+    else
+        queue->head = queue->pendingHead;
+    queue->tail = queue->pendingTail;
+    __atomic_store_n ( &queue->frames , queue->frames + queue->pendingFrames , __ATOMIC_RELAXED );
+    __atomic_store_n ( &queue->bytes , queue->bytes + queue->pendingBytes , __ATOMIC_RELAXED );
+    queue->pendingHead = queue->pendingTail = NULL;
+    queue->pendingFrames = queue->pendingBytes = 0;
+}
+
+bool sendQueueEmpty ( const SendQueue *queue ) {
+    return queue->head == NULL;
+}
+
+int sendQueueFrames ( const SendQueue *queue ) {
+    return __atomic_load_n ( &queue->frames , __ATOMIC_RELAXED ) + queue->pendingFrames;
+}
+
+int sendQueueBytes ( const SendQueue *queue ) {
+    return __atomic_load_n ( &queue->bytes , __ATOMIC_RELAXED ) + queue->pendingBytes;
+}
+
+int dropOldestFrames ( SendQueue *queue , int keep , int maxFrames , int maxBytes , unsigned long *droppedBytes ) {
+
+    // A packet which is partly written (or in flight) must stay whole
+    if ( keep == 0 && queue->headSent > 0 )
+        keep = 1;
+
+    SendFrame *before = NULL;
+    SendFrame *frame = queue->head;
+    for ( int i = 0 ; i < keep && frame != NULL ; i++ )
+        before = frame , frame = frame->next;
+
+    int dropped = 0;
+    int frames = queue->frames , bytes = queue->bytes;
+    while ( frame != NULL && ( frames > maxFrames || bytes > maxBytes ) ) {
+        SendFrame *next = frame->next;
+        frames--;
+        bytes -= frame->shared->length;
+        *droppedBytes += frame->shared->length;
+        freeSendFrame ( frame );
+        dropped++;
+        frame = next;
+    }
+
+    // Link what is left
+    if ( before != NULL )
+        before->next = frame;
+    else
+        queue->head = frame;
+    if ( frame == NULL )
+        queue->tail = before;
+    if ( queue->head == NULL )
+        queue->headSent = 0;
+    __atomic_store_n ( &queue->frames , frames , __ATOMIC_RELAXED );
+    __atomic_store_n ( &queue->bytes , bytes , __ATOMIC_RELAXED );
+
+    return dropped;
+}
+
+int sendQueueVector ( const SendQueue *queue , struct iovec *vectors , int maxCount ) {
+
+    int count = 0;
+    int skip = queue->headSent;
+    for ( SendFrame *frame = queue->head ; frame != NULL && count < maxCount ; frame = frame->next ) {
+        vectors[ count ].iov_base = sharedFrameData ( frame->shared ) + skip;
+        vectors[ count ].iov_len = frame->shared->length - skip;
+        count++;
+        skip = 0;
+    }
+    return count;
+}
+
+void sendQueueAdvance ( SendQueue *queue , int bytes ) {
+
+    while ( bytes > 0 && queue->head != NULL ) {
+        SendFrame *frame = queue->head;
+        int left = frame->shared->length - queue->headSent;
+        if ( bytes < left ) {
+            queue->headSent += bytes;
+            __atomic_store_n ( &queue->bytes , queue->bytes - bytes , __ATOMIC_RELAXED );
+            return;
+        }
+
+        // This packet is done
+        bytes -= left;
+        queue->head = frame->next;
+        if ( queue->head == NULL )
+            queue->tail = NULL;
+        queue->headSent = 0;
+        __atomic_store_n ( &queue->frames , queue->frames - 1 , __ATOMIC_RELAXED );
+        __atomic_store_n ( &queue->bytes , queue->bytes - left , __ATOMIC_RELAXED );
+        freeSendFrame ( frame );
+    }
+}
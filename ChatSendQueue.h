@@ -0,0 +1,105 @@
+// ChatSendQueue.h
+
+#ifndef __ChatSendQueue_h
+#define __ChatSendQueue_h
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Outbound packets of one connection.
+ *
+ * Any thread may add a packet to the queue of any connection, but only
+ * the reactor which owns the connection writes to its socket. Packets
+ * are first added to the 'pending' list (under a lock held by the
+ * caller), and the writer moves the whole list to the end of its own
+ * list with spliceSendQueue() before writing. The writer then sends as
+ * many packets as possible in one system call, using the iovecs given
+ * by sendQueueVector().
+ *
+ * The data of a packet is kept in a SharedFrame, which is immutable and
+ * reference counted, so a packet sent to many connections (e.g. a Yell)
+ * is encoded and copied once, and every queue only holds a small
+ * SendFrame pointing to it.
+ *
+ * The queue counts its packets and bytes, so that the reactor can limit
+ * how much a client which does not read is allowed to hold up.
+ */
+
+/// @brief  Maximum number of packets written in one system call
+#define MAX_SEND_VECTORS  64
+
+/**
+ * @brief  Data of a packet, shared by all the queues it is in
+ *
+ * The data follows the structure in the same allocation.
+ */
+struct SharedFrame {
+    int         refs;        ///< Number of references (changed atomically)
+    int         length;      ///< Size of the packet
+};
+
+/**
+ * @brief  A packet waiting to be sent on one connection
+ */
+struct SendFrame {
+    SendFrame    *next;      ///< Next packet in the queue
+    SharedFrame  *shared;    ///< Data of the packet (one reference is held by this frame)
+};
+
+/**
+ * @brief  Outbound queue of one connection
+ */
+struct SendQueue {
+    SendFrame  *head;            ///< Packets being written (owner only)
+    SendFrame  *tail;
+    int         headSent;        ///< Bytes of 'head' already written
+    int         frames;          ///< Packets from 'head' on (written by the owner, read atomically)
+    int         bytes;           ///< Unsent bytes from 'head' on (written by the owner, read atomically)
+    SendFrame  *pendingHead;     ///< Packets added since the last splice (under the lock)
+    SendFrame  *pendingTail;
+    int         pendingFrames;   ///< Packets in the pending list (under the lock)
+    int         pendingBytes;    ///< Bytes in the pending list (under the lock)
+    bool        flushScheduled;  ///< Whether the owner has been asked to flush (under the lock)
+};
+
+/// @brief  Copy a packet into a new shared frame with 'refs' references
+SharedFrame* newSharedFrame ( const char *buffer , int length , int refs );
+/// @brief  Add 'count' references to a shared frame (from any thread)
+void retainSharedFrame ( SharedFrame *shared , int count );
+/// @brief  Drop 'count' references to a shared frame, freeing it with the last one (from any thread)
+void releaseSharedFrame ( SharedFrame *shared , int count );
+/// @brief  Data of a shared frame
+char* sharedFrameData ( SharedFrame *shared );
+
+/// @brief  New frame for a queue, taking over one reference to 'shared'
+SendFrame* newSendFrame ( SharedFrame *shared );
+/// @brief  Free a frame which is not in a queue, and drop its reference
+void freeSendFrame ( SendFrame *frame );
+
+/// @brief  Initialise an empty queue
+void initSendQueue ( SendQueue *queue );
+/// @brief  Free every frame in the queue
+void clearSendQueue ( SendQueue *queue );
+
+/// @brief  Add a frame to the pending list
+void pushSendFrame ( SendQueue *queue , SendFrame *frame );
+/// @brief  Move the pending list to the end of the packets being written
+void spliceSendQueue ( SendQueue *queue );
+
+/// @brief  Whether there is nothing left to write (the pending list is not checked)
+bool sendQueueEmpty ( const SendQueue *queue );
+/// @brief  Packets in the queue, including the pending list (call with the lock held)
+int sendQueueFrames ( const SendQueue *queue );
+/// @brief  Unsent bytes in the queue, including the pending list (call with the lock held)
+int sendQueueBytes ( const SendQueue *queue );
+/// @brief  Drop the oldest packets (but not the first 'keep') till at most 'maxFrames' and 'maxBytes' are left
+///
+/// Returns the number of packets dropped, and adds their size to 'droppedBytes'.
+int dropOldestFrames ( SendQueue *queue , int keep , int maxFrames , int maxBytes , unsigned long *droppedBytes );
+/// @brief  Fill 'vectors' with the unsent bytes of up to 'maxCount' packets, returns the count
+int sendQueueVector ( const SendQueue *queue , struct iovec *vectors , int maxCount );
+/// @brief  Remove 'bytes' written bytes from the front of the queue
+void sendQueueAdvance ( SendQueue *queue , int bytes );
+
+#endif  // __ChatSendQueue_h
@@ -1,83 +1,320 @@
 // ChatServer.cpp
 
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 #include <stdint.h>
 #include <time.h>
 #include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/random.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "ChatBufferPool.h"
+#include "ChatCodec.h"
+#include "ChatEpoch.h"
+#include "ChatFanout.h"
+#include "ChatGroups.h"
 #include "ChatPacket.h"
+#include "ChatReactor.h"
+#include "ChatRecvBuffer.h"
+#include "ChatResume.h"
+#include "ChatRoster.h"
+#include "ChatStringScan.h"
+#include "ChatUserRegistry.h"
+#include "ChatWorkerPool.h"
 
 using namespace std;
 
 /*
  * Here, you can define a data structure to store information
- * about the users, as shown in the 'User' structure below.
+ * about the users, as shown in the 'User' structure of ChatUserRegistry.h.
  *
  * For info on vector (and other useful data structures in C++), see -
  * http://www.cplusplus.com/reference/stl/vector/
  */
 
 /**
- * @brief  Group chat status
+ * @brief  Broadcast channels (see broadcastPacket())
  */
 enum {
-    GROUPCHAT_EMPTY     = 0 ,   ///< User not in group chat
-    GROUPCHAT_ACCEPTED  = 1 ,   ///< User currently in group chat
-    GROUPCHAT_PENDING   = 2     ///< User has yet to answer invitation
+    BROADCAST_WORDS         = 1 ,   ///< Users getting messages as lists of words, each chunk as a message of its own
+    BROADCAST_WORD_CHUNKS   = 2 ,   ///< Users getting lists of words, in chunks as they were sent (FEATURE_CHUNKED)
+    BROADCAST_TEXT          = 4 ,   ///< Users getting messages as text (FEATURE_MESSAGE_TEXT)
+    BROADCAST_TEXT_CHUNKS   = 8 ,   ///< Users getting text, in chunks
+    BROADCAST_EXITS         = 16 ,  ///< Users told of the exits only, without versions
+    BROADCAST_PRESENCE      = 32    ///< Users told of every login and exit, with versions (FEATURE_PRESENCE)
 };
 
+/// @brief  Features the server accepts at login
+#define SERVER_FEATURES  ( FEATURE_CHUNKED | FEATURE_REQUEST_IDS | FEATURE_MESSAGE_TEXT | FEATURE_PRESENCE | FEATURE_GROUPS )
+/// @brief  First guess of the time forwarding a Discuss message to one member takes (measured from then on)
+#define DISCUSS_MEMBER_NANOS  250
+
+/**
+ * @brief  The users logged in, by name, cookie and UserID (see ChatUserRegistry.h)
+ *
+ * It locks what it changes itself, and is read without a lock between
+ * beginEpochRead() and endEpochRead().
+ */
+UserRegistry userRegistry;
+
+/**
+ * @brief  The Show response, kept encoded as the users log in and out (see ChatRoster.h)
+ */
+Roster roster;
+
 /**
- * @brief  Data type representing a list of users
+ * @brief  The users whose connection broke, till they come back or their time is up (see ChatResume.h)
  */
-typedef vector <string> UserList;
+ResumeStore resumeStore;
 
 /**
- * @brief  Information about a User
+ * @brief  The group chats, with their members and invitations (see ChatGroups.h)
  */
-struct User {
-    string userName;          ///< User Name
-    uint32_t      cookie;            ///< Cookie value
-    int           socketFD;          ///< TCP Socket Descriptor
-    int           groupChatStatus;   ///< Group chat status
-    UserList*     groupChatUsers;    ///< Users in Group Chat (including this user)
+GroupTable groupTable;
+
+/**
+ * @brief  Measured cost of forwarding a Discuss message to one member, sizing the chunks of large groups (see ChatFanout.h)
+ */
+FanoutCost discussCost;
+
+/**
+ * @brief  State of the chat session on one connection
+ */
+struct ClientSession {
+    User      currentUser;     ///< This user (valid once logged in)
+    vector <GroupID> groupIDs; ///< Group chats of this user, the last one joined last (one at most without FEATURE_GROUPS)
+    bool      loggedIn;        ///< Whether currentUser is in the userRegistry
+    bool      exited;          ///< Whether the user sent an Exit request
+    uint32_t  chunkStatus;     ///< First error of the chunks of the current message, reported after the last one
 };
 
-typedef vector <User> List;
+/**
+ * @brief  A Discuss message being forwarded to the other members of its group, in chunks (see ChatFanout.h)
+ */
+struct DiscussFanout {
+    UserList            memberIDs;      ///< The other members (as they were when the message came)
+    bool                continued;      ///< Whether the message is a chunk followed by more
+    GroupID             groupID;
+    string_view         userName;       ///< The sender
+    bool                isText;         ///< Whether the message is 'text', else the words read by 'words'
+    string_view         text;
+    FrameReader         words;          ///< At the words of the message (copied for each form encoded)
+    SharedFrame        *forwards[8];    ///< Forward in each form of handleDiscuss(), encoded by the first chunk needing it (read atomically)
+};
 
-List userList;
+/**
+ * @brief  One request being handled (several of a connection may be, see requestIsIndependent)
+ */
+struct Request {
+    FrameReader  reader;       ///< Reads the request after the 'type' and 'length' fields (and the request ID)
+    uint32_t     requestID;    ///< Echoed in the response (FEATURE_REQUEST_IDS)
+    uint32_t     status;       ///< Status of the response
+    bool         continued;    ///< Whether the request is a chunk followed by more
+};
 
 /**
- * @brief  Read-write lock used on the above data structures
+ * @brief  Callback handling one type of request on a connection
  *
- * If you do not want to use locks, thats also fine, since in this
- * assignment the program will most likely still work without locks.
+ * 'replyBuffer' has room for MAX_PACKET_LENGTH bytes, and for the
+ * request ID in front of them (see sendReply()).
+ * Returns false if the connection should be closed.
  */
-pthread_rwlock_t userDataLock;
+typedef bool (*RequestHandler) ( Connection *conn , Request *request , char *replyBuffer );
+
+/// @brief  Reactor callback for a new connection
+void onOpen ( Connection *conn );
+/// @brief  Reactor callback for a complete request
+bool onPacket ( Connection *conn , uint16_t type , const char *buffer , int length );
+/// @brief  Reactor callback choosing the requests which need not wait for the others
+bool isIndependentRequest ( Connection *conn , uint16_t type );
+/// @brief  Reactor callback for a closed connection
+void onClose ( Connection *conn );
+/// @brief  Print the counters of the server
+void printStats ();
+/// @brief  Tell the users of FEATURE_PRESENCE of a login or exit (called by the roster, see ChatRoster.h)
+void onRosterChange ( string_view name , bool joined , uint64_t version );
+/// @brief  Remove the users away for longer than the grace period
+void expireSessions ();
+/// @brief  Tell the group, and the user who invited, of an invitation ending (called by the groups, see ChatGroups.h)
+void onInvitationEnd ( UserID userID , UserID inviter , GroupID groupID , const UserBitmap *members ,
+                       uint16_t answer , bool tellInvited );
+
+/// @brief  Handlers for each type of request
+bool handleLogin ( Connection *conn , Request *request , char *replyBuffer );
+bool handleTalk ( Connection *conn , Request *request , char *replyBuffer );
+bool handleYell ( Connection *conn , Request *request , char *replyBuffer );
+bool handleShow ( Connection *conn , Request *request , char *replyBuffer );
+bool handleCreateGroup ( Connection *conn , Request *request , char *replyBuffer );
+bool handleDiscuss ( Connection *conn , Request *request , char *replyBuffer );
+bool handleLeaveGroup ( Connection *conn , Request *request , char *replyBuffer );
+bool handleJoinGroup ( Connection *conn , Request *request , char *replyBuffer );
+bool handleExit ( Connection *conn , Request *request , char *replyBuffer );
+
+/// @brief  Number of entries in a request dispatch table
+#define REQUEST_TYPE_COUNT  ( REQUEST_JOINGROUP + 1 )
 
-/// @brief  Thread handling one particular client
-void* clientThread ( void *args );
+/**
+ * @brief  Dispatch table used by every connection, indexed by request type
+ *
+ * Request types without a handler are ignored.
+ */
+const RequestHandler requestHandlers[ REQUEST_TYPE_COUNT ] = {
+    NULL ,                  // 0
+    handleLogin ,           // REQUEST_LOGIN
+    handleShow ,            // REQUEST_SHOW
+    handleTalk ,            // REQUEST_TALK
+    handleYell ,            // REQUEST_YELL
+    handleCreateGroup ,     // REQUEST_CREATEGROUP
+    handleDiscuss ,         // REQUEST_DISCUSS
+    handleLeaveGroup ,      // REQUEST_LEAVEGROUP
+    NULL ,                  // REQUEST_HELP
+    handleExit ,            // REQUEST_EXIT
+    handleJoinGroup         // REQUEST_JOINGROUP
+};
 
-/// @brief  Helper function to get the next NULL terminated string in the packet stream
-string getNextString ( const char *buffer , int &offset );
-/// @brief  Helper function to get the next uint32_t in the packet stream
-uint32_t getNextUint32 ( const char *buffer , int &offset );
-/// @brief  Helper function to get the next uint16_t in the packet stream
-uint16_t getNextUint16 ( const char *buffer , int &offset );
+/**
+ * @brief  Request types whose body is a list of strings ending with an empty one (after the cookie)
+ *
+ * The list is checked, and all its strings found, before the handler is called.
+ */
+const bool requestHasStringList[ REQUEST_TYPE_COUNT ] = {
+    false ,                 // 0
+    false ,                 // REQUEST_LOGIN
+    false ,                 // REQUEST_SHOW
+    true ,                  // REQUEST_TALK
+    true ,                  // REQUEST_YELL
+    true ,                  // REQUEST_CREATEGROUP
+    true ,                  // REQUEST_DISCUSS
+    false ,                 // REQUEST_LEAVEGROUP
+    false ,                 // REQUEST_HELP
+    false ,                 // REQUEST_EXIT
+    false                   // REQUEST_JOINGROUP
+};
 
-/// @brief  Helper function to put the next NULL terminated string in the packet stream
-void putNextString ( char *buffer , int &offset , const string &nextString );
-/// @brief  Helper function to put the next uint32_t in the packet stream
-void putNextUint32 ( char *buffer , int &offset , uint32_t nextUint32 );
-/// @brief  Helper function to put the next uint16_t in the packet stream
-void putNextUint16 ( char *buffer , int &offset , uint16_t nextUint16 );
+/**
+ * @brief  Request types ending with a message, which is text instead of a list with FEATURE_MESSAGE_TEXT
+ */
+const bool requestHasMessage[ REQUEST_TYPE_COUNT ] = {
+    false ,                 // 0
+    false ,                 // REQUEST_LOGIN
+    false ,                 // REQUEST_SHOW
+    true ,                  // REQUEST_TALK
+    true ,                  // REQUEST_YELL
+    false ,                 // REQUEST_CREATEGROUP
+    true ,                  // REQUEST_DISCUSS
+    false ,                 // REQUEST_LEAVEGROUP
+    false ,                 // REQUEST_HELP
+    false ,                 // REQUEST_EXIT
+    false                   // REQUEST_JOINGROUP
+};
+
+/**
+ * @brief  Request types naming their group first (after the cookie) with FEATURE_GROUPS
+ */
+const bool requestHasGroupID[ REQUEST_TYPE_COUNT ] = {
+    false ,                 // 0
+    false ,                 // REQUEST_LOGIN
+    false ,                 // REQUEST_SHOW
+    false ,                 // REQUEST_TALK
+    false ,                 // REQUEST_YELL
+    false ,                 // REQUEST_CREATEGROUP
+    true ,                  // REQUEST_DISCUSS
+    true ,                  // REQUEST_LEAVEGROUP
+    false ,                 // REQUEST_HELP
+    false ,                 // REQUEST_EXIT
+    true                    // REQUEST_JOINGROUP
+};
+
+/**
+ * @brief  Request types which may be sent in chunks (FEATURE_CHUNKED)
+ */
+const bool requestCanContinue[ REQUEST_TYPE_COUNT ] = {
+    false ,                 // 0
+    false ,                 // REQUEST_LOGIN
+    false ,                 // REQUEST_SHOW
+    true ,                  // REQUEST_TALK
+    true ,                  // REQUEST_YELL
+    false ,                 // REQUEST_CREATEGROUP
+    true ,                  // REQUEST_DISCUSS
+    false ,                 // REQUEST_LEAVEGROUP
+    false ,                 // REQUEST_HELP
+    false ,                 // REQUEST_EXIT
+    false                   // REQUEST_JOINGROUP
+};
+
+/**
+ * @brief  Request types which may be handled alongside the other requests of a client (FEATURE_REQUEST_IDS)
+ *
+ * They neither change the session, nor send anything to other users,
+ * so their responses may overtake the ones of earlier requests.
+ */
+const bool requestIsIndependent[ REQUEST_TYPE_COUNT ] = {
+    false ,                 // 0
+    false ,                 // REQUEST_LOGIN
+    true ,                  // REQUEST_SHOW
+    false ,                 // REQUEST_TALK
+    false ,                 // REQUEST_YELL
+    false ,                 // REQUEST_CREATEGROUP
+    false ,                 // REQUEST_DISCUSS
+    false ,                 // REQUEST_LEAVEGROUP
+    true ,                  // REQUEST_HELP
+    false ,                 // REQUEST_EXIT
+    false                   // REQUEST_JOINGROUP
+};
+
+/// @brief  Report a request whose fields do not fit in it, returns false (the connection is closed)
+bool malformedRequest ();
+/// @brief  Whether the reply to a request waits for the last chunk of its message (keeping the status till then)
+bool holdReply ( ClientSession *session , Request *request );
+/// @brief  Broadcast channels of the users with 'features'
+unsigned broadcastChannel ( uint32_t features );
+/// @brief  A new cookie, which cannot be guessed
+uint32_t newCookie ();
+/// @brief  Take over the session of a user away, with this cookie and name, returns false if there is none
+bool resumeLogin ( Connection *conn , uint32_t cookie , string_view userName , char *replyBuffer );
+/// @brief  Send a packet to a user, or hold it for the user while it is away (on NO_CONNECTION)
+void sendToUser ( UserID userID , ConnectionID connection , const char *buffer , int length );
+/// @brief  Group a request is about: the one it names with FEATURE_GROUPS, else the last one joined (NO_GROUP if none)
+GroupID sessionGroup ( ClientSession *session , GroupID named );
+/// @brief  Take a user out of one of its group chats, returns false if it was not in it
+bool leaveGroupChat ( ClientSession *session , GroupID groupID );
+/// @brief  Take a user out of all its group chats, and drop its invitations (as it leaves)
+void leaveGroupChats ( ClientSession *session );
+/// @brief  Encode the Discuss Forward of a message in one of the forms of handleDiscuss() (not as a chunk)
+int encodeDiscussForward ( char *buffer , int form , GroupID groupID , string_view userName ,
+                           bool isText , string_view text , FrameStrings words );
+/// @brief  Send one packet to some members of a group, sharing one copy of it (held for the ones away)
+void sendToGroup ( const UserList &userIDs , const vector <ConnectionID> &connections , const char *buffer , int length );
+/// @brief  Same, with a shared frame the caller keeps its reference to
+void sendSharedToGroup ( const UserList &userIDs , const vector <ConnectionID> &connections , SharedFrame *shared );
+/// @brief  Forward a Discuss message to some of the members of its group (a chunk of its fan-out)
+void sendDiscussChunk ( void *context , size_t first , size_t last );
+/// @brief  The Discuss Forward in one form (see handleDiscuss()), encoded once for the whole fan-out
+SharedFrame* discussForward ( DiscussFanout *fanout , int form );
+/// @brief  Broadcast a packet to the users of 'channels', the ones away included
+void broadcastToUsers ( const char *buffer , int length , Connection *except , unsigned channels );
+/// @brief  Broadcast a message forward to the users of 'channel', and marked as a chunk to the ones of 'chunkChannel'
+void broadcastMessage ( char *buffer , int length , Connection *except , bool continued ,
+                        unsigned channel , unsigned chunkChannel );
+/// @brief  Send the response encoded at 'replyBuffer', with the request ID if the client asked for them
+bool sendReply ( Connection *conn , uint32_t requestID , char *replyBuffer , int replyLength );
+/// @brief  Send the pages of the roster in answer to a Show request, taking over their references
+bool sendRoster ( Connection *conn , uint32_t requestID , const vector <SharedFrame*> &pages , char *replyBuffer );
+/// @brief  Name of a user, for the lists of users put in packets
+string_view listString ( const User *user );
 
 /// @brief  Starting point of the server
 int
@@ -85,865 +322,1231 @@ main ( int argc , char **argv ) {
 
     // Step 1: Initialise the server
 
+    // Number of reactor threads (-t), each with its own listening socket, by default one per core
+    int reactorCount = sysconf ( _SC_NPROCESSORS_ONLN );
+    // Number of worker threads handling the requests (-w), by default one per core, 0 to handle them on the reactors
+    int workerCount = sysconf ( _SC_NPROCESSORS_ONLN );
+    // I/O backend of the reactors (-u for io_uring)
+    int backend = REACTOR_EPOLL;
+    // Length of the queue of not yet accepted connections of each listening socket (-b)
+    int backlog = SOMAXCONN;
+    // Packets and bytes which may wait for a client (-f, -q), and what to do beyond that (-p)
+    SendLimits sendLimits = { 4096 , 1024 * 1024 , SEND_DISCONNECT };
+    // Print the counters of the server every so many seconds (-s)
+    int statsInterval = 0;
+    // Seconds a user whose connection broke may come back in (-g)
+    int graceSeconds = 30;
+    // Seconds an invitation to a group chat waits for its answer (-i)
+    int inviteSeconds = 60;
+    int option;
+    while ( ( option = getopt ( argc , argv , "t:w:ub:f:q:p:s:g:i:" ) ) != -1 ) {
+        switch ( option ) {
+            case 't':
+                reactorCount = atoi ( optarg );
+                break;
+            case 'w':
+                workerCount = atoi ( optarg );
+                break;
+            case 'u':
+                backend = REACTOR_URING;
+                break;
+            case 'b':
+                backlog = atoi ( optarg );
+                break;
+            case 'f':
+                sendLimits.maxFrames = atoi ( optarg );
+                break;
+            case 'q':
+                sendLimits.maxBytes = atoi ( optarg );
+                break;
+            case 'p':
+                if ( string ( optarg ) == "oldest" )
+                    sendLimits.policy = SEND_DROP_OLDEST;
+                else if ( string ( optarg ) == "newest" )
+                    sendLimits.policy = SEND_DROP_NEWEST;
+                else if ( string ( optarg ) == "disconnect" )
+                    sendLimits.policy = SEND_DISCONNECT;
+                else {
+                    cerr << "Unknown policy " << optarg << " (use oldest, newest or disconnect)\n";
+                    return -1;
+                }
+                break;
+            case 's':
+                statsInterval = atoi ( optarg );
+                break;
+            case 'g':
+                graceSeconds = atoi ( optarg );
+                break;
+            case 'i':
+                inviteSeconds = atoi ( optarg );
+                break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-t reactor threads] [-w worker threads] [-u] [-b backlog]"
+                     << " [-f max queued packets] [-q max queued bytes]"
+                     << " [-p oldest|newest|disconnect] [-s stats interval] [-g grace seconds]"
+                     << " [-i invitation seconds]\n";
+                return -1;
+        }
+    }
+    if ( reactorCount < 1 )
+        reactorCount = 1;
+    if ( workerCount < 0 )
+        workerCount = 0;
+
     // Get the service port to use
     uint16_t servicePort;
     cout << "=== Welcome to the Chat Server!! ===\n";
     cout << "Enter Service Port: ";
     cin >> servicePort;
 
-    // Create a socket to listen for client connections
-    int socketFD;
-    if ( ( socketFD = socket ( AF_INET , SOCK_STREAM , 0 ) ) < 0 ) {
-        cerr << "Error creating Server socket\n";
-        return -1;
-    }
-
-    // Bind to all IP Addresses of this machine, on the input service port
-    struct sockaddr_in serverAddress;
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons ( servicePort );
-    serverAddress.sin_addr.s_addr = INADDR_ANY;
-    if ( bind ( socketFD , (const struct sockaddr*) &serverAddress ,
-                sizeof ( struct sockaddr_in ) ) < 0 ) {
-        cerr << "Error on bind()\n";
-        close ( socketFD );
-        return -1;
-    }
+    // A client disconnecting while we send must not kill the server
+    signal ( SIGPIPE , SIG_IGN );
 
-    // Tell the OS that the server wants to listen on this socket
-    if ( listen ( socketFD , 10 ) < 0 ) {
-        cerr << "Error on listen()\n";
-        close ( socketFD );
-        return -1;
+    // Each client only costs a socket now, so allow as many as the system does
+    struct rlimit fileLimit;
+    if ( getrlimit ( RLIMIT_NOFILE , &fileLimit ) == 0 ) {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        setrlimit ( RLIMIT_NOFILE , &fileLimit );
     }
 
-    // Initialise the Read-write lock
-    if ( pthread_rwlock_init ( &userDataLock , NULL ) != 0 ) {
-        cerr << "Error on pthread_rwlock_init()\n";
-        close ( socketFD );
-        return -1;
-    }
+    // Create one socket per reactor to listen for client connections, all on the same port
+    vector <int> listenFDs;
+    for ( int i = 0 ; i < reactorCount ; i++ ) {
+        int socketFD;
+        if ( ( socketFD = socket ( AF_INET , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 ) ) < 0 ) {
+            cerr << "Error creating Server socket\n";
+            return -1;
+        }
 
-    // Step 2: Wait for connections
-    cout << "Chat Server Running on 127.0.0.1:" << servicePort << endl;
-    int newSocketFD;
-    while ( true ) {
-        if ( ( newSocketFD = accept ( socketFD , NULL , NULL ) ) < 0 ) {
-            cerr << "Error on accept()\n";
+        // SO_REUSEPORT lets the kernel spread new connections over all the sockets
+        int enable = 1;
+        if ( setsockopt ( socketFD , SOL_SOCKET , SO_REUSEADDR , &enable , sizeof ( enable ) ) < 0 ||
+             setsockopt ( socketFD , SOL_SOCKET , SO_REUSEPORT , &enable , sizeof ( enable ) ) < 0 ) {
+            cerr << "Error on setsockopt()\n";
             close ( socketFD );
             return -1;
         }
 
-        // Step 3: On a new connection, create a new thread
-        pthread_t threadID;
-        int *userSocketFD = new int;
-        *userSocketFD = newSocketFD;
-        if ( userSocketFD == NULL ) {
-            cerr << "Out of heap memory\n";
+        // Bind to all IP Addresses of this machine, on the input service port
+        struct sockaddr_in serverAddress;
+        serverAddress.sin_family = AF_INET;
+        serverAddress.sin_port = htons ( servicePort );
+        serverAddress.sin_addr.s_addr = INADDR_ANY;
+        if ( bind ( socketFD , (const struct sockaddr*) &serverAddress ,
+                    sizeof ( struct sockaddr_in ) ) < 0 ) {
+            cerr << "Error on bind()\n";
             close ( socketFD );
             return -1;
         }
 
-        // Also, tell the thread the socket FD it should use for this user
-        if ( pthread_create ( &threadID , NULL , clientThread , userSocketFD ) != 0 ) {
-            cerr << "Error on pthread_create()\n";
+        // Tell the OS that the server wants to listen on this socket
+        if ( listen ( socketFD , backlog ) < 0 ) {
+            cerr << "Error on listen()\n";
             close ( socketFD );
             return -1;
         }
+        listenFDs.push_back ( socketFD );
+    }
+
+    // Initialise the users
+    initUserRegistry ( &userRegistry );
+    initRoster ( &roster , onRosterChange );
+    initResumeStore ( &resumeStore , &userRegistry , graceSeconds );
+    initGroupTable ( &groupTable , inviteSeconds , onInvitationEnd );
+    initFanoutCost ( &discussCost , DISCUSS_MEMBER_NANOS );
+
+    // Step 2: Start the worker threads, which handle the requests, and the
+    // reactor threads, which accept and serve all the clients
+    if ( !startWorkerPool ( workerCount ) )
+        return -1;
+    ReactorCallbacks callbacks;
+    callbacks.onOpen = onOpen;
+    callbacks.onPacket = onPacket;
+    callbacks.isIndependent = isIndependentRequest;
+    callbacks.onClose = onClose;
+    setSendLimits ( sendLimits );
+    if ( !startReactors ( &listenFDs[0] , reactorCount , backend , callbacks ) )
+        return -1;
+
+    cout << "Chat Server Running on 127.0.0.1:" << servicePort
+         << " with " << reactorCount << " reactor threads ("
+         << ( reactorBackend() == REACTOR_URING ? "io_uring" : "epoll" ) << ") and "
+         << workerCount << " worker threads, scanning packets with " << stringScanName() << endl;
+
+    // The reactors run till the server is killed, this thread removes the
+    // users who did not come back in time, and the invitations not answered
+    for ( int second = 1 ; graceSeconds > 0 || inviteSeconds > 0 || statsInterval > 0 ; second++ ) {
+        sleep ( 1 );
+        expireSessions ();
+        expireInvitations ( &groupTable );
+        if ( statsInterval > 0 && second % statsInterval == 0 )
+            printStats ();
     }
+    waitReactors ();
 
     // Control should not reach here
-    pthread_rwlock_destroy ( &userDataLock );
 
     return 0;
 }
 
-void* clientThread ( void *args ) {
-	uint32_t status = STATUS_SUCCESS; 
+void onOpen ( Connection *conn ) {
 
-	User currentUser;
-	UserList groupList;
+    ClientSession *session = new ClientSession;
+    session->loggedIn = false;
+    session->exited = false;
+    session->chunkStatus = STATUS_SUCCESS;
+    session->currentUser.userID = NO_USER;
+    session->currentUser.features = 0;
+    conn->context = session;
+}
+
+bool onPacket ( Connection *conn , uint16_t type , const char *buffer , int length ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // A chunk of a longer message has the same type, with one more bit
+    bool continued = ( type & PACKET_CONTINUED ) != 0;
+    type &= ~PACKET_CONTINUED;
 
-    // Get the socketFD this thread has been assigned to
-    int *userSocketFD = (int*) args;
-    int socketFD = *userSocketFD;
-    delete userSocketFD;
+    // Check what is the type of packet received
+    if ( type >= REQUEST_TYPE_COUNT || requestHandlers[ type ] == NULL )
+        return true;
+    uint32_t features = __atomic_load_n ( &session->currentUser.features , __ATOMIC_ACQUIRE );
+    if ( continued && ( !requestCanContinue[ type ] || ( features & FEATURE_CHUNKED ) == 0 ) )
+        return malformedRequest ();
 
-    // Get the Client's IP and Port
-    struct sockaddr_in clientAddress;
-    socklen_t addressLength = sizeof ( struct sockaddr_in );
-    if ( getpeername ( socketFD , (struct sockaddr*) &clientAddress ,
-                       &addressLength ) != 0 ) {
-        cerr << "Error on getpeername()\n";
-        close ( socketFD );
-        return NULL;
+    Request request;
+    request.requestID = 0;
+    request.status = STATUS_SUCCESS;
+    request.continued = continued;
+
+    // The request ID comes before the cookie
+    if ( features & FEATURE_REQUEST_IDS ) {
+        if ( length < (int) REQUEST_ID_LENGTH )
+            return malformedRequest ();
+        request.requestID = takeRequestID ( buffer , length );
+    }
+    initFrameReader ( &request.reader , buffer , length );
+
+    // Find the end of every string in one pass, and make sure the list is complete
+    bool hasStringList = requestHasStringList[ type ] &&
+                         !( requestHasMessage[ type ] && ( features & FEATURE_MESSAGE_TEXT ) );
+    int listOffset = sizeof ( uint32_t ) + ( requestHasGroupID[ type ] && ( features & FEATURE_GROUPS ) ? sizeof ( GroupID ) : 0 );
+    uint16_t stringEnds[ MAX_PACKET_LENGTH ];
+    if ( hasStringList &&
+         ( scanFrameStrings ( &request.reader , listOffset , stringEnds , MAX_PACKET_LENGTH ) < 0 ||
+           !isStringList ( &request.reader , listOffset ) ) )
+        return malformedRequest ();
+
+    // Keep a reply buffer ready for sending a reply back (with room for the request ID in front)
+    char *replyMemory = (char*) allocBuffer ( REQUEST_ID_LENGTH + MAX_PACKET_LENGTH );
+    bool keepOpen = requestHandlers[ type ] ( conn , &request , replyMemory + REQUEST_ID_LENGTH );
+    freeBuffer ( replyMemory );
+
+    if ( !keepOpen )
+        return false;
+
+    if ( request.status != STATUS_SUCCESS ) {
+        cerr << "Error occurred" << endl;
+        return false;
     }
 
+    return true;
+}
+
+bool isIndependentRequest ( Connection *conn , uint16_t type ) {
+
+    // Called by the reactor while a worker may be handling the login
+    ClientSession *session = (ClientSession*) conn->context;
+    uint32_t features = __atomic_load_n ( &session->currentUser.features , __ATOMIC_ACQUIRE );
+    return ( features & FEATURE_REQUEST_IDS ) && type < REQUEST_TYPE_COUNT && requestIsIndependent[ type ];
+}
 
-    // Receive packets on this socket
-    while ( true ) {
+void onClose ( Connection *conn ) {
 
-        // Step 1: First, get the 'type' and 'length' of the packet (first 2 fields are total 4 bytes)
-        size_t bufferSize = sizeof ( uint16_t ) + sizeof ( uint16_t );
-        char *buffer = new char[ bufferSize ];
-        if ( buffer == NULL ) {
-            cerr << "Error: Heap Over\n";
-            close ( socketFD );
-            return NULL;
+    ClientSession *session = (ClientSession*) conn->context;
+
+    if ( conn->tooSlow ) {
+        // Tell the client why, if it ever reads it (it did not ask, so the request ID is 0)
+        char replyMemory[ REQUEST_ID_LENGTH + ExitResponse::maxLength ];
+        char *replyBuffer = replyMemory + REQUEST_ID_LENGTH;
+        int replyLength = encodePacket < ExitResponse > ( replyBuffer , ERROR_TOO_SLOW );
+        sendReply ( conn , 0 , replyBuffer , replyLength );
+
+        cerr << "Client " << session->currentUser.userName
+             << " disconnected, too many packets waiting to be sent\n";
+    }
+    else if ( !session->exited ) {
+        // If we get here, then the connection was closed or there was an error
+        cerr << "Client closed connection unexpectedly\n";
+    }
+
+    // The user can no longer be reached on this socket, it is kept for a while
+    // if it may come back (the session goes with it)
+    if ( session->loggedIn && !session->exited &&
+         detachUser ( &resumeStore , session->currentUser.userID ,
+                      broadcastChannel ( session->currentUser.features ) , session ) )
+        return;
+    if ( session->loggedIn ) {
+        leaveGroupChats ( session );
+        removeRosterUser ( &roster , session->currentUser.userID );
+        removeUser ( &userRegistry , session->currentUser.userID );
+    }
+
+    delete session;
+}
+
+void onRosterChange ( string_view name , bool joined , uint64_t version ) {
+
+    // The roster holds its lock, so the changes are queued in the order of their versions
+    char buffer[ LoginForward::maxLength ];
+    int length;
+    if ( joined )
+        length = encodePacket < LoginForward > ( buffer , STATUS_SUCCESS , name , version );
+    else
+        length = encodePacket < ExitPresenceForward > ( buffer , STATUS_SUCCESS , name , version );
+    broadcastToUsers ( buffer , length , NULL , BROADCAST_PRESENCE );
+}
+
+void expireSessions () {
+
+    vector <void*> expired;
+    expireUsers ( &resumeStore , &expired );
+    for ( void *context : expired ) {
+        ClientSession *session = (ClientSession*) context;
+        leaveGroupChats ( session );
+        removeRosterUser ( &roster , session->currentUser.userID );
+        removeUser ( &userRegistry , session->currentUser.userID );
+        cout << "Client " << session->currentUser.userName << " did not come back\n";
+        delete session;
+    }
+}
+
+void onInvitationEnd ( UserID userID , UserID inviter , GroupID groupID , const UserBitmap *members ,
+                       uint16_t answer , bool tellInvited ) {
+
+    // The groups hold their lock, so the members are told in the order the group changes
+    char buffers[2][ JoinGroupIDForward::maxLength ];
+    int lengths[2] = { 0 , 0 };
+    // By form: without the group ID (0) or with it (1)
+    UserList receiverIDs[2];
+    vector <ConnectionID> receiverConnections[2];
+    // The members, and the inviter even if it has left the group (but not the user who answered,
+    // which is only told if its invitation was dropped without its doing)
+    uint32_t answered = userIndex ( userID );
+    bool inviterNotified = false;
+    auto notify = [&] ( const User *receiver ) {
+        if ( receiver == NULL )
+            return;
+        int form = ( receiver->features & FEATURE_GROUPS ) ? 1 : 0;
+        receiverIDs[ form ].push_back ( receiver->userID );
+        receiverConnections[ form ].push_back ( __atomic_load_n ( &receiver->connection , __ATOMIC_ACQUIRE ) );
+        inviterNotified = inviterNotified || receiver->userID == inviter;
+    };
+
+    beginEpochRead ();
+    const User *user = getUser ( &userRegistry , userID );
+    if ( user != NULL ) {
+        lengths[0] = encodePacket < JoinGroupForward > ( buffers[0] , STATUS_SUCCESS , user->userName , answer );
+        lengths[1] = encodePacket < JoinGroupIDForward > ( buffers[1] , STATUS_SUCCESS , groupID , user->userName , answer );
+        forEachInBitmap ( members , [&] ( uint32_t index ) {
+            if ( index != answered )
+                notify ( getUserByIndex ( &userRegistry , index ) );
+        } );
+        if ( !inviterNotified && inviter != userID )
+            notify ( getUser ( &userRegistry , inviter ) );
+        if ( tellInvited )
+            notify ( user );
+    }
+    endEpochRead ();
+
+    for ( int form = 0 ; form < 2 && lengths[ form ] > 0 ; form++ )
+        sendToGroup ( receiverIDs[ form ] , receiverConnections[ form ] , buffers[ form ] , lengths[ form ] );
+}
+
+void printStats () {
+
+    ReactorStats stats;
+    getReactorStats ( &stats );
+    cout << "Connections: " << stats.open << " open, " << stats.accepted << " accepted"
+         << " | Dropped: " << stats.droppedFrames << " packets (" << stats.droppedBytes << " bytes), "
+         << stats.slowDisconnects << " slow clients disconnected" << endl;
+
+    BufferPoolStats bufferStats;
+    getBufferPoolStats ( &bufferStats );
+    unsigned long hitRate = bufferStats.allocations > 0 ? 100 * bufferStats.recycled / bufferStats.allocations : 0;
+    cout << "Buffers: " << bufferStats.inUse << " in use (at most " << bufferStats.maxInUse << "), "
+         << bufferStats.allocations << " allocated, " << hitRate << "% recycled, "
+         << bufferStats.remoteFrees << " freed by another thread | Slabs: " << bufferStats.slabs
+         << " (" << bufferStats.slabBytes << " bytes), " << bufferStats.largeAllocations << " large buffers" << endl;
+
+    if ( workerPoolSize() == 0 )
+        return;
+    WorkerPoolStats workerStats;
+    getWorkerPoolStats ( &workerStats );
+    cout << "Workers: " << workerStats.queuedTasks << " requests waiting (at most "
+         << workerStats.maxQueuedTasks << " so far), " << workerStats.queuedStrands << " clients queued"
+         << " (at most " << workerStats.maxDequeDepth << " on one worker) | "
+         << workerStats.executed << " handled, " << workerStats.stolen << " stolen" << endl;
+
+    FanoutStats fanoutStats;
+    getFanoutStats ( &fanoutStats );
+    cout << "Fan-outs: " << fanoutStats.fanouts << " large groups sent to in " << fanoutStats.chunks << " chunks, "
+         << fanoutStats.helped << " by other workers | Discuss: " << fanoutChunkSize ( &discussCost )
+         << " members a chunk" << endl;
+}
+
+/*
+ * Event:
+ * Login Request
+ *
+ * Action:
+ * 1. Set Cookie value
+ * 2. Send LOGIN_RESPONSE
+ */
+bool handleLogin ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+    User &currentUser = session->currentUser;
+
+    // Get the cookie value, the user name and the features asked for from the packet
+    uint32_t cookie , features;
+    string_view userName;
+    if ( !decodePacket < LoginRequest > ( &request->reader , cookie , userName , features ) )
+        return malformedRequest ();
+
+    // A client coming back after its connection broke gets its session back
+    if ( cookie != 0 && !session->loggedIn && resumeLogin ( conn , cookie , userName , replyBuffer ) )
+        return true;
+
+    // A session has one user, another login would leave the first one behind
+    // in the registry and the roster for good
+    bool loggedInAlready = session->loggedIn;
+    if ( loggedInAlready )
+        request->status = ERROR_USERNAME;
+    // An empty name is no user's: it ends the lists of names, and marks the
+    // version of a Show in a Login Forward (FEATURE_PRESENCE)
+    else if ( userName.empty() )
+        request->status = ERROR_USERNAME;
+
+    // The registry outlives the request, so it keeps its own copy of the name
+    User user;
+    user.userName = userName;
+    user.userID = NO_USER;
+    user.connection = connectionID ( conn );
+    // A random cookie (or the next one free, a cookie names one user)
+    user.cookie = newCookie ();
+    user.features = features & SERVER_FEATURES;
+    // The list of users may take several pages, a copy of it needs them all
+    if ( ( user.features & FEATURE_CHUNKED ) == 0 )
+        user.features &= ~FEATURE_PRESENCE;
+
+    // The registry locks what it changes itself
+    if ( request->status == STATUS_SUCCESS && !addUser ( &userRegistry , &user ) )
+        request->status = ERROR_USERNAME;
+    if ( request->status == STATUS_SUCCESS ) {
+        currentUser.userName = user.userName;
+        currentUser.userID = user.userID;
+        currentUser.connection = user.connection;
+        currentUser.cookie = user.cookie;
+        // Read by the reactor as well (see isIndependentRequest())
+        __atomic_store_n ( &currentUser.features , user.features , __ATOMIC_RELEASE );
+        session->loggedIn = true;
+        addRosterUser ( &roster , user.userID , user.userName );
+
+        // Client bob connected from 127.0.0.1:58101
+        cout << "Client " << currentUser.userName << " connected from "
+             << inet_ntoa ( conn->clientAddress.sin_addr )
+             << ":" << ntohs ( conn->clientAddress.sin_port )
+             << endl;
+    }
+
+    // Login Response packet to the Client, with its cookie and the features in use
+    int replyLength = encodePacket < LoginResponse > ( replyBuffer , request->status ,
+                                                       currentUser.cookie , currentUser.features );
+
+    // Send response here...
+    if ( !sendPacket ( connectionID ( conn ) , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
+    }
+
+    // The user logged in before stays so, on this connection
+    if ( loggedInAlready ) {
+        request->status = STATUS_SUCCESS;
+        return true;
+    }
+
+    // Yells and Exit (or Login) notifications reach this user from now on, after
+    // the response (the changes of the roster missed till then are in its next Show)
+    if ( request->status == STATUS_SUCCESS )
+        setBroadcast ( conn , broadcastChannel ( currentUser.features ) );
+
+    return true;
+}
+
+/*
+ * Event:
+ * Talk Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Reply a message to sender
+ * 3. Forward message to the receiver
+ */
+bool handleTalk ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value from the packet
+    uint32_t cookie;
+    UserID receiverID = NO_USER;
+    ConnectionID receiverConnection = NO_CONNECTION;
+    uint32_t receiverFeatures = 0;
+    // Views into the request, nothing is copied till the forward packet is built
+    string_view senderName , receiverName , text;
+    FrameStrings words = { NULL };
+    bool isText = ( session->currentUser.features & FEATURE_MESSAGE_TEXT ) != 0;
+    if ( isText ? !decodePacket < TalkTextRequest > ( &request->reader , cookie , senderName , receiverName , text )
+                : !decodePacket < TalkRequest > ( &request->reader , cookie , senderName , receiverName , words ) )
+        return malformedRequest ();
+
+    // Only what is needed is copied, the registry is read without a lock
+    beginEpochRead ();
+    const User *receiver = findUserByName ( &userRegistry , receiverName );
+    if ( receiver != NULL ) {
+        receiverID = receiver->userID;
+        receiverConnection = __atomic_load_n ( &receiver->connection , __ATOMIC_ACQUIRE );
+        receiverFeatures = receiver->features;
+    }
+    endEpochRead ();
+
+    if ( receiverID == NO_USER )
+        request->status = ERROR_USER_NOT_FOUND;
+
+    if ( request->status == STATUS_SUCCESS ) {
+        // Talk Forward packet to the receiver (with as much of the message as fits), the
+        // text is copied as it is, and only turned into words (or back) for an older client
+        int replyLength;
+        if ( receiverFeatures & FEATURE_MESSAGE_TEXT )
+            replyLength = isText ? encodePacket < TalkTextForward > ( replyBuffer , request->status , senderName , receiverName , text )
+                                 : encodePacket < TalkTextForward > ( replyBuffer , request->status , senderName , receiverName , words );
+        else
+            replyLength = isText ? encodePacket < TalkForward > ( replyBuffer , request->status , senderName , receiverName , MessageWords { text } )
+                                 : encodePacket < TalkForward > ( replyBuffer , request->status , senderName , receiverName , words );
+        // A receiver which does not take chunks gets each one as a message
+        if ( request->continued && ( receiverFeatures & FEATURE_CHUNKED ) )
+            markPacketContinued ( replyBuffer );
+
+        // Held if the receiver is away (fails only if the receiver has just
+        // left, its reactor closes the connection itself if writing to it fails)
+        sendToUser ( receiverID , receiverConnection , replyBuffer , replyLength );
+    }
+
+    // One response for all the chunks of a message
+    if ( holdReply ( session , request ) )
+        return true;
+
+    // Talk Response packet to the sender
+    int replyLength = encodePacket < TalkResponse > ( replyBuffer , request->status );
+
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
+    }
+
+    // not a serious error, reset status to STATUS_SUCCESS after report error to sender
+    request->status = STATUS_SUCCESS;
+
+    return true;
+}
+
+/*
+ * Event:
+ * Yell Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Reply a message to sender
+ * 3. Forward message to the all other online users
+ */
+bool handleYell ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value from the packet
+    uint32_t cookie;
+    string_view text;
+    FrameStrings words = { NULL };
+    bool isText = ( session->currentUser.features & FEATURE_MESSAGE_TEXT ) != 0;
+    if ( isText ? !decodePacket < YellTextRequest > ( &request->reader , cookie , text )
+                : !decodePacket < YellRequest > ( &request->reader , cookie , words ) )
+        return malformedRequest ();
+    const string &userName = session->currentUser.userName;
+
+    bool othersOnline = userCount ( &userRegistry ) > ( session->loggedIn ? 1 : 0 );
+
+    if ( !othersOnline )
+        request->status = ERROR_NO_USER_ONLINE;
+
+    if ( request->status == STATUS_SUCCESS ) {
+        // Yell Forward packets to the other users (with as much of the message as fits), one
+        // with the words, one with the text, each sent to all the users who take it (the
+        // reactors do the sending, we do not wait for it). The words are read twice.
+        FrameReader wordsAgain = request->reader;
+        FrameStrings sameWords = { &wordsAgain };
+        int replyLength = isText ? encodePacket < YellForward > ( replyBuffer , request->status , userName , MessageWords { text } )
+                                 : encodePacket < YellForward > ( replyBuffer , request->status , userName , words );
+        broadcastMessage ( replyBuffer , replyLength , conn , request->continued , BROADCAST_WORDS , BROADCAST_WORD_CHUNKS );
+
+        replyLength = isText ? encodePacket < YellTextForward > ( replyBuffer , request->status , userName , text )
+                             : encodePacket < YellTextForward > ( replyBuffer , request->status , userName , sameWords );
+        broadcastMessage ( replyBuffer , replyLength , conn , request->continued , BROADCAST_TEXT , BROADCAST_TEXT_CHUNKS );
+    }
+
+    // One response for all the chunks of a message
+    if ( holdReply ( session , request ) )
+        return true;
+
+    // Yell Response packet to the sender
+    int replyLength = encodePacket < YellResponse > ( replyBuffer , request->status );
+
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
+    }
+
+    // not a serious error, reset status to STATUS_SUCCESS after report error to sender
+    request->status = STATUS_SUCCESS;
+
+    return true;
+}
+
+/*
+ * Event:
+ * Show Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Send back the list of users
+ */
+bool handleShow ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    // Get the cookie value from the packet
+    uint32_t cookie;
+    if ( !decodePacket < ShowRequest > ( &request->reader , cookie ) )
+        return malformedRequest ();
+
+    // The roster is already encoded, one packet per page
+    vector <SharedFrame*> pages;
+    uint64_t version = getRosterFrames ( &roster , &pages );
+    if ( !sendRoster ( conn , request->requestID , pages , replyBuffer ) )
+        return false;
+
+    // A copy of the list takes the changes after this version only
+    ClientSession *session = (ClientSession*) conn->context;
+    if ( session->currentUser.features & FEATURE_PRESENCE ) {
+        int replyLength = encodePacket < LoginForward > ( replyBuffer , STATUS_SUCCESS , string_view () , version );
+        if ( !sendPacket ( connectionID ( conn ) , replyBuffer , replyLength ) ) {
+            cerr << "Error on send()\n";
+            return false;
         }
-        // The flag MSG_WAITALL ensures that we get the all the 4 bytes in one recv()
-        if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize )
-            break;
-        // Read the 'type' and 'length' fields from the buffer using helper functions
-        int offset = 0;
-        uint16_t type , length;
-        type = getNextUint16 ( buffer , offset );
-        length = getNextUint16 ( buffer , offset );
-        delete[] buffer;
-
-        // Step 2: Now that we know the packet length, we can recv() the full packet
-        bufferSize = length - ( sizeof ( uint16_t ) + sizeof ( uint16_t ) );
-        buffer = new char[ bufferSize ];
-        if ( buffer == NULL ) {
-            cerr << "Error: Heap Over\n";
-            close ( socketFD );
-            return NULL;
+    }
+    return true;
+}
+
+/*
+ * Event:
+ * CreateGroup Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Reply a message to sender
+ * 3. Forward invitation to the invited users
+ */
+bool handleCreateGroup ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+    User &currentUser = session->currentUser;
+
+    // Get the cookie value from the packet
+    uint32_t cookie;
+    FrameStrings invitedNames;
+    if ( !decodePacket < CreateGroupRequest > ( &request->reader , cookie , invitedNames ) )
+        return malformedRequest ();
+
+    // Only a logged in user has a slot of its own to be a member with
+    if ( !session->loggedIn )
+        request->status = ERROR_COOKIE_INVALID;
+
+    // Without FEATURE_GROUPS a user is in one group at a time, the creator leaves the one it was in
+    bool named = ( currentUser.features & FEATURE_GROUPS ) != 0;
+    if ( !named && !session->groupIDs.empty() )
+        leaveGroupChat ( session , session->groupIDs.back() );
+    GroupID groupID = NO_GROUP;
+
+    if ( request->status == STATUS_SUCCESS ) {
+        // send to invited users
+        UserList receiverIDs;
+        vector <ConnectionID> receiverConnections;
+        // Whether each invited user takes the forward with the group ID
+        vector <bool> receiverNamed;
+        // Members as they are named in the CreateGroup Forward packet
+        vector <const User*> memberUsers ( 1 , &currentUser );
+        int replyLength = 0;
+        char *namedBuffer = NULL;
+        int namedLength = 0;
+
+        // Names are only looked up here, the invited users which are not
+        // logged in (or named twice, or the creator) are left out
+        beginEpochRead ();
+        for ( string_view invitedName : invitedNames ) {
+            User *invitedUser = findUserByName ( &userRegistry , invitedName );
+            if ( invitedUser == NULL || invitedUser->userID == currentUser.userID ||
+                 find ( receiverIDs.begin() , receiverIDs.end() , invitedUser->userID ) != receiverIDs.end() )
+                continue;
+
+            memberUsers.push_back ( invitedUser );
+            receiverIDs.push_back ( invitedUser->userID );
+            receiverConnections.push_back ( __atomic_load_n ( &invitedUser->connection , __ATOMIC_ACQUIRE ) );
+            receiverNamed.push_back ( ( invitedUser->features & FEATURE_GROUPS ) != 0 );
         }
-        if ( recv ( socketFD , buffer , bufferSize , MSG_WAITALL ) < bufferSize )
-            break;
-        // Put 'offset' as 0, so that the buffer is ready for reading using helper functions
-        offset = 0;
-
-        // Keep a reply buffer ready for sending a reply back
-        char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
-        if ( replyBuffer == NULL ) {
-            cerr << "Error: Heap Over\n";
-            close ( socketFD );
-            return NULL;
+        // The group, with the creator as its member and its invitations, exists
+        // before anyone is invited, so an answer always finds it
+        groupID = createGroup ( &groupTable , currentUser.userID , receiverIDs );
+        if ( groupID == NO_GROUP )
+            request->status = ERROR_UNKNOWN;
+        else {
+            session->groupIDs.push_back ( groupID );
+            // CreateGroup Forward packets to the invited users, with the names of the members,
+            // each form encoded once
+            replyLength = encodePacket < CreateGroupForward > ( replyBuffer , request->status ,
+                                                                currentUser.userName , memberUsers );
+            if ( find ( receiverNamed.begin() , receiverNamed.end() , true ) != receiverNamed.end() ) {
+                namedBuffer = (char*) allocBuffer ( MAX_PACKET_LENGTH );
+                namedLength = encodePacket < CreateGroupIDForward > ( namedBuffer , request->status , groupID ,
+                                                                      currentUser.userName , memberUsers );
+            }
         }
-        int replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-
-        // Step 3: Check what is the type of packet received
-        switch ( type ) {
-            /*
-             * Event:
-             * Login Request
-             *
-
-             * Action:
-             * 1. Set Cookie value
-             * 2. Send LOGIN_RESPONSE
-             */
-	    	case REQUEST_LOGIN: {
-
-                // Get the cookie value from the packet
-                uint32_t cookie;
-                cookie = getNextUint32 ( buffer , offset );
-				string userName;
-				userName = getNextString (buffer, offset);
-				for (int i = 0; i < userList.size(); i++)
-				{
-					if (userList.at(i).userName == userName)
-						status = ERROR_USERNAME;
-				}
-				if (status == STATUS_SUCCESS)
-				{
-					currentUser.userName = userName;
-					currentUser.socketFD = socketFD;
-					currentUser.cookie = ntohs ( clientAddress.sin_port );
-					currentUser.groupChatStatus = GROUPCHAT_EMPTY;
-					currentUser.groupChatUsers = &groupList; 
-
-					userList.push_back(currentUser);
-
-					// Client bob connected from 127.0.0.1:58101
-    				cout << "Client " << currentUser.userName << " connected from "
-                		 << inet_ntoa ( clientAddress.sin_addr )
-                		 << ":" << ntohs ( clientAddress.sin_port )
-                		 << endl;
-				}				
-
-
-                /*
-                 * If you are modifying the data structures, then
-                 * Write lock.
-                 */
-                // Read Lock the Data structure
-                pthread_rwlock_rdlock ( &userDataLock );
-
-                // Do any processing here...
-				//////////////////////////////
-				// Login Response packet to the Client
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , RESPONSE_LOGIN );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Status
-    			putNextUint32 ( replyBuffer , replyOffset , status );
-    			// Cookie (need to assign Cookie)
-    			putNextUint32 ( replyBuffer , replyOffset , currentUser.cookie);
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-                // Unlock the Data structure
-                pthread_rwlock_unlock ( &userDataLock );
-
-                // Send response here...
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
+        endEpochRead ();
 
-                break;
-            }
+        for ( int i = 0 ; i < receiverConnections.size() && replyLength > 0 ; i++ ) {
+            if ( receiverNamed[i] )
+                sendToUser ( receiverIDs[i] , receiverConnections[i] , namedBuffer , namedLength );
+            else
+                sendToUser ( receiverIDs[i] , receiverConnections[i] , replyBuffer , replyLength );
+        }
+        if ( namedBuffer != NULL )
+            freeBuffer ( namedBuffer );
+    }
 
-			/*
-			 * Event:
-			 * Talk Request
-			 * 
-			 * Action:
-			 * 1. Check if the cookie value is OK
-			 * 2. Reply a message to sender
-			 * 3. Forward message to the receiver
-			 */
-			case REQUEST_TALK: {
-				// Get the cookie value from the packet
-				uint32_t cookie;
-				int receiverSocketFD = -1;
-				cookie = getNextUint32(buffer, offset);
-				string senderName = getNextString(buffer, offset);
-				string receiverName = getNextString(buffer, offset);			
-
-				for (int i = 0; i < userList.size(); i++)
-				{
-					if (userList.at(i).userName == receiverName)
-					{
-						receiverSocketFD = userList.at(i).socketFD;
-						break;
-					}
-				}
-				if (receiverSocketFD == -1)
-					status = ERROR_USER_NOT_FOUND;
-				
-				if (status == STATUS_SUCCESS)
-				{
-	                // Read Lock the Data structure
-	                pthread_rwlock_rdlock ( &userDataLock );
-
-                	// Do any processing here...
-					//////////////////////////////
-					// Login Response packet to the Client
-    				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    				// Request Type
-    				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_TALK_FWD );
-    				// Length (we will fill this later on)
-    				putNextUint16 ( replyBuffer , replyOffset , 0 );
-    				// Status
-    				putNextUint32 ( replyBuffer , replyOffset , status );
-    				// Sender Name
-    				putNextString ( replyBuffer , replyOffset , senderName );
-					// Receiver Name
-    				putNextString ( replyBuffer , replyOffset , receiverName );
-					// Packet Message
-					string message = getNextString (buffer, offset);
-					while (message != "")
-					{
-    					putNextString ( replyBuffer , replyOffset , message );
-						message = getNextString (buffer, offset);
-					}
-                	// Terminate with two NULLs (i.e. terminate with an empty string)
-                	putNextString ( replyBuffer , replyOffset , "" );
-    				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-					///////////////////////////////
-
-                	// Unlock the Data structure
-                	pthread_rwlock_unlock ( &userDataLock );
-
-    				if ( send ( receiverSocketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        				cerr << "Error on send()\n";
-       				 	close ( receiverSocketFD );
-    				}
-				}
-				
-				delete[] replyBuffer;
-
-				char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
-        		if ( replyBuffer == NULL ) {
-            		cerr << "Error: Heap Over\n";
-            		close ( socketFD );
-            		return NULL;
-        		}
-
-	            // Read Lock the Data structure
-	            pthread_rwlock_rdlock ( &userDataLock );
-
-               	// Do any processing here...
-				//////////////////////////////
-				// Login Response packet to the Client
-   				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-   				// Request Type
-   				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_TALK );
-   				// Length (we will fill this later on)
-   				putNextUint16 ( replyBuffer , replyOffset , 0 );
-   				// Status
-   				putNextUint32 ( replyBuffer , replyOffset , status );
-   				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-   				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-               	// Unlock the Data structure
-               	pthread_rwlock_unlock ( &userDataLock );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
-				
-				// not a serious error, reset status to STATUS_SUCCESS after report error to sender
-				status = STATUS_SUCCESS;
-
-				break;
-			}
-
-			/*
-			 * Event:
-
-			 * Yell Request
-			 * 
-			 * Action:
-			 * 1. Check if the cookie value is OK
-			 * 2. Reply a message to sender
-			 * 3. Forward message to the all other online users
-			 */
-			case REQUEST_YELL: {
-				// Get the cookie value from the packet
-				uint32_t cookie;
-				cookie = getNextUint32(buffer, offset);	
-				string userName;	
-				int receiverSocketFD;
-
-				for (int i = 0; i < userList.size(); i++)
-				{
-					if (userList.at(i).cookie == cookie)
-					{
-						userName = userList.at(i).userName;
-						break;
-					}
-				}
-
-				if (userList.size() == 1)
-					status = ERROR_NO_USER_ONLINE;
-				
-				if (status == STATUS_SUCCESS)
-				{
-	                // Read Lock the Data structure
-	                pthread_rwlock_rdlock ( &userDataLock );
-
-					//////////////////////////////
-					// Login Response packet to the Client
-    				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    				// Response Type
-    				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_YELL_FWD );
-    				// Length (we will fill this later on)
-    				putNextUint16 ( replyBuffer , replyOffset , 0 );
-    				// Status
-    				putNextUint32 ( replyBuffer , replyOffset , status );
-    				// Sender Name
-    				putNextString ( replyBuffer , replyOffset , userName );
-					// Packet Message
-					string message = getNextString (buffer, offset);
-					while (message != "")
-					{
-    					putNextString ( replyBuffer , replyOffset , message );
-						message = getNextString (buffer, offset);
-					}
-                	// Terminate with two NULLs (i.e. terminate with an empty string)
-                	putNextString ( replyBuffer , replyOffset , "" );
-    				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-					///////////////////////////////
-
-                	// Unlock the Data structure
-                	pthread_rwlock_unlock ( &userDataLock );
-					
-					// send to all online users
-					for (int i = 0; i < userList.size(); i++)
-					{
-						if (userList.at(i).cookie != cookie)
-						{
-							receiverSocketFD = userList.at(i).socketFD;
-    						if ( send ( receiverSocketFD , replyBuffer , replyOffset , 0 ) < 0 )
-							{
-        						cerr << "Error on send()\n";
-       				 			close ( receiverSocketFD );
-    						}
-						}
-					}
-				}
-				
-				delete[] replyBuffer;
-
-				char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
-        		if ( replyBuffer == NULL ) {
-            		cerr << "Error: Heap Over\n";
-            		close ( socketFD );
-            		return NULL;
-        		}
-
-	            // Read Lock the Data structure
-	            pthread_rwlock_rdlock ( &userDataLock );
-
-               	// Do any processing here...
-				//////////////////////////////
-				// Login Response packet to the Client
-   				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-   				// Request Type
-   				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_YELL );
-   				// Length (we will fill this later on)
-   				putNextUint16 ( replyBuffer , replyOffset , 0 );
-   				// Status
-   				putNextUint32 ( replyBuffer , replyOffset , status );
-   				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-   				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-               	// Unlock the Data structure
-               	pthread_rwlock_unlock ( &userDataLock );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
-				
-				// not a serious error, reset status to STATUS_SUCCESS after report error to sender
-				status = STATUS_SUCCESS;
-
-				break;
-			}
-
-            /*
-             * Event:
-             * Show Request
-             *
-             * Action:
-             * 1. Check if the cookie value is OK
-             * 2. Send back the list of users
-             */
-            case REQUEST_SHOW: {
-
-                // Get the cookie value from the packet
-                uint32_t cookie;
-                cookie = getNextUint32 ( buffer , offset );
-
-                // Read Lock the Data structure
-                pthread_rwlock_rdlock ( &userDataLock );
-
-                // Do any processing here...
-				//////////////////////////////
-				// Login Response packet to the Client
-   				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-   				// Request Type
-   				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_SHOW );
-   				// Length (we will fill this later on)
-   				putNextUint16 ( replyBuffer , replyOffset , 0 );
-   				// Status
-   				putNextUint32 ( replyBuffer , replyOffset , status );
-				// Names
-				for (int i = 0; i < userList.size(); i++)
-					putNextString(replyBuffer, replyOffset, userList.at(i).userName);
-				// Terminate with two NULLs (i.e. terminate with an empty string)
-                putNextString ( replyBuffer , replyOffset , "" );
-   				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-   				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-                // Unlock the Data structure
-                pthread_rwlock_unlock ( &userDataLock );
-
-                // Send response here...
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
+    // CreateGroup Response packet to the sender (with the ID of the group)
+    int replyLength = named ? encodePacket < CreateGroupIDResponse > ( replyBuffer , request->status , groupID )
+                            : encodePacket < CreateGroupResponse > ( replyBuffer , request->status );
 
-                break;
-            }
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
+    }
 
-			/*
-			 * Event:
-			 * CreateGroup Request
-			 * 
-			 * Action:
-			 * 1. Check if the cookie value is OK
-			 * 2. Reply a message to sender
-			 * 3. Forward invitation to the invited users
-			 */
-			case REQUEST_CREATEGROUP: {
-				// Get the cookie value from the packet
-				uint32_t cookie;
-				cookie = getNextUint32(buffer, offset);		
-				int receiverSocketFD;
-
-				// gather names of invited users
-				// including the creator of the group
-				(currentUser.groupChatUsers)->push_back(currentUser.userName);
-				string message = getNextString (buffer, offset);
-				while (message != "")
-				{
-//					for (int i = 0; i < userList.size(); i++)
-//					{
-//						if (userList.at(i).userName == message)
-//						{
-//							userName = userList.at(i).userName;
-//							break;
-//						}
-//					}
-					(currentUser.groupChatUsers)->push_back(message);
-					message = getNextString (buffer, offset);
-				}
-
-				currentUser.groupChatStatus = GROUPCHAT_PENDING;
-
-//					currentUser.userName = userName;
-//					currentUser.socketFD = socketFD;
-//					currentUser.cookie = ntohs ( clientAddress.sin_port );
-//					currentUser.groupChatStatus = GROUPCHAT_EMPTY;
-//					currentUser.groupChatUsers = &groupList; 
-				
-				if (status == STATUS_SUCCESS)
-				{
-	                // Read Lock the Data structure
-	                pthread_rwlock_rdlock ( &userDataLock );
-
-					//////////////////////////////
-					// Login Response packet to the Client
-    				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    				// Response Type
-    				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_CREATEGROUP_FWD);
-    				// Length (we will fill this later on)
-    				putNextUint16 ( replyBuffer , replyOffset , 0 );
-    				// Status
-    				putNextUint32 ( replyBuffer , replyOffset , status );
-    				// Sender Name
-    				putNextString ( replyBuffer , replyOffset , currentUser.userName );
-					// invited namelist
-					for (int j = 0; j < (currentUser.groupChatUsers)->size(); j++)
-					{
-						putNextString(replyBuffer, replyOffset, (currentUser.groupChatUsers)->at(j));
-					}
-    				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-					///////////////////////////////
-
-                	// Unlock the Data structure
-                	pthread_rwlock_unlock ( &userDataLock );
-					
-					// send to invited users
-					for (int j = 0; j < (currentUser.groupChatUsers)->size(); j++)		
-					{
-						if ((currentUser.groupChatUsers)->at(j) == currentUser.userName)
-							continue;
-
-						for (int i = 0; i < userList.size(); i++)
-						{
-							if (userList.at(i).userName == (currentUser.groupChatUsers)->at(j))
-							{
-								userList.at(i).groupChatStatus = GROUPCHAT_PENDING;
-								receiverSocketFD = userList.at(i).socketFD;
-	    						if ( send ( receiverSocketFD , replyBuffer , replyOffset , 0 ) < 0 )
-								{
-	        						cerr << "Error on send()\n";
-	       				 			close ( receiverSocketFD );
-	    						}
-								break;
-							}
-						}
-					}
-				}
-				
-				delete[] replyBuffer;
-
-				char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
-        		if ( replyBuffer == NULL ) {
-            		cerr << "Error: Heap Over\n";
-            		close ( socketFD );
-            		return NULL;
-        		}
-
-	            // Read Lock the Data structure
-	            pthread_rwlock_rdlock ( &userDataLock );
-
-               	// Do any processing here...
-				//////////////////////////////
-				// Login Response packet to the Client
-   				replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-   				// Request Type
-   				putNextUint16 ( replyBuffer , replyOffset , RESPONSE_CREATEGROUP );
-   				// Length (we will fill this later on)
-   				putNextUint16 ( replyBuffer , replyOffset , 0 );
-   				// Status
-   				putNextUint32 ( replyBuffer , replyOffset , status );
-   				// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-   				putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-               	// Unlock the Data structure
-               	pthread_rwlock_unlock ( &userDataLock );
-
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
-				
-				// not a serious error, reset status to STATUS_SUCCESS after report error to sender
-				status = STATUS_SUCCESS;
-
-				break;
-			}
-
-			/*
-			 * Event:
-			 * LeaveGroup Request
-			 * 
-			 * Action:
-			 * 1. Check if the cookie value is OK
-			 * 2. Reply a message to sender
-			 * 3. Forward notification to the group members
-			 */
-			case REQUEST_LEAVEGROUP: {
-
-				// !!! INCOMPLETE !!!
-
-				// set groupChatStatus back to empty
-				currentUser.groupChatStatus = GROUPCHAT_EMPTY;
-				// erase all the groupChatUsers record
-				currentUser.groupChatUsers = &groupList; 
-				
-				break;
-			}
-
-            /*
-             * Event:
-             * Exit Request
-             *
-
-             * Action:
-             * 1. Check if the cookie value is OK
-             * 2. Send RESPONSE_EXIT
-	     	 * 3. Send RESPONSE_EXIT_FWD
-             */
-            case REQUEST_EXIT: {
-
-                // Get the cookie value from the packet
-                uint32_t cookie;
-                cookie = getNextUint32 ( buffer , offset );
-				string userName;
-				userName = getNextString (buffer, offset);
-				for (int i = 0; i < userList.size(); i++)
-				{
-					if (userList.at(i).userName == userName)
-					{
-						userList.erase(userList.begin()+i);
-					}
-				}
-				// Client bob exited from 127.0.0.1:58101
-    			cout << "Client " << userName << " exited from "
-                	 << inet_ntoa ( clientAddress.sin_addr )
-                	 << ":" << ntohs ( clientAddress.sin_port )
-                	 << endl;	
-
-                /*
-                 * If you are modifying the data structures, then
-                 * Write lock.
-
-                 */
-                // Read Lock the Data structure
-                pthread_rwlock_rdlock ( &userDataLock );
-
-                // Do any processing here...
-				//////////////////////////////
-				// Send a Login request to the sender
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , RESPONSE_EXIT );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Status
-    			putNextUint32 ( replyBuffer , replyOffset , status);
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-                // Unlock the Data structure
-                pthread_rwlock_unlock ( &userDataLock );
-
-                // Send response here...
-    			if ( send ( socketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-        			cerr << "Error on send()\n";
-       			 	close ( socketFD );
-    			}
-
-				delete[] replyBuffer;
-       			
-				char *replyBuffer = new char[ MAX_PACKET_LENGTH ];
-        		if ( replyBuffer == NULL ) {
-            		cerr << "Error: Heap Over\n";
-            		close ( socketFD );
-            		return NULL;
-        		}
-
-                // Read Lock the Data structure
-                pthread_rwlock_rdlock ( &userDataLock );
-
-				//////////////////////////////
-				// Send a Login request to the other clients
-    			replyOffset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
-    			// Request Type
-    			putNextUint16 ( replyBuffer , replyOffset , RESPONSE_EXIT_FWD );
-    			// Length (we will fill this later on)
-    			putNextUint16 ( replyBuffer , replyOffset , 0 );
-    			// Status
-    			putNextUint32 ( replyBuffer , replyOffset , status );
-    			// User name
-    			putNextString ( replyBuffer , replyOffset , userName );
-    			// Now 'replyOffset' has the number of bytes we put in the buffer, we can now write the length
-    			putNextUint16 ( replyBuffer , lengthOffset , replyOffset );
-				///////////////////////////////
-
-                // Unlock the Data structure
-                pthread_rwlock_unlock ( &userDataLock );
-
-				int everySocketFD = 0;
-				
-				for (int i = 0; i < userList.size(); i++)
-				{
-					if (userList.at(i).userName != userName)
-					{
-						everySocketFD = userList.at(i).socketFD;
-						if ( send ( everySocketFD , replyBuffer , replyOffset , 0 ) < 0 ) {
-    	    				cerr << "Error on send()\n";
-    	   			 		close ( socketFD );
-    					}
-					}
-				}
-
-        		// Buffer should be deallocated
-        		delete[] buffer;
-        		delete[] replyBuffer;
-
-                // break;
-				close (socketFD);
-				return NULL;
-				
-            }
+    // not a serious error, reset status to STATUS_SUCCESS after report error to sender
+    request->status = STATUS_SUCCESS;
 
+    return true;
+}
 
-            // etc..
+/*
+ * Event:
+ * Discuss Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Reply a message to sender
+ * 3. Forward message to the other members of the group
+ */
+bool handleDiscuss ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value (and the group) from the packet
+    uint32_t cookie;
+    GroupID groupID = NO_GROUP;
+    string_view text;
+    FrameStrings words = { NULL };
+    bool isText = ( session->currentUser.features & FEATURE_MESSAGE_TEXT ) != 0;
+    bool decoded;
+    if ( session->currentUser.features & FEATURE_GROUPS )
+        decoded = isText ? decodePacket < DiscussIDTextRequest > ( &request->reader , cookie , groupID , text )
+                         : decodePacket < DiscussIDRequest > ( &request->reader , cookie , groupID , words );
+    else
+        decoded = isText ? decodePacket < DiscussTextRequest > ( &request->reader , cookie , text )
+                         : decodePacket < DiscussRequest > ( &request->reader , cookie , words );
+    if ( !decoded )
+        return malformedRequest ();
+    groupID = sessionGroup ( session , groupID );
+    const string &userName = session->currentUser.userName;
+    if ( !session->loggedIn )
+        request->status = ERROR_COOKIE_INVALID;
+
+    // The other members, by their IDs. Only the members of the group are looked
+    // at, without a lock. The read section ends with the list: a member leaving
+    // later (and a newcomer in its slot) is told apart by its ID in the chunks.
+    DiscussFanout fanout;
+    fanout.continued = request->continued;
+    fanout.groupID = groupID;
+    fanout.userName = userName;
+    fanout.isText = isText;
+    fanout.text = text;
+    fanout.words = request->reader;
+    fill ( fanout.forwards , fanout.forwards + 8 , (SharedFrame*) NULL );
+    uint32_t senderIndex = userIndex ( session->currentUser.userID );
+    beginEpochRead ();
+    const UserBitmap *members = getGroupMembers ( &groupTable , groupID );
+    bool inGroup = request->status == STATUS_SUCCESS && members != NULL && bitmapContains ( members , senderIndex );
+    if ( inGroup ) {
+        fanout.memberIDs.reserve ( members->count );
+        forEachInBitmap ( members , [&] ( uint32_t index ) {
+            const User *member = index != senderIndex ? getUserByIndex ( &userRegistry , index ) : NULL;
+            if ( member != NULL )
+                fanout.memberIDs.push_back ( member->userID );
+        } );
+    }
+    else if ( request->status == STATUS_SUCCESS )
+        request->status = ERROR_NOT_IN_GROUP;
+    endEpochRead ();
+
+    // Discuss Forward packets (with as much of the message as fits), each form
+    // encoded once and shared by all the members who take it. The members of a
+    // large group are sent to by several workers at once, and all of them before
+    // the next message of the sender.
+    if ( request->status == STATUS_SUCCESS )
+        runFanout ( &discussCost , fanout.memberIDs.size() , sendDiscussChunk , &fanout );
+    for ( SharedFrame *forward : fanout.forwards ) {
+        if ( forward != NULL )
+            releaseSharedFrame ( forward , 1 );
+    }
 
-            default: {
-                break;
-            }
-        }
+    // One response for all the chunks of a message
+    if ( holdReply ( session , request ) )
+        return true;
 
-        // Buffer should be deallocated
-        delete[] buffer;
-        delete[] replyBuffer;
+    // Discuss Response packet to the sender
+    int replyLength = encodePacket < DiscussResponse > ( replyBuffer , request->status );
 
-		if (status != STATUS_SUCCESS)
-		{
-			cerr << "Error occurred" << endl;
-			close (socketFD);
-			return NULL;
-		}
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
     }
 
-    // If we broke out of the loop, then the connection was closed or
-    // there was an error
-    cerr << "Client closed connection unexpectedly\n";
-    close ( socketFD );
+    // not a serious error, reset status to STATUS_SUCCESS after report error to sender
+    request->status = STATUS_SUCCESS;
 
-    // Exit the thread
-    return NULL;
+    return true;
 }
 
-string getNextString ( const char *buffer , int &offset ) {
+/*
+ * Event:
+ * LeaveGroup Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Take the user out of its group
+ * 3. Reply a message to sender
+ */
+bool handleLeaveGroup ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value (and the group) from the packet
+    uint32_t cookie;
+    GroupID groupID = NO_GROUP;
+    if ( ( session->currentUser.features & FEATURE_GROUPS )
+            ? !decodePacket < LeaveGroupIDRequest > ( &request->reader , cookie , groupID )
+            : !decodePacket < LeaveGroupRequest > ( &request->reader , cookie ) )
+        return malformedRequest ();
+
+    // The group goes with its last member
+    if ( !session->loggedIn )
+        request->status = ERROR_COOKIE_INVALID;
+    else if ( !leaveGroupChat ( session , sessionGroup ( session , groupID ) ) )
+        request->status = ERROR_NOT_IN_GROUP;
+
+    // LeaveGroup Response packet to the sender
+    int replyLength = encodePacket < LeaveGroupResponse > ( replyBuffer , request->status );
+
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) ) {
+        cerr << "Error on send()\n";
+        return false;
+    }
+
+    // not a serious error, reset status to STATUS_SUCCESS after report error to sender
+    request->status = STATUS_SUCCESS;
+
+    return true;
+}
+
+/*
+ * Event:
+ * JoinGroup Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Join the group the user was invited to, if it accepts
+ * 3. Forward the answer to the group and the inviter
+ */
+bool handleJoinGroup ( Connection *conn , Request *request , char* ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value, the group (with FEATURE_GROUPS, else the last
+    // invitation is answered) and the answer from the packet
+    uint32_t cookie;
+    GroupID groupID = NO_GROUP;
+    uint16_t answer;
+    bool named = ( session->currentUser.features & FEATURE_GROUPS ) != 0;
+    if ( named ? !decodePacket < JoinGroupIDRequest > ( &request->reader , cookie , groupID , answer )
+               : !decodePacket < JoinGroupRequest > ( &request->reader , cookie , answer ) )
+        return malformedRequest ();
+
+    // There is no JoinGroup response, the groups forward the answer (see
+    // onInvitationEnd()), and an answer to an invitation which is gone changes
+    // nothing. A client which has not logged in has no invitation to answer.
+    if ( !session->loggedIn )
+        return true;
+    groupID = answerInvitation ( &groupTable , session->currentUser.userID , groupID , answer == ACCEPT_GROUP );
+    if ( groupID != NO_GROUP ) {
+        // Without FEATURE_GROUPS a user is in one group at a time
+        if ( !named && !session->groupIDs.empty() )
+            leaveGroupChat ( session , session->groupIDs.back() );
+        session->groupIDs.push_back ( groupID );
+    }
+
+    return true;
+}
+
+/*
+ * Event:
+ * Exit Request
+ *
+ * Action:
+ * 1. Check if the cookie value is OK
+ * 2. Send RESPONSE_EXIT
+ * 3. Send RESPONSE_EXIT_FWD
+ */
+bool handleExit ( Connection *conn , Request *request , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Get the cookie value and the user name from the packet
+    uint32_t cookie;
+    string_view userName;
+    if ( !decodePacket < ExitRequest > ( &request->reader , cookie , userName ) )
+        return malformedRequest ();
+
+    // The user of this session, whatever name the request gives (and who is
+    // not told of its own exit)
+    setBroadcast ( conn , 0 );
+    if ( session->loggedIn ) {
+        leaveGroupChats ( session );
+        removeRosterUser ( &roster , session->currentUser.userID );
+        removeUser ( &userRegistry , session->currentUser.userID );
+    }
+
+    session->loggedIn = false;
+    session->exited = true;
+
+    // Client bob exited from 127.0.0.1:58101
+    cout << "Client " << userName << " exited from "
+         << inet_ntoa ( conn->clientAddress.sin_addr )
+         << ":" << ntohs ( conn->clientAddress.sin_port )
+         << endl;
+
+    // Exit Response packet to the sender
+    int replyLength = encodePacket < ExitResponse > ( replyBuffer , request->status );
+
+    // Send response here...
+    if ( !sendReply ( conn , request->requestID , replyBuffer , replyLength ) )
+        cerr << "Error on send()\n";
+
+    // Exit Forward packet to the other clients, with the user name (the
+    // users of FEATURE_PRESENCE were told by the roster)
+    replyLength = encodePacket < ExitForward > ( replyBuffer , request->status , userName );
+
+    broadcastToUsers ( replyBuffer , replyLength , conn , BROADCAST_EXITS );
+
+    // The reactor closes the connection
+    return false;
+}
+
+bool malformedRequest () {
+    cerr << "Error: Malformed request\n";
+    return false;
+}
+
+bool holdReply ( ClientSession *session , Request *request ) {
+
+    if ( session->chunkStatus == STATUS_SUCCESS )
+        session->chunkStatus = request->status;
+    if ( request->continued ) {
+        request->status = STATUS_SUCCESS;
+        return true;
+    }
 
-    char nextString [ MAX_CHAT_LENGTH ];
+    // Last chunk (or a whole message), the reply has the first error of the message
+    request->status = session->chunkStatus;
+    session->chunkStatus = STATUS_SUCCESS;
+    return false;
+}
+
+unsigned broadcastChannel ( uint32_t features ) {
+    unsigned channel = ( features & FEATURE_MESSAGE_TEXT ) ? BROADCAST_TEXT : BROADCAST_WORDS;
+    if ( features & FEATURE_CHUNKED )
+        channel <<= 1;
+    return channel | ( ( features & FEATURE_PRESENCE ) ? BROADCAST_PRESENCE : BROADCAST_EXITS );
+}
+
+void broadcastMessage ( char *buffer , int length , Connection *except , bool continued ,
+                        unsigned channel , unsigned chunkChannel ) {
 
-    // Read the string byte by byte till we reach NULL
-    int i = 0;
-    while ( ( nextString[i++] = buffer[ offset++ ] ) != '\0' ) {
-        if ( i >= MAX_CHAT_LENGTH )
-            break;
+    if ( !continued ) {
+        broadcastToUsers ( buffer , length , except , channel | chunkChannel );
+        return;
     }
-    nextString[i - 1] = '\0';
 
-    // The value of offset is now ready for the next call to getNextThing()
-    return string ( nextString );
+    // A chunk followed by more goes out as it is to the users who take
+    // chunks, and as a message of its own to the others
+    broadcastToUsers ( buffer , length , except , channel );
+    markPacketContinued ( buffer );
+    broadcastToUsers ( buffer , length , except , chunkChannel );
 }
 
-uint32_t getNextUint32 ( const char *buffer , int &offset ) {
+uint32_t newCookie () {
 
-    // Read the next uint32_t
-    uint32_t value;
-    value = *( const uint32_t* ) ( buffer + offset );
+    uint32_t cookie = 0;
+    if ( getrandom ( &cookie , sizeof ( cookie ) , 0 ) != sizeof ( cookie ) )
+        cerr << "Error on getrandom()\n";
+    return cookie;
+}
 
-    // Convert from Network to Host order
-    value = ntohl ( value );
+bool resumeLogin ( Connection *conn , uint32_t cookie , string_view userName , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+
+    // Both the cookie and the name must match a user away
+    beginEpochRead ();
+    const User *user = findUserByCookie ( &userRegistry , cookie );
+    bool away = user != NULL && user->userName == userName &&
+                __atomic_load_n ( &user->connection , __ATOMIC_ACQUIRE ) == NO_CONNECTION;
+    UserID userID = away ? user->userID : NO_USER;
+    uint32_t features = away ? user->features : 0;
+    endEpochRead ();
+    if ( !away )
+        return false;
+
+    // Login Response packet to the Client, with the same cookie and features, followed by what it missed
+    int replyLength = encodePacket < LoginResponse > ( replyBuffer , STATUS_SUCCESS , cookie , features );
+    ClientSession *old = (ClientSession*) resumeUser ( &resumeStore , userID , conn , replyBuffer , replyLength );
+    if ( old == NULL )
+        return false;
+
+    // This connection takes the session over
+    User &currentUser = session->currentUser;
+    session->groupIDs.swap ( old->groupIDs );
+    currentUser.userName = old->currentUser.userName;
+    currentUser.userID = userID;
+    currentUser.connection = connectionID ( conn );
+    currentUser.cookie = cookie;
+    // Read by the reactor as well (see isIndependentRequest())
+    __atomic_store_n ( &currentUser.features , features , __ATOMIC_RELEASE );
+    session->loggedIn = true;
+    delete old;
+
+    // Client bob came back from 127.0.0.1:58101
+    cout << "Client " << currentUser.userName << " came back from "
+         << inet_ntoa ( conn->clientAddress.sin_addr )
+         << ":" << ntohs ( conn->clientAddress.sin_port )
+         << endl;
+    return true;
+}
 
-    // The value of offset is now ready for the next call to getNextThing()
-    offset += sizeof ( uint32_t );
-    return value;
+GroupID sessionGroup ( ClientSession *session , GroupID named ) {
+    if ( session->currentUser.features & FEATURE_GROUPS )
+        return named;
+    return session->groupIDs.empty() ? NO_GROUP : session->groupIDs.back();
 }
 
-uint16_t getNextUint16 ( const char *buffer , int &offset ) {
+bool leaveGroupChat ( ClientSession *session , GroupID groupID ) {
+    vector <GroupID>::iterator found = find ( session->groupIDs.begin() , session->groupIDs.end() , groupID );
+    if ( found == session->groupIDs.end() )
+        return false;
+    session->groupIDs.erase ( found );
+    return leaveGroup ( &groupTable , groupID , session->currentUser.userID );
+}
 
-    // Read the next uint16_t
-    uint16_t value;
-    value = *( const uint16_t* ) ( buffer + offset );
+void leaveGroupChats ( ClientSession *session ) {
+    for ( GroupID groupID : session->groupIDs )
+        leaveGroup ( &groupTable , groupID , session->currentUser.userID );
+    session->groupIDs.clear();
+    dropInvitations ( &groupTable , session->currentUser.userID );
+}
 
-    // Convert from Network to Host order
-    value = ntohs ( value );
+int encodeDiscussForward ( char *buffer , int form , GroupID groupID , string_view userName ,
+                           bool isText , string_view text , FrameStrings words ) {
+
+    bool named = ( form & 4 ) != 0;
+    // The message as it was sent, or turned from text into words (or back)
+    if ( form & 2 ) {
+        if ( isText )
+            return named ? encodePacket < DiscussIDTextForward > ( buffer , STATUS_SUCCESS , groupID , userName , text )
+                         : encodePacket < DiscussTextForward > ( buffer , STATUS_SUCCESS , userName , text );
+        return named ? encodePacket < DiscussIDTextForward > ( buffer , STATUS_SUCCESS , groupID , userName , words )
+                     : encodePacket < DiscussTextForward > ( buffer , STATUS_SUCCESS , userName , words );
+    }
+    if ( isText )
+        return named ? encodePacket < DiscussIDForward > ( buffer , STATUS_SUCCESS , groupID , userName , MessageWords { text } )
+                     : encodePacket < DiscussForward > ( buffer , STATUS_SUCCESS , userName , MessageWords { text } );
+    return named ? encodePacket < DiscussIDForward > ( buffer , STATUS_SUCCESS , groupID , userName , words )
+                 : encodePacket < DiscussForward > ( buffer , STATUS_SUCCESS , userName , words );
+}
 
-    // The value of offset is now ready for the next call to getNextThing()
-    offset += sizeof ( uint16_t );
-    return value;
+void sendToUser ( UserID userID , ConnectionID connection , const char *buffer , int length ) {
+    if ( connection != NO_CONNECTION )
+        sendPacket ( connection , buffer , length );
+    else
+        holdPacket ( &resumeStore , userID , buffer , length );
 }
 
-void putNextString ( char *buffer , int &offset , const string &nextString ) {
+void sendToGroup ( const UserList &userIDs , const vector <ConnectionID> &connections , const char *buffer , int length ) {
 
-    // Write the string byte by byte till we reach NULL
-    int i = 0;
-    const char *str = nextString.c_str();
-    while ( ( buffer[ offset++ ] = str[i++] ) != '\0' )
-        ;
+    int online = count_if ( connections.begin() , connections.end() ,
+                            [] ( ConnectionID connection ) { return connection != NO_CONNECTION; } );
+    SharedFrame *shared = online > 0 ? newSharedFrame ( buffer , length , online ) : NULL;
+    for ( size_t i = 0 ; i < userIDs.size() ; i++ ) {
+        if ( connections[i] != NO_CONNECTION )
+            sendSharedFrame ( connections[i] , shared );
+        else
+            holdPacket ( &resumeStore , userIDs[i] , buffer , length );
+    }
+}
 
-    // The value of offset is now ready for the next call to putNextThing()
+void sendSharedToGroup ( const UserList &userIDs , const vector <ConnectionID> &connections , SharedFrame *shared ) {
+
+    // One reference for each member online, taken at once
+    int online = count_if ( connections.begin() , connections.end() ,
+                            [] ( ConnectionID connection ) { return connection != NO_CONNECTION; } );
+    if ( online > 0 )
+        retainSharedFrame ( shared , online );
+    for ( size_t i = 0 ; i < userIDs.size() ; i++ ) {
+        if ( connections[i] != NO_CONNECTION )
+            sendSharedFrame ( connections[i] , shared );
+        else
+            holdPacket ( &resumeStore , userIDs[i] , sharedFrameData ( shared ) , shared->length );
+    }
 }
 
-void putNextUint32 ( char *buffer , int &offset , uint32_t nextUint32 ) {
+void sendDiscussChunk ( void *context , size_t first , size_t last ) {
+
+    DiscussFanout *fanout = (DiscussFanout*) context;
+
+    // The members of the chunk, by the forward they take: words (0) or text (2),
+    // with the group ID (+4) or not, as a chunk (+1) or not
+    UserList receiverIDs[8];
+    vector <ConnectionID> receiverConnections[8];
+    beginEpochRead ();
+    for ( size_t i = first ; i < last ; i++ ) {
+        const User *member = getUser ( &userRegistry , fanout->memberIDs[i] );
+        if ( member == NULL )
+            continue;
+        int form = ( ( member->features & FEATURE_GROUPS ) ? 4 : 0 ) +
+                   ( ( member->features & FEATURE_MESSAGE_TEXT ) ? 2 : 0 ) +
+                   ( ( fanout->continued && ( member->features & FEATURE_CHUNKED ) ) ? 1 : 0 );
+        receiverIDs[ form ].push_back ( member->userID );
+        receiverConnections[ form ].push_back ( __atomic_load_n ( &member->connection , __ATOMIC_ACQUIRE ) );
+    }
+    endEpochRead ();
 
-    // Convert from Host to Network order
-    nextUint32 = htonl ( nextUint32 );
+    for ( int form = 0 ; form < 8 ; form++ ) {
+        if ( !receiverIDs[ form ].empty() )
+            sendSharedToGroup ( receiverIDs[ form ] , receiverConnections[ form ] , discussForward ( fanout , form ) );
+    }
+}
+
+SharedFrame* discussForward ( DiscussFanout *fanout , int form ) {
+
+    SharedFrame *shared = __atomic_load_n ( &fanout->forwards[ form ] , __ATOMIC_ACQUIRE );
+    if ( shared != NULL )
+        return shared;
+
+    // Two chunks may encode it at the same time, the first one published is kept
+    char buffer[ MAX_PACKET_LENGTH ];
+    FrameReader words = fanout->words;
+    int length = encodeDiscussForward ( buffer , form & ~1 , fanout->groupID , fanout->userName ,
+                                        fanout->isText , fanout->text , FrameStrings { &words } );
+    if ( form & 1 )
+        markPacketContinued ( buffer );
+    shared = newSharedFrame ( buffer , length , 1 );
+    SharedFrame *published = NULL;
+    if ( !__atomic_compare_exchange_n ( &fanout->forwards[ form ] , &published , shared , false ,
+                                        __ATOMIC_ACQ_REL , __ATOMIC_ACQUIRE ) ) {
+        releaseSharedFrame ( shared , 1 );
+        return published;
+    }
+    return shared;
+}
+
+void broadcastToUsers ( const char *buffer , int length , Connection *except , unsigned channels ) {
+
+    // Held first, so that a user coming back meanwhile does not miss it
+    holdBroadcast ( &resumeStore , buffer , length , channels );
+    broadcastPacket ( buffer , length , except , channels );
+}
 
-    // Write the next uint32_t
-    *( uint32_t* ) ( buffer + offset ) = nextUint32;
+bool sendReply ( Connection *conn , uint32_t requestID , char *replyBuffer , int replyLength ) {
 
-    // The value of offset is now ready for the next call to putNextThing()
-    offset += sizeof ( uint32_t );
+    ClientSession *session = (ClientSession*) conn->context;
+    if ( ( session->currentUser.features & FEATURE_REQUEST_IDS ) == 0 )
+        return sendPacket ( connectionID ( conn ) , replyBuffer , replyLength );
+
+    // The header moves into the room in front of the packet, the ID takes its place
+    char *packet = replyBuffer - REQUEST_ID_LENGTH;
+    putTaggedHeader ( packet , replyBuffer , requestID );
+    return sendPacket ( connectionID ( conn ) , packet , replyLength + REQUEST_ID_LENGTH );
 }
 
-void putNextUint16 ( char *buffer , int &offset , uint16_t nextUint16 ) {
+bool sendRoster ( Connection *conn , uint32_t requestID , const vector <SharedFrame*> &pages , char *replyBuffer ) {
+
+    ClientSession *session = (ClientSession*) conn->context;
+    uint32_t features = session->currentUser.features;
 
-    // Convert from Host to Network order
-    nextUint16 = htons ( nextUint16 );
+    // Without chunks, only the first page, which must then not look like a chunk
+    int count = ( features & FEATURE_CHUNKED ) ? pages.size() : 1;
+    for ( int i = count ; i < pages.size() ; i++ )
+        releaseSharedFrame ( pages[i] , 1 );
+
+    bool sent = true;
+    for ( int i = 0 ; i < count ; i++ ) {
+        SharedFrame *page = pages[i];
+        bool unmark = i == count - 1 && count < pages.size();
+        if ( ( features & FEATURE_REQUEST_IDS ) == 0 && !unmark ) {
+            // The usual case, the frame is queued as it is
+            sent = sendSharedFrame ( connectionID ( conn ) , page ) && sent;
+            continue;
+        }
 
-    // Write the next uint16_t
-    *( uint16_t* ) ( buffer + offset ) = nextUint16;
+        // The request ID goes into the packet, so the page is copied (it is not encoded again)
+        int replyLength = page->length;
+        memcpy ( replyBuffer , sharedFrameData ( page ) , replyLength );
+        releaseSharedFrame ( page , 1 );
+        if ( unmark )
+            replyBuffer[0] &= ~( PACKET_CONTINUED >> 8 );
+        sent = sendReply ( conn , requestID , replyBuffer , replyLength ) && sent;
+    }
+
+    if ( !sent )
+        cerr << "Error on send()\n";
+    return sent;
+}
 
-    // The value of offset is now ready for the next call to putNextThing()
-    offset += sizeof ( uint16_t );
+string_view listString ( const User *user ) {
+    return user->userName;
 }
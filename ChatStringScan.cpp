@@ -0,0 +1,159 @@
+// ChatStringScan.cpp
+
+#include <stdint.h>
+
+#if defined ( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+#include "ChatRecvBuffer.h"
+#include "ChatStringScan.h"
+
+/// @brief  Scan used by findStringEnds(), chosen on the first call
+typedef int (*StringScanFunction) ( const char *data , int length , uint16_t *ends , int maxCount );
+
+#if defined ( __x86_64__ )
+/// @brief  Scans with the SIMD instruction sets
+static int findStringEndsSSE2 ( const char *data , int length , uint16_t *ends , int maxCount );
+static int findStringEndsAVX2 ( const char *data , int length , uint16_t *ends , int maxCount );
+#endif
+/// @brief  Best scan for this processor
+static StringScanFunction chooseStringScan ( const char **name );
+/// @brief  Add the NULLs marked in 'mask' (one bit per byte from 'base' on) to 'ends'
+static inline int addStringEnds ( uint32_t mask , int base , uint16_t *ends , int count , int maxCount );
+
+static const char *scanName = NULL;
+static const StringScanFunction scanFunction = chooseStringScan ( &scanName );
+
+int findStringEnds ( const char *data , int length , uint16_t *ends , int maxCount ) {
+    return scanFunction ( data , length , ends , maxCount );
+}
+
+const char* stringScanName () {
+    return scanName;
+}
+
+int findStringEndsScalar ( const char *data , int length , uint16_t *ends , int maxCount ) {
+
+    int count = 0;
+    for ( int i = 0 ; i < length ; i++ ) {
+        if ( data[i] != '\0' )
+            continue;
+        if ( count == maxCount )
+            return -1;
+        ends[ count++ ] = i;
+    }
+    return count;
+}
+
+int scanFrameStrings ( FrameReader *reader , int start , uint16_t *ends , int maxCount ) {
+
+    if ( start > reader->length )
+        start = reader->length;
+    int count = findStringEnds ( reader->data + start , reader->length - start , ends , maxCount );
+    if ( count < 0 )
+        return -1;
+
+    // The reader wants them from the start of the body
+    for ( int i = 0 ; i < count ; i++ )
+        ends[i] += start;
+    reader->ends = ends;
+    reader->endCount = count;
+    reader->nextEnd = 0;
+    return count;
+}
+
+bool isStringList ( const FrameReader *reader , int start ) {
+
+    // The last string is empty, and ends the body
+    int count = reader->endCount;
+    if ( reader->ends == NULL || count == 0 || reader->ends[ count - 1 ] != reader->length - 1 )
+        return false;
+    int previous = count > 1 ? reader->ends[ count - 2 ] : start - 1;
+    if ( reader->ends[ count - 1 ] != previous + 1 )
+        return false;
+
+    // No other string is empty (it would end the list early)
+    previous = start - 1;
+    for ( int i = 0 ; i < count - 1 ; i++ ) {
+        if ( reader->ends[i] == previous + 1 )
+            return false;
+        previous = reader->ends[i];
+    }
+    return true;
+}
+
+static inline int addStringEnds ( uint32_t mask , int base , uint16_t *ends , int count , int maxCount ) {
+
+    // One bit per NULL, lowest first
+    while ( mask != 0 ) {
+        if ( count == maxCount )
+            return -1;
+        ends[ count++ ] = base + __builtin_ctz ( mask );
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+#if defined ( __x86_64__ )
+
+static int findStringEndsSSE2 ( const char *data , int length , uint16_t *ends , int maxCount ) {
+
+    const __m128i zero = _mm_setzero_si128();
+    int count = 0 , i = 0;
+    for ( ; i + 16 <= length ; i += 16 ) {
+        __m128i bytes = _mm_loadu_si128 ( (const __m128i*) ( data + i ) );
+        uint32_t mask = _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( bytes , zero ) );
+        if ( mask != 0 && ( count = addStringEnds ( mask , i , ends , count , maxCount ) ) < 0 )
+            return -1;
+    }
+
+    // Less than 16 bytes left, which must not be read past
+    int tail = findStringEndsScalar ( data + i , length - i , ends + count , maxCount - count );
+    if ( tail < 0 )
+        return -1;
+    for ( int j = count ; j < count + tail ; j++ )
+        ends[j] += i;
+    return count + tail;
+}
+
+__attribute__ (( target ( "avx2" ) ))
+static int findStringEndsAVX2 ( const char *data , int length , uint16_t *ends , int maxCount ) {
+
+    const __m256i zero = _mm256_setzero_si256();
+    int count = 0 , i = 0;
+    for ( ; i + 32 <= length ; i += 32 ) {
+        __m256i bytes = _mm256_loadu_si256 ( (const __m256i*) ( data + i ) );
+        uint32_t mask = _mm256_movemask_epi8 ( _mm256_cmpeq_epi8 ( bytes , zero ) );
+        if ( mask != 0 && ( count = addStringEnds ( mask , i , ends , count , maxCount ) ) < 0 )
+            return -1;
+    }
+
+    // Less than 32 bytes left
+    int tail = findStringEndsSSE2 ( data + i , length - i , ends + count , maxCount - count );
+    if ( tail < 0 )
+        return -1;
+    for ( int j = count ; j < count + tail ; j++ )
+        ends[j] += i;
+    return count + tail;
+}
+
+static StringScanFunction chooseStringScan ( const char **name ) {
+
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports ( "avx2" ) ) {
+        *name = "AVX2";
+        return findStringEndsAVX2;
+    }
+    *name = "SSE2";
+    return findStringEndsSSE2;
+}
+
+#else
+
+static StringScanFunction chooseStringScan ( const char **name ) {
+    *name = "scalar";
+    return findStringEndsScalar;
+}
+
+#endif
@@ -0,0 +1,41 @@
+// ChatStringScan.h
+
+#ifndef __ChatStringScan_h
+#define __ChatStringScan_h
+
+#include <stdint.h>
+
+#include "ChatRecvBuffer.h"
+
+/*
+ * Finds the NULL terminating each string of a packet, 16 or 32 bytes
+ * at a time.
+ *
+ * Most request bodies are a list of NULL terminated strings, ending
+ * with an empty string (i.e. a double NULL). Instead of looking for
+ * the end of each string separately, scanFrameStrings() finds all of
+ * them in one pass over the packet, and hands them to the FrameReader,
+ * which then cuts the strings without looking at their bytes again.
+ * isStringList() checks the list is complete before the request is
+ * handled.
+ *
+ * The scan uses AVX2 if the processor has it, otherwise SSE2 (always
+ * there on x86-64), and plain C on other processors.
+ */
+
+/// @brief  Offsets of every NULL in 'data', returns the count, or -1 if there are more than 'maxCount'
+int findStringEnds ( const char *data , int length , uint16_t *ends , int maxCount );
+/// @brief  Same as findStringEnds(), one byte at a time
+int findStringEndsScalar ( const char *data , int length , uint16_t *ends , int maxCount );
+/// @brief  Name of the instruction set used by findStringEnds()
+const char* stringScanName ();
+
+/// @brief  Find the NULLs of the body of 'reader' from 'start' on, and let readString() use them
+///
+/// 'ends' must stay valid as long as the reader. Returns the number of
+/// strings, or -1 if there are more than 'maxCount'.
+int scanFrameStrings ( FrameReader *reader , int start , uint16_t *ends , int maxCount );
+/// @brief  Whether the body of 'reader' ends with the strings found by scanFrameStrings(), the last one (only) empty
+bool isStringList ( const FrameReader *reader , int start );
+
+#endif  // __ChatStringScan_h
@@ -0,0 +1,74 @@
+// ChatTimerWheel.cpp
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ChatTimerWheel.h"
+
+using namespace std;
+
+/// @brief  Link a timer at the end of a slot
+static void linkTimer ( TimerEntry *slot , TimerEntry *timer );
+
+void initTimerWheel ( TimerWheel *wheel , size_t slots , uint64_t now ) {
+
+    size_t size = 1;
+    while ( size < slots )
+        size <<= 1;
+    wheel->slots.assign ( size , TimerEntry () );
+    // An empty slot is a ring of its head alone
+    for ( TimerEntry &slot : wheel->slots ) {
+        slot.next = &slot;
+        slot.prev = &slot;
+    }
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+void addTimer ( TimerWheel *wheel , TimerEntry *timer , uint64_t ticks ) {
+
+    timer->expires = wheel->now + ( ticks > 0 ? ticks : 1 );
+    linkTimer ( &wheel->slots[ timer->expires & ( wheel->slots.size() - 1 ) ] , timer );
+    wheel->count++;
+}
+
+void cancelTimer ( TimerWheel *wheel , TimerEntry *timer ) {
+
+    if ( timer->next == NULL )
+        return;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    wheel->count--;
+}
+
+void advanceTimerWheel ( TimerWheel *wheel , uint64_t now , vector <TimerEntry*> *expired ) {
+
+    // After a long pause, one turn of the wheel visits every slot
+    if ( now > wheel->now + wheel->slots.size() )
+        wheel->now = now - wheel->slots.size();
+
+    while ( wheel->now < now ) {
+        wheel->now++;
+        TimerEntry *slot = &wheel->slots[ wheel->now & ( wheel->slots.size() - 1 ) ];
+        for ( TimerEntry *timer = slot->next ; timer != slot ; ) {
+            TimerEntry *next = timer->next;
+            // Timers of a later turn stay
+            if ( timer->expires <= wheel->now ) {
+                cancelTimer ( wheel , timer );
+                expired->push_back ( timer );
+            }
+            timer = next;
+        }
+    }
+}
+
+static void linkTimer ( TimerEntry *slot , TimerEntry *timer ) {
+
+    timer->next = slot;
+    timer->prev = slot->prev;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
@@ -0,0 +1,52 @@
+// ChatTimerWheel.h
+
+#ifndef __ChatTimerWheel_h
+#define __ChatTimerWheel_h
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Timers which expire after a number of ticks (a hashed timing wheel).
+ *
+ * The wheel is a ring of slots, one per tick, each with a list of the
+ * timers expiring in it. A timer is linked into the slot of its tick
+ * (modulo the number of slots) when it is added, and unlinked when it
+ * is cancelled, both in constant time. Each tick visits one slot, so it
+ * costs the timers expiring in it, however many timers are pending. A
+ * timer further away than the number of slots stays in its slot for more
+ * turns of the wheel, and is passed over by the ticks before it.
+ *
+ * The timers are embedded in the objects they time (nothing is
+ * allocated), and the wheel takes no lock: its owner locks it.
+ */
+
+/**
+ * @brief  A timer, embedded in what it times
+ */
+struct TimerEntry {
+    TimerEntry     *next;       ///< Next timer of the slot (NULL if the timer is not pending)
+    TimerEntry     *prev;       ///< Previous timer of the slot, or the slot itself
+    uint64_t        expires;    ///< Tick the timer expires at
+};
+
+/**
+ * @brief  Pending timers, by the tick they expire at
+ */
+struct TimerWheel {
+    std::vector <TimerEntry>    slots;      ///< Head of the list of each slot (a power of 2 of them)
+    uint64_t                    now;        ///< Last tick handled
+    size_t                      count;      ///< Pending timers
+};
+
+/// @brief  Prepare an empty wheel of 'slots' slots (rounded up to a power of 2), at tick 'now'
+void initTimerWheel ( TimerWheel *wheel , size_t slots , uint64_t now );
+/// @brief  Start a timer expiring 'ticks' ticks after the last one handled (at least 1)
+void addTimer ( TimerWheel *wheel , TimerEntry *timer , uint64_t ticks );
+/// @brief  Stop a timer, if it is pending
+void cancelTimer ( TimerWheel *wheel , TimerEntry *timer );
+/// @brief  Handle the ticks up to 'now', appending the timers expired to 'expired' (they are no longer pending)
+void advanceTimerWheel ( TimerWheel *wheel , uint64_t now , std::vector <TimerEntry*> *expired );
+
+#endif  // __ChatTimerWheel_h
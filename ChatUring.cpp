@@ -0,0 +1,213 @@
+// ChatUring.cpp
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "ChatUring.h"
+
+using namespace std;
+
+static int sysUringSetup ( unsigned entries , struct io_uring_params *params ) {
+    return syscall ( __NR_io_uring_setup , entries , params );
+}
+
+static int sysUringEnter ( int ringFD , unsigned toSubmit , unsigned minComplete , unsigned flags ) {
+    return syscall ( __NR_io_uring_enter , ringFD , toSubmit , minComplete , flags , NULL , 0 );
+}
+
+static int sysUringRegister ( int ringFD , unsigned opcode , void *arg , unsigned count ) {
+    return syscall ( __NR_io_uring_register , ringFD , opcode , arg , count );
+}
+
+bool uringInit ( Uring *ring , unsigned entries ) {
+
+    memset ( ring , 0 , sizeof ( Uring ) );
+    ring->ringFD = -1;
+
+    struct io_uring_params params;
+    memset ( &params , 0 , sizeof ( params ) );
+    // Leave room for completions of multishot receives which are not yet reaped
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4 * entries;
+
+    if ( ( ring->ringFD = sysUringSetup ( entries , &params ) ) < 0 )
+        return false;
+
+    // Map the submission and completion queues
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof ( unsigned );
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof ( struct io_uring_cqe );
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        if ( ring->cqRingSize > ring->sqRingSize )
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRingPtr = mmap ( NULL , ring->sqRingSize , PROT_READ | PROT_WRITE ,
+                             MAP_SHARED | MAP_POPULATE , ring->ringFD , IORING_OFF_SQ_RING );
+    if ( ring->sqRingPtr == MAP_FAILED ) {
+        ring->sqRingPtr = NULL;
+        uringExit ( ring );
+        return false;
+    }
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+        ring->cqRingPtr = ring->sqRingPtr;
+    else {
+        ring->cqRingPtr = mmap ( NULL , ring->cqRingSize , PROT_READ | PROT_WRITE ,
+                                 MAP_SHARED | MAP_POPULATE , ring->ringFD , IORING_OFF_CQ_RING );
+        if ( ring->cqRingPtr == MAP_FAILED ) {
+            ring->cqRingPtr = NULL;
+            uringExit ( ring );
+            return false;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof ( struct io_uring_sqe );
+    ring->sqes = (struct io_uring_sqe*) mmap ( NULL , ring->sqesSize , PROT_READ | PROT_WRITE ,
+                                               MAP_SHARED | MAP_POPULATE , ring->ringFD , IORING_OFF_SQES );
+    if ( ring->sqes == MAP_FAILED ) {
+        ring->sqes = NULL;
+        uringExit ( ring );
+        return false;
+    }
+
+    char *sq = (char*) ring->sqRingPtr;
+    ring->sqHead = (unsigned*) ( sq + params.sq_off.head );
+    ring->sqTail = (unsigned*) ( sq + params.sq_off.tail );
+    ring->sqMask = *(unsigned*) ( sq + params.sq_off.ring_mask );
+    ring->sqArray = (unsigned*) ( sq + params.sq_off.array );
+    ring->sqEntries = params.sq_entries;
+    ring->sqLocalTail = *ring->sqTail;
+
+    char *cq = (char*) ring->cqRingPtr;
+    ring->cqHead = (unsigned*) ( cq + params.cq_off.head );
+    ring->cqTail = (unsigned*) ( cq + params.cq_off.tail );
+    ring->cqMask = *(unsigned*) ( cq + params.cq_off.ring_mask );
+    ring->cqes = (struct io_uring_cqe*) ( cq + params.cq_off.cqes );
+
+    return true;
+}
+
+void uringExit ( Uring *ring ) {
+
+    if ( ring->bufRing != NULL )
+        munmap ( ring->bufRing , ring->bufCount * sizeof ( struct io_uring_buf ) );
+    free ( ring->bufBase );
+    if ( ring->sqes != NULL )
+        munmap ( ring->sqes , ring->sqesSize );
+    if ( ring->cqRingPtr != NULL && ring->cqRingPtr != ring->sqRingPtr )
+        munmap ( ring->cqRingPtr , ring->cqRingSize );
+    if ( ring->sqRingPtr != NULL )
+        munmap ( ring->sqRingPtr , ring->sqRingSize );
+    if ( ring->ringFD >= 0 )
+        close ( ring->ringFD );
+
+    memset ( ring , 0 , sizeof ( Uring ) );
+    ring->ringFD = -1;
+}
+
+bool uringSetupBuffers ( Uring *ring , uint16_t group , unsigned count , unsigned size ) {
+
+    // The ring of buffer descriptors must be page aligned
+    size_t ringSize = count * sizeof ( struct io_uring_buf );
+    void *bufRing = mmap ( NULL , ringSize , PROT_READ | PROT_WRITE ,
+                           MAP_ANONYMOUS | MAP_PRIVATE , -1 , 0 );
+    if ( bufRing == MAP_FAILED )
+        return false;
+
+    struct io_uring_buf_reg reg;
+    memset ( &reg , 0 , sizeof ( reg ) );
+    reg.ring_addr = (uint64_t) (uintptr_t) bufRing;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if ( sysUringRegister ( ring->ringFD , IORING_REGISTER_PBUF_RING , &reg , 1 ) < 0 ) {
+        munmap ( bufRing , ringSize );
+        return false;
+    }
+
+    ring->bufRing = (struct io_uring_buf_ring*) bufRing;
+    ring->bufCount = count;
+    ring->bufSize = size;
+    ring->bufGroup = group;
+    ring->bufTail = 0;
+    if ( posix_memalign ( (void**) &ring->bufBase , 4096 , (size_t) count * size ) != 0 ) {
+        ring->bufBase = NULL;
+        return false;
+    }
+
+    // Hand all the buffers to the kernel
+    for ( unsigned i = 0 ; i < count ; i++ )
+        uringRecycleBuffer ( ring , i );
+    __atomic_store_n ( &ring->bufRing->tail , ring->bufTail , __ATOMIC_RELEASE );
+
+    return true;
+}
+
+char* uringBuffer ( Uring *ring , uint16_t bufferID ) {
+    return ring->bufBase + (size_t) bufferID * ring->bufSize;
+}
+
+void uringRecycleBuffer ( Uring *ring , uint16_t bufferID ) {
+
+    // Not ring->bufRing->bufs[], in C++ the kernel header puts that array at the wrong offset
+    struct io_uring_buf *buf = (struct io_uring_buf*) ring->bufRing + ( ring->bufTail & ( ring->bufCount - 1 ) );
+    buf->addr = (uint64_t) (uintptr_t) uringBuffer ( ring , bufferID );
+    buf->len = ring->bufSize;
+    buf->bid = bufferID;
+    ring->bufTail++;
+}
+
+struct io_uring_sqe* uringGetSQE ( Uring *ring ) {
+
+    unsigned head = __atomic_load_n ( ring->sqHead , __ATOMIC_ACQUIRE );
+    if ( ring->sqLocalTail - head >= ring->sqEntries ) {
+        // The queue is full, let the kernel consume it first
+        uringSubmitAndWait ( ring , 0 );
+        head = __atomic_load_n ( ring->sqHead , __ATOMIC_ACQUIRE );
+        if ( ring->sqLocalTail - head >= ring->sqEntries )
+            return NULL;
+    }
+
+    unsigned index = ring->sqLocalTail & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[ index ];
+    memset ( sqe , 0 , sizeof ( struct io_uring_sqe ) );
+    ring->sqArray[ index ] = index;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+int uringSubmitAndWait ( Uring *ring , unsigned waitCount ) {
+
+    // Publish the recycled buffers and the new SQEs
+    if ( ring->bufRing != NULL )
+        __atomic_store_n ( &ring->bufRing->tail , ring->bufTail , __ATOMIC_RELEASE );
+    unsigned toSubmit = ring->sqLocalTail - *ring->sqTail;
+    __atomic_store_n ( ring->sqTail , ring->sqLocalTail , __ATOMIC_RELEASE );
+
+    unsigned flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int result;
+    while ( ( result = sysUringEnter ( ring->ringFD , toSubmit , waitCount , flags ) ) < 0
+            && errno == EINTR ) {
+        // Whatever the kernel already consumed must not be counted again
+        toSubmit = ring->sqLocalTail - __atomic_load_n ( ring->sqHead , __ATOMIC_ACQUIRE );
+    }
+
+    return result;
+}
+
+struct io_uring_cqe* uringPeekCQE ( Uring *ring ) {
+
+    unsigned head = *ring->cqHead;
+    if ( head == __atomic_load_n ( ring->cqTail , __ATOMIC_ACQUIRE ) )
+        return NULL;
+    return &ring->cqes[ head & ring->cqMask ];
+}
+
+void uringAdvanceCQ ( Uring *ring ) {
+    __atomic_store_n ( ring->cqHead , *ring->cqHead + 1 , __ATOMIC_RELEASE );
+}
@@ -0,0 +1,85 @@
+// ChatUring.h
+
+#ifndef __ChatUring_h
+#define __ChatUring_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring wrapper for the reactor (we do not depend on
+ * liburing, the system calls are made directly).
+ *
+ * Requests are added to the submission queue with uringGetSQE(), and
+ * nothing reaches the kernel until uringSubmitAndWait() is called, so
+ * everything queued during one iteration of the event loop goes in
+ * one system call.
+ *
+ * Received data is placed by the kernel into a ring of buffers which
+ * is registered with the ring once (a "provided buffer ring"). A
+ * completion tells which buffer was used, and the buffer has to be
+ * given back with uringRecycleBuffer() once the data has been
+ * consumed.
+ */
+
+/**
+ * @brief  An io_uring instance with its provided receive buffers
+ */
+struct Uring {
+    int                     ringFD;          ///< Ring file descriptor
+
+    // Submission queue (shared with the kernel)
+    unsigned               *sqHead;
+    unsigned               *sqTail;
+    unsigned                sqMask;
+    unsigned               *sqArray;
+    struct io_uring_sqe    *sqes;
+    unsigned                sqLocalTail;     ///< Tail including SQEs not yet published
+    unsigned                sqEntries;
+
+    // Completion queue (shared with the kernel)
+    unsigned               *cqHead;
+    unsigned               *cqTail;
+    unsigned                cqMask;
+    struct io_uring_cqe    *cqes;
+
+    // Memory mapped from the kernel
+    void                   *sqRingPtr;
+    size_t                  sqRingSize;
+    void                   *cqRingPtr;
+    size_t                  cqRingSize;
+    size_t                  sqesSize;
+
+    // Provided buffer ring used by the receives
+    struct io_uring_buf_ring *bufRing;
+    char                   *bufBase;         ///< Memory of all the buffers
+    unsigned                bufCount;        ///< Number of buffers (power of 2)
+    unsigned                bufSize;         ///< Size of each buffer
+    uint16_t                bufGroup;        ///< Buffer group ID used in the SQEs
+    uint16_t                bufTail;         ///< Tail including buffers not yet published
+};
+
+/// @brief  Create a ring with room for 'entries' SQEs, return false if io_uring is not available
+bool uringInit ( Uring *ring , unsigned entries );
+/// @brief  Release everything held by the ring
+void uringExit ( Uring *ring );
+
+/// @brief  Register 'count' buffers of 'size' bytes each as buffer group 'group'
+bool uringSetupBuffers ( Uring *ring , uint16_t group , unsigned count , unsigned size );
+/// @brief  Address of a provided buffer
+char* uringBuffer ( Uring *ring , uint16_t bufferID );
+/// @brief  Give a provided buffer back to the kernel (published on the next submit)
+void uringRecycleBuffer ( Uring *ring , uint16_t bufferID );
+
+/// @brief  Next free SQE (zeroed), submits the queue first if it is full
+struct io_uring_sqe* uringGetSQE ( Uring *ring );
+/// @brief  Submit everything queued and wait for at least 'waitCount' completions
+int uringSubmitAndWait ( Uring *ring , unsigned waitCount );
+
+/// @brief  Oldest unprocessed completion, or NULL if there is none
+struct io_uring_cqe* uringPeekCQE ( Uring *ring );
+/// @brief  Mark the completion returned by uringPeekCQE() as processed
+void uringAdvanceCQ ( Uring *ring );
+
+#endif  // __ChatUring_h
@@ -0,0 +1,129 @@
+// ChatUserBitmap.cpp
+
+#include <algorithm>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ChatUserBitmap.h"
+
+using namespace std;
+
+/// @brief  Words of a bitmap container
+#define BITMAP_WORDS  ( 65536 / 64 )
+
+/// @brief  Position of the container of the numbers with 'key', or of the first one after
+static size_t containerPosition ( const UserBitmap *bitmap , uint16_t key );
+/// @brief  Turn an array container into a bitmap container, or back
+static void toBitmapContainer ( BitmapContainer *container );
+static void toArrayContainer ( BitmapContainer *container );
+
+void initUserBitmap ( UserBitmap *bitmap ) {
+    bitmap->containers.clear();
+    bitmap->count = 0;
+}
+
+bool addToBitmap ( UserBitmap *bitmap , uint32_t index ) {
+
+    size_t position = containerPosition ( bitmap , index >> 16 );
+    if ( position == bitmap->containers.size() || bitmap->containers[ position ].key != index >> 16 ) {
+        BitmapContainer empty;
+        empty.key = index >> 16;
+        empty.count = 0;
+        bitmap->containers.insert ( bitmap->containers.begin() + position , empty );
+    }
+    BitmapContainer *container = &bitmap->containers[ position ];
+    uint16_t value = index & 0xFFFF;
+    if ( !container->words.empty() ) {
+        uint64_t bit = 1ULL << ( value & 63 );
+        if ( container->words[ value >> 6 ] & bit )
+            return false;
+        container->words[ value >> 6 ] |= bit;
+    }
+    else {
+        vector <uint16_t>::iterator found = lower_bound ( container->values.begin() , container->values.end() , value );
+        if ( found != container->values.end() && *found == value )
+            return false;
+        container->values.insert ( found , value );
+    }
+
+    container->count++;
+    bitmap->count++;
+    if ( container->words.empty() && container->count > BITMAP_ARRAY_MAX )
+        toBitmapContainer ( container );
+    return true;
+}
+
+bool removeFromBitmap ( UserBitmap *bitmap , uint32_t index ) {
+
+    size_t position = containerPosition ( bitmap , index >> 16 );
+    if ( position == bitmap->containers.size() || bitmap->containers[ position ].key != index >> 16 )
+        return false;
+    BitmapContainer *container = &bitmap->containers[ position ];
+    uint16_t value = index & 0xFFFF;
+    if ( !container->words.empty() ) {
+        uint64_t bit = 1ULL << ( value & 63 );
+        if ( ( container->words[ value >> 6 ] & bit ) == 0 )
+            return false;
+        container->words[ value >> 6 ] &= ~bit;
+    }
+    else {
+        vector <uint16_t>::iterator found = lower_bound ( container->values.begin() , container->values.end() , value );
+        if ( found == container->values.end() || *found != value )
+            return false;
+        container->values.erase ( found );
+    }
+
+    container->count--;
+    bitmap->count--;
+    if ( container->count == 0 )
+        bitmap->containers.erase ( bitmap->containers.begin() + position );
+    else if ( !container->words.empty() && container->count <= BITMAP_ARRAY_MAX )
+        toArrayContainer ( container );
+    return true;
+}
+
+bool bitmapContains ( const UserBitmap *bitmap , uint32_t index ) {
+
+    size_t position = containerPosition ( bitmap , index >> 16 );
+    if ( position == bitmap->containers.size() || bitmap->containers[ position ].key != index >> 16 )
+        return false;
+    const BitmapContainer *container = &bitmap->containers[ position ];
+    uint16_t value = index & 0xFFFF;
+    if ( !container->words.empty() )
+        return ( container->words[ value >> 6 ] >> ( value & 63 ) ) & 1;
+    return binary_search ( container->values.begin() , container->values.end() , value );
+}
+
+size_t bitmapBytes ( const UserBitmap *bitmap ) {
+
+    size_t bytes = sizeof ( UserBitmap ) + bitmap->containers.capacity() * sizeof ( BitmapContainer );
+    for ( const BitmapContainer &container : bitmap->containers )
+        bytes += container.values.capacity() * sizeof ( uint16_t ) + container.words.capacity() * sizeof ( uint64_t );
+    return bytes;
+}
+
+static size_t containerPosition ( const UserBitmap *bitmap , uint16_t key ) {
+
+    return lower_bound ( bitmap->containers.begin() , bitmap->containers.end() , key ,
+                         [] ( const BitmapContainer &container , uint16_t key ) { return container.key < key; } )
+           - bitmap->containers.begin();
+}
+
+static void toBitmapContainer ( BitmapContainer *container ) {
+
+    container->words.assign ( BITMAP_WORDS , 0 );
+    for ( uint16_t value : container->values )
+        container->words[ value >> 6 ] |= 1ULL << ( value & 63 );
+    vector <uint16_t> ().swap ( container->values );
+}
+
+static void toArrayContainer ( BitmapContainer *container ) {
+
+    container->values.reserve ( container->count );
+    for ( int i = 0 ; i < BITMAP_WORDS ; i++ ) {
+        for ( uint64_t word = container->words[i] ; word != 0 ; word &= word - 1 )
+            container->values.push_back ( ( i << 6 ) | __builtin_ctzll ( word ) );
+    }
+    vector <uint64_t> ().swap ( container->words );
+}
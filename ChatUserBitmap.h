@@ -0,0 +1,74 @@
+// ChatUserBitmap.h
+
+#ifndef __ChatUserBitmap_h
+#define __ChatUserBitmap_h
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sets of users, as compressed bitmaps of the dense numbers of their
+ * slots (see userIndex()), in the manner of Roaring bitmaps.
+ *
+ * The numbers are split by their high 16 bits into containers, kept in
+ * the order of their keys. A container of few users (at most
+ * BITMAP_ARRAY_MAX) is a sorted array of the low 16 bits of their
+ * numbers, 2 bytes a user. A fuller one is a bitmap of 65536 bits, 8 KB
+ * however many users it has. Finding a user is a binary search over the
+ * containers (at most 64, as the numbers have USER_INDEX_BITS bits), then
+ * over the array, or one bit. Going through the users costs one step per
+ * user, or per 64 numbers in a bitmap.
+ *
+ * A set takes no lock. The groups copy a set to change it, and publish
+ * the copy (see ChatGroups.h).
+ */
+
+/// @brief  Most users in an array container (beyond, the bitmap is smaller)
+#define BITMAP_ARRAY_MAX  4096
+
+/**
+ * @brief  The users whose numbers have the same high 16 bits
+ */
+struct BitmapContainer {
+    uint16_t                    key;        ///< High 16 bits of the numbers of its users
+    uint32_t                    count;      ///< Users in the container
+    std::vector <uint16_t>      values;     ///< Low 16 bits of their numbers, sorted (array container)
+    std::vector <uint64_t>      words;      ///< One bit per number (bitmap container, 'values' is then empty)
+};
+
+/**
+ * @brief  A set of users, by the numbers of their slots
+ */
+struct UserBitmap {
+    std::vector <BitmapContainer>   containers;     ///< By key
+    size_t                          count;          ///< Users in the set
+};
+
+/// @brief  Prepare an empty set
+void initUserBitmap ( UserBitmap *bitmap );
+/// @brief  Add a user, returns false if it is already in the set
+bool addToBitmap ( UserBitmap *bitmap , uint32_t index );
+/// @brief  Remove a user, returns false if it was not in the set
+bool removeFromBitmap ( UserBitmap *bitmap , uint32_t index );
+/// @brief  Whether a user is in the set
+bool bitmapContains ( const UserBitmap *bitmap , uint32_t index );
+/// @brief  Bytes of memory the set takes
+size_t bitmapBytes ( const UserBitmap *bitmap );
+
+/// @brief  Call 'visit' with the number of each user of the set, in increasing order
+template < class Visit >
+inline void forEachInBitmap ( const UserBitmap *bitmap , Visit visit ) {
+
+    for ( const BitmapContainer &container : bitmap->containers ) {
+        uint32_t high = (uint32_t) container.key << 16;
+        for ( uint16_t value : container.values )
+            visit ( high | value );
+        for ( size_t i = 0 ; i < container.words.size() ; i++ ) {
+            for ( uint64_t word = container.words[i] ; word != 0 ; word &= word - 1 )
+                visit ( high | (uint32_t) ( i << 6 ) | __builtin_ctzll ( word ) );
+        }
+    }
+}
+
+#endif  // __ChatUserBitmap_h
@@ -0,0 +1,380 @@
+// ChatUserRegistry.cpp
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ChatEpoch.h"
+#include "ChatUserRegistry.h"
+
+using namespace std;
+
+/// @brief  Bits of a hash choosing the shard (the others choose the entry in its table)
+#define SHARD_BITS         4
+/// @brief  Entries of the table of an empty shard (a power of 2)
+#define MIN_TABLE_SIZE     16
+/// @brief  Slots in a chunk, and most chunks of a shard (4M users over all the shards)
+#define SLOT_CHUNK_SIZE    1024
+#define MAX_SLOT_CHUNKS    256
+
+/**
+ * @brief  A user, as it is pointed to by the tables (freed only once no reader can see it)
+ */
+struct UserRecord {
+    User        user;
+    UserShard  *shard;      ///< Shard of the name of the user, whose slot is freed with the record
+};
+
+/**
+ * @brief  Open addressing table of one shard
+ */
+struct UserTable {
+    size_t          mask;       ///< Number of entries - 1
+    size_t          used;       ///< Entries which are not empty, tombstones included (writers only)
+    size_t          live;       ///< Entries with a user (writers only)
+    UserRecord    **entries;    ///< The users, NULL for an empty entry (read atomically)
+};
+
+/**
+ * @brief  Slot of a user, in the shard of its name
+ */
+struct UserSlot {
+    UserRecord     *record;     ///< The user, NULL if the slot is free (read atomically)
+    uint32_t        generation; ///< Times the slot was freed (writers only)
+    uint32_t        nextFreed;  ///< Next slot of the freed slots of the shard, plus 1 (0 for none)
+};
+
+/// @brief  Left in the entry of a removed user, so that the probes go on past it
+static UserRecord tombstone;
+#define TOMBSTONE  ( &tombstone )
+
+/// @brief  Position of a key in a table, from its hash
+typedef size_t (*RecordHash) ( const UserRecord *record );
+
+/// @brief  Hash of a name (no copy of the name is made to look it up)
+static inline size_t hashName ( string_view name ) {
+    return hash < string_view > () ( name );
+}
+
+/// @brief  Hash of a cookie (cookies are often close to each other, so they are spread first)
+static inline size_t hashCookie ( uint32_t cookie ) {
+    return ( cookie * 0x9E3779B97F4A7C15ULL ) >> 32;
+}
+
+/// @brief  Hashes of the keys of the users, without the shard bits
+static size_t nameEntryHash ( const UserRecord *record ) {
+    return hashName ( record->user.userName ) >> SHARD_BITS;
+}
+static size_t cookieEntryHash ( const UserRecord *record ) {
+    return hashCookie ( record->user.cookie ) >> SHARD_BITS;
+}
+
+/// @brief  ID of the user of a slot (never NO_USER)
+static inline UserID makeUserID ( uint32_t slot , uint32_t generation ) {
+    return ( generation % USER_GENERATIONS + 1 ) << USER_INDEX_BITS | slot;
+}
+
+/// @brief  Empty table of 'size' entries (a power of 2)
+static UserTable* newTable ( size_t size );
+/// @brief  Release function of the retired tables and users
+static void freeTable ( void *table );
+static void freeRecord ( void *record );
+/// @brief  The user of 'table' for which 'match' is true, NULL if there is none
+template < class Match >
+static UserRecord* findEntry ( const UserTable *table , size_t hash , Match match );
+/// @brief  Add 'record' to the table of 'shard' (with the lock held), replacing the table if it is full
+static void insertEntry ( UserShard *shard , size_t hash , UserRecord *record , RecordHash hashOf );
+/// @brief  Leave a tombstone in the place of 'record' in the table of 'shard' (with the lock held)
+static void eraseEntry ( UserShard *shard , size_t hash , UserRecord *record );
+/// @brief  Slot 'index' of a shard of the names, NULL if it was never handed out
+static UserSlot* getSlot ( UserShard *shard , uint32_t index );
+/// @brief  A free slot of 'shard' (with the lock held), whose last user no reader can still see, false if all are taken
+static bool takeSlot ( UserShard *shard , uint32_t *index );
+
+void initUserRegistry ( UserRegistry *registry ) {
+
+    for ( int i = 0 ; i < USER_SHARDS ; i++ ) {
+        UserShard *shards[2] = { &registry->names[i] , &registry->cookies[i] };
+        for ( UserShard *shard : shards ) {
+            pthread_mutex_init ( &shard->lock , NULL );
+            shard->table = newTable ( MIN_TABLE_SIZE );
+            shard->slotChunks = NULL;
+            shard->slotCount = 0;
+            shard->freedSlots = 0;
+        }
+        registry->names[i].slotChunks = (UserSlot**) calloc ( MAX_SLOT_CHUNKS , sizeof ( UserSlot* ) );
+    }
+    registry->count = 0;
+}
+
+bool addUser ( UserRegistry *registry , User *user ) {
+
+    size_t hash = hashName ( user->userName );
+    UserShard *shard = &registry->names[ hash & ( USER_SHARDS - 1 ) ];
+    const string &name = user->userName;
+
+    pthread_mutex_lock ( &shard->lock );
+    uint32_t index;
+    if ( findEntry ( shard->table , hash >> SHARD_BITS ,
+                     [ &name ] ( const UserRecord *record ) { return record->user.userName == name; } ) != NULL
+         || !takeSlot ( shard , &index ) ) {
+        pthread_mutex_unlock ( &shard->lock );
+        return false;
+    }
+
+    UserSlot *slot = getSlot ( shard , index );
+    UserRecord *record = new UserRecord ();
+    record->user = *user;
+    record->shard = shard;
+    record->user.userID = makeUserID ( index << SHARD_BITS | ( hash & ( USER_SHARDS - 1 ) ) , slot->generation );
+
+    // A cookie no one has (a shard of the cookies is only ever locked
+    // while holding the one of the name, so they cannot deadlock)
+    for ( ;; record->user.cookie++ ) {
+        if ( record->user.cookie == 0 )
+            continue;
+        uint32_t cookie = record->user.cookie;
+        size_t cookieHash = hashCookie ( cookie );
+        UserShard *cookieShard = &registry->cookies[ cookieHash & ( USER_SHARDS - 1 ) ];
+        pthread_mutex_lock ( &cookieShard->lock );
+        bool taken = findEntry ( cookieShard->table , cookieHash >> SHARD_BITS ,
+                                 [ cookie ] ( const UserRecord *other ) { return other->user.cookie == cookie; } ) != NULL;
+        if ( !taken )
+            insertEntry ( cookieShard , cookieHash >> SHARD_BITS , record , cookieEntryHash );
+        pthread_mutex_unlock ( &cookieShard->lock );
+        if ( !taken )
+            break;
+    }
+    user->cookie = record->user.cookie;
+    user->userID = record->user.userID;
+
+    __atomic_store_n ( &slot->record , record , __ATOMIC_RELEASE );
+    // Found by name from here on
+    insertEntry ( shard , hash >> SHARD_BITS , record , nameEntryHash );
+    __atomic_add_fetch ( &registry->count , 1 , __ATOMIC_RELAXED );
+    pthread_mutex_unlock ( &shard->lock );
+    return true;
+}
+
+bool removeUser ( UserRegistry *registry , UserID userID ) {
+
+    uint32_t index = userIndex ( userID );
+    UserShard *shard = &registry->names[ index & ( USER_SHARDS - 1 ) ];
+    pthread_mutex_lock ( &shard->lock );
+
+    UserSlot *slot = getSlot ( shard , index >> SHARD_BITS );
+    UserRecord *record = slot != NULL ? slot->record : NULL;
+    if ( record == NULL || record->user.userID != userID ) {
+        pthread_mutex_unlock ( &shard->lock );
+        return false;
+    }
+
+    eraseEntry ( shard , nameEntryHash ( record ) , record );
+    size_t cookieHash = hashCookie ( record->user.cookie );
+    UserShard *cookieShard = &registry->cookies[ cookieHash & ( USER_SHARDS - 1 ) ];
+    pthread_mutex_lock ( &cookieShard->lock );
+    eraseEntry ( cookieShard , cookieHash >> SHARD_BITS , record );
+    pthread_mutex_unlock ( &cookieShard->lock );
+
+    // The ID of this user no longer finds the slot, which is not reused while
+    // a reader may still see the user in it (see getUserByIndex()): freeRecord()
+    // hands it back
+    __atomic_store_n ( &slot->record , NULL , __ATOMIC_RELEASE );
+    slot->generation++;
+    __atomic_sub_fetch ( &registry->count , 1 , __ATOMIC_RELAXED );
+    pthread_mutex_unlock ( &shard->lock );
+
+    // Readers which found the user before it was unlinked may still be using it
+    retireEpochMemory ( record , freeRecord );
+    return true;
+}
+
+bool moveUser ( UserRegistry *registry , UserID userID , ConnectionID connection ) {
+
+    uint32_t index = userIndex ( userID );
+    UserShard *shard = &registry->names[ index & ( USER_SHARDS - 1 ) ];
+    pthread_mutex_lock ( &shard->lock );
+
+    UserSlot *slot = getSlot ( shard , index >> SHARD_BITS );
+    UserRecord *record = slot != NULL ? slot->record : NULL;
+    if ( record == NULL || record->user.userID != userID ) {
+        pthread_mutex_unlock ( &shard->lock );
+        return false;
+    }
+
+    __atomic_store_n ( &record->user.connection , connection , __ATOMIC_RELEASE );
+    pthread_mutex_unlock ( &shard->lock );
+    return true;
+}
+
+User* getUser ( UserRegistry *registry , UserID userID ) {
+
+    uint32_t index = userIndex ( userID );
+    UserSlot *slot = getSlot ( &registry->names[ index & ( USER_SHARDS - 1 ) ] , index >> SHARD_BITS );
+    if ( slot == NULL )
+        return NULL;
+    UserRecord *record = __atomic_load_n ( &slot->record , __ATOMIC_ACQUIRE );
+    if ( record == NULL || record->user.userID != userID )
+        return NULL;
+    return &record->user;
+}
+
+User* getUserByIndex ( UserRegistry *registry , uint32_t index ) {
+
+    UserSlot *slot = getSlot ( &registry->names[ index & ( USER_SHARDS - 1 ) ] , index >> SHARD_BITS );
+    UserRecord *record = slot != NULL ? __atomic_load_n ( &slot->record , __ATOMIC_ACQUIRE ) : NULL;
+    return record != NULL ? &record->user : NULL;
+}
+
+User* findUserByName ( UserRegistry *registry , string_view name ) {
+
+    size_t hash = hashName ( name );
+    const UserTable *table = __atomic_load_n ( &registry->names[ hash & ( USER_SHARDS - 1 ) ].table , __ATOMIC_ACQUIRE );
+    UserRecord *record = findEntry ( table , hash >> SHARD_BITS ,
+                                     [ name ] ( const UserRecord *record ) { return record->user.userName == name; } );
+    return record != NULL ? &record->user : NULL;
+}
+
+User* findUserByCookie ( UserRegistry *registry , uint32_t cookie ) {
+
+    size_t hash = hashCookie ( cookie );
+    const UserTable *table = __atomic_load_n ( &registry->cookies[ hash & ( USER_SHARDS - 1 ) ].table , __ATOMIC_ACQUIRE );
+    UserRecord *record = findEntry ( table , hash >> SHARD_BITS ,
+                                     [ cookie ] ( const UserRecord *record ) { return record->user.cookie == cookie; } );
+    return record != NULL ? &record->user : NULL;
+}
+
+int userCount ( const UserRegistry *registry ) {
+    return __atomic_load_n ( &registry->count , __ATOMIC_RELAXED );
+}
+
+static UserTable* newTable ( size_t size ) {
+
+    // One block for the table and its entries
+    UserTable *table = (UserTable*) calloc ( 1 , sizeof ( UserTable ) + size * sizeof ( UserRecord* ) );
+    table->mask = size - 1;
+    table->used = table->live = 0;
+    table->entries = (UserRecord**) ( table + 1 );
+    return table;
+}
+
+static void freeTable ( void *table ) {
+    free ( table );
+}
+
+static void freeRecord ( void *memory ) {
+
+    // No reader can see the user any more, its slot may be reused. The shard is
+    // not locked here (the memory may be released with its lock held, or with
+    // the lock of another shard): the slot is pushed on the freed slots, which
+    // takeSlot() takes all at once
+    UserRecord *record = (UserRecord*) memory;
+    UserShard *shard = record->shard;
+    uint32_t index = userIndex ( record->user.userID ) >> SHARD_BITS;
+    UserSlot *slot = getSlot ( shard , index );
+    uint32_t top = __atomic_load_n ( &shard->freedSlots , __ATOMIC_RELAXED );
+    do {
+        slot->nextFreed = top;
+    } while ( !__atomic_compare_exchange_n ( &shard->freedSlots , &top , index + 1 , true ,
+                                             __ATOMIC_RELEASE , __ATOMIC_RELAXED ) );
+    delete record;
+}
+
+template < class Match >
+static UserRecord* findEntry ( const UserTable *table , size_t hash , Match match ) {
+
+    for ( size_t i = hash & table->mask ; ; i = ( i + 1 ) & table->mask ) {
+        UserRecord *record = __atomic_load_n ( &table->entries[i] , __ATOMIC_ACQUIRE );
+        if ( record == NULL )
+            return NULL;
+        if ( record != TOMBSTONE && match ( record ) )
+            return record;
+    }
+}
+
+static void insertEntry ( UserShard *shard , size_t hash , UserRecord *record , RecordHash hashOf ) {
+
+    UserTable *table = shard->table;
+
+    // Never more than half full (tombstones included), so that the probes stay short
+    if ( 2 * ( table->used + 1 ) > table->mask + 1 ) {
+        size_t size = MIN_TABLE_SIZE;
+        while ( size < 4 * ( table->live + 1 ) )
+            size *= 2;
+        UserTable *newer = newTable ( size );
+        for ( size_t i = 0 ; i <= table->mask ; i++ ) {
+            UserRecord *other = table->entries[i];
+            if ( other == NULL || other == TOMBSTONE )
+                continue;
+            size_t j = hashOf ( other ) & newer->mask;
+            while ( newer->entries[j] != NULL )
+                j = ( j + 1 ) & newer->mask;
+            newer->entries[j] = other;
+        }
+        newer->used = newer->live = table->live;
+
+        // Readers still probing the old table see it as it was
+        __atomic_store_n ( &shard->table , newer , __ATOMIC_RELEASE );
+        retireEpochMemory ( table , freeTable );
+        table = newer;
+    }
+
+    size_t i = hash & table->mask;
+    while ( table->entries[i] != NULL && table->entries[i] != TOMBSTONE )
+        i = ( i + 1 ) & table->mask;
+    if ( table->entries[i] == NULL )
+        table->used++;
+    table->live++;
+    __atomic_store_n ( &table->entries[i] , record , __ATOMIC_RELEASE );
+}
+
+static void eraseEntry ( UserShard *shard , size_t hash , UserRecord *record ) {
+
+    UserTable *table = shard->table;
+    for ( size_t i = hash & table->mask ; table->entries[i] != NULL ; i = ( i + 1 ) & table->mask ) {
+        if ( table->entries[i] == record ) {
+            __atomic_store_n ( &table->entries[i] , TOMBSTONE , __ATOMIC_RELEASE );
+            table->live--;
+            return;
+        }
+    }
+}
+
+static UserSlot* getSlot ( UserShard *shard , uint32_t index ) {
+
+    if ( index >= MAX_SLOT_CHUNKS * SLOT_CHUNK_SIZE )
+        return NULL;
+    UserSlot *chunk = __atomic_load_n ( &shard->slotChunks[ index / SLOT_CHUNK_SIZE ] , __ATOMIC_ACQUIRE );
+    return chunk != NULL ? &chunk[ index % SLOT_CHUNK_SIZE ] : NULL;
+}
+
+static bool takeSlot ( UserShard *shard , uint32_t *index ) {
+
+    // Only slots whose last user was released are free. Their user may be
+    // released long after it left (each thread releases what it retired in
+    // batches), so they come from freeRecord(), in the order they were freed.
+    // The stack is only ever emptied here, with the lock held, so taking it
+    // whole cannot miss a slot pushed meanwhile.
+    if ( shard->freeSlots.empty() ) {
+        uint32_t next = __atomic_exchange_n ( &shard->freedSlots , 0 , __ATOMIC_ACQUIRE );
+        for ( ; next != 0 ; next = getSlot ( shard , next - 1 )->nextFreed )
+            shard->freeSlots.push_front ( next - 1 );
+    }
+    if ( !shard->freeSlots.empty() ) {
+        *index = shard->freeSlots.front();
+        shard->freeSlots.pop_front();
+        return true;
+    }
+
+    if ( shard->slotCount == MAX_SLOT_CHUNKS * SLOT_CHUNK_SIZE )
+        return false;
+    *index = shard->slotCount++;
+    UserSlot **chunk = &shard->slotChunks[ *index / SLOT_CHUNK_SIZE ];
+    if ( *chunk == NULL )
+        __atomic_store_n ( chunk , (UserSlot*) calloc ( SLOT_CHUNK_SIZE , sizeof ( UserSlot ) ) , __ATOMIC_RELEASE );
+    return true;
+}
@@ -0,0 +1,131 @@
+// ChatUserRegistry.h
+
+#ifndef __ChatUserRegistry_h
+#define __ChatUserRegistry_h
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ChatReactor.h"
+
+/*
+ * The users logged in to the server, found by name, by cookie or by
+ * UserID in constant time, from any thread.
+ *
+ * Lookups take no lock at all: they are made between beginEpochRead()
+ * and endEpochRead() (see ChatEpoch.h), and the User they return stays
+ * valid till endEpochRead(), even if the user is removed meanwhile. A
+ * User is not changed once added, except its connection (see moveUser()),
+ * which is read and written atomically.
+ *
+ * The users are spread over USER_SHARDS shards by the hash of their name
+ * (and separately over USER_SHARDS shards by their cookie), each with a
+ * mutex of its own, so that logins and exits of different users seldom
+ * wait for each other. Each shard has an open addressing table (linear
+ * probing) of pointers to the users. A removed user leaves a tombstone,
+ * so a reader probing at the same time still finds the users past it.
+ * When the table fills up (tombstones included) the shard builds a new
+ * one, publishes it, and retires the old one.
+ *
+ * Every user is also given a UserID at login, by which the rest of the
+ * server knows it (names are only used in packets). The low bits of the
+ * ID are a slot, numbered densely (see userIndex()), the high bits the
+ * generation of the slot, counted up each time it is freed: an ID kept
+ * after its user has left finds no one, instead of the user who took the
+ * slot since (unless the slot was reused USER_GENERATIONS times meanwhile).
+ * A slot is only reused once no reader can still see the user who left
+ * it, so a set of slot numbers read in a read section (see ChatGroups.h)
+ * finds no one who came after. Slots are allocated in chunks which never
+ * move, so they are read without a lock as well.
+ */
+
+/// @brief  Number of shards of the names and of the cookies (a power of 2)
+#define USER_SHARDS      16
+/// @brief  Bits of a UserID numbering its slot (the others count the generations of the slot)
+#define USER_INDEX_BITS  22
+/// @brief  Generations of a slot told apart by the IDs
+#define USER_GENERATIONS ( ( 1U << ( 32 - USER_INDEX_BITS ) ) - 1 )
+/// @brief  UserID of no user
+#define NO_USER          0
+
+/**
+ * @brief  A user, while logged in (see ChatUserRegistry.h)
+ */
+typedef uint32_t UserID;
+
+/**
+ * @brief  Data type representing a list of users
+ */
+typedef std::vector <UserID> UserList;
+
+/**
+ * @brief  Information about a User
+ */
+struct User {
+    std::string   userName;          ///< User Name
+    UserID        userID;            ///< Given at login
+    uint32_t      cookie;            ///< Cookie value
+    ConnectionID  connection;        ///< Connection of the user, NO_CONNECTION while away (changed atomically once the user is added)
+    uint32_t      features;          ///< FEATURE_* bits accepted at login
+};
+
+struct UserRecord;
+struct UserTable;
+struct UserSlot;
+
+/**
+ * @brief  Users of one shard of the names, or of the cookies
+ *
+ * The slots are only used by the shards of the names.
+ */
+struct UserShard {
+    pthread_mutex_t          lock;           ///< Held by the writers of the shard
+    UserTable               *table;          ///< Current table (replaced by the writers, read atomically)
+    UserSlot               **slotChunks;     ///< Chunks of slots (written once each, read atomically)
+    uint32_t                 slotCount;      ///< Slots handed out so far
+    std::deque <uint32_t>    freeSlots;      ///< Slots to reuse, first freed first (no reader can see their last user)
+    uint32_t                 freedSlots;     ///< Slots whose last user was released since, pushed from any thread (see takeSlot())
+} __attribute__ (( aligned ( 64 ) ));
+
+/**
+ * @brief  Users indexed by name, cookie and UserID
+ */
+struct UserRegistry {
+    UserShard           names[ USER_SHARDS ];
+    UserShard           cookies[ USER_SHARDS ];
+    int                 count;           ///< Number of users (changed atomically)
+};
+
+/// @brief  Prepare an empty registry
+void initUserRegistry ( UserRegistry *registry );
+/// @brief  Add a copy of 'user' and give it an ID, returns false (and adds nothing) if its name is taken
+///
+/// The ID is written to 'user'. If another user has the cookie of 'user',
+/// the next free one is used instead, and written back to 'user' as well.
+bool addUser ( UserRegistry *registry , User *user );
+/// @brief  Remove a user, returns false if that user has already left
+bool removeUser ( UserRegistry *registry , UserID userID );
+/// @brief  Move a user to another connection (NO_CONNECTION for none, see ChatResume.h), returns false if that user has left
+bool moveUser ( UserRegistry *registry , UserID userID , ConnectionID connection );
+
+/// @brief  The user with an ID, NULL if that user has left (in a read section)
+User* getUser ( UserRegistry *registry , UserID userID );
+/// @brief  The user in a slot (see userIndex()), NULL if the slot is free (in a read section)
+User* getUserByIndex ( UserRegistry *registry , uint32_t index );
+/// @brief  Users with a name, or a cookie, NULL if there is none (in a read section)
+User* findUserByName ( UserRegistry *registry , std::string_view name );
+User* findUserByCookie ( UserRegistry *registry , uint32_t cookie );
+
+/// @brief  Number of users
+int userCount ( const UserRegistry *registry );
+
+/// @brief  Dense number of the slot of a user (below 1 << USER_INDEX_BITS), for arrays indexed by user
+inline uint32_t userIndex ( UserID userID ) {
+    return userID & ( ( 1U << USER_INDEX_BITS ) - 1 );
+}
+
+#endif  // __ChatUserRegistry_h
@@ -0,0 +1,262 @@
+// ChatWorkerPool.cpp
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ChatWorkerPool.h"
+
+using namespace std;
+
+/// @brief  Initial number of strands each deque has room for (power of 2)
+#define DEQUE_SIZE  256
+
+/**
+ * @brief  One worker thread, with its deque of strands
+ *
+ * The deque is a ring growing as needed. The owner takes the oldest
+ * strand (so every connection gets its turn), thieves take the newest.
+ * Each worker is on its own cache line, so that workers using their
+ * own deques do not slow each other down.
+ */
+struct Worker {
+    pthread_spinlock_t   lock;         ///< Lock on the deque
+    Strand             **ring;         ///< Strands waiting
+    unsigned             capacity;     ///< Size of 'ring' (power of 2)
+    unsigned             head;         ///< Oldest strand (taken by the owner)
+    unsigned             tail;         ///< One past the newest strand (taken by thieves)
+    unsigned long        executed;     ///< Tasks run by this worker (read atomically)
+    unsigned long        stolen;       ///< Strands taken from other workers (read atomically)
+    int                  index;        ///< Position in 'workers'
+    pthread_t            threadID;
+} __attribute__ (( aligned ( 64 ) ));
+
+/// @brief  All the workers
+static vector <Worker*> workers;
+/// @brief  Tasks submitted but not yet run, and the most there ever were (changed atomically)
+static unsigned long queuedTasks = 0;
+static unsigned long maxQueuedTasks = 0;
+/// @brief  Strands in all the deques (changed atomically, under the lock of the deque)
+static unsigned long queuedStrands = 0;
+/// @brief  Idle workers wait here for new strands
+static pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCondition = PTHREAD_COND_INITIALIZER;
+static int sleepingWorkers = 0;
+/// @brief  Worker run by the calling thread (NULL outside the pool)
+static __thread Worker *currentWorker = NULL;
+/// @brief  Deque which gets the next strand submitted by the calling thread (outside the pool)
+static __thread unsigned nextWorker = 0;
+
+/// @brief  Event loop of the worker threads
+static void* workerThread ( void *args );
+/// @brief  Add a strand to the newest end of a deque, and wake up a worker if one is idle
+static void pushStrand ( Worker *worker , Strand *strand );
+/// @brief  Oldest strand of the own deque, or else the newest one of another deque, NULL if all are empty
+static Strand* takeStrand ( Worker *worker );
+/// @brief  Run the waiting tasks of a strand (at most STRAND_BATCH), and queue it again if any are left
+static void runStrand ( Worker *worker , Strand *strand );
+
+bool startWorkerPool ( int count ) {
+
+    for ( int i = 0 ; i < count ; i++ ) {
+        Worker *worker = new Worker;
+        pthread_spin_init ( &worker->lock , PTHREAD_PROCESS_PRIVATE );
+        worker->ring = (Strand**) malloc ( DEQUE_SIZE * sizeof ( Strand* ) );
+        worker->capacity = DEQUE_SIZE;
+        worker->head = worker->tail = 0;
+        worker->executed = 0;
+        worker->stolen = 0;
+        worker->index = i;
+        workers.push_back ( worker );
+    }
+
+    // Every deque exists before any worker looks for one to steal from
+    for ( int i = 0 ; i < count ; i++ ) {
+        if ( pthread_create ( &workers[i]->threadID , NULL , workerThread , workers[i] ) != 0 ) {
+            cerr << "Error on pthread_create()\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int workerPoolSize () {
+    return workers.size();
+}
+
+void getWorkerPoolStats ( WorkerPoolStats *stats ) {
+
+    stats->workers = workers.size();
+    stats->queuedTasks = __atomic_load_n ( &queuedTasks , __ATOMIC_RELAXED );
+    stats->maxQueuedTasks = __atomic_load_n ( &maxQueuedTasks , __ATOMIC_RELAXED );
+    stats->queuedStrands = __atomic_load_n ( &queuedStrands , __ATOMIC_RELAXED );
+    stats->maxDequeDepth = stats->executed = stats->stolen = 0;
+    for ( int i = 0 ; i < workers.size() ; i++ ) {
+        Worker *worker = workers[i];
+        pthread_spin_lock ( &worker->lock );
+        unsigned long depth = worker->tail - worker->head;
+        pthread_spin_unlock ( &worker->lock );
+        if ( depth > stats->maxDequeDepth )
+            stats->maxDequeDepth = depth;
+        stats->executed += __atomic_load_n ( &worker->executed , __ATOMIC_RELAXED );
+        stats->stolen += __atomic_load_n ( &worker->stolen , __ATOMIC_RELAXED );
+    }
+}
+
+void initStrand ( Strand *strand ) {
+    pthread_spin_init ( &strand->lock , PTHREAD_PROCESS_PRIVATE );
+    strand->head = strand->tail = NULL;
+    strand->scheduled = false;
+}
+
+void destroyStrand ( Strand *strand ) {
+    pthread_spin_destroy ( &strand->lock );
+}
+
+void submitTask ( Strand *strand , WorkerTask *task ) {
+
+    task->next = NULL;
+    unsigned long queued = __atomic_add_fetch ( &queuedTasks , 1 , __ATOMIC_RELAXED );
+    unsigned long maxQueued = __atomic_load_n ( &maxQueuedTasks , __ATOMIC_RELAXED );
+    while ( queued > maxQueued &&
+            !__atomic_compare_exchange_n ( &maxQueuedTasks , &maxQueued , queued , true ,
+                                           __ATOMIC_RELAXED , __ATOMIC_RELAXED ) )
+        ;
+
+    pthread_spin_lock ( &strand->lock );
+    if ( strand->tail != NULL )
+        strand->tail->next = task;
+    else
+        strand->head = task;
+    strand->tail = task;
+    // A strand which is already queued (or running) picks up the task by itself
+    bool schedule = !strand->scheduled;
+    strand->scheduled = true;
+    pthread_spin_unlock ( &strand->lock );
+
+    if ( !schedule )
+        return;
+
+    // Spread the strands of other threads over the deques, the idle workers steal the rest
+    Worker *worker = currentWorker;
+    if ( worker == NULL )
+        worker = workers[ nextWorker++ % workers.size() ];
+    pushStrand ( worker , strand );
+}
+
+static void pushStrand ( Worker *worker , Strand *strand ) {
+
+    pthread_spin_lock ( &worker->lock );
+    if ( worker->tail - worker->head == worker->capacity ) {
+        // Full, move everything to a ring twice the size
+        Strand **ring = (Strand**) malloc ( 2 * worker->capacity * sizeof ( Strand* ) );
+        for ( unsigned i = worker->head ; i != worker->tail ; i++ )
+            ring[ i & ( 2 * worker->capacity - 1 ) ] = worker->ring[ i & ( worker->capacity - 1 ) ];
+        free ( worker->ring );
+        worker->ring = ring;
+        worker->capacity *= 2;
+    }
+    worker->ring[ worker->tail++ & ( worker->capacity - 1 ) ] = strand;
+    __atomic_add_fetch ( &queuedStrands , 1 , __ATOMIC_SEQ_CST );
+    pthread_spin_unlock ( &worker->lock );
+
+    // A worker going to sleep checks 'queuedStrands' after counting itself
+    if ( __atomic_load_n ( &sleepingWorkers , __ATOMIC_SEQ_CST ) > 0 ) {
+        pthread_mutex_lock ( &sleepLock );
+        pthread_cond_signal ( &wakeCondition );
+        pthread_mutex_unlock ( &sleepLock );
+    }
+}
+
+static Strand* takeStrand ( Worker *worker ) {
+
+    Strand *strand = NULL;
+    pthread_spin_lock ( &worker->lock );
+    if ( worker->head != worker->tail ) {
+        strand = worker->ring[ worker->head++ & ( worker->capacity - 1 ) ];
+        __atomic_sub_fetch ( &queuedStrands , 1 , __ATOMIC_SEQ_CST );
+    }
+    pthread_spin_unlock ( &worker->lock );
+    if ( strand != NULL )
+        return strand;
+
+    // Nothing of our own, try the other workers in turn
+    for ( int i = 1 ; i < workers.size() ; i++ ) {
+        Worker *victim = workers[ ( worker->index + i ) % workers.size() ];
+        pthread_spin_lock ( &victim->lock );
+        if ( victim->head != victim->tail ) {
+            strand = victim->ring[ --victim->tail & ( victim->capacity - 1 ) ];
+            __atomic_sub_fetch ( &queuedStrands , 1 , __ATOMIC_SEQ_CST );
+        }
+        pthread_spin_unlock ( &victim->lock );
+        if ( strand != NULL ) {
+            __atomic_store_n ( &worker->stolen , worker->stolen + 1 , __ATOMIC_RELAXED );
+            return strand;
+        }
+    }
+
+    return NULL;
+}
+
+static void runStrand ( Worker *worker , Strand *strand ) {
+
+    for ( int i = 0 ; i < STRAND_BATCH ; i++ ) {
+        pthread_spin_lock ( &strand->lock );
+        WorkerTask *task = strand->head;
+        if ( task == NULL ) {
+            strand->scheduled = false;
+            pthread_spin_unlock ( &strand->lock );
+            return;
+        }
+        strand->head = task->next;
+        if ( strand->head == NULL )
+            strand->tail = NULL;
+        pthread_spin_unlock ( &strand->lock );
+
+        // The task may free itself, and the last one the strand too
+        bool last = task->last;
+        task->run ( task );
+        __atomic_sub_fetch ( &queuedTasks , 1 , __ATOMIC_RELAXED );
+        __atomic_store_n ( &worker->executed , worker->executed + 1 , __ATOMIC_RELAXED );
+        if ( last )
+            return;
+    }
+
+    // Give the other strands a turn, this one goes to the back of the deque
+    pthread_spin_lock ( &strand->lock );
+    bool more = strand->head != NULL;
+    if ( !more )
+        strand->scheduled = false;
+    pthread_spin_unlock ( &strand->lock );
+    if ( more )
+        pushStrand ( worker , strand );
+}
+
+static void* workerThread ( void *args ) {
+
+    Worker *worker = (Worker*) args;
+    currentWorker = worker;
+
+    while ( true ) {
+        Strand *strand = takeStrand ( worker );
+        if ( strand != NULL ) {
+            runStrand ( worker , strand );
+            continue;
+        }
+
+        // Every deque is empty, sleep till a strand is queued
+        pthread_mutex_lock ( &sleepLock );
+        __atomic_add_fetch ( &sleepingWorkers , 1 , __ATOMIC_SEQ_CST );
+        while ( __atomic_load_n ( &queuedStrands , __ATOMIC_SEQ_CST ) == 0 )
+            pthread_cond_wait ( &wakeCondition , &sleepLock );
+        __atomic_sub_fetch ( &sleepingWorkers , 1 , __ATOMIC_SEQ_CST );
+        pthread_mutex_unlock ( &sleepLock );
+    }
+
+    // Control should not reach here
+    return NULL;
+}
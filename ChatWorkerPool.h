@@ -0,0 +1,77 @@
+// ChatWorkerPool.h
+
+#ifndef __ChatWorkerPool_h
+#define __ChatWorkerPool_h
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * A fixed number of worker threads, started once, which run the tasks
+ * handed to them by other threads (e.g. the requests received by the
+ * reactors).
+ *
+ * Every task belongs to a Strand, and the tasks of one strand run one
+ * after the other, in the order they were submitted (e.g. one strand
+ * per connection keeps the requests of a client in order, while the
+ * requests of different clients run in parallel).
+ *
+ * A strand with tasks waiting is queued on the deque of one worker.
+ * Each worker takes the strands from its own deque, and a worker with
+ * an empty deque steals from the other end of the deque of another
+ * worker, so a long task does not hold up the strands queued behind
+ * it. Idle workers sleep till a new strand is queued.
+ */
+
+/// @brief  Maximum number of tasks of one strand run in a row, before the others get a turn
+#define STRAND_BATCH  16
+
+/**
+ * @brief  A unit of work, usually the first member of a larger structure
+ *
+ * 'run' is called on a worker thread, and may free the task.
+ */
+struct WorkerTask {
+    WorkerTask   *next;                          ///< Next task of the same strand
+    void        (*run) ( WorkerTask *task );     ///< Function running the task
+    bool          last;                          ///< Nothing is submitted to the strand after this task, which may free it
+};
+
+/**
+ * @brief  Tasks which must run in order, one at a time
+ */
+struct Strand {
+    pthread_spinlock_t  lock;        ///< Lock on the fields below
+    WorkerTask         *head;        ///< Tasks waiting to run
+    WorkerTask         *tail;
+    bool                scheduled;   ///< Queued on a worker, or running
+};
+
+/**
+ * @brief  Counters of the worker pool (see getWorkerPoolStats())
+ */
+struct WorkerPoolStats {
+    int             workers;          ///< Number of worker threads
+    unsigned long   queuedTasks;      ///< Tasks submitted but not yet run
+    unsigned long   maxQueuedTasks;   ///< Most tasks ever waiting at the same time
+    unsigned long   queuedStrands;    ///< Strands waiting in the deques
+    unsigned long   maxDequeDepth;    ///< Strands in the fullest deque now
+    unsigned long   executed;         ///< Tasks run so far
+    unsigned long   stolen;           ///< Strands taken from the deque of another worker
+};
+
+/// @brief  Start 'count' worker threads (no tasks may be submitted while there are none)
+bool startWorkerPool ( int count );
+/// @brief  Number of worker threads, 0 if the pool was not started
+int workerPoolSize ();
+/// @brief  Current counters of the pool, from any thread
+void getWorkerPoolStats ( WorkerPoolStats *stats );
+
+/// @brief  Initialise an empty strand
+void initStrand ( Strand *strand );
+/// @brief  Release a strand which has no tasks left
+void destroyStrand ( Strand *strand );
+/// @brief  Run 'task' on a worker once the earlier tasks of 'strand' are done, from any thread
+void submitTask ( Strand *strand , WorkerTask *task );
+
+#endif  // __ChatWorkerPool_h
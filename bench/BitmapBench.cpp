@@ -0,0 +1,133 @@
+// BitmapBench.cpp
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ChatBench.h"
+#include "../ChatUserBitmap.h"
+
+using namespace std;
+
+/*
+ * The member sets of the groups (ChatUserBitmap.h) against a vector of
+ * the IDs of the members, with the users numbered densely as the
+ * registry numbers its slots:
+ *  - the memory of 50 rooms of 100k members each, and of 1000 rooms
+ *    which 100k users joined 50 each (about 5000 members a room),
+ *  - going through the 100k members of a room,
+ *  - finding whether a user is in a room of 5000 (a scan of the vector),
+ *  - a join to a room of 5000, which copies the set and adds to the copy
+ *    (as the groups publish a new set on each change).
+ *
+ * Usage: BitmapBench [iterations]
+ */
+
+/// @brief  Bytes of memory a vector of members takes (once shrunk to fit)
+size_t vectorBytes ( const vector <uint32_t> &members ) {
+    return sizeof ( members ) + members.capacity() * sizeof ( uint32_t );
+}
+
+/// @brief  Nanoseconds per call of 'run' over 'iterations' calls, given the number of the call
+template < class Run >
+double timeRuns ( int iterations , Run run ) {
+    uint64_t start = nowNanos ();
+    for ( int i = 0 ; i < iterations ; i++ )
+        run ( i );
+    return (double) ( nowNanos () - start ) / iterations;
+}
+
+int main ( int argc , char **argv ) {
+
+    int iterations = argc > 1 ? atoi ( argv[1] ) : 100000;
+    const int users = 100000;
+    srand ( 1 );
+
+    // 50 rooms which everyone joined, in the order they logged in
+    vector <UserBitmap> fullRooms ( 50 );
+    vector <vector <uint32_t>> fullVectors ( 50 );
+    size_t fullBitmapBytes = 0 , fullVectorBytes = 0;
+    for ( int room = 0 ; room < 50 ; room++ ) {
+        initUserBitmap ( &fullRooms[ room ] );
+        for ( int user = 0 ; user < users ; user++ ) {
+            addToBitmap ( &fullRooms[ room ] , user );
+            fullVectors[ room ].push_back ( user );
+        }
+        fullVectors[ room ].shrink_to_fit ();
+        fullBitmapBytes += bitmapBytes ( &fullRooms[ room ] );
+        fullVectorBytes += vectorBytes ( fullVectors[ room ] );
+    }
+
+    // 1000 rooms, each user in 50 of them
+    vector <UserBitmap> rooms ( 1000 );
+    vector <vector <uint32_t>> roomVectors ( 1000 );
+    for ( UserBitmap &room : rooms )
+        initUserBitmap ( &room );
+    for ( int user = 0 ; user < users ; user++ ) {
+        for ( int joined = 0 ; joined < 50 ; ) {
+            int room = rand () % 1000;
+            if ( addToBitmap ( &rooms[ room ] , user ) ) {
+                roomVectors[ room ].push_back ( user );
+                joined++;
+            }
+        }
+    }
+    size_t roomBitmapBytes = 0 , roomVectorBytes = 0;
+    for ( int room = 0 ; room < 1000 ; room++ ) {
+        roomVectors[ room ].shrink_to_fit ();
+        roomBitmapBytes += bitmapBytes ( &rooms[ room ] );
+        roomVectorBytes += vectorBytes ( roomVectors[ room ] );
+    }
+
+    cout << fixed << setprecision ( 1 );
+    cout << "                                          vector      bitmap\n";
+    cout << "  KB, 50 rooms of 100k members      " << setw ( 12 ) << fullVectorBytes / 1024.0
+         << setw ( 12 ) << fullBitmapBytes / 1024.0 << "\n";
+    cout << "  KB, 100k users in 50 of 1000 rooms" << setw ( 12 ) << roomVectorBytes / 1024.0
+         << setw ( 12 ) << roomBitmapBytes / 1024.0 << "\n";
+
+    // A room of 5000 members, and the users to look for in it
+    const UserBitmap *room = &rooms[0];
+    const vector <uint32_t> &roomVector = roomVectors[0];
+    vector <uint32_t> lookups;
+    for ( int i = 0 ; i < iterations ; i++ )
+        lookups.push_back ( rand () % users );
+    int passes = max ( 1 , iterations / 1000 );
+
+    cout << "  us, going through 100k members    "
+         << setw ( 12 ) << timeRuns ( passes , [&] ( int ) {
+                uint64_t sum = 0;
+                for ( uint32_t member : fullVectors[0] )
+                    sum += member;
+                keepValue ( sum );
+            } ) / 1000
+         << setw ( 12 ) << timeRuns ( passes , [&] ( int ) {
+                uint64_t sum = 0;
+                forEachInBitmap ( &fullRooms[0] , [&sum] ( uint32_t member ) { sum += member; } );
+                keepValue ( sum );
+            } ) / 1000 << "\n";
+    cout << "  ns, contains, " << setw ( 4 ) << room->count << " members     "
+         << setw ( 12 ) << timeRuns ( iterations , [&] ( int i ) {
+                keepValue ( find ( roomVector.begin() , roomVector.end() , lookups[i] ) != roomVector.end() );
+            } )
+         << setw ( 12 ) << timeRuns ( iterations , [&] ( int i ) {
+                keepValue ( bitmapContains ( room , lookups[i] ) );
+            } ) << "\n";
+    cout << "  us, join (copy and add), " << setw ( 4 ) << room->count << "    "
+         << setw ( 12 ) << timeRuns ( passes , [&] ( int i ) {
+                vector <uint32_t> *members = new vector <uint32_t> ( roomVector );
+                members->push_back ( users + i );
+                keepValue ( members->size() );
+                delete members;
+            } ) / 1000
+         << setw ( 12 ) << timeRuns ( passes , [&] ( int i ) {
+                UserBitmap *members = new UserBitmap ( *room );
+                addToBitmap ( members , users + i );
+                keepValue ( members->count );
+                delete members;
+            } ) / 1000 << "\n";
+    return 0;
+}
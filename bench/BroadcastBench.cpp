@@ -0,0 +1,139 @@
+// BroadcastBench.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ChatBench.h"
+
+using namespace std;
+
+/*
+ * Time a Yell takes to reach many users: one sender yells, one message
+ * at a time, to 'receivers' other clients logged in to a running server.
+ * For each message it measures the time till the sender gets its Yell
+ * response, and till the last receiver gets the forward. All the clients
+ * are read by one thread with epoll.
+ *
+ * Usage: BroadcastBench [-p port] [-n receivers] [-m messages] [-s message bytes] [host]
+ */
+
+/// @brief  Read what came for 'client', count the packets of 'type', returns false if it closed
+bool readClient ( BenchClient *client , uint16_t type , bool *replied , uint16_t replyType );
+
+int main ( int argc , char **argv ) {
+
+    const char *port = NULL;
+    int receiverCount = 1000 , messageCount = 50 , messageBytes = 32;
+    int option;
+    while ( ( option = getopt ( argc , argv , "p:n:m:s:" ) ) != -1 ) {
+        switch ( option ) {
+            case 'p': port = optarg; break;
+            case 'n': receiverCount = atoi ( optarg ); break;
+            case 'm': messageCount = atoi ( optarg ); break;
+            case 's': messageBytes = atoi ( optarg ); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-p port] [-n receivers] [-m messages] [-s message bytes] [host]\n";
+                return 1;
+        }
+    }
+    const char *host = optind < argc ? argv[ optind ] : "127.0.0.1";
+    raiseFileLimit ();
+
+    // Names of this run only, as the users of an earlier run may still be waiting to resume
+    string prefix = to_string ( getpid () ) + "-";
+    vector <BenchClient> receivers ( receiverCount );
+    for ( int i = 0 ; i < receiverCount ; i++ ) {
+        if ( !openClient ( &receivers[i] , host , benchPort ( port ) , prefix + to_string ( i ) , 0 ) )
+            return 1;
+    }
+    BenchClient sender;
+    if ( !openClient ( &sender , host , benchPort ( port ) , prefix + "sender" , 0 ) )
+        return 1;
+
+    int epollFD = epoll_create1 ( 0 );
+    for ( BenchClient *client = &receivers[0] ; client <= &receivers.back() ; client++ ) {
+        fcntl ( client->socketFD , F_SETFL , O_NONBLOCK );
+        struct epoll_event event = { EPOLLIN , { .ptr = client } };
+        epoll_ctl ( epollFD , EPOLL_CTL_ADD , client->socketFD , &event );
+    }
+    fcntl ( sender.socketFD , F_SETFL , O_NONBLOCK );
+    struct epoll_event senderEvent = { EPOLLIN , { .ptr = &sender } };
+    epoll_ctl ( epollFD , EPOLL_CTL_ADD , sender.socketFD , &senderEvent );
+
+    char packet[ MAX_PACKET_LENGTH ];
+    vector <string> words ( 1 , string ( messageBytes , 'x' ) );
+    int length = encodePacket < YellRequest > ( packet , sender.cookie , words );
+    vector <uint64_t> replyTimes , deliveryTimes;
+    vector <struct epoll_event> events ( 1024 );
+    uint64_t begin = nowNanos ();
+
+    for ( int message = 0 ; message < messageCount ; message++ ) {
+        for ( BenchClient &client : receivers )
+            client.received = 0;
+        int delivered = 0;
+        bool replied = false;
+        uint64_t sent = nowNanos ();
+        if ( !sendAll ( sender.socketFD , packet , length ) ) {
+            cerr << "The sender's connection failed\n";
+            return 1;
+        }
+        while ( !replied || delivered < receiverCount ) {
+            int count = epoll_wait ( epollFD , events.data() , events.size() , 5000 );
+            if ( count <= 0 ) {
+                cerr << "Timed out with " << delivered << " of " << receiverCount << " delivered\n";
+                return 1;
+            }
+            for ( int i = 0 ; i < count ; i++ ) {
+                BenchClient *client = (BenchClient*) events[i].data.ptr;
+                bool wasReplied = replied;
+                int before = client->received;
+                if ( !readClient ( client , RESPONSE_YELL_FWD , &replied , RESPONSE_YELL ) ) {
+                    cerr << client->name << " was disconnected\n";
+                    return 1;
+                }
+                if ( replied && !wasReplied )
+                    replyTimes.push_back ( nowNanos () - sent );
+                if ( client != &sender && client->received > before && before == 0 )
+                    delivered++;
+            }
+        }
+        deliveryTimes.push_back ( nowNanos () - sent );
+    }
+
+    double seconds = ( nowNanos () - begin ) / 1e9;
+    cout << receiverCount << " receivers, " << messageCount << " yells of " << messageBytes << " bytes in "
+         << seconds << " s\n";
+    cout << "sender reply     p50 " << percentile ( replyTimes , 0.5 ) / 1000 << " us, p99 "
+         << percentile ( replyTimes , 0.99 ) / 1000 << " us\n";
+    cout << "last delivery    p50 " << percentile ( deliveryTimes , 0.5 ) / 1000 << " us, p99 "
+         << percentile ( deliveryTimes , 0.99 ) / 1000 << " us\n";
+    return 0;
+}
+
+bool readClient ( BenchClient *client , uint16_t type , bool *replied , uint16_t replyType ) {
+
+    while ( true ) {
+        int result = recvFrames ( &client->buffer , client->socketFD );
+        if ( result == 0 || ( result < 0 && errno != EAGAIN ) )
+            return false;
+        Frame frame;
+        int found;
+        while ( ( found = nextFrame ( &client->buffer , &frame ) ) > 0 ) {
+            uint16_t frameType = frame.type & ~PACKET_CONTINUED;
+            if ( frameType == type )
+                client->received++;
+            else if ( frameType == replyType )
+                *replied = true;
+        }
+        if ( found < 0 )
+            return false;
+        if ( result < 0 || recvBufferDrained ( &client->buffer ) )
+            return true;
+    }
+}
@@ -0,0 +1,145 @@
+// ChatBench.h
+
+#ifndef __ChatBench_h
+#define __ChatBench_h
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "../ChatCodec.h"
+#include "../ChatPacket.h"
+#include "../ChatRecvBuffer.h"
+
+/*
+ * Helpers shared by the benchmarks (see bench/Readme.txt): a clock, the
+ * percentiles of a set of times, and a plain blocking client of the
+ * server, which the load benchmarks then read with epoll.
+ */
+
+/// @brief  Monotonic time, in nanoseconds
+inline uint64_t nowNanos () {
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC , &now );
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/// @brief  The time below which 'share' (0 to 1) of 'times' fall (sorts them)
+inline uint64_t percentile ( std::vector <uint64_t> &times , double share ) {
+    if ( times.empty() )
+        return 0;
+    std::sort ( times.begin() , times.end() );
+    size_t index = std::min ( times.size() - 1 , (size_t) ( share * times.size() ) );
+    return times[ index ];
+}
+
+/// @brief  Keep the compiler from dropping a result which is not used
+template < class Value >
+inline void keepValue ( const Value &value ) {
+    asm volatile ( "" : : "g" ( &value ) : "memory" );
+}
+
+/// @brief  Allow as many sockets as the hard limit does
+inline void raiseFileLimit () {
+    struct rlimit limit;
+    if ( getrlimit ( RLIMIT_NOFILE , &limit ) == 0 ) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit ( RLIMIT_NOFILE , &limit );
+    }
+}
+
+/**
+ * @brief  One connection of a benchmark to the server
+ */
+struct BenchClient {
+    int           socketFD;
+    RecvBuffer    buffer;
+    uint32_t      cookie;
+    uint32_t      features;      ///< Accepted by the server
+    std::string   name;
+    int           received;      ///< Packets counted by the benchmark
+};
+
+/// @brief  Send all of 'data', returns false if the connection failed
+inline bool sendAll ( int socketFD , const char *data , int length ) {
+    while ( length > 0 ) {
+        ssize_t sent = send ( socketFD , data , length , MSG_NOSIGNAL );
+        if ( sent <= 0 )
+            return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/// @brief  Wait for the next packet of a client (blocking), returns false if the connection closed
+inline bool waitFrame ( BenchClient *client , Frame *frame ) {
+    while ( true ) {
+        int found = nextFrame ( &client->buffer , frame );
+        if ( found < 0 )
+            return false;
+        if ( found > 0 )
+            return true;
+        if ( recvFrames ( &client->buffer , client->socketFD ) <= 0 )
+            return false;
+    }
+}
+
+/// @brief  Connect to the server and log in as 'name' with 'features', returns false if it failed
+inline bool openClient ( BenchClient *client , const char *host , uint16_t port ,
+                         const std::string &name , uint32_t features ) {
+
+    client->name = name;
+    client->received = 0;
+    initRecvBuffer ( &client->buffer );
+    client->socketFD = socket ( AF_INET , SOCK_STREAM , 0 );
+    if ( client->socketFD < 0 ) {
+        perror ( "socket" );
+        return false;
+    }
+    int on = 1;
+    setsockopt ( client->socketFD , IPPROTO_TCP , TCP_NODELAY , &on , sizeof ( on ) );
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons ( port );
+    inet_pton ( AF_INET , host , &address.sin_addr );
+    if ( connect ( client->socketFD , (struct sockaddr*) &address , sizeof ( address ) ) < 0 ) {
+        perror ( "connect" );
+        return false;
+    }
+
+    char packet[ MAX_PACKET_LENGTH ];
+    int length = encodePacket < LoginRequest > ( packet , 0 , name , features );
+    Frame frame;
+    if ( !sendAll ( client->socketFD , packet , length ) || !waitFrame ( client , &frame ) ) {
+        fprintf ( stderr , "%s: no Login response\n" , name.c_str() );
+        return false;
+    }
+    FrameReader reader;
+    initFrameReader ( &reader , frame.body , frame.bodyLength );
+    uint32_t status;
+    decodePacket < LoginResponse > ( &reader , status , client->cookie , client->features );
+    if ( frame.type != RESPONSE_LOGIN || status != STATUS_SUCCESS ) {
+        fprintf ( stderr , "%s: login failed (%u)\n" , name.c_str() , status );
+        return false;
+    }
+    return true;
+}
+
+/// @brief  Port of the server from the command line, or 8080
+inline uint16_t benchPort ( const char *value ) {
+    return value != NULL ? (uint16_t) atoi ( value ) : 8080;
+}
+
+#endif  // __ChatBench_h
@@ -0,0 +1,177 @@
+// CodecBench.cpp
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ChatBench.h"
+
+using namespace std;
+
+/// @brief  Offset of the body of a packet, after its 'type' and 'length'
+#define FRAME_BODY_OFFSET  ( 2 * sizeof ( uint16_t ) )
+
+/*
+ * Packets written and read by the ChatCodec.h schemas, against the
+ * hand-rolled code they replaced (the putNext* helpers and readString()
+ * loops of the handlers), in nanoseconds per packet:
+ *  - a Talk Forward of 40 words (about 270 bytes) encoded from the words
+ *    of a Talk request, as handleTalk() does,
+ *  - a Login response (with its features),
+ *  - the Talk Forward decoded, as the client does.
+ * It also checks that both write the same bytes.
+ *
+ * Usage: CodecBench [iterations]
+ */
+
+/// @brief  The hand-rolled helpers, as they were before ChatCodec.h
+void putNextString ( char *buffer , int &offset , string_view nextString ) {
+    memcpy ( buffer + offset , nextString.data() , nextString.size() );
+    offset += nextString.size();
+    buffer[ offset++ ] = '\0';
+}
+
+void putNextUint32 ( char *buffer , int &offset , uint32_t nextUint32 ) {
+    nextUint32 = htonl ( nextUint32 );
+    memcpy ( buffer + offset , &nextUint32 , sizeof ( nextUint32 ) );
+    offset += sizeof ( uint32_t );
+}
+
+void putNextUint16 ( char *buffer , int &offset , uint16_t nextUint16 ) {
+    nextUint16 = htons ( nextUint16 );
+    memcpy ( buffer + offset , &nextUint16 , sizeof ( nextUint16 ) );
+    offset += sizeof ( uint16_t );
+}
+
+bool replyFits ( int offset , string_view nextString ) {
+    return offset + (int) nextString.size() + 2 <= MAX_PACKET_LENGTH;
+}
+
+/// @brief  Talk Forward of the words left in 'request', written by hand
+int handTalkForward ( char *buffer , string_view sender , string_view receiver , FrameReader *request ) {
+
+    int offset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
+    putNextUint16 ( buffer , offset , RESPONSE_TALK_FWD );
+    putNextUint16 ( buffer , offset , 0 );
+    putNextUint32 ( buffer , offset , STATUS_SUCCESS );
+    putNextString ( buffer , offset , sender );
+    putNextString ( buffer , offset , receiver );
+    string_view message = readString ( request );
+    while ( !message.empty() && replyFits ( offset , message ) ) {
+        putNextString ( buffer , offset , message );
+        message = readString ( request );
+    }
+    putNextString ( buffer , offset , "" );
+    putNextUint16 ( buffer , lengthOffset , offset );
+    return offset;
+}
+
+/// @brief  Login response with its features, written by hand
+int handLoginResponse ( char *buffer , uint32_t cookie , uint32_t features ) {
+
+    int offset = 0 , lengthOffset = LENGTH_FIELD_OFFSET;
+    putNextUint16 ( buffer , offset , RESPONSE_LOGIN );
+    putNextUint16 ( buffer , offset , 0 );
+    putNextUint32 ( buffer , offset , STATUS_SUCCESS );
+    putNextUint32 ( buffer , offset , cookie );
+    putNextUint32 ( buffer , offset , features );
+    putNextUint16 ( buffer , lengthOffset , offset );
+    return offset;
+}
+
+/// @brief  Nanoseconds per call of 'run' over 'iterations' calls (after as many to warm up)
+template < class Run >
+double timeRun ( int iterations , Run run ) {
+    for ( int i = 0 ; i < iterations ; i++ )
+        run ();
+    uint64_t start = nowNanos ();
+    for ( int i = 0 ; i < iterations ; i++ )
+        run ();
+    return (double) ( nowNanos () - start ) / iterations;
+}
+
+int main ( int argc , char **argv ) {
+
+    int iterations = argc > 1 ? atoi ( argv[1] ) : 2000000;
+
+    // A Talk request body of 40 words, after its cookie
+    vector <string> words;
+    for ( int i = 0 ; i < 40 ; i++ )
+        words.push_back ( string ( 3 + i % 6 , 'a' + i % 26 ) );
+    char request[ MAX_PACKET_LENGTH ];
+    int requestLength = encodePacket < TalkRequest > ( request , 1234 , "alice" , "bob" , words );
+    const char *body = request + FRAME_BODY_OFFSET;
+    int bodyLength = requestLength - FRAME_BODY_OFFSET;
+    // Offset of the words, after the cookie and the two names
+    int wordsOffset = sizeof ( uint32_t ) + strlen ( "alice" ) + 1 + strlen ( "bob" ) + 1;
+
+    char hand[ MAX_PACKET_LENGTH ] , codec[ MAX_PACKET_LENGTH ];
+    FrameReader reader;
+    initFrameReader ( &reader , body , bodyLength );
+    reader.offset = wordsOffset;
+    int handLength = handTalkForward ( hand , "alice" , "bob" , &reader );
+    initFrameReader ( &reader , body , bodyLength );
+    reader.offset = wordsOffset;
+    int codecLength = encodePacket < TalkForward > ( codec , STATUS_SUCCESS , "alice" , "bob" , FrameStrings { &reader } );
+    if ( handLength != codecLength || memcmp ( hand , codec , handLength ) != 0 ) {
+        cerr << "The codec and the hand-rolled code wrote different Talk Forwards\n";
+        return 1;
+    }
+    int loginLength = handLoginResponse ( hand , 1234 , 0 );
+    if ( loginLength != encodePacket < LoginResponse > ( codec , STATUS_SUCCESS , 1234 , 0 ) ||
+         memcmp ( hand , codec , loginLength ) != 0 ) {
+        cerr << "The codec and the hand-rolled code wrote different Login responses\n";
+        return 1;
+    }
+
+    cout << "ns per packet                          hand-rolled   codec\n";
+    cout << "  TALK_FWD encode, " << handLength << " bytes, 40 words     "
+         << timeRun ( iterations , [&] () {
+                initFrameReader ( &reader , body , bodyLength );
+                reader.offset = wordsOffset;
+                keepValue ( handTalkForward ( hand , "alice" , "bob" , &reader ) );
+            } ) << "    "
+         << timeRun ( iterations , [&] () {
+                initFrameReader ( &reader , body , bodyLength );
+                reader.offset = wordsOffset;
+                keepValue ( encodePacket < TalkForward > ( codec , STATUS_SUCCESS , "alice" , "bob" ,
+                                                           FrameStrings { &reader } ) );
+            } ) << "\n";
+    cout << "  LOGIN response encode                "
+         << timeRun ( iterations , [&] () { keepValue ( handLoginResponse ( hand , 1234 , 0 ) ); } ) << "    "
+         << timeRun ( iterations , [&] () {
+                keepValue ( encodePacket < LoginResponse > ( codec , STATUS_SUCCESS , 1234 , 0 ) );
+            } ) << "\n";
+
+    // The forward as the client reads it, counting the bytes of the words
+    initFrameReader ( &reader , body , bodyLength );
+    reader.offset = wordsOffset;
+    codecLength = encodePacket < TalkForward > ( codec , STATUS_SUCCESS , "alice" , "bob" , FrameStrings { &reader } );
+    const char *forward = codec + FRAME_BODY_OFFSET;
+    int forwardLength = codecLength - FRAME_BODY_OFFSET;
+    cout << "  TALK_FWD decode                      "
+         << timeRun ( iterations , [&] () {
+                initFrameReader ( &reader , forward , forwardLength );
+                uint32_t status = readUint32 ( &reader );
+                size_t bytes = readString ( &reader ).size() + readString ( &reader ).size() + status;
+                for ( string_view word = readString ( &reader ) ; !word.empty() ; word = readString ( &reader ) )
+                    bytes += word.size();
+                keepValue ( bytes );
+            } ) << "    "
+         << timeRun ( iterations , [&] () {
+                initFrameReader ( &reader , forward , forwardLength );
+                uint32_t status;
+                string_view sender , receiver;
+                FrameStrings message;
+                decodePacket < TalkForward > ( &reader , status , sender , receiver , message );
+                size_t bytes = sender.size() + receiver.size() + status;
+                for ( string_view word : message )
+                    bytes += word.size();
+                keepValue ( bytes );
+            } ) << "\n";
+    return 0;
+}
@@ -0,0 +1,159 @@
+// ContentionBench.cpp
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ChatBench.h"
+#include "../ChatEpoch.h"
+#include "../ChatUserRegistry.h"
+
+using namespace std;
+
+/*
+ * Lookups of the user registry from several threads while users log in
+ * and out: 10k users, 1 to 'threads' reader threads finding random users
+ * by name (as Talk routing does), and one more thread making a random
+ * user leave and log in again, over and over, for one second per row.
+ * The lookups and logins per second are printed, the registry read in
+ * read sections and locked per shard as the server does, and the same
+ * calls made under one global pthread_rwlock (as the server did before
+ * the registry).
+ *
+ * Usage: ContentionBench [-t threads] [-u users]
+ */
+
+/**
+ * @brief  What the threads of one row share
+ */
+struct Contention {
+    UserRegistry            *registry;
+    vector <string>         *names;
+    vector <UserID>         *userIDs;       ///< Of each name (only changed by the churn thread)
+    pthread_rwlock_t        *globalLock;    ///< NULL to run as the server does
+    bool                     stop;          ///< Set to end the row (read atomically)
+};
+
+/**
+ * @brief  One thread of a row and what it counted
+ */
+struct ContentionThread {
+    pthread_t       thread;
+    Contention     *contention;
+    unsigned int    seed;
+    uint64_t        operations;
+};
+
+/// @brief  Find random users by name till the row ends
+void* readUsers ( void *argument );
+/// @brief  Make random users leave and log in again till the row ends
+void* churnUsers ( void *argument );
+
+int main ( int argc , char **argv ) {
+
+    int threads = max ( 1L , sysconf ( _SC_NPROCESSORS_ONLN ) ) , users = 10000;
+    int option;
+    while ( ( option = getopt ( argc , argv , "t:u:" ) ) != -1 ) {
+        switch ( option ) {
+            case 't': threads = atoi ( optarg ); break;
+            case 'u': users = atoi ( optarg ); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-t threads] [-u users]\n";
+                return 1;
+        }
+    }
+
+    vector <string> names;
+    for ( int i = 0 ; i < users ; i++ )
+        names.push_back ( "user" + to_string ( i ) );
+    pthread_rwlock_t globalLock;
+    pthread_rwlock_init ( &globalLock , NULL );
+
+    cout << fixed << setprecision ( 1 );
+    cout << "readers   lookups/s (M)          logins/s (k)\n";
+    cout << "          registry   global     registry   global\n";
+    for ( int readers = 1 ; readers <= threads ; readers *= 2 ) {
+        double lookups[2] , logins[2];
+        for ( int global = 0 ; global < 2 ; global++ ) {
+
+            UserRegistry *registry = new UserRegistry ();
+            initUserRegistry ( registry );
+            vector <UserID> userIDs;
+            for ( int i = 0 ; i < users ; i++ ) {
+                User user = { names[i] , NO_USER , (uint32_t) i + 1 , NO_CONNECTION , 0 };
+                addUser ( registry , &user );
+                userIDs.push_back ( user.userID );
+            }
+            Contention contention = { registry , &names , &userIDs , global ? &globalLock : NULL , false };
+
+            vector <ContentionThread> rowThreads ( readers + 1 );
+            for ( int i = 0 ; i <= readers ; i++ ) {
+                rowThreads[i] = ContentionThread { 0 , &contention , (unsigned int) i + 1 , 0 };
+                pthread_create ( &rowThreads[i].thread , NULL , i < readers ? readUsers : churnUsers , &rowThreads[i] );
+            }
+            uint64_t start = nowNanos ();
+            usleep ( 1000000 );
+            __atomic_store_n ( &contention.stop , true , __ATOMIC_RELAXED );
+            uint64_t reads = 0;
+            for ( int i = 0 ; i <= readers ; i++ ) {
+                pthread_join ( rowThreads[i].thread , NULL );
+                if ( i < readers )
+                    reads += rowThreads[i].operations;
+            }
+            double seconds = ( nowNanos () - start ) / 1e9;
+            lookups[ global ] = reads / seconds / 1e6;
+            logins[ global ] = rowThreads[ readers ].operations / seconds / 1e3;
+        }
+        cout << setw ( 7 ) << readers << setw ( 11 ) << lookups[0] << setw ( 9 ) << lookups[1]
+             << setw ( 13 ) << logins[0] << setw ( 9 ) << logins[1] << "\n";
+    }
+    return 0;
+}
+
+void* readUsers ( void *argument ) {
+
+    ContentionThread *self = (ContentionThread*) argument;
+    Contention *contention = self->contention;
+    const vector <string> &names = *contention->names;
+    while ( !__atomic_load_n ( &contention->stop , __ATOMIC_RELAXED ) ) {
+        // A batch between two looks at the flag
+        for ( int i = 0 ; i < 256 ; i++ ) {
+            const string &name = names[ rand_r ( &self->seed ) % names.size() ];
+            if ( contention->globalLock != NULL )
+                pthread_rwlock_rdlock ( contention->globalLock );
+            beginEpochRead ();
+            User *user = findUserByName ( contention->registry , name );
+            keepValue ( user != NULL ? user->connection : NO_CONNECTION );
+            endEpochRead ();
+            if ( contention->globalLock != NULL )
+                pthread_rwlock_unlock ( contention->globalLock );
+        }
+        self->operations += 256;
+    }
+    return NULL;
+}
+
+void* churnUsers ( void *argument ) {
+
+    ContentionThread *self = (ContentionThread*) argument;
+    Contention *contention = self->contention;
+    vector <UserID> &userIDs = *contention->userIDs;
+    while ( !__atomic_load_n ( &contention->stop , __ATOMIC_RELAXED ) ) {
+        size_t index = rand_r ( &self->seed ) % userIDs.size();
+        User user = { ( *contention->names )[ index ] , NO_USER , (uint32_t) index + 1 , NO_CONNECTION , 0 };
+        if ( contention->globalLock != NULL )
+            pthread_rwlock_wrlock ( contention->globalLock );
+        removeUser ( contention->registry , userIDs[ index ] );
+        addUser ( contention->registry , &user );
+        if ( contention->globalLock != NULL )
+            pthread_rwlock_unlock ( contention->globalLock );
+        userIDs[ index ] = user.userID;
+        self->operations++;
+    }
+    return NULL;
+}
@@ -0,0 +1,109 @@
+// FanoutBench.cpp
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ChatBench.h"
+#include "../ChatBufferPool.h"
+#include "../ChatFanout.h"
+#include "../ChatSendQueue.h"
+#include "../ChatWorkerPool.h"
+
+using namespace std;
+
+/*
+ * The time till the last member of a room has a message queued, with
+ * the members sent to by runFanout() (ChatFanout.h) on 'workers' worker
+ * threads, for rooms of 1k to 50k members. Each member has a send queue
+ * under a spinlock of its own, as a connection of the server has; the
+ * time to write the queues to sockets is left out. A message is a shared
+ * frame of 200 bytes, queued once per member; the queues are emptied
+ * between two messages, outside the times.
+ *
+ * With -w 1 the calling thread goes through every member by itself;
+ * compare with -w 4 (and as many cores).
+ *
+ * Usage: FanoutBench [-w workers] [-m messages]
+ */
+
+/**
+ * @brief  A member of the room, as the server sees its connection
+ */
+struct BenchMember {
+    pthread_spinlock_t  lock;
+    SendQueue           queue;
+} __attribute__ (( aligned ( 64 ) ));
+
+/**
+ * @brief  One message to the room
+ */
+struct BenchFanout {
+    BenchMember    *members;
+    SharedFrame    *shared;
+};
+
+/// @brief  Queue the message for the members 'first' to 'last' (excluded)
+void queueChunk ( void *context , size_t first , size_t last ) {
+
+    BenchFanout *fanout = (BenchFanout*) context;
+    for ( size_t i = first ; i < last ; i++ ) {
+        BenchMember *member = &fanout->members[i];
+        SendFrame *frame = newSendFrame ( fanout->shared );
+        pthread_spin_lock ( &member->lock );
+        pushSendFrame ( &member->queue , frame );
+        pthread_spin_unlock ( &member->lock );
+    }
+}
+
+int main ( int argc , char **argv ) {
+
+    int workers = 1 , messages = 200;
+    int option;
+    while ( ( option = getopt ( argc , argv , "w:m:" ) ) != -1 ) {
+        switch ( option ) {
+            case 'w': workers = atoi ( optarg ); break;
+            case 'm': messages = atoi ( optarg ); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-w workers] [-m messages]\n";
+                return 1;
+        }
+    }
+    if ( !startWorkerPool ( workers ) )
+        return 1;
+
+    FanoutCost cost;
+    initFanoutCost ( &cost , 250 );
+    char packet[ 200 ] = {};
+
+    cout << fixed << setprecision ( 1 );
+    cout << workers << " workers, us till the last member has the message\n";
+    cout << "  members     p50      p99      max    chunk\n";
+    for ( int members : { 1000 , 5000 , 10000 , 50000 } ) {
+
+        vector <BenchMember> room ( members );
+        for ( BenchMember &member : room ) {
+            pthread_spin_init ( &member.lock , PTHREAD_PROCESS_PRIVATE );
+            initSendQueue ( &member.queue );
+        }
+        vector <uint64_t> times;
+        for ( int i = 0 ; i < messages ; i++ ) {
+            BenchFanout fanout = { room.data() , newSharedFrame ( packet , sizeof ( packet ) , members ) };
+            uint64_t start = nowNanos ();
+            runFanout ( &cost , members , queueChunk , &fanout );
+            times.push_back ( nowNanos () - start );
+            for ( BenchMember &member : room )
+                clearSendQueue ( &member.queue );
+        }
+        cout << setw ( 9 ) << members << setw ( 8 ) << percentile ( times , 0.5 ) / 1e3
+             << setw ( 9 ) << percentile ( times , 0.99 ) / 1e3 << setw ( 9 ) << percentile ( times , 1.0 ) / 1e3
+             << setw ( 9 ) << fanoutChunkSize ( &cost ) << "\n";
+        for ( BenchMember &member : room )
+            pthread_spin_destroy ( &member.lock );
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// MallocCount.cpp
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Counts the calls to malloc(), calloc(), realloc() and the aligned
+ * allocators of a program, loaded in front of the C library with
+ * LD_PRELOAD (see bench/Readme.txt). The count so far is written to
+ * stderr when the program gets SIGUSR1, and when it exits, so that the
+ * calls made during a run are the difference of two counts.
+ *
+ * The calls go on to the allocator of the C library (glibc), through
+ * its __libc_* entry points.
+ */
+
+extern "C" {
+    void* __libc_malloc ( size_t size );
+    void* __libc_calloc ( size_t count , size_t size );
+    void* __libc_realloc ( void *memory , size_t size );
+    void* __libc_memalign ( size_t alignment , size_t size );
+}
+
+/// @brief  Calls counted so far (changed atomically)
+static uint64_t mallocCalls = 0;
+
+/// @brief  Write the count to stderr (only calls which are safe in a signal handler)
+static void printMallocCount ( int ) {
+
+    char line[ 64 ] = "malloc calls: ";
+    char digits[ 24 ];
+    int length = 0;
+    uint64_t count = __atomic_load_n ( &mallocCalls , __ATOMIC_RELAXED );
+    do {
+        digits[ length++ ] = '0' + count % 10;
+        count /= 10;
+    } while ( count > 0 );
+    int offset = strlen ( line );
+    while ( length > 0 )
+        line[ offset++ ] = digits[ --length ];
+    line[ offset++ ] = '\n';
+    if ( write ( STDERR_FILENO , line , offset ) < 0 )
+        return;
+}
+
+__attribute__ (( constructor ))
+static void startMallocCount () {
+    signal ( SIGUSR1 , printMallocCount );
+}
+
+__attribute__ (( destructor ))
+static void stopMallocCount () {
+    printMallocCount ( 0 );
+}
+
+extern "C" void* malloc ( size_t size ) {
+    __atomic_add_fetch ( &mallocCalls , 1 , __ATOMIC_RELAXED );
+    return __libc_malloc ( size );
+}
+
+extern "C" void* calloc ( size_t count , size_t size ) {
+    __atomic_add_fetch ( &mallocCalls , 1 , __ATOMIC_RELAXED );
+    return __libc_calloc ( count , size );
+}
+
+extern "C" void* realloc ( void *memory , size_t size ) {
+    __atomic_add_fetch ( &mallocCalls , 1 , __ATOMIC_RELAXED );
+    return __libc_realloc ( memory , size );
+}
+
+extern "C" int posix_memalign ( void **memory , size_t alignment , size_t size ) {
+    __atomic_add_fetch ( &mallocCalls , 1 , __ATOMIC_RELAXED );
+    *memory = __libc_memalign ( alignment , size );
+    return *memory != NULL ? 0 : ENOMEM;
+}
+
+extern "C" void* aligned_alloc ( size_t alignment , size_t size ) {
+    __atomic_add_fetch ( &mallocCalls , 1 , __ATOMIC_RELAXED );
+    return __libc_memalign ( alignment , size );
+}
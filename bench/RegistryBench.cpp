@@ -0,0 +1,115 @@
+// RegistryBench.cpp
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ChatBench.h"
+#include "../ChatEpoch.h"
+#include "../ChatUserRegistry.h"
+
+using namespace std;
+
+/*
+ * The user registry against the vector of users it replaced, with 100,
+ * 10k and 1M users logged in, in nanoseconds per operation:
+ *  - routing a Talk: finding the receiver by name (a linear scan of the
+ *    vector, a lookup of findUserByName() in a read section),
+ *  - a user leaving and another logging in (an erase in the middle of
+ *    the vector and a push_back, removeUser() and addUser()). The scans
+ *    of the vector which came with them (for the socket of the user
+ *    leaving, for the name of the one logging in) are left out.
+ *
+ * Usage: RegistryBench [operations]
+ */
+
+/// @brief  A user in the vector of users, as it was before the registry
+struct OldUser {
+    string     userName;
+    uint32_t   cookie;
+    int        socketFD;
+    int        groupChatStatus;
+    void      *groupChatUsers;
+};
+
+/// @brief  Nanoseconds per call of 'run' over 'count' calls, given the number of the call
+template < class Run >
+double timeRuns ( int count , Run run ) {
+    uint64_t start = nowNanos ();
+    for ( int i = 0 ; i < count ; i++ )
+        run ( i );
+    return (double) ( nowNanos () - start ) / count;
+}
+
+int main ( int argc , char **argv ) {
+
+    int operations = argc > 1 ? atoi ( argv[1] ) : 1000000;
+    srand ( 1 );
+
+    cout << fixed << setprecision ( 0 );
+    cout << "ns per operation                   users      vector    registry\n";
+    for ( int users : { 100 , 10000 , 1000000 } ) {
+
+        vector <OldUser> oldUsers;
+        UserRegistry *registry = new UserRegistry ();
+        initUserRegistry ( registry );
+        vector <UserID> userIDs;
+        for ( int i = 0 ; i < users ; i++ ) {
+            string name = "user" + to_string ( i );
+            oldUsers.push_back ( OldUser { name , (uint32_t) i + 1 , i + 3 , 0 , NULL } );
+            User user = { name , NO_USER , (uint32_t) i + 1 , ( (ConnectionID) 1 << 32 ) | ( i + 3 ) , 0 };
+            addUser ( registry , &user );
+            userIDs.push_back ( user.userID );
+        }
+
+        // The same random receivers for both; the scans of the vector are
+        // cut short at the larger sizes (they take milliseconds each)
+        vector <string> receivers;
+        for ( int i = 0 ; i < operations ; i++ )
+            receivers.push_back ( "user" + to_string ( rand () % users ) );
+        int scans = min ( operations , max ( 1000 , 200000000 / users ) );
+
+        double vectorTalk = timeRuns ( scans , [&] ( int i ) {
+            int socketFD = -1;
+            for ( size_t j = 0 ; j < oldUsers.size() ; j++ ) {
+                if ( oldUsers.at(j).userName == receivers[i] ) {
+                    socketFD = oldUsers.at(j).socketFD;
+                    break;
+                }
+            }
+            keepValue ( socketFD );
+        } );
+        double registryTalk = timeRuns ( operations , [&] ( int i ) {
+            beginEpochRead ();
+            User *receiver = findUserByName ( registry , receivers[i] );
+            keepValue ( receiver != NULL ? receiver->connection : NO_CONNECTION );
+            endEpochRead ();
+        } );
+        cout << "  Talk routing (find by name)  " << setw ( 9 ) << users << setw ( 12 ) << vectorTalk
+             << setw ( 12 ) << registryTalk << "\n";
+
+        // Each time a random user leaves and comes back under the same name
+        double vectorChurn = timeRuns ( scans , [&] ( int i ) {
+            size_t index = rand () % oldUsers.size();
+            OldUser user = oldUsers[ index ];
+            oldUsers.erase ( oldUsers.begin() + index );
+            oldUsers.push_back ( user );
+            keepValue ( i );
+        } );
+        double registryChurn = timeRuns ( operations , [&] ( int ) {
+            size_t index = rand () % userIDs.size();
+            beginEpochRead ();
+            User user = *getUser ( registry , userIDs[ index ] );
+            endEpochRead ();
+            removeUser ( registry , user.userID );
+            addUser ( registry , &user );
+            userIDs[ index ] = user.userID;
+        } );
+        cout << "  Exit and login               " << setw ( 9 ) << users << setw ( 12 ) << vectorChurn
+             << setw ( 12 ) << registryChurn << "\n";
+    }
+    return 0;
+}
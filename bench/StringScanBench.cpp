@@ -0,0 +1,88 @@
+// StringScanBench.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ChatBench.h"
+
+// The SSE2 and AVX2 scans are static: they are reached by building the scan into this file
+#include "../ChatStringScan.cpp"
+
+using namespace std;
+
+/*
+ * Finding the ends of the strings of a 2 KB Yell body (58 words and the
+ * empty string ending the list), in nanoseconds per body: the old
+ * getNextString() copying each string into a stack array and then into
+ * a std::string, a byte loop, and the SSE2 and AVX2 scans.
+ *
+ * Usage: StringScanBench [iterations]
+ */
+
+/// @brief  Size of the stack array of the old getNextString()
+#define OLD_CHAT_LENGTH  2048
+
+/// @brief  The string reader of the server before FrameReader (copies twice)
+string oldGetNextString ( const char *buffer , int &offset ) {
+
+    char nextString [ OLD_CHAT_LENGTH ];
+    int i = 0;
+    while ( ( nextString[i++] = buffer[ offset++ ] ) != '\0' ) {
+        if ( i >= OLD_CHAT_LENGTH )
+            break;
+    }
+    nextString[i - 1] = '\0';
+    return string ( nextString );
+}
+
+/// @brief  Nanoseconds per call of 'scan' over 'iterations' calls (after as many to warm up)
+template < class Scan >
+double timeScan ( int iterations , Scan scan ) {
+    for ( int i = 0 ; i < iterations ; i++ )
+        scan ();
+    uint64_t start = nowNanos ();
+    for ( int i = 0 ; i < iterations ; i++ )
+        scan ();
+    return (double) ( nowNanos () - start ) / iterations;
+}
+
+int main ( int argc , char **argv ) {
+
+    int iterations = argc > 1 ? atoi ( argv[1] ) : 200000;
+
+    // 58 words of 2 to 70 letters, about 2 KB with their NULLs
+    string body;
+    srand ( 1 );
+    for ( int i = 0 ; i < 58 ; i++ ) {
+        body.append ( 2 + rand () % 69 , 'a' + i % 26 );
+        body.push_back ( '\0' );
+    }
+    body.push_back ( '\0' );
+    const char *data = body.data();
+    int length = body.size();
+    uint16_t ends[ MAX_PACKET_LENGTH ];
+
+    cout << "Yell body of " << length << " bytes, 58 strings, ns per body:\n";
+    cout << "  byte loop copying into std::string (old getNextString)  "
+         << timeScan ( iterations , [&] () {
+                int offset = 0;
+                for ( string word = oldGetNextString ( data , offset ) ; !word.empty() ;
+                      word = oldGetNextString ( data , offset ) )
+                    keepValue ( word );
+            } ) << "\n";
+    cout << "  byte loop                                               "
+         << timeScan ( iterations , [&] () { keepValue ( findStringEndsScalar ( data , length , ends , 1024 ) ); } )
+         << "\n";
+    cout << "  SSE2                                                    "
+         << timeScan ( iterations , [&] () { keepValue ( findStringEndsSSE2 ( data , length , ends , 1024 ) ); } )
+         << "\n";
+    if ( __builtin_cpu_supports ( "avx2" ) ) {
+        cout << "  AVX2                                                    "
+             << timeScan ( iterations , [&] () { keepValue ( findStringEndsAVX2 ( data , length , ends , 1024 ) ); } )
+             << "\n";
+    }
+    return 0;
+}
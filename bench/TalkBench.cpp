@@ -0,0 +1,104 @@
+// TalkBench.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "ChatBench.h"
+
+using namespace std;
+
+/*
+ * Steady Talk traffic between two users: a sender keeps 'window' Talk
+ * requests of 'bytes' bytes in flight to a receiver for 'seconds', and
+ * the number of Talks answered and delivered is printed. Run against a
+ * server counting its mallocs (see MallocCount.cpp), it shows what each
+ * message costs the allocator.
+ *
+ * Usage: TalkBench [-p port] [-t seconds] [-s message bytes] [-w window] [host]
+ */
+
+/// @brief  Read what came for 'client', returns the packets of 'type' (-1 if it closed)
+int countFrames ( BenchClient *client , uint16_t type );
+
+int main ( int argc , char **argv ) {
+
+    const char *port = NULL;
+    int seconds = 8 , messageBytes = 200 , window = 64;
+    int option;
+    while ( ( option = getopt ( argc , argv , "p:t:s:w:" ) ) != -1 ) {
+        switch ( option ) {
+            case 'p': port = optarg; break;
+            case 't': seconds = atoi ( optarg ); break;
+            case 's': messageBytes = atoi ( optarg ); break;
+            case 'w': window = atoi ( optarg ); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-p port] [-t seconds] [-s message bytes] [-w window] [host]\n";
+                return 1;
+        }
+    }
+    const char *host = optind < argc ? argv[ optind ] : "127.0.0.1";
+
+    string prefix = to_string ( getpid () ) + "-";
+    BenchClient sender , receiver;
+    if ( !openClient ( &sender , host , benchPort ( port ) , prefix + "sender" , 0 ) ||
+         !openClient ( &receiver , host , benchPort ( port ) , prefix + "receiver" , 0 ) )
+        return 1;
+    fcntl ( sender.socketFD , F_SETFL , O_NONBLOCK );
+    fcntl ( receiver.socketFD , F_SETFL , O_NONBLOCK );
+
+    char packet[ MAX_PACKET_LENGTH ];
+    vector <string> words ( 1 , string ( messageBytes , 'x' ) );
+    int length = encodePacket < TalkRequest > ( packet , sender.cookie , sender.name , receiver.name , words );
+
+    long sent = 0 , answered = 0 , delivered = 0;
+    uint64_t end = nowNanos () + (uint64_t) seconds * 1000000000;
+    while ( nowNanos () < end ) {
+        while ( sent - answered < window ) {
+            if ( !sendAll ( sender.socketFD , packet , length ) ) {
+                cerr << "The sender's connection failed\n";
+                return 1;
+            }
+            sent++;
+        }
+        struct pollfd sockets[2] = { { sender.socketFD , POLLIN , 0 } , { receiver.socketFD , POLLIN , 0 } };
+        poll ( sockets , 2 , 1000 );
+        int replies = countFrames ( &sender , RESPONSE_TALK );
+        int forwards = countFrames ( &receiver , RESPONSE_TALK_FWD );
+        if ( replies < 0 || forwards < 0 ) {
+            cerr << "The server closed a connection\n";
+            return 1;
+        }
+        answered += replies;
+        delivered += forwards;
+    }
+
+    cout << answered << " Talks of " << messageBytes << " bytes answered and " << delivered << " delivered in "
+         << seconds << " s (" << answered / seconds << " a second)\n";
+    return 0;
+}
+
+int countFrames ( BenchClient *client , uint16_t type ) {
+
+    int count = 0;
+    while ( true ) {
+        int result = recvFrames ( &client->buffer , client->socketFD );
+        if ( result == 0 || ( result < 0 && errno != EAGAIN ) )
+            return -1;
+        Frame frame;
+        int found;
+        while ( ( found = nextFrame ( &client->buffer , &frame ) ) > 0 ) {
+            if ( frame.type == type )
+                count++;
+        }
+        if ( found < 0 )
+            return -1;
+        if ( result < 0 || recvBufferDrained ( &client->buffer ) )
+            return count;
+    }
+}
@@ -0,0 +1,393 @@
+# chatproto.py
+#
+# The chat protocol (see ChatPacket.h and ChatCodec.h) as used by the
+# regression scripts, and a way to start the server for them.
+#
+# The server is ./ChatServer in the directory above this one (build it
+# as the Readme says), or the one named by the CHAT_SERVER variable.
+
+import os
+import select
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+REQUEST_LOGIN, REQUEST_SHOW, REQUEST_TALK, REQUEST_YELL = 1, 2, 3, 4
+REQUEST_CREATEGROUP, REQUEST_DISCUSS, REQUEST_LEAVEGROUP = 5, 6, 7
+REQUEST_HELP, REQUEST_EXIT, REQUEST_JOINGROUP = 8, 9, 10
+
+RESPONSE_LOGIN, RESPONSE_SHOW, RESPONSE_TALK, RESPONSE_YELL = 11, 12, 13, 14
+RESPONSE_CREATEGROUP, RESPONSE_DISCUSS, RESPONSE_LEAVEGROUP = 15, 16, 17
+RESPONSE_HELP, RESPONSE_EXIT = 18, 19
+RESPONSE_TALK_FWD, RESPONSE_YELL_FWD, RESPONSE_CREATEGROUP_FWD = 131, 141, 151
+RESPONSE_DISCUSS_FWD, RESPONSE_EXIT_FWD = 161, 191
+RESPONSE_JOINGROUP_FWD, RESPONSE_LOGIN_FWD = 101, 111
+
+STATUS_SUCCESS = 0
+ERROR_COOKIE_INVALID = 1
+ERROR_USERNAME = 2
+ERROR_USER_NOT_FOUND = 3
+ERROR_NO_USER_ONLINE = 4
+ERROR_TOO_SLOW = 6
+ERROR_NOT_IN_GROUP = 7
+ERROR_UNKNOWN = 1024
+
+FEATURE_CHUNKED = 0x1
+FEATURE_REQUEST_IDS = 0x2
+FEATURE_MESSAGE_TEXT = 0x4
+FEATURE_PRESENCE = 0x8
+FEATURE_GROUPS = 0x10
+
+REJECT_GROUP, ACCEPT_GROUP, EXPIRED_GROUP = 0, 1, 2
+
+PACKET_CONTINUED = 0x8000
+MAX_PACKET_LENGTH = 4096
+MAX_USER_NAME_LENGTH = 32
+
+# Direct responses, which carry the request ID with FEATURE_REQUEST_IDS
+TAGGED_RESPONSES = range(RESPONSE_LOGIN + 1, RESPONSE_EXIT + 1)
+
+
+def string(value):
+    """A NULL terminated string"""
+    return value.encode() + b"\0"
+
+
+def string_list(values):
+    """NULL terminated strings ending with an empty one"""
+    return b"".join(string(value) for value in values) + b"\0"
+
+
+def text(value):
+    """A message as text (FEATURE_MESSAGE_TEXT)"""
+    data = value.encode()
+    return struct.pack("!H", len(data)) + data
+
+
+class Packet:
+    """A packet received from the server"""
+
+    def __init__(self, type, status, body, request_id=0):
+        self.continued = (type & PACKET_CONTINUED) != 0
+        self.type = type & ~PACKET_CONTINUED
+        self.status = status
+        self.body = body
+        self.request_id = request_id
+        self.offset = 0
+
+    def uint16(self):
+        value, = struct.unpack_from("!H", self.body, self.offset)
+        self.offset += 2
+        return value
+
+    def uint32(self):
+        value, = struct.unpack_from("!I", self.body, self.offset)
+        self.offset += 4
+        return value
+
+    def string(self):
+        end = self.body.index(b"\0", self.offset)
+        value = self.body[self.offset:end].decode()
+        self.offset = end + 1
+        return value
+
+    def strings(self):
+        values = []
+        while self.offset < len(self.body):
+            value = self.string()
+            if value == "":
+                break
+            values.append(value)
+        return values
+
+    def text(self):
+        length = self.uint16()
+        value = self.body[self.offset:self.offset + length].decode()
+        self.offset += length
+        return value
+
+    def message(self, features):
+        """The message ending a forward, as one text either way"""
+        if features & FEATURE_MESSAGE_TEXT:
+            return self.text()
+        return " ".join(self.strings())
+
+    def __repr__(self):
+        return "Packet(type=%d, status=%d, %d bytes)" % (self.type, self.status, len(self.body))
+
+
+class Client:
+    """One connection to the server"""
+
+    def __init__(self, port, host="127.0.0.1", timeout=5.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.timeout = timeout
+        self.data = b""
+        self.pending = []
+        self.cookie = 0
+        self.features = 0
+        self.name = None
+        self.next_id = 1
+
+    def close(self):
+        self.sock.close()
+
+    # Sending
+
+    def send_raw(self, data):
+        self.sock.sendall(data)
+
+    def encode(self, type, body=b"", cookie=None, request_id=None, continued=False):
+        """A whole request, tagged with a request ID once FEATURE_REQUEST_IDS is in use"""
+        if cookie is None:
+            cookie = self.cookie
+        if continued:
+            type |= PACKET_CONTINUED
+        tag = b""
+        if self.features & FEATURE_REQUEST_IDS and type != REQUEST_LOGIN:
+            if request_id is None:
+                request_id = self.next_id
+                self.next_id += 1
+            tag = struct.pack("!I", request_id)
+        length = 8 + len(tag) + len(body)
+        return struct.pack("!HH", type, length) + tag + struct.pack("!I", cookie) + body
+
+    def send(self, type, body=b"", **options):
+        self.send_raw(self.encode(type, body, **options))
+
+    def message(self, value):
+        """A message in the form of this client: text, or a list of words"""
+        if self.features & FEATURE_MESSAGE_TEXT:
+            return text(value)
+        return string_list(value.split())
+
+    # Receiving
+
+    def read_packet(self, timeout=None):
+        """The next packet, None if nothing comes in time, or if the server closed the connection"""
+        deadline = time.time() + (self.timeout if timeout is None else timeout)
+        while True:
+            if len(self.data) >= 4:
+                type, length = struct.unpack_from("!HH", self.data)
+                if length < 8:
+                    raise ValueError("bad packet length %d" % length)
+                if len(self.data) >= length:
+                    frame, self.data = self.data[:length], self.data[length:]
+                    request_id = 0
+                    body = frame[4:]
+                    if self.features & FEATURE_REQUEST_IDS and (type & ~PACKET_CONTINUED) in TAGGED_RESPONSES:
+                        request_id, = struct.unpack_from("!I", body)
+                        body = body[4:]
+                    status, = struct.unpack_from("!I", body)
+                    return Packet(type, status, body[4:], request_id)
+            left = deadline - time.time()
+            if left <= 0:
+                return None
+            ready, _, _ = select.select([self.sock], [], [], left)
+            if not ready:
+                return None
+            try:
+                chunk = self.sock.recv(65536)
+            except ConnectionError:
+                return None
+            if not chunk:
+                return None
+            self.data += chunk
+
+    def receive(self, type=None, timeout=None, match=None):
+        """The next packet of 'type' (any if None) for which 'match' is true, others are kept for later"""
+        for i, packet in enumerate(self.pending):
+            if (type is None or packet.type == type) and (match is None or match(packet)):
+                return self.pending.pop(i)
+        deadline = time.time() + (self.timeout if timeout is None else timeout)
+        while True:
+            packet = self.read_packet(max(0.0, deadline - time.time()))
+            if packet is None:
+                return None
+            if (type is None or packet.type == type) and (match is None or match(packet)):
+                return packet
+            self.pending.append(packet)
+
+    def expect(self, type, timeout=None, match=None):
+        packet = self.receive(type, timeout, match)
+        if packet is None:
+            raise AssertionError("%s: no packet of type %d" % (self.name, type))
+        return packet
+
+    def drain(self, timeout=0.2):
+        """Everything received within 'timeout', kept packets included"""
+        packets, self.pending = self.pending, []
+        while True:
+            packet = self.read_packet(timeout)
+            if packet is None:
+                return packets
+            packets.append(packet)
+
+    def is_closed(self, timeout=2.0):
+        """Whether the server closes the connection within 'timeout' (the packets before are dropped)"""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            ready, _, _ = select.select([self.sock], [], [], deadline - time.time())
+            if not ready:
+                return False
+            try:
+                chunk = self.sock.recv(65536)
+            except ConnectionError:
+                return True
+            if not chunk:
+                return True
+        return False
+
+    # Requests
+
+    def login(self, name, features=0, cookie=0):
+        """Log in, returns the status of the Login response"""
+        self.name = name
+        body = string(name) + (struct.pack("!I", features) if features else b"")
+        self.send(REQUEST_LOGIN, body, cookie=cookie)
+        packet = self.expect(RESPONSE_LOGIN)
+        if packet.status == STATUS_SUCCESS:
+            self.cookie = packet.uint32()
+            self.features = packet.uint32() if packet.offset < len(packet.body) else 0
+        return packet.status
+
+    def talk(self, receiver, message, **options):
+        self.send(REQUEST_TALK, string(self.name) + string(receiver) + self.message(message), **options)
+
+    def yell(self, message, **options):
+        self.send(REQUEST_YELL, self.message(message), **options)
+
+    def show(self, **options):
+        self.send(REQUEST_SHOW, **options)
+
+    def create_group(self, names, **options):
+        self.send(REQUEST_CREATEGROUP, string_list(names), **options)
+
+    def group_field(self, group):
+        return struct.pack("!I", group) if self.features & FEATURE_GROUPS else b""
+
+    def discuss(self, message, group=0, **options):
+        self.send(REQUEST_DISCUSS, self.group_field(group) + self.message(message), **options)
+
+    def leave_group(self, group=0, **options):
+        self.send(REQUEST_LEAVEGROUP, self.group_field(group), **options)
+
+    def join_group(self, answer, group=0, **options):
+        self.send(REQUEST_JOINGROUP, self.group_field(group) + struct.pack("!H", answer), **options)
+
+    def exit(self, **options):
+        self.send(REQUEST_EXIT, string(self.name), **options)
+
+    def users(self):
+        """The names of a Show response, all its pages (send show() first)"""
+        names = []
+        while True:
+            packet = self.expect(RESPONSE_SHOW)
+            names += packet.strings()
+            if not packet.continued:
+                return names
+
+
+class Server:
+    """A server started for one script, on a free port"""
+
+    def __init__(self, *options):
+        self.port = free_port()
+        binary = os.environ.get("CHAT_SERVER",
+                                os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "ChatServer"))
+        if not os.path.exists(binary):
+            sys.exit("No server at %s, build it as the Readme says (or set CHAT_SERVER)" % binary)
+        self.output = open(os.devnull, "w") if not os.environ.get("CHAT_VERBOSE") else None
+        self.process = subprocess.Popen([binary] + [str(option) for option in options],
+                                        stdin=subprocess.PIPE, stdout=self.output, stderr=self.output)
+        self.process.stdin.write(b"%d\n" % self.port)
+        self.process.stdin.flush()
+        deadline = time.time() + 5
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", self.port), timeout=1).close()
+                break
+            except OSError:
+                if time.time() > deadline or self.process.poll() is not None:
+                    raise RuntimeError("the server did not start")
+                time.sleep(0.05)
+
+    def client(self, name=None, features=0, **options):
+        """A new connection, logged in as 'name' if given"""
+        client = Client(self.port, **options)
+        if name is not None:
+            status = client.login(name, features)
+            if status != STATUS_SUCCESS:
+                raise AssertionError("login of %s failed with %d" % (name, status))
+        return client
+
+    def alive(self):
+        return self.process.poll() is None
+
+    def stop(self):
+        self.process.kill()
+        self.process.wait()
+        if self.output is not None:
+            self.output.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exception):
+        self.stop()
+
+
+def make_group(creator, members):
+    """A group of 'creator' and the 'members' (clients), who all accept, returns its ID (0 without FEATURE_GROUPS)"""
+    creator.create_group([member.name for member in members])
+    response = creator.expect(RESPONSE_CREATEGROUP)
+    check(response.status == STATUS_SUCCESS, "CreateGroup failed")
+    group = response.uint32() if creator.features & FEATURE_GROUPS else 0
+    for member in members:
+        member.expect(RESPONSE_CREATEGROUP_FWD)
+        member.join_group(ACCEPT_GROUP, group)
+    for member in members:
+        creator.expect(RESPONSE_JOINGROUP_FWD)
+    # The members are told of each other joining
+    for client in [creator] + members:
+        client.drain(0.1)
+    return group
+
+
+def free_port():
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return sock.getsockname()[1]
+
+
+def check(condition, what):
+    """Fail the script with 'what' unless 'condition' holds"""
+    if not condition:
+        raise AssertionError(what)
+
+
+def wait_for(condition, what, timeout=3.0):
+    """Fail the script with 'what' unless 'condition()' becomes true within 'timeout'"""
+    deadline = time.time() + timeout
+    while not condition():
+        if time.time() > deadline:
+            raise AssertionError(what)
+        time.sleep(0.05)
+
+
+def run(tests, *server_options):
+    """Run each test function against a server of its own, print the results, returns the number failed"""
+    failed = 0
+    for test in tests:
+        with Server(*server_options) as server:
+            try:
+                test(server)
+                check(server.alive(), "the server died")
+                print("ok    %s" % test.__name__)
+            except Exception as error:
+                failed += 1
+                print("FAIL  %s: %s" % (test.__name__, error))
+    return failed
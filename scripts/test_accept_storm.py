@@ -0,0 +1,66 @@
+# test_accept_storm.py
+#
+# Many clients connecting at once: every one is accepted and can log in,
+# over every reactor's listening socket (see -t and -b).
+
+import selectors
+import socket
+import struct
+import sys
+import time
+
+from chatproto import *
+
+CLIENTS = 2000
+
+
+def storm(server, count, prefix="storm"):
+    """Connect and log in 'count' clients at once (named 'prefix' and a number), returns how many got their Login response"""
+    selector = selectors.DefaultSelector()
+    sockets = []
+    for i in range(count):
+        sock = socket.socket()
+        sock.setblocking(False)
+        sock.connect_ex(("127.0.0.1", server.port))
+        selector.register(sock, selectors.EVENT_WRITE, i)
+        sockets.append(sock)
+    logged_in = 0
+    received = {}
+    deadline = time.time() + 30
+    while logged_in < count and time.time() < deadline:
+        for key, events in selector.select(timeout=1):
+            sock, i = key.fileobj, key.data
+            if events & selectors.EVENT_WRITE:
+                name = string("%s%d" % (prefix, i))
+                sock.send(struct.pack("!HHI", REQUEST_LOGIN, 8 + len(name), 0) + name)
+                selector.modify(sock, selectors.EVENT_READ, i)
+                received[i] = b""
+                continue
+            chunk = sock.recv(4096)
+            if not chunk:
+                selector.unregister(sock)
+                continue
+            received[i] += chunk
+            if len(received[i]) >= 8:
+                type, length, status = struct.unpack_from("!HHI", received[i])
+                if type == RESPONSE_LOGIN and status == STATUS_SUCCESS:
+                    logged_in += 1
+                selector.unregister(sock)
+    for sock in sockets:
+        sock.close()
+    return logged_in
+
+
+def test_storm(server):
+    count = storm(server, CLIENTS)
+    check(count == CLIENTS, "only %d of %d clients logged in" % (count, CLIENTS))
+
+
+def test_storm_twice(server):
+    storm(server, CLIENTS // 2)
+    count = storm(server, CLIENTS // 2, "again")
+    check(count == CLIENTS // 2, "only %d of %d clients logged in after a first storm" % (count, CLIENTS // 2))
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_storm, test_storm_twice], *sys.argv[1:]))
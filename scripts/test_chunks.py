@@ -0,0 +1,77 @@
+# test_chunks.py
+#
+# Messages longer than a packet, sent as chunks (FEATURE_CHUNKED): each
+# chunk is forwarded as it comes, flagged for the receivers which asked
+# for chunks, as a message of its own for the others, and the sender is
+# answered once, after the last chunk.
+
+import sys
+
+from chatproto import *
+
+
+def talk_chunks(sender, receiver, chunks):
+    for i, words in enumerate(chunks):
+        sender.send(REQUEST_TALK, string(sender.name) + string(receiver) + string_list(words),
+                    continued=i < len(chunks) - 1)
+
+
+def forwarded_words(receiver, count):
+    """The words of 'count' Talk forwards, and the flags they came with"""
+    words, flags = [], []
+    for i in range(count):
+        forward = receiver.expect(RESPONSE_TALK_FWD)
+        forward.string(), forward.string()
+        words += forward.strings()
+        flags.append(forward.continued)
+    return words, flags
+
+
+def test_chunked_receiver(server):
+    alice = server.client("alice", FEATURE_CHUNKED)
+    bob = server.client("bob", FEATURE_CHUNKED)
+    chunks = [["w%d-%d" % (chunk, i) for i in range(300)] for chunk in range(5)]
+    talk_chunks(alice, "bob", chunks)
+    check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "the chunked Talk failed")
+    check(alice.receive(RESPONSE_TALK, timeout=0.3) is None, "more than one response to a chunked Talk")
+    words, flags = forwarded_words(bob, 5)
+    check(words == sum(chunks, []), "the chunked Talk arrived damaged")
+    check(flags == [True] * 4 + [False], "wrong chunk flags: %s" % flags)
+
+
+def test_plain_receiver(server):
+    alice = server.client("alice", FEATURE_CHUNKED)
+    bob = server.client("bob")
+    chunks = [["first"], ["second"], ["third"]]
+    talk_chunks(alice, "bob", chunks)
+    check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "the chunked Talk failed")
+    words, flags = forwarded_words(bob, 3)
+    check(words == ["first", "second", "third"] and flags == [False] * 3,
+          "a plain receiver did not get each chunk as a message")
+
+
+def test_yell_channels(server):
+    alice = server.client("alice", FEATURE_CHUNKED)
+    chunked = server.client("chunked", FEATURE_CHUNKED)
+    plain = server.client("plain")
+    alice.send(REQUEST_YELL, string_list(["one"]), continued=True)
+    alice.send(REQUEST_YELL, string_list(["two"]))
+    check(alice.expect(RESPONSE_YELL).status == STATUS_SUCCESS, "the chunked Yell failed")
+    check([chunked.expect(RESPONSE_YELL_FWD).continued for i in range(2)] == [True, False],
+          "wrong chunk flags on a Yell")
+    check([plain.expect(RESPONSE_YELL_FWD).continued for i in range(2)] == [False, False],
+          "a plain receiver got chunk flags on a Yell")
+
+
+def test_first_error(server):
+    alice = server.client("alice", FEATURE_CHUNKED)
+    bob = server.client("bob", FEATURE_CHUNKED)
+    alice.send(REQUEST_TALK, string("alice") + string("bob") + string_list(["to bob"]), continued=True)
+    alice.send(REQUEST_TALK, string("alice") + string("nobody") + string_list(["lost"]), continued=True)
+    alice.send(REQUEST_TALK, string("alice") + string("bob") + string_list(["end"]))
+    check(alice.expect(RESPONSE_TALK).status == ERROR_USER_NOT_FOUND, "the first error of the chunks was not reported")
+    check(alice.receive(RESPONSE_TALK, timeout=0.3) is None, "more than one response to a chunked Talk")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_chunked_receiver, test_plain_receiver, test_yell_channels, test_first_error], *sys.argv[1:]))
@@ -0,0 +1,52 @@
+# test_discuss.py
+#
+# A Discuss message reaches each member in its own form: words or text
+# (FEATURE_MESSAGE_TEXT), flagged as chunks or not (FEATURE_CHUNKED), and
+# a large group is sent to by several workers at once (see ChatFanout.h).
+
+import sys
+
+from chatproto import *
+
+FORMS = {"words": 0, "text": FEATURE_MESSAGE_TEXT, "chunks": FEATURE_CHUNKED,
+         "textchunks": FEATURE_MESSAGE_TEXT | FEATURE_CHUNKED}
+
+
+def test_forms(server):
+    for sender_features in (FEATURE_CHUNKED, FEATURE_CHUNKED | FEATURE_MESSAGE_TEXT):
+        sender = server.client("sender%d" % sender_features, sender_features)
+        members = {name: server.client("%s%d" % (name, sender_features), features) for name, features in FORMS.items()}
+        make_group(sender, list(members.values()))
+        sender.send(REQUEST_DISCUSS, sender.message("first  part "), continued=True)
+        sender.send(REQUEST_DISCUSS, sender.message("second part"))
+        check(sender.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "the chunked Discuss failed")
+        for name, member in members.items():
+            forwards = [member.expect(RESPONSE_DISCUSS_FWD) for i in range(2)]
+            check(all(forward.string() == sender.name for forward in forwards), "wrong sender in a Discuss forward")
+            flags = [forward.continued for forward in forwards]
+            chunked = FORMS[name] & FEATURE_CHUNKED
+            check(flags == ([True, False] if chunked else [False, False]), "%s got the flags %s" % (name, flags))
+            parts = [forward.message(member.features) for forward in forwards]
+            if member.features & FEATURE_MESSAGE_TEXT and sender.features & FEATURE_MESSAGE_TEXT:
+                check(parts == ["first  part ", "second part"], "%s got the text %s" % (name, parts))
+            else:
+                check(" ".join(parts).split() == ["first", "part", "second", "part"], "%s got %s" % (name, parts))
+
+
+def test_large_group(server):
+    sender = server.client("sender")
+    members = [server.client("member%d" % i, FORMS[["words", "text", "chunks", "textchunks"][i % 4]])
+               for i in range(300)]
+    make_group(sender, members)
+    for i in range(3):
+        sender.discuss("message %d" % i)
+        check(sender.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "Discuss to a large group failed")
+    for member in members:
+        for i in range(3):
+            forward = member.expect(RESPONSE_DISCUSS_FWD)
+            check(forward.string() == "sender" and forward.message(member.features).split() == ["message", str(i)],
+                  "a member of a large group got a wrong Discuss")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_forms, test_large_group], *sys.argv[1:]))
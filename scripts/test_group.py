@@ -0,0 +1,111 @@
+# test_group.py
+#
+# Group chats of clients without FEATURE_GROUPS, in one group at a time:
+# invitations, JoinGroup answers, Discuss to the members only, LeaveGroup.
+
+import sys
+
+from chatproto import *
+
+
+def test_create_and_join(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    alice.create_group(["bob", "carol", "nobody"])
+    check(alice.expect(RESPONSE_CREATEGROUP).status == STATUS_SUCCESS, "CreateGroup failed")
+    forward = bob.expect(RESPONSE_CREATEGROUP_FWD)
+    check(forward.string() == "alice" and forward.strings() == ["alice", "bob", "carol"],
+          "wrong CreateGroup forward")
+    carol.expect(RESPONSE_CREATEGROUP_FWD)
+    bob.join_group(ACCEPT_GROUP)
+    forward = alice.expect(RESPONSE_JOINGROUP_FWD)
+    check(forward.string() == "bob" and forward.uint16() == ACCEPT_GROUP, "wrong JoinGroup forward")
+    check(bob.receive(RESPONSE_JOINGROUP_FWD, timeout=0.3) is None, "the user who answered was told its answer")
+    carol.join_group(REJECT_GROUP)
+    forward = alice.expect(RESPONSE_JOINGROUP_FWD)
+    check(forward.string() == "carol" and forward.uint16() == REJECT_GROUP, "the refusal was not forwarded")
+
+
+def test_discuss_members_only(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    outsider = server.client("dave")
+    make_group(alice, [bob, carol])
+    alice.discuss("hello group")
+    check(alice.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "Discuss failed")
+    for client in (bob, carol):
+        forward = client.expect(RESPONSE_DISCUSS_FWD)
+        check(forward.string() == "alice" and forward.strings() == ["hello", "group"], "wrong Discuss forward")
+    check(alice.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "the sender got its own Discuss")
+    check(outsider.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "a user outside the group got the Discuss")
+    outsider.discuss("let me in")
+    check(outsider.expect(RESPONSE_DISCUSS).status == ERROR_NOT_IN_GROUP, "Discuss outside a group succeeded")
+
+
+def test_leave(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    make_group(alice, [bob])
+    bob.leave_group()
+    check(bob.expect(RESPONSE_LEAVEGROUP).status == STATUS_SUCCESS, "LeaveGroup failed")
+    bob.leave_group()
+    check(bob.expect(RESPONSE_LEAVEGROUP).status == ERROR_NOT_IN_GROUP, "LeaveGroup outside a group succeeded")
+    alice.discuss("anyone")
+    check(alice.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "Discuss alone failed")
+    check(bob.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "a user who left got the Discuss")
+
+
+def test_one_group_at_a_time(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    make_group(alice, [bob])
+    make_group(carol, [bob])
+    alice.discuss("first group")
+    alice.expect(RESPONSE_DISCUSS)
+    check(bob.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "joining a group did not leave the other")
+    carol.discuss("second group")
+    carol.expect(RESPONSE_DISCUSS)
+    check(bob.expect(RESPONSE_DISCUSS_FWD).string() == "carol", "the Discuss of the new group did not come")
+
+
+def test_group_goes_with_last_member(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    make_group(alice, [bob])
+    alice.exit()
+    alice.expect(RESPONSE_EXIT)
+    bob.leave_group()
+    check(bob.expect(RESPONSE_LEAVEGROUP).status == STATUS_SUCCESS, "LeaveGroup of the last member failed")
+    bob.discuss("hello")
+    check(bob.expect(RESPONSE_DISCUSS).status == ERROR_NOT_IN_GROUP, "the group outlived its last member")
+
+
+def test_groups_need_login(server):
+    # Enough users for one of them to have the first slot, which a client
+    # not logged in must not stand for
+    users = [server.client("user%d" % i) for i in range(100)]
+    anonymous = server.client()
+    anonymous.create_group(["user1"])
+    check(anonymous.expect(RESPONSE_CREATEGROUP).status == ERROR_COOKIE_INVALID,
+          "CreateGroup before login succeeded")
+    check(users[1].receive(RESPONSE_CREATEGROUP_FWD, timeout=0.3) is None,
+          "a CreateGroup before login invited someone")
+    users[1].join_group(ACCEPT_GROUP)
+    users[1].discuss("anyone there")
+    check(users[1].expect(RESPONSE_DISCUSS).status == ERROR_NOT_IN_GROUP,
+          "a group created before login was joined")
+    anonymous.discuss("hello")
+    check(anonymous.expect(RESPONSE_DISCUSS).status == ERROR_COOKIE_INVALID, "Discuss before login succeeded")
+    anonymous.leave_group()
+    check(anonymous.expect(RESPONSE_LEAVEGROUP).status == ERROR_COOKIE_INVALID,
+          "LeaveGroup before login succeeded")
+    for user in users:
+        check(user.receive(RESPONSE_DISCUSS_FWD, timeout=0.01) is None, "a user got a Discuss of no group")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_create_and_join, test_discuss_members_only, test_leave, test_one_group_at_a_time,
+                  test_group_goes_with_last_member, test_groups_need_login], *sys.argv[1:]))
@@ -0,0 +1,47 @@
+# test_idle_close.py
+#
+# Connections which stay idle, or close without an Exit: they cost the
+# server nothing but a socket, and a closed one takes its user with it
+# (run with -g 0, so that no session waits to be resumed).
+
+import socket
+import sys
+
+from chatproto import *
+
+
+def test_idle_connections(server):
+    idle = [server.client() for i in range(500)]
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.talk("bob", "still there")
+    check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "Talk failed beside idle connections")
+    for client in idle:
+        client.close()
+    alice.show()
+    check(sorted(alice.users()) == ["alice", "bob"], "idle connections were listed")
+
+
+def test_close_without_exit(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.close()
+    wait_for(lambda: bob.show() or bob.users() == ["bob"], "the user of a closed connection is still listed")
+    again = server.client()
+    check(again.login("alice") == STATUS_SUCCESS, "the name of a closed connection was not freed")
+
+
+def test_reset_while_queued(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    for i in range(200):
+        alice.yell("a message for bob who is about to go " * 4)
+    bob.sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, b"\1\0\0\0\0\0\0\0")
+    bob.close()
+    for i in range(200):
+        check(alice.expect(RESPONSE_YELL) is not None, "a Yell got no response")
+    wait_for(lambda: alice.show() or alice.users() == ["alice"], "a reset connection kept its user")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_idle_connections, test_close_without_exit, test_reset_while_queued], "-g", "0", *sys.argv[1:]))
@@ -0,0 +1,79 @@
+# test_invite.py
+#
+# Every invitation ends once, and the group and the inviter are told how:
+# accepted or refused, or EXPIRED_GROUP when it was not answered in time
+# (-i), the invited user left, or the group went with its last member.
+
+import sys
+import time
+
+from chatproto import *
+
+
+def answer_of(client, name, timeout=None):
+    """The answer of the JoinGroup forward about 'name' sent to 'client'"""
+    forward = client.expect(RESPONSE_JOINGROUP_FWD, timeout)
+    check(forward.string() == name, "a JoinGroup forward about the wrong user")
+    return forward.uint16()
+
+
+def test_expired(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    make_group(alice, [bob])
+    alice.create_group(["carol"])
+    alice.expect(RESPONSE_CREATEGROUP)
+    carol.expect(RESPONSE_CREATEGROUP_FWD)
+    check(answer_of(alice, "carol", timeout=5) == EXPIRED_GROUP, "the inviter was not told of the expiry")
+    check(answer_of(carol, "carol") == EXPIRED_GROUP, "the invited user was not told of the expiry")
+    carol.join_group(ACCEPT_GROUP)
+    alice.discuss("too late")
+    alice.expect(RESPONSE_DISCUSS)
+    check(carol.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "an expired invitation was accepted")
+
+
+def test_invited_user_leaves(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    make_group(alice, [bob])
+    alice.create_group(["carol"])
+    alice.expect(RESPONSE_CREATEGROUP)
+    carol.expect(RESPONSE_CREATEGROUP_FWD)
+    carol.exit()
+    carol.expect(RESPONSE_EXIT)
+    check(answer_of(alice, "carol") == EXPIRED_GROUP, "the inviter was not told the invited user left")
+
+
+def test_inviter_leaves(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    carol = server.client("carol")
+    make_group(alice, [bob])
+    alice.create_group(["carol"])
+    alice.expect(RESPONSE_CREATEGROUP)
+    carol.expect(RESPONSE_CREATEGROUP_FWD)
+    alice.leave_group()
+    alice.expect(RESPONSE_LEAVEGROUP)
+    check(answer_of(carol, "carol") == EXPIRED_GROUP, "the invited user was not told the group went")
+    check(answer_of(alice, "carol") == EXPIRED_GROUP, "the inviter was not told the group went")
+
+
+def test_answered_once(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.create_group(["bob"])
+    alice.expect(RESPONSE_CREATEGROUP)
+    bob.expect(RESPONSE_CREATEGROUP_FWD)
+    bob.join_group(REJECT_GROUP)
+    check(answer_of(alice, "bob") == REJECT_GROUP, "the refusal was not forwarded")
+    bob.join_group(ACCEPT_GROUP)
+    check(alice.receive(RESPONSE_JOINGROUP_FWD, timeout=0.3) is None, "an invitation was answered twice")
+    time.sleep(1.5)
+    check(alice.receive(RESPONSE_JOINGROUP_FWD, timeout=0.3) is None, "an answered invitation expired")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_expired, test_invited_user_leaves, test_inviter_leaves, test_answered_once],
+                 "-i", "1", *sys.argv[1:]))
@@ -0,0 +1,75 @@
+# test_malformed.py
+#
+# Requests which do not hold what their type says: the server closes the
+# connection ("Malformed request"), and goes on serving everyone else.
+
+import struct
+import sys
+
+from chatproto import *
+
+
+def closes(client, type, body, what, cookie=None):
+    client.send(type, body, cookie=cookie)
+    check(client.is_closed(), "the connection stayed open after " + what)
+
+
+def still_serving(server):
+    alice = server.client("alice")
+    alice.show()
+    check("alice" in alice.users(), "the server stopped serving")
+
+
+def test_unterminated_name(server):
+    closes(server.client(), REQUEST_LOGIN, b"alice", "a Login with an unterminated name")
+    still_serving(server)
+
+
+def test_long_name(server):
+    closes(server.client(), REQUEST_LOGIN, string("a" * (MAX_USER_NAME_LENGTH + 1)), "a Login with a long name")
+    still_serving(server)
+
+
+def test_short_cookie(server):
+    bob = server.client("bob")
+    bob.send_raw(struct.pack("!HHH", REQUEST_SHOW, 6, 0))
+    check(bob.is_closed(), "the connection stayed open after a short cookie")
+    still_serving(server)
+
+
+def test_unterminated_list(server):
+    bob = server.client("bob")
+    closes(bob, REQUEST_YELL, string("hello") + b"world", "a Yell whose list does not end")
+    still_serving(server)
+
+
+def test_empty_word(server):
+    bob = server.client("bob")
+    closes(bob, REQUEST_TALK, string("bob") + string("bob") + b"\0" + string_list(["x"]),
+           "a Talk with an empty word in its list")
+    still_serving(server)
+
+
+def test_text_past_end(server):
+    bob = server.client("bob", FEATURE_MESSAGE_TEXT)
+    closes(bob, REQUEST_YELL, struct.pack("!H", 100) + b"short", "a text running past the packet")
+    still_serving(server)
+
+
+def test_chunk_not_negotiated(server):
+    bob = server.client("bob")
+    bob.send(REQUEST_YELL, bob.message("first part"), continued=True)
+    check(bob.is_closed(), "the connection stayed open after a chunk not negotiated")
+    still_serving(server)
+
+
+def test_chunked_show(server):
+    bob = server.client("bob", FEATURE_CHUNKED)
+    bob.send(REQUEST_SHOW, continued=True)
+    check(bob.is_closed(), "the connection stayed open after a chunked Show")
+    still_serving(server)
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_unterminated_name, test_long_name, test_short_cookie, test_unterminated_list, test_empty_word,
+                  test_text_past_end, test_chunk_not_negotiated, test_chunked_show], *sys.argv[1:]))
@@ -0,0 +1,105 @@
+# test_multi_group.py
+#
+# Clients with FEATURE_GROUPS in several groups at once, named by their
+# Group IDs, beside clients keeping the one group rule; and a stress run
+# of many clients joining, talking in and leaving groups at the same time
+# (to run under a server built with -fsanitize=thread).
+
+import random
+import sys
+import threading
+
+from chatproto import *
+
+
+def test_two_groups(server):
+    alice = server.client("alice", FEATURE_GROUPS)
+    bob = server.client("bob", FEATURE_GROUPS)
+    carol = server.client("carol")
+    dave = server.client("dave", FEATURE_GROUPS | FEATURE_MESSAGE_TEXT)
+    first = make_group(alice, [bob, carol])
+    second = make_group(alice, [bob, dave])
+    check(first != second, "two groups have the same ID")
+    alice.discuss("to the first", first)
+    check(alice.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "Discuss to the first group failed")
+    forward = bob.expect(RESPONSE_DISCUSS_FWD)
+    check(forward.uint32() == first and forward.string() == "alice", "wrong group in a Discuss forward")
+    forward = carol.expect(RESPONSE_DISCUSS_FWD)
+    check(forward.string() == "alice" and forward.strings() == ["to", "the", "first"],
+          "a client without groups got a Group ID")
+    check(dave.receive(RESPONSE_DISCUSS_FWD, timeout=0.3) is None, "Discuss went to the other group")
+    alice.discuss("to the second", second)
+    alice.expect(RESPONSE_DISCUSS)
+    forward = dave.expect(RESPONSE_DISCUSS_FWD)
+    check(forward.uint32() == second and forward.string() == "alice" and forward.text() == "to the second",
+          "wrong Discuss forward with text and Group ID")
+    check(bob.expect(RESPONSE_DISCUSS_FWD).uint32() == second, "Discuss missed a member of both groups")
+
+
+def test_leave_one(server):
+    alice = server.client("alice", FEATURE_GROUPS)
+    bob = server.client("bob", FEATURE_GROUPS)
+    first = make_group(alice, [bob])
+    second = make_group(alice, [bob])
+    bob.leave_group(first)
+    check(bob.expect(RESPONSE_LEAVEGROUP).status == STATUS_SUCCESS, "LeaveGroup failed")
+    bob.discuss("still here", first)
+    check(bob.expect(RESPONSE_DISCUSS).status == ERROR_NOT_IN_GROUP, "Discuss to a group left succeeded")
+    bob.discuss("still here", second)
+    check(bob.expect(RESPONSE_DISCUSS).status == STATUS_SUCCESS, "leaving one group left the other")
+    check(alice.expect(RESPONSE_DISCUSS_FWD).uint32() == second, "wrong group in a Discuss forward")
+
+
+def test_pending_invitations(server):
+    alice = server.client("alice", FEATURE_GROUPS)
+    carol = server.client("carol", FEATURE_GROUPS)
+    bob = server.client("bob", FEATURE_GROUPS)
+    alice.create_group(["bob"])
+    first = alice.expect(RESPONSE_CREATEGROUP).uint32()
+    carol.create_group(["bob"])
+    second = carol.expect(RESPONSE_CREATEGROUP).uint32()
+    check(bob.expect(RESPONSE_CREATEGROUP_FWD).uint32() == first, "wrong group in a CreateGroup forward")
+    check(bob.expect(RESPONSE_CREATEGROUP_FWD).uint32() == second, "wrong group in a CreateGroup forward")
+    bob.join_group(ACCEPT_GROUP, first)
+    bob.join_group(ACCEPT_GROUP, second)
+    for inviter, group in ((alice, first), (carol, second)):
+        forward = inviter.expect(RESPONSE_JOINGROUP_FWD)
+        check(forward.uint32() == group and forward.string() == "bob" and forward.uint16() == ACCEPT_GROUP,
+              "an invitation was dropped by the next one")
+
+
+def stress_client(server, index, names, errors):
+    try:
+        client = server.client("stress%d" % index, random.choice([0, FEATURE_GROUPS, FEATURE_MESSAGE_TEXT]))
+        for round in range(30):
+            action = random.random()
+            if action < 0.2:
+                client.create_group(random.sample(names, 5))
+            elif action < 0.5:
+                client.join_group(random.choice([ACCEPT_GROUP, REJECT_GROUP]), random.randint(1, 50))
+            elif action < 0.8:
+                client.discuss("round %d" % round, random.randint(1, 50))
+            else:
+                client.leave_group(random.randint(1, 50))
+            client.drain(0.01)
+        client.exit()
+        client.expect(RESPONSE_EXIT)
+    except Exception as error:
+        errors.append(error)
+
+
+def test_stress(server):
+    names = ["stress%d" % i for i in range(40)]
+    errors = []
+    threads = [threading.Thread(target=stress_client, args=(server, i, names, errors)) for i in range(40)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    check(not errors, "a stress client failed: %s" % (errors[:1],))
+    alice = server.client("alice")
+    wait_for(lambda: alice.show() or alice.users() == ["alice"], "users stayed after their exit")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_two_groups, test_leave_one, test_pending_invitations, test_stress], *sys.argv[1:]))
@@ -0,0 +1,65 @@
+# test_pipeline.py
+#
+# Requests sent without waiting for their responses: each client's
+# requests are answered in order, and tagged ones (FEATURE_REQUEST_IDS)
+# with the ID of the request they answer.
+
+import sys
+
+from chatproto import *
+
+
+def test_talks_in_order(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    count = 200
+    alice.send_raw(b"".join(alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list(["n%d" % i]))
+                            for i in range(count)))
+    for i in range(count):
+        check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "a pipelined Talk failed")
+        forward = bob.expect(RESPONSE_TALK_FWD)
+        forward.string(), forward.string()
+        check(forward.strings() == ["n%d" % i], "pipelined Talks arrived out of order")
+
+
+def test_mixed_requests(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    batch = []
+    for i in range(50):
+        batch.append(alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list(["x"])))
+        batch.append(alice.encode(REQUEST_SHOW))
+        batch.append(alice.encode(REQUEST_TALK, string("alice") + string("nobody") + string_list(["x"])))
+    alice.send_raw(b"".join(batch))
+    for i in range(50):
+        check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "a Talk to bob failed")
+        check(sorted(alice.users()) == ["alice", "bob"], "a pipelined Show listed the wrong users")
+        check(alice.expect(RESPONSE_TALK).status == ERROR_USER_NOT_FOUND, "a Talk to no one succeeded")
+
+
+def test_request_ids(server):
+    alice = server.client("alice", FEATURE_REQUEST_IDS | FEATURE_CHUNKED)
+    bob = server.client("bob")
+    sent = {}
+    batch = []
+    for i in range(200):
+        request_id = 1000 + i
+        if i % 4 == 3:
+            batch.append(alice.encode(REQUEST_SHOW, request_id=request_id))
+            sent[request_id] = RESPONSE_SHOW
+        else:
+            batch.append(alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list(["t%d" % i]),
+                                      request_id=request_id))
+            sent[request_id] = RESPONSE_TALK
+    alice.send_raw(b"".join(batch))
+    talks = []
+    while sent:
+        packet = alice.expect(None)
+        check(sent.pop(packet.request_id, None) == packet.type, "response %d has a wrong ID" % packet.type)
+        if packet.type == RESPONSE_TALK:
+            talks.append(packet.request_id)
+    check(talks == sorted(talks), "the Talk responses were not in order")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_talks_in_order, test_mixed_requests, test_request_ids], *sys.argv[1:]))
@@ -0,0 +1,80 @@
+# test_resume.py
+#
+# A client whose connection broke logs in again with its cookie (see
+# ChatResume.h): it gets its session back, and the packets held for it
+# meanwhile, in order.
+
+import sys
+import time
+
+from chatproto import *
+
+
+def resume(server, client, features=0):
+    """Log 'client' in again on a new connection, with its cookie, returns the new client"""
+    again = server.client()
+    status = again.login(client.name, features, cookie=client.cookie)
+    check(status == STATUS_SUCCESS, "the login to resume failed with %d" % status)
+    return again
+
+
+def test_held_talks(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.close()
+    time.sleep(0.2)
+    for i in range(150):
+        bob.talk("alice", "message %d" % i)
+        check(bob.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "a Talk to a user away failed")
+    again = resume(server, alice)
+    check(again.cookie == alice.cookie, "the session was not resumed")
+    for i in range(150):
+        forward = again.expect(RESPONSE_TALK_FWD)
+        forward.string(), forward.string()
+        check(forward.strings() == ["message", str(i)], "the held Talks came back out of order")
+
+
+def test_away_keeps_name(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.close()
+    time.sleep(0.2)
+    other = server.client()
+    check(other.login("alice") == ERROR_USERNAME, "the name of a user away was taken")
+    bob.show()
+    check(sorted(bob.users()) == ["alice", "bob"], "a user away left the list")
+    check(bob.receive(RESPONSE_EXIT_FWD, timeout=0.3) is None, "a user away was said to exit")
+
+
+def test_held_yells(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.close()
+    time.sleep(0.2)
+    bob.yell("while you were away")
+    check(bob.expect(RESPONSE_YELL).status == STATUS_SUCCESS, "Yell failed")
+    again = resume(server, alice)
+    check(again.expect(RESPONSE_YELL_FWD).string() == "bob", "the held Yell was not replayed")
+
+
+def test_expired(server):
+    alice = server.client("alice")
+    alice.close()
+    time.sleep(2.5)
+    again = server.client()
+    check(again.login("alice", cookie=alice.cookie) == STATUS_SUCCESS, "the login after expiry failed")
+    check(again.cookie != alice.cookie, "an expired session was resumed")
+
+
+def test_wrong_cookie(server):
+    alice = server.client("alice")
+    alice.close()
+    time.sleep(0.2)
+    other = server.client()
+    check(other.login("alice", cookie=alice.cookie ^ 1) == ERROR_USERNAME, "a wrong cookie took a session over")
+
+
+if __name__ == "__main__":
+    failed = run([test_held_talks, test_away_keeps_name, test_held_yells, test_wrong_cookie], *sys.argv[1:])
+    failed += run([test_expired], "-g", "1", *sys.argv[1:])
+    sys.exit(failed)
@@ -0,0 +1,71 @@
+# test_slow_reader.py
+#
+# Clients which never read, while another yells 8 MB (more than the
+# kernel buffers of a socket hold): the server must not queue for them
+# forever (see -f, -q and -p). They are closed, or lose packets, and the
+# clients which do read get every message.
+
+import sys
+import threading
+
+from chatproto import *
+
+YELLS = 8000
+# (-g 0: a client closed is gone at once, not kept to resume its session)
+LIMITS = ["-f", "100", "-q", "65536", "-g", "0"]
+
+
+def count_forwards(client, count, results):
+    """Read till 'count' Yell forwards came (or nothing comes any more)"""
+    got = 0
+    while got < count:
+        packet = client.read_packet(timeout=10)
+        if packet is None:
+            break
+        if packet.type == RESPONSE_YELL_FWD:
+            got += 1
+    results[client.name] = got
+
+
+def flood(server):
+    """Yell YELLS times beside 3 clients which never read, returns them, the reader and the yeller"""
+    stuck = []
+    for i in range(3):
+        stuck.append(server.client("stuck%d" % i))
+    reader = server.client("reader")
+    yeller = server.client("yeller")
+    results = {}
+    thread = threading.Thread(target=count_forwards, args=(reader, YELLS, results))
+    thread.start()
+    # In batches, each answered before the next, so that the yeller and the reader keep up
+    message = "x" * 1000
+    for start in range(0, YELLS, 50):
+        yeller.send_raw(b"".join(yeller.encode(REQUEST_YELL, string_list([message])) for i in range(50)))
+        for i in range(50):
+            check(yeller.receive(RESPONSE_YELL) is not None, "a Yell got no response")
+    thread.join()
+    check(results["reader"] == YELLS, "the reader got %d of %d messages" % (results["reader"], YELLS))
+    return stuck, reader, yeller
+
+
+def test_disconnect(server):
+    stuck, reader, yeller = flood(server)
+    for client in stuck:
+        check(client.is_closed(5), "a client which never reads was not closed")
+    wait_for(lambda: yeller.show() or sorted(yeller.users()) == ["reader", "yeller"],
+             "the closed clients are still listed")
+
+
+def test_drop(server):
+    stuck, reader, yeller = flood(server)
+    yeller.show()
+    check(sorted(yeller.users()) == ["reader", "stuck0", "stuck1", "stuck2", "yeller"],
+          "a client which never reads was closed")
+
+
+if __name__ == "__main__":
+    options = sys.argv[1:]
+    failed = run([test_disconnect], *LIMITS, *options)
+    failed += run([test_drop], *LIMITS, "-p", "oldest", *options)
+    failed += run([test_drop], *LIMITS, "-p", "newest", *options)
+    sys.exit(failed)
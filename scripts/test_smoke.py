@@ -0,0 +1,93 @@
+# test_smoke.py
+#
+# Login, Show, Talk, Yell and Exit between plain clients (no features).
+
+import sys
+
+from chatproto import *
+
+
+def test_login_show(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    check(alice.cookie != bob.cookie, "two users have the same cookie")
+    alice.show()
+    check(sorted(alice.users()) == ["alice", "bob"], "Show does not list both users")
+
+
+def test_name_taken(server):
+    alice = server.client("alice")
+    other = server.client()
+    check(other.login("alice") == ERROR_USERNAME, "a name in use was taken again")
+
+
+def test_talk(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.talk("bob", "hello there bob")
+    check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "Talk failed")
+    forward = bob.expect(RESPONSE_TALK_FWD)
+    check(forward.string() == "alice" and forward.string() == "bob", "wrong names in the Talk forward")
+    check(forward.strings() == ["hello", "there", "bob"], "wrong message in the Talk forward")
+
+
+def test_talk_unknown(server):
+    alice = server.client("alice")
+    alice.talk("nobody", "hello")
+    check(alice.expect(RESPONSE_TALK).status == ERROR_USER_NOT_FOUND, "Talk to no one succeeded")
+
+
+def test_yell(server):
+    alice = server.client("alice")
+    others = [server.client("user%d" % i) for i in range(5)]
+    alice.yell("hello everyone")
+    check(alice.expect(RESPONSE_YELL).status == STATUS_SUCCESS, "Yell failed")
+    for other in others:
+        forward = other.expect(RESPONSE_YELL_FWD)
+        check(forward.string() == "alice" and forward.strings() == ["hello", "everyone"],
+              "wrong Yell forward")
+    check(alice.receive(RESPONSE_YELL_FWD, timeout=0.3) is None, "the sender got its own yell")
+
+
+def test_yell_alone(server):
+    alice = server.client("alice")
+    alice.yell("anyone")
+    check(alice.expect(RESPONSE_YELL).status == ERROR_NO_USER_ONLINE, "Yell to no one succeeded")
+
+
+def test_exit(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    alice.exit()
+    check(alice.expect(RESPONSE_EXIT).status == STATUS_SUCCESS, "Exit failed")
+    check(alice.is_closed(), "the connection stayed open after Exit")
+    check(bob.expect(RESPONSE_EXIT_FWD).string() == "alice", "no Exit forward")
+    bob.show()
+    check(bob.users() == ["bob"], "the user who exited is still listed")
+    again = server.client()
+    check(again.login("alice") == STATUS_SUCCESS, "the name was not freed by Exit")
+
+
+def test_login_twice(server):
+    alice = server.client("alice")
+    check(alice.login("alice2") == ERROR_USERNAME, "a second login on one connection succeeded")
+    bob = server.client("bob")
+    bob.show()
+    check(sorted(bob.users()) == ["alice", "bob"], "the second login changed the list of users")
+
+
+def test_empty_name(server):
+    alice = server.client("alice")
+    watcher = server.client("watcher", FEATURE_CHUNKED | FEATURE_PRESENCE)
+    watcher.drain()
+    empty = server.client()
+    check(empty.login("") == ERROR_USERNAME, "a login with an empty name succeeded")
+    check(watcher.receive(RESPONSE_LOGIN_FWD, timeout=0.3) is None, "a login with an empty name was pushed")
+    bob = server.client("bob")
+    bob.show()
+    check(sorted(bob.users()) == ["alice", "bob", "watcher"], "the empty name cut the list of users short")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_login_show, test_name_taken, test_talk, test_talk_unknown, test_yell,
+         test_yell_alone, test_exit, test_login_twice, test_empty_name], *sys.argv[1:]))
@@ -0,0 +1,64 @@
+# test_split.py
+#
+# Requests cut anywhere across writes, and several requests in one write:
+# the server must put the packets back together (see ChatRecvBuffer.h).
+
+import sys
+import time
+
+from chatproto import *
+
+
+def test_byte_by_byte(server):
+    alice = server.client()
+    packet = alice.encode(REQUEST_LOGIN, string("alice"))
+    for i in range(len(packet)):
+        alice.send_raw(packet[i:i + 1])
+        time.sleep(0.01)
+    check(alice.expect(RESPONSE_LOGIN).status == STATUS_SUCCESS, "a login sent byte by byte failed")
+
+
+def test_header_cut(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    packet = alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list(["cut", "here"]))
+    for cut in (1, 2, 3, 4, 7, 9, len(packet) - 1):
+        alice.send_raw(packet[:cut])
+        time.sleep(0.05)
+        alice.send_raw(packet[cut:])
+        check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "Talk cut at %d failed" % cut)
+        forward = bob.expect(RESPONSE_TALK_FWD)
+        forward.string(), forward.string()
+        check(forward.strings() == ["cut", "here"], "Talk cut at %d arrived damaged" % cut)
+
+
+def test_many_in_one_write(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    words = ["message%d" % i for i in range(50)]
+    alice.send_raw(b"".join(alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list([word]))
+                            for word in words))
+    for word in words:
+        check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "a Talk of the batch failed")
+        forward = bob.expect(RESPONSE_TALK_FWD)
+        forward.string(), forward.string()
+        check(forward.strings() == [word], "the batch arrived out of order")
+
+
+def test_long_packet_in_pieces(server):
+    alice = server.client("alice")
+    bob = server.client("bob")
+    words = ["w%03d" % i for i in range(600)]
+    packet = alice.encode(REQUEST_TALK, string("alice") + string("bob") + string_list(words))
+    check(len(packet) <= MAX_PACKET_LENGTH, "the test packet is too long")
+    for start in range(0, len(packet), 700):
+        alice.send_raw(packet[start:start + 700])
+        time.sleep(0.02)
+    check(alice.expect(RESPONSE_TALK).status == STATUS_SUCCESS, "a long Talk in pieces failed")
+    forward = bob.expect(RESPONSE_TALK_FWD)
+    forward.string(), forward.string()
+    check(forward.strings() == words, "the long Talk arrived damaged")
+
+
+if __name__ == "__main__":
+    sys.exit(run([test_byte_by_byte, test_header_cut, test_many_in_one_write, test_long_packet_in_pieces], *sys.argv[1:]))